@@ -0,0 +1,205 @@
+#include <fpu.h>
+#include <malloc.h>
+#include <system.h>
+#include <task.h>
+#include <util.h>
+
+// FPU/SSE/AVX state. Switched lazily: the scheduler only sets CR0.TS when
+// it's switching to someone other than whoever's state is in the registers,
+// the first fpu instruction then traps (#NM) and the swap happens right there.
+// Tasks that never touch the fpu (& kernel ones) cost nothing to switch to.
+// Areas are sized by cpuid 0xD for what XCR0 has enabled, so the AVX upper
+// halves survive as well
+
+// offsets into the area
+#define FPU_MXCSR 24
+#define FPU_MXCSR_MASK 28
+#define FPU_SW_BYTES 464 // left to software (signal frames)
+#define FPU_XSAVE_HEADER 512
+
+Task    *fpuOwner = 0; // whose state the registers are holding
+bool     fpuTs = false;
+uint32_t fpuMxcsrMask = 0xFFBF; // bits mxcsr is allowed to have set
+uint8_t *fpuInitial = 0;        // template for fresh areas
+
+static void fpuStore(uint8_t *area) {
+  if (fpuXsaveopt)
+    asm volatile("xsaveopt64 (%0)" ::"r"(area), "a"(-1), "d"(-1) : "memory");
+  else if (fpuXcr0)
+    asm volatile("xsave64 (%0)" ::"r"(area), "a"(-1), "d"(-1) : "memory");
+  else
+    asm volatile("fxsave64 (%0)" ::"r"(area) : "memory");
+}
+
+static void fpuLoad(uint8_t *area) {
+  if (fpuXcr0)
+    asm volatile("xrstor64 (%0)" ::"r"(area), "a"(-1), "d"(-1) : "memory");
+  else
+    asm volatile("fxrstor64 (%0)" ::"r"(area) : "memory");
+}
+
+// CR0 writes are serializing, so only on actual changes. ints have to be off
+static void fpuTsSet(bool ts) {
+  if (fpuTs == ts)
+    return;
+  fpuTs = ts;
+  if (!ts) {
+    asm volatile("clts");
+    return;
+  }
+  uint64_t cr0;
+  asm volatile("mov %%cr0, %0" : "=r"(cr0));
+  cr0 |= 1 << 3; // TS
+  asm volatile("mov %0, %%cr0" ::"r"(cr0));
+}
+
+void initiateFpu() {
+  uint32_t eax = 1, ebx = 0, ecx = 0, edx = 0;
+  cpuid(&eax, &ebx, &ecx, &edx);
+  if (ecx & (1 << 27)) { // OSXSAVE, initiateSSE() has set XCR0 up
+    uint32_t low, high;
+    asm volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+    fpuXcr0 = (uint64_t)high << 32 | low;
+
+    eax = 0xD;
+    ecx = 0;
+    cpuid(&eax, &ebx, &ecx, &edx);
+    fpuSize = ebx; // for what's enabled in XCR0 right now
+
+    eax = 0xD;
+    ecx = 1;
+    cpuid(&eax, &ebx, &ecx, &edx);
+    fpuXsaveopt = eax & 1;
+  } else
+    fpuSize = FPU_LEGACY_SIZE;
+
+  fpuInitial = memalign(FPU_ALIGN, fpuSize);
+  memset(fpuInitial, 0, fpuSize);
+  asm volatile("fxsave64 (%0)" ::"r"(fpuInitial) : "memory");
+  uint32_t mask = *(uint32_t *)(fpuInitial + FPU_MXCSR_MASK);
+  if (mask)
+    fpuMxcsrMask = mask;
+
+  // an empty xsave header means everything's in its initial state already
+  memset(fpuInitial, 0, fpuSize);
+  *(uint16_t *)(fpuInitial) = 0x37f;
+  *(uint32_t *)(fpuInitial + FPU_MXCSR) = 0x1f80;
+
+  asm volatile("cli");
+  fpuOwner = 0;
+  fpuTsSet(true);
+  asm volatile("sti");
+
+  debugf("[fpu] Lazy switching ready: size{%ld} xcr0{%lx} xsaveopt{%d}\n",
+         fpuSize, fpuXcr0, fpuXsaveopt);
+}
+
+void *fpuAllocate() {
+  if (!fpuSize) {
+    debugf("[fpu] Tried to allocate a save area too early!\n");
+    panic();
+  }
+  void *area = memalign(FPU_ALIGN, fpuSize);
+  memcpy(area, fpuInitial, fpuSize);
+  return area;
+}
+
+void fpuFree(Task *task) {
+  if (!task->fpuenv)
+    return;
+  fpuDiscard(task);
+  free(task->fpuenv);
+  task->fpuenv = 0;
+}
+
+// ints are off, currentTask is already next
+void fpuSchedule(Task *next) {
+  if (fpuSize)
+    fpuTsSet(next != fpuOwner);
+}
+
+// ints are off (interrupt gate)
+bool fpuTrap() {
+  Task *task = currentTask;
+  if (!fpuSize || !task->fpuenv)
+    return false;
+
+  fpuTsSet(false);
+  if (fpuOwner != task) {
+    if (fpuOwner)
+      fpuStore(fpuOwner->fpuenv);
+    fpuLoad(task->fpuenv);
+    fpuOwner = task;
+  }
+  return true;
+}
+
+void fpuSave(Task *task) {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  if (fpuOwner == task) {
+    fpuTsSet(false);
+    fpuStore(task->fpuenv); // it stays the owner, registers are still valid
+    fpuTsSet(currentTask != fpuOwner);
+  }
+  if (ints)
+    asm volatile("sti");
+}
+
+void fpuDiscard(Task *task) {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  if (fpuOwner == task) {
+    fpuOwner = 0;
+    fpuTsSet(true);
+  }
+  if (ints)
+    asm volatile("sti");
+}
+
+size_t fpuFrameSize() {
+  size_t size = fpuSize + (fpuXcr0 ? sizeof(uint32_t) : 0); // magic2
+  return DivRoundUp(size, FPU_ALIGN) * FPU_ALIGN;
+}
+
+void fpuFrameStore(Task *task, void *frame) {
+  uint8_t *out = (uint8_t *)frame;
+  fpuSave(task);
+  memcpy(out, task->fpuenv, fpuSize);
+  if (!fpuXcr0)
+    return;
+
+  // struct _fpx_sw_bytes, tells userspace (& us) the area's extended
+  uint32_t *sw = (uint32_t *)(out + FPU_SW_BYTES);
+  memset(sw, 0, FPU_LEGACY_SIZE - FPU_SW_BYTES);
+  sw[0] = FPU_FRAME_MAGIC1;
+  sw[1] = fpuSize + sizeof(uint32_t); // extended_size
+  *(uint64_t *)(&sw[2]) = fpuXcr0;    // xfeatures
+  sw[4] = fpuSize;                    // xstate_size
+  *(uint32_t *)(out + fpuSize) = FPU_FRAME_MAGIC2;
+}
+
+void fpuFrameLoad(Task *task, void *frame) {
+  uint8_t  *in = (uint8_t *)frame;
+  uint32_t *sw = (uint32_t *)(in + FPU_SW_BYTES);
+  bool      extended = fpuXcr0 && sw[0] == FPU_FRAME_MAGIC1 &&
+                  sw[4] == fpuSize &&
+                  *(uint32_t *)(in + fpuSize) == FPU_FRAME_MAGIC2;
+
+  // a legacy frame leaves whatever's past the legacy area as it was
+  fpuSave(task);
+  uint8_t *area = task->fpuenv;
+  memcpy(area, in, extended ? fpuSize : FPU_LEGACY_SIZE);
+
+  // it's userspace's memory, reserved bits would fault on the restore
+  *(uint32_t *)(area + FPU_MXCSR) &= fpuMxcsrMask;
+  if (fpuXcr0) {
+    uint64_t *header = (uint64_t *)(area + FPU_XSAVE_HEADER);
+    if (!extended)
+      header[0] |= 0x3; // x87 & sse came with the frame
+    header[0] &= fpuXcr0;
+    memset(&header[1], 0, 56); // xcomp_bv & reserved
+  }
+
+  fpuDiscard(task); // picked up on the next fpu instruction
+}
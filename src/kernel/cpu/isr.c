@@ -1,7 +1,11 @@
 #include <apic.h>
+#include <elf.h>
+#include <fpu.h>
+#include <gdt.h>
 #include <idt.h>
 #include <isr.h>
 #include <kb.h>
+#include <kstack.h>
 #include <linked_list.h>
 #include <nic_controller.h>
 #include <paging.h>
@@ -114,6 +118,8 @@ void        initiateISR() {
     set_idt_gate(i, (uint64_t)asm_isr_redirect_table[i], 0x8E);
   }
 
+  set_idt_ist(8, GDT_IST_DOUBLE_FAULT);
+
   // Allow userspace to use breakpoints (like int3)
   set_idt_gate(3, (uint64_t)asm_isr_redirect_table[3], 0xEE);
 
@@ -199,6 +205,55 @@ void handle_interrupt(uint64_t rsp) {
       }
     }
 
+    // Lazily switched fpu state, the task's own gets loaded in
+    if (cpu->interrupt == 7 && fpuTrap())
+      return;
+
+    // Lazily handled pages (demand-zero, copy-on-write after a fork(),
+    // executables' pages)
+    if (cpu->interrupt == 14) {
+      uint64_t errorLocation = 0;
+      asm volatile("movq %%cr2, %0" : "=r"(errorLocation));
+      bool write = cpu->error & PAGE_FAULT_WRITE;
+      int  result = FAULT_NONE;
+      if (!(cpu->error & PAGE_FAULT_PRESENT))
+        result = VirtualDemandFault(currentTask, errorLocation, write);
+      else if (write)
+        result = VirtualCopyOnWrite(GetPageDirectory(), errorLocation);
+
+      // has to come from the disk, so sleep on the pager meanwhile. only if
+      // we could've been preempted anyways (userland or syscalls), otherwise
+      // nothing could ever make progress
+      if (result == FAULT_FILE) {
+        if (!(cpu->rflags & RFLAGS_IF)) {
+          debugf("[isr] Executable page needed with interrupts off! task{%d} "
+                 "cr2{%lx} rip{%lx}\n",
+                 currentTask->id, errorLocation, cpu->rip);
+          registerDump(cpu);
+          panic();
+        }
+        if (elfPagerRequest(currentTask, errorLocation)) {
+          currentTask->state = TASK_STATE_PAGING;
+          schedule((uint64_t)cpu);
+        }
+        return; // will fault again once woken up (or if busy)
+      }
+      if (result != FAULT_NONE)
+        return; // if busy, it will simply fault again
+    }
+
+    // ran off the end of a kernel stack, nothing to recover here
+    if (cpu->interrupt == 8 || cpu->interrupt == 14) {
+      uint64_t errorLocation = 0;
+      asm volatile("movq %%cr2, %0" : "=r"(errorLocation));
+      if (KernelStackGuard(errorLocation)) {
+        debugf("[isr] Kernel stack overflow! task{%d} cr2{%lx} rip{%lx}\n",
+               currentTask->id, errorLocation, cpu->rip);
+        registerDump(cpu);
+        panic();
+      }
+    }
+
     if (currentTask->systemCallInProgress)
       debugf("[isr] Happened from system call!\n");
 
@@ -1,5 +1,6 @@
 #include <bootloader.h>
 #include <console.h>
+#include <fpu.h>
 #include <system.h>
 
 // Source code for handling ports via assembly references
@@ -55,6 +56,13 @@ uint64_t wrmsr(uint32_t msrid, uint64_t value) {
   return value;
 }
 
+uint64_t rdtsc() {
+  uint32_t low;
+  uint32_t high;
+  __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+  return (uint64_t)low << 0 | (uint64_t)high << 32;
+}
+
 bool checkSSE() {
   uint32_t eax = 0x1, ebx = 0, ecx = 0, edx = 0;
   cpuid(&eax, &ebx, &ecx, &edx);
@@ -113,14 +121,17 @@ void        initiateSSE() {
     cr4 |= (uint32_t)1 << 18;
     asm volatile("mov %0, %%cr4" : : "r"(cr4));
 
+    uint32_t xcr0_lo = 0x3; // x87 (bit 0), SSE (bit 1)
+    uint32_t xcr0_hi = 0;
     if (ecx & (1 << 28)) {
       debugf("[cpu] The AVX extensions are available. Enabling..\n");
-      uint32_t xcr0_lo = 0x7; // x87 (bit 0), SSE (bit 1), AVX (bit 2)
-      uint32_t xcr0_hi = 0;
-      asm volatile("xsetbv" ::"c"(0), "a"(xcr0_lo), "d"(xcr0_hi));
+      xcr0_lo |= 0x4; // AVX (bit 2)
     }
+    asm volatile("xsetbv" ::"c"(0), "a"(xcr0_lo), "d"(xcr0_hi));
   }
 
+  initiateFpu(); // save areas depend on what's enabled above
+
   debugf("[cpu] Extra CPU features have all been enabled without issue\n");
 }
 
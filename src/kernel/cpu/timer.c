@@ -4,6 +4,7 @@
 #include <schedule.h>
 #include <system.h>
 #include <timer.h>
+#include <vdso.h>
 
 void initiatePitTimer(uint32_t reload_value) {
   // outportb(0x43, 0b00110100);
@@ -28,8 +29,234 @@ void initiatePitTimer(uint32_t reload_value) {
   debugf("[timer] Ready to fire: frequency{%dMHz}\n", timerFrequency);
 }
 
+// Hierarchical timer wheel. Deadlines are in timerNanos(), bucketed into units
+// of TIMER_WHEEL_UNIT ns (rounded up, so nothing fires early). Level 0 has a
+// slot for each of the next 64 units, every level above covers 64 times the
+// range of the one below. Events get cascaded down a level whenever the lower
+// one wraps around, so only units with something expiring (or a cascade) are
+// ever dealt with
+#define TIMER_WHEEL_UNIT_SHIFT 16 // ~65us
+#define TIMER_WHEEL_UNIT (1ULL << TIMER_WHEEL_UNIT_SHIFT)
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 6
+#define TIMER_WHEEL_RANGE (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+TimerEvent *timerWheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS] = {0};
+uint64_t    timerWheelNow = 0; // next unit to get processed
+
+static uint64_t timerWheelUnit(uint64_t nanos) {
+  return (nanos >> TIMER_WHEEL_UNIT_SHIFT) + !!(nanos & (TIMER_WHEEL_UNIT - 1));
+}
+
+// ints have to be off for the two below
+static void timerWheelInsert(TimerEvent *event) {
+  uint64_t at = timerWheelUnit(event->at);
+  if (at < timerWheelNow)
+    at = timerWheelNow; // already late, fire on the next one
+  if (at - timerWheelNow >= TIMER_WHEEL_RANGE)
+    at = timerWheelNow + TIMER_WHEEL_RANGE - 1; // re-inserted on cascade
+
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 &&
+         (at - timerWheelNow) >> (TIMER_WHEEL_BITS * (level + 1)))
+    level++;
+
+  size_t       index = (at >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+  TimerEvent **slot = &timerWheel[level][index];
+  event->slot = slot;
+  event->prev = 0;
+  event->next = *slot;
+  if (*slot)
+    (*slot)->prev = event;
+  *slot = event;
+}
+
+static void timerWheelRemove(TimerEvent *event) {
+  if (event->prev)
+    event->prev->next = event->next;
+  else
+    *event->slot = event->next;
+  if (event->next)
+    event->next->prev = event->prev;
+  event->slot = 0;
+  event->next = 0;
+  event->prev = 0;
+}
+
+void timerArm(TimerEvent *event, uint64_t at, TimerCallback callback,
+              void *ctx) {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  if (event->armed)
+    timerWheelRemove(event);
+  event->at = at;
+  event->callback = callback;
+  event->ctx = ctx;
+  event->armed = true;
+  timerWheelInsert(event);
+  if (ints)
+    asm volatile("sti");
+}
+
+void timerDisarm(TimerEvent *event) {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  if (event->armed) {
+    timerWheelRemove(event);
+    event->armed = false;
+  }
+  if (ints)
+    asm volatile("sti");
+}
+
+// takes the whole slot & puts everything back, a level (or more) lower
+static void timerWheelCascade(int level, size_t index) {
+  TimerEvent *browse = timerWheel[level][index];
+  timerWheel[level][index] = 0;
+  while (browse) {
+    TimerEvent *next = browse->next;
+    timerWheelInsert(browse);
+    browse = next;
+  }
+}
+
+static uint64_t timerWheelNext();
+
+static void timerWheelRun() {
+  uint64_t target = timerNanos() >> TIMER_WHEEL_UNIT_SHIFT;
+  while (timerWheelNow <= target) {
+    // skip right over the units with nothing in them
+    uint64_t next = timerWheelNext();
+    if (next > target) {
+      timerWheelNow = target + 1;
+      break;
+    }
+    if (next > timerWheelNow)
+      timerWheelNow = next;
+    uint64_t now = timerWheelNow;
+
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+      if (now & ((1ULL << (TIMER_WHEEL_BITS * level)) - 1))
+        break;
+      timerWheelCascade(level,
+                        (now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+    }
+
+    // detach first, callbacks are free to re-arm (past this tick)
+    TimerEvent **slot = &timerWheel[0][now & TIMER_WHEEL_MASK];
+    TimerEvent  *browse = *slot;
+    *slot = 0;
+    timerWheelNow++;
+    while (browse) {
+      TimerEvent *next = browse->next;
+      browse->slot = 0;
+      browse->next = 0;
+      browse->prev = 0;
+      if (timerWheelUnit(browse->at) > now) // clamped ones, not there yet
+        timerWheelInsert(browse);
+      else {
+        browse->armed = false;
+        browse->callback(browse->ctx);
+      }
+      browse = next;
+    }
+  }
+}
+
+// earliest unit the wheel has anything to do at (an expiry or a cascade)
+static uint64_t timerWheelNext() {
+  uint64_t earliest = (uint64_t)-1;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    int      shift = TIMER_WHEEL_BITS * level;
+    uint64_t base = timerWheelNow >> shift;
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+      if (!timerWheel[level][(base + i) & TIMER_WHEEL_MASK])
+        continue;
+      uint64_t at = (base + i) << shift;
+      if (at < timerWheelNow) // already cascaded this time around
+        at += (uint64_t)TIMER_WHEEL_SLOTS << shift;
+      earliest = MIN(earliest, at);
+      if (!level)
+        break; // the rest of level 0 is only later on
+    }
+  }
+  return earliest;
+}
+
+// Tickless mode: the lapic timer runs one-shot and only gets armed for the
+// end of the current time slice, or the next timer wheel event (whichever's
+// first). timerTicks is then kept up off the tsc, or by folding in whatever
+// the lapic counted down when there's none (which loses whatever passed after
+// it hit 0, and leaves everything at whole ticks)
+#define TIMER_TICKLESS 1
+#define TIMER_SLICE 1 // ms
+
+bool     timerOneShot = false;
+uint32_t timerCountLast = 0;  // lapic count at the last sync
+uint64_t timerCountCarry = 0; // lapic counts since the last whole tick
+
+// ints have to be off
+static void timerOneShotSync() {
+  if (timerTscFreq) {
+    uint64_t now = timerNanos() / 1000000;
+    if (now > timerTicks)
+      timerTicks = now;
+    vdsoUpdate();
+    return;
+  }
+
+  uint32_t left = apicRead(APIC_REGISTER_TIMER_CURRCNT);
+  uint64_t elapsed = timerCountLast - left + timerCountCarry;
+  timerTicks += elapsed / apicFreq;
+  timerCountCarry = elapsed % apicFreq;
+  timerCountLast = left;
+  vdsoUpdate();
+}
+
+// fires in (at least) nanos from now
+static void timerOneShotArm(uint64_t nanos) {
+  uint64_t max = (uint32_t)-1 / apicFreq * 1000000;
+  if (nanos > max)
+    nanos = max;
+
+  uint64_t count = 0;
+  if (timerTscFreq)
+    count = DivRoundUp(nanos * apicFreq, 1000000);
+  else {
+    count = DivRoundUp(nanos, 1000000) * apicFreq;
+    // counts we're already into the current tick
+    count = count > timerCountCarry ? count - timerCountCarry : 0;
+  }
+  count = MAX(count, 1);
+  timerCountLast = count;
+  apicWrite(APIC_REGISTER_TIMER_INITCNT, count);
+}
+
+void timerSetDeadline(bool idle) {
+  if (!timerOneShot)
+    return;
+
+  timerOneShotSync();
+  uint64_t now = timerNanos();
+  uint64_t next = timerWheelNext();
+  uint64_t at = next == (uint64_t)-1 ? next : next << TIMER_WHEEL_UNIT_SHIFT;
+  if (!idle)
+    at = MIN(at, now + TIMER_SLICE * 1000000);
+  timerOneShotArm(at > now ? at - now : 0);
+}
+
 void timerTick(uint64_t rsp) {
-  timerTicks++;
+  if (timerOneShot) {
+    timerOneShotSync();
+    // schedule() might pick something else
+    timerOneShotArm(TIMER_SLICE * 1000000);
+  } else {
+    timerTicks++;
+    vdsoUpdate();
+  }
+  timerWheelRun();
   schedule(rsp);
 }
 
@@ -41,6 +268,53 @@ uint32_t sleep(uint32_t time) {
   return 0;
 }
 
+// Invariant TSC: ticks at a constant rate regardless of power states, so it
+// makes for a cheap nanosecond clock. Calibrated against the pit, while that's
+// still the one driving timerTicks
+#define TIMER_TSC_CALIBRATE 50 // in ms
+
+static bool timerTscInvariant() {
+  uint32_t eax = 0x80000000, ebx = 0, ecx = 0, edx = 0;
+  cpuid(&eax, &ebx, &ecx, &edx);
+  if (eax < 0x80000007)
+    return false;
+
+  eax = 0x80000007;
+  ecx = 0;
+  cpuid(&eax, &ebx, &ecx, &edx);
+  return (edx >> 8) & 1;
+}
+
+static void timerTscCalibrate() {
+  if (!timerTscInvariant()) {
+    debugf("[timer] No invariant TSC, clocks stay at ms resolution!\n");
+    return;
+  }
+
+  // start right on a tick edge, otherwise we're off by up to a whole tick
+  uint64_t edge = timerTicks + 1;
+  while (edge > timerTicks)
+    ;
+  uint64_t start = rdtsc();
+  while (edge + TIMER_TSC_CALIBRATE > timerTicks)
+    ;
+  uint64_t end = rdtsc();
+
+  uint64_t freq = (end - start) * 1000 / TIMER_TSC_CALIBRATE;
+  timerTscMult = (1000000000ULL << TIMER_TSC_SHIFT) / freq;
+  timerTscBoot = start - edge * freq / 1000; // lines up with timerTicks
+  timerTscFreq = freq;                       // last, timerNanos() goes by it
+  debugf("[timer] TSC clocksource: frequency{%ldHz}\n", freq);
+}
+
+uint64_t timerNanos() {
+  if (!timerTscFreq)
+    return timerTicks * 1000000;
+
+  uint64_t delta = rdtsc() - timerTscBoot;
+  return ((unsigned __int128)delta * timerTscMult) >> TIMER_TSC_SHIFT;
+}
+
 void initiateApicTimer() {
   size_t waitfor = 10; // in ms
   initiatePitTimer(1000);
@@ -63,10 +337,20 @@ void initiateApicTimer() {
   uint8_t  targIrq = irqPerCoreAllocate(0, &lapicId);
   apicFreq = ticksInXms / waitfor;
 
+  timerTscCalibrate(); // while the pit is still around
+
   // finally configure the it
+#if TIMER_TICKLESS
+  apicWrite(APIC_REGISTER_LVT_TIMER, targIrq | APIC_LVT_TIMER_MODE_ONESHOT);
+  apicWrite(APIC_REGISTER_TIMER_DIV, 0x3);
+  timerCountCarry = 0;
+  timerOneShotArm(TIMER_SLICE * 1000000);
+  timerOneShot = true;
+#else
   apicWrite(APIC_REGISTER_LVT_TIMER, targIrq | APIC_LVT_TIMER_MODE_PERIODIC);
   apicWrite(APIC_REGISTER_TIMER_DIV, 0x3);
   apicWrite(APIC_REGISTER_TIMER_INITCNT, apicFreq);
+#endif
   ioapicInt = ioApicRedirect(0, true); // mask the old pit
   registerIRQhandler(targIrq, timerTick);
 }
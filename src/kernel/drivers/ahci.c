@@ -6,8 +6,10 @@
 #include <malloc.h>
 #include <paging.h>
 #include <pmm.h>
+#include <schedule.h>
 #include <string.h>
 #include <system.h>
+#include <task.h>
 #include <timer.h>
 #include <util.h>
 #include <vmm.h>
@@ -55,48 +57,98 @@ void ahciCmdStop(HBA_PORT *port) {
 
 /* Command port operations: */
 
-Spinlock LOCK_AHCI_CMD_FIND = ATOMIC_FLAG_INIT;
-int      ahciCmdFind(ahci *ahciPtr, HBA_PORT *port) {
-  spinlockAcquire(&LOCK_AHCI_CMD_FIND);
+// Claims a free command slot, waiting for one if they're all taken
+int ahciCmdFind(ahci *ahciPtr, uint32_t portId) {
+  AhciPort *state = &ahciPtr->ports[portId];
+  while (true) {
+    uint32_t used = __atomic_load_n(&state->slotsUsed, __ATOMIC_SEQ_CST);
+    uint32_t available = ~used & state->slotsMask;
+    if (!available) {
+      if (checkInterrupts())
+        handControl();
+      continue;
+    }
 
-  int ret = -1;
+    int slot = __builtin_ctz(available);
+    if (__atomic_compare_exchange_n(&state->slotsUsed, &used,
+                                    used | (1 << slot), false, __ATOMIC_SEQ_CST,
+                                    __ATOMIC_SEQ_CST))
+      return slot;
+  }
+}
 
-  // Don't let the waiting get out of hand
-  uint64_t start = timerTicks;
-  while (ret == -1 && timerTicks <= (start + 500)) {
-    // If not set in SACT and CI, the slot is free
-    uint32_t slots = (port->sact | port->ci);
-    for (int i = 0; i < 32; i++) {
-      if ((slots & 1) == 0 && !(ahciPtr->cmdSlotsPreping & (1 << i))) {
-        ret = i;
-        break;
-      }
-      slots >>= 1;
+// Finds out which of our in-flight commands the HBA is done with and wakes up
+// whoever's waiting on them. Called from the interrupt handler, as well as by
+// the waiters themselves (polling, or in case an interrupt went missing)
+void ahciPortReap(ahci *ahciPtr, uint32_t portId) {
+  AhciPort *state = &ahciPtr->ports[portId];
+  HBA_PORT *port = &ahciPtr->mem->ports[portId];
+
+  // NCQ commands stay in SACT until the device's set device bits FIS
+  uint32_t active = port->sact | port->ci;
+  uint32_t inflight = __atomic_load_n(&state->inflight, __ATOMIC_SEQ_CST);
+  uint32_t done = inflight & ~active;
+  if (!done)
+    return;
+
+  // only wake the ones we actually took off (someone else may be reaping too)
+  done &= __atomic_fetch_and(&state->inflight, ~done, __ATOMIC_SEQ_CST);
+  while (done) {
+    int   slot = __builtin_ctz(done);
+    Task *task = state->waiting[slot];
+    if (task) {
+      task->forcefulWakeupTimeUnsafe = 0;
+      schedWake(task);
     }
+    done &= ~(1 << slot);
   }
-
-  if (ret == -1)
-    printf("Cannot find free command list entry\n");
-  else
-    ahciPtr->cmdSlotsPreping |= (1 << ret);
-  spinlockRelease(&LOCK_AHCI_CMD_FIND);
-  return ret;
 }
 
-force_inline bool ahciCmdIssue(ahci *ahciPtr, HBA_PORT *port, int slot) {
-  port->ci = 1 << slot; // Issue command
-
-  // Done "preparing"
-  ahciPtr->cmdSlotsPreping &= ~(1 << slot);
+// How often sleeping waiters check on the HBA themselves (ms)
+#define AHCI_RECHECK 100
+
+// Hands a prepared slot over to the HBA and sleeps until it's completed (see
+// ahciInterruptHandler()). Polls instead, when sleeping isn't possible
+bool ahciCmdIssue(ahci *ahciPtr, uint32_t portId, HBA_PORT *port, int slot) {
+  AhciPort *state = &ahciPtr->ports[portId];
+  uint32_t  bit = 1 << slot;
+  bool      ints = checkInterrupts();
+  bool      sleep = ahciPtr->irqReady && tasksInitiated && ints;
+
+  state->waiting[slot] = sleep ? currentTask : 0;
+
+  // SACT has to be set before CI, and the interrupt handler shouldn't see us
+  // in-flight without the HBA knowing about it
+  asm volatile("cli");
+  __atomic_or_fetch(&state->inflight, bit, __ATOMIC_SEQ_CST);
+  if (state->ncq)
+    port->sact = bit;
+  port->ci = bit;
+  if (ints)
+    asm volatile("sti");
+
+  while (__atomic_load_n(&state->inflight, __ATOMIC_SEQ_CST) & bit) {
+    if (!sleep) {
+      ahciPortReap(ahciPtr, portId);
+      continue;
+    }
 
-  // Wait for completion
-  while (1) {
-    // In some longer duration reads, it may be helpful to spin on the DPS bit
-    // in the PxIS port field as well (1 << 5)
-    if ((port->ci & (1 << slot)) == 0)
+    currentTask->forcefulWakeupTimeUnsafe =
+        timerNanos() + AHCI_RECHECK * 1000000ULL;
+    currentTask->state = TASK_STATE_BLOCKED;
+    if (!(__atomic_load_n(&state->inflight, __ATOMIC_SEQ_CST) & bit)) {
+      // completed right under our nose
+      currentTask->forcefulWakeupTimeUnsafe = 0;
+      schedWake(currentTask);
       break;
+    }
+    handControl();
+    ahciPortReap(ahciPtr, portId);
   }
 
+  // let go of the slot
+  state->waiting[slot] = 0;
+  __atomic_and_fetch(&state->slotsUsed, ~bit, __ATOMIC_SEQ_CST);
   return true;
 }
 
@@ -125,6 +177,8 @@ force_inline HBA_CMD_TBL *ahciSetUpCmd(ahci *ahciPtr, uint32_t portId,
                                         cmdslot * AHCI_MEM_TABLE);
   memset(cmdtbl, 0,
          sizeof(HBA_CMD_TBL) + cmdheader->prdtl * sizeof(HBA_PRDT_ENTRY));
+  if (!count)
+    return cmdtbl; // no data to move
 
   // allocate the stuff needed
   size_t totalBytes = count << 9;
@@ -164,6 +218,55 @@ force_inline HBA_CMD_TBL *ahciSetUpCmd(ahci *ahciPtr, uint32_t portId,
 
 /* Port initialization (used only on startup): */
 
+// Await for port to stop being "busy" and send results
+force_inline bool ahciPortReady(HBA_PORT *port) {
+  uint64_t start = timerTicks;
+  while ((port->tfd & (ATA_DEV_BUSY | ATA_DEV_DRQ))) {
+    if (timerTicks >= (start + 1000)) {
+      printf("[pci::ahci] Port is hung ATA_DEV_BUSY{%d} ATA_DEV_DRQ{%d}\n",
+             port->tfd & ATA_DEV_BUSY, port->tfd & ATA_DEV_DRQ);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Figures out whether the drive itself does NCQ (and how deep its queue is)
+void ahciPortIdentify(ahci *ahciPtr, uint32_t portId, HBA_PORT *port) {
+  AhciPort *state = &ahciPtr->ports[portId];
+  uint16_t *identify = VirtualAllocate(1);
+  memset(identify, 0, PAGE_SIZE);
+
+  int          slot = ahciCmdFind(ahciPtr, portId);
+  HBA_CMD_TBL *cmdtbl = ahciSetUpCmd(ahciPtr, portId, slot, identify, 1, false);
+  FIS_REG_H2D *cmdfis = (FIS_REG_H2D *)(&cmdtbl->cfis);
+  cmdfis->fis_type = FIS_TYPE_REG_H2D;
+  cmdfis->c = 1; // Command
+  cmdfis->command = ATA_CMD_IDENTIFY;
+
+  if (!ahciPortReady(port)) {
+    __atomic_and_fetch(&state->slotsUsed, ~(1 << slot), __ATOMIC_SEQ_CST);
+    goto cleanup;
+  }
+  ahciCmdIssue(ahciPtr, portId, port, slot);
+
+  if (!(ahciPtr->mem->cap & HBA_CAP_SNCQ) ||
+      ahciPtr->bsdInfo->quirks & AHCI_Q_NONCQ ||
+      !(identify[ATA_IDENT_SATA_CAP] & ATA_IDENT_SATA_CAP_NCQ))
+    goto cleanup;
+
+  uint32_t depth = (identify[ATA_IDENT_QUEUE_DEPTH] & 0x1F) + 1;
+  if (depth < 32)
+    state->slotsMask &= (1ULL << depth) - 1;
+  state->ncq = true;
+
+cleanup:
+  debugf("[pci::ahci] Port %d: ncq{%d} slots{%x}\n", portId, state->ncq,
+         state->slotsMask);
+  VirtualFree(identify, 1);
+}
+
 int ahciPortType(HBA_PORT *port) {
   uint32_t ssts = port->ssts;
 
@@ -190,8 +293,8 @@ int ahciPortType(HBA_PORT *port) {
 void ahciPortRebase(ahci *ahciPtr, HBA_PORT *port, int portno) {
   ahciCmdStop(port); // Stop command engine
 
-  // enable (all) interrupts
-  port->ie = 1;
+  // enable interrupts (completions are handled through them)
+  port->ie = HBA_PxIE_DEFAULT;
 
   // Command list: 1K-byte aligned, 32 commands, 32 bytes each = 1K per port
   uint32_t clbPages = DivRoundUp(sizeof(HBA_CMD_HEADER) * 32, BLOCK_SIZE);
@@ -243,6 +346,10 @@ void ahciPortRebase(ahci *ahciPtr, HBA_PORT *port, int portno) {
   port->serr = port->serr;
   ahciCmdStart(port); // Start command engine
 
+  ahciPtr->ports[portno].slotsMask =
+      (uint32_t)((1ULL << HBA_CAP_NCS(ahciPtr->mem->cap)) - 1);
+  ahciPortIdentify(ahciPtr, portno, port);
+
   ahciPtr->sata |= (1 << portno);
 }
 
@@ -268,36 +375,12 @@ void ahciPortProbe(ahci *ahciPtr, HBA_MEM *abar) {
   }
 }
 
-// Await for port to stop being "busy" and send results
-force_inline bool ahciPortReady(HBA_PORT *port) {
-  uint64_t start = timerTicks;
-  while ((port->tfd & (ATA_DEV_BUSY | ATA_DEV_DRQ))) {
-    if (timerTicks >= (start + 1000)) {
-      printf("[pci::ahci] Port is hung ATA_DEV_BUSY{%d} ATA_DEV_DRQ{%d}\n",
-             port->tfd & ATA_DEV_BUSY, port->tfd & ATA_DEV_DRQ);
-      return false;
-    }
-  }
-
-  return true;
-}
-
-bool ahciRead(ahci *ahciPtr, uint32_t portId, HBA_PORT *port, uint32_t startl,
-              uint32_t starth, uint32_t count, uint8_t *buff) {
-  assert(((size_t)buff % 2) == 0);
-  port->is = (uint32_t)-1; // Clear pending interrupt bits
-  int slot = ahciCmdFind(ahciPtr, port);
-  // debugf("%d ", slot);
-  if (slot == -1)
-    return false;
-
-  HBA_CMD_TBL *cmdtbl =
-      ahciSetUpCmd(ahciPtr, portId, slot, (uint16_t *)buff, count, false);
-  FIS_REG_H2D *cmdfis = (FIS_REG_H2D *)(&cmdtbl->cfis);
-
+// Fills in a read/write command FIS, queued (NCQ) or not
+force_inline void ahciCmdFisRw(FIS_REG_H2D *cmdfis, bool ncq, int slot,
+                               uint32_t startl, uint32_t starth,
+                               uint32_t count, bool write) {
   cmdfis->fis_type = FIS_TYPE_REG_H2D;
   cmdfis->c = 1; // Command
-  cmdfis->command = ATA_CMD_READ_DMA_EX;
 
   cmdfis->lba0 = (uint8_t)startl;
   cmdfis->lba1 = (uint8_t)(startl >> 8);
@@ -308,50 +391,81 @@ bool ahciRead(ahci *ahciPtr, uint32_t portId, HBA_PORT *port, uint32_t startl,
   cmdfis->lba4 = (uint8_t)starth;
   cmdfis->lba5 = (uint8_t)(starth >> 8);
 
-  cmdfis->countl = count & 0xFF;
-  cmdfis->counth = (count >> 8) & 0xFF;
+  if (ncq) {
+    // sector count goes on the features, the tag on the count
+    cmdfis->command =
+        write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+    cmdfis->featurel = count & 0xFF;
+    cmdfis->featureh = (count >> 8) & 0xFF;
+    cmdfis->countl = slot << 3;
+  } else {
+    cmdfis->command = write ? ATA_CMD_WRITE_DMA_EX : ATA_CMD_READ_DMA_EX;
+    cmdfis->countl = count & 0xFF;
+    cmdfis->counth = (count >> 8) & 0xFF;
+  }
+}
+
+bool ahciRw(ahci *ahciPtr, uint32_t portId, HBA_PORT *port, uint32_t startl,
+            uint32_t starth, uint32_t count, uint8_t *buff, bool write) {
+  assert(((size_t)buff % 2) == 0);
+  AhciPort *state = &ahciPtr->ports[portId];
+  int       slot = ahciCmdFind(ahciPtr, portId);
 
-  if (!ahciPortReady(port))
+  HBA_CMD_TBL *cmdtbl =
+      ahciSetUpCmd(ahciPtr, portId, slot, (uint16_t *)buff, count, write);
+  ahciCmdFisRw((FIS_REG_H2D *)(&cmdtbl->cfis), state->ncq, slot, startl,
+               starth, count, write);
+
+  // with commands still going, BSY/DRQ are (expectedly) set
+  if (!__atomic_load_n(&state->inflight, __ATOMIC_SEQ_CST) &&
+      !ahciPortReady(port)) {
+    __atomic_and_fetch(&state->slotsUsed, ~(1 << slot), __ATOMIC_SEQ_CST);
     return false;
+  }
 
-  return ahciCmdIssue(ahciPtr, port, slot);
+  return ahciCmdIssue(ahciPtr, portId, port, slot);
+}
+
+bool ahciRead(ahci *ahciPtr, uint32_t portId, HBA_PORT *port, uint32_t startl,
+              uint32_t starth, uint32_t count, uint8_t *buff) {
+  return ahciRw(ahciPtr, portId, port, startl, starth, count, buff, false);
 }
 
 bool ahciWrite(ahci *ahciPtr, uint32_t portId, HBA_PORT *port, uint32_t startl,
                uint32_t starth, uint32_t count, uint8_t *buff) {
-  assert(((size_t)buff % 2) == 0);
-  port->is = (uint32_t)-1; // Clear pending interrupt bits
-  int slot = ahciCmdFind(ahciPtr, port);
-  if (slot == -1)
-    return false;
+  return ahciRw(ahciPtr, portId, port, startl, starth, count, buff, true);
+}
 
-  HBA_CMD_TBL *cmdtbl =
-      ahciSetUpCmd(ahciPtr, portId, slot, (uint16_t *)buff, count, true);
+// Makes the drive commit its volatile write cache to the media. FLUSH CACHE
+// isn't a queued command, so the whole queue is claimed first (which also
+// means everything issued before us has landed and nothing lands meanwhile)
+bool ahciFlush(ahci *ahciPtr, uint32_t portId, HBA_PORT *port) {
+  AhciPort *state = &ahciPtr->ports[portId];
+  uint32_t  claimed = 0;
+  while (claimed != state->slotsMask)
+    claimed |= 1 << ahciCmdFind(ahciPtr, portId);
+
+  int          slot = __builtin_ctz(claimed);
+  HBA_CMD_TBL *cmdtbl = ahciSetUpCmd(ahciPtr, portId, slot, 0, 0, false);
   FIS_REG_H2D *cmdfis = (FIS_REG_H2D *)(&cmdtbl->cfis);
-
   cmdfis->fis_type = FIS_TYPE_REG_H2D;
   cmdfis->c = 1; // Command
-  cmdfis->command = ATA_CMD_WRITE_DMA_EX;
-
-  cmdfis->lba0 = (uint8_t)startl;
-  cmdfis->lba1 = (uint8_t)(startl >> 8);
-  cmdfis->lba2 = (uint8_t)(startl >> 16);
+  cmdfis->command = ATA_CMD_FLUSH_CACHE_EX;
   cmdfis->device = 1 << 6; // LBA mode
 
-  cmdfis->lba3 = (uint8_t)(startl >> 24);
-  cmdfis->lba4 = (uint8_t)starth;
-  cmdfis->lba5 = (uint8_t)(starth >> 8);
-
-  cmdfis->countl = count & 0xFF;
-  cmdfis->counth = (count >> 8) & 0xFF;
-
-  if (!ahciPortReady(port))
-    return false;
+  bool ret = ahciPortReady(port);
+  if (ret) {
+    // SACT mustn't be touched for it (nobody else can be issuing right now)
+    bool ncq = state->ncq;
+    state->ncq = false;
+    ahciCmdIssue(ahciPtr, portId, port, slot);
+    state->ncq = ncq;
+  }
 
-  return ahciCmdIssue(ahciPtr, port, slot);
+  __atomic_and_fetch(&state->slotsUsed, ~claimed, __ATOMIC_SEQ_CST);
+  return ret;
 }
 
-// todo! FIX THIS!!!
 void ahciInterruptHandler(AsmPassedInterrupt *regs) {
   PCI *browse = (PCI *)dsPCI.firstObject;
   while (browse) {
@@ -363,15 +477,17 @@ void ahciInterruptHandler(AsmPassedInterrupt *regs) {
           continue;
 
         HBA_PORT *port = &ahciPtr->mem->ports[portNum];
-        if (port->is & HBA_PxIS_TFES) {
+        uint32_t  is = port->is;
+        if (is & HBA_PxIS_TFES) {
           // Task file error
           printf("[pci::ahci] FATAL! Task file error! %x %x\n", port->tfd,
                  port->serr);
           panic();
         }
-        ahciPtr->mem->is = ahciPtr->mem->is;
-        ahciPtr->mem->ports[portNum].is = ahciPtr->mem->ports[portNum].is;
+        port->is = is;
+        ahciPortReap(ahciPtr, portNum);
       }
+      ahciPtr->mem->is = ahciPtr->mem->is;
     }
 
     browse = (PCI *)browse->_ll.next;
@@ -452,6 +568,7 @@ bool initiateAHCI(PCIdevice *device) {
   pci->irqHandler = registerIRQhandler(targIrq, &ahciInterruptHandler);
   if (!(mem->ghc & (1 << 1)))
     mem->ghc |= 1 << 1;
+  ahciPtr->irqReady = true;
 
   return true;
 }
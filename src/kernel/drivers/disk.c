@@ -1,4 +1,5 @@
 #include <ahci.h>
+#include <caching.h>
 #include <disk.h>
 #include <malloc.h>
 #include <system.h>
@@ -11,7 +12,7 @@ uint16_t mbr_partition_indexes[] = {MBR_PARTITION_1, MBR_PARTITION_2,
 
 bool openDisk(uint32_t disk, uint8_t partition, mbr_partition *out) {
   uint8_t *rawArr = (uint8_t *)malloc(SECTOR_SIZE);
-  getDiskBytes(rawArr, 0x0, 1);
+  getDiskBytes(disk, rawArr, 0x0, 1);
   // *out = *(mbr_partition *)(&rawArr[mbr_partition_indexes[partition]]);
   bool ret = validateMbr(rawArr);
   if (!ret)
@@ -26,34 +27,67 @@ bool validateMbr(uint8_t *mbrSector) {
   return mbrSector[510] == 0x55 && mbrSector[511] == 0xaa;
 }
 
+// disks are numbered by sata port, across every ahci controller (in the
+// order they were found). ctx is how many more to skip
 bool diskBytesCb(void *data, void *ctx) {
-  PCI *browse = data;
-  return browse->driver == PCI_DRIVER_AHCI && ((ahci *)browse->extra)->sata;
-}
-
-void diskBytes(uint8_t *target_address, uint32_t LBA, uint32_t sector_count,
-               bool write) {
-  // todo: yeah, this STILL is NOT ideal
+  PCI      *browse = data;
+  uint32_t *left = ctx;
+  if (browse->driver != PCI_DRIVER_AHCI)
+    return false;
 
-  PCI *browse = LinkedListSearch(&dsPCI, diskBytesCb, 0);
+  uint32_t ports = __builtin_popcount(((ahci *)browse->extra)->sata);
+  if (*left < ports)
+    return true;
+  *left -= ports;
+  return false;
+}
 
-  if (!browse) {
-    memset(target_address, 0, sector_count * SECTOR_SIZE);
-    return;
-  }
+// the ahci controller & port a disk number lives on (0 if there's none)
+static ahci *diskFind(uint32_t disk, int *port) {
+  uint32_t left = disk;
+  PCI     *browse = LinkedListSearch(&dsPCI, diskBytesCb, &left);
+  if (!browse)
+    return 0;
 
+  // the one we were left at out of this controller's ports
   ahci *target = (ahci *)browse->extra;
   int   pos = 0;
-  while (!(target->sata & (1 << pos)))
+  while (!(target->sata & (1 << pos)) || left--)
     pos++;
 
+  *port = pos;
+  return target;
+}
+
+void diskBytes(uint32_t disk, uint8_t *target_address, uint32_t LBA,
+               uint32_t sector_count, bool write) {
+  int   pos = 0;
+  ahci *target = diskFind(disk, &pos);
+  if (!target) {
+    debugf("[disk] No such disk{%d}!\n", disk);
+    if (!write)
+      memset(target_address, 0, sector_count * SECTOR_SIZE);
+    return;
+  }
+
   (write ? ahciWrite : ahciRead)(target, pos, &target->mem->ports[pos], LBA, 0,
                                  sector_count, target_address);
 }
 
+bool diskFlush(uint32_t disk) {
+  int   pos = 0;
+  ahci *target = diskFind(disk, &pos);
+  if (!target)
+    return false;
+
+  if (!ahciFlush(target, pos, &target->mem->ports[pos]))
+    debugf("[disk] Couldn't flush disk{%d}!\n", disk);
+  return true;
+}
+
 // todo: allow concurrent stuff
-force_inline void diskBytesMax(uint8_t *target_address, uint32_t LBA,
-                               size_t sector_count, bool write) {
+void diskBytesUncached(uint32_t disk, uint8_t *target_address, uint32_t LBA,
+                       size_t sector_count, bool write) {
   int prdtAmnt = AHCI_PRDTS;
 
   if (!IS_ALIGNED((size_t)target_address, 0x1000))
@@ -67,12 +101,12 @@ force_inline void diskBytesMax(uint8_t *target_address, uint32_t LBA,
   size_t remainder = sector_count % max;
   if (chunks)
     for (size_t i = 0; i < chunks; i++)
-      diskBytes(target_address + i * max * SECTOR_SIZE, LBA + i * max, max,
-                write);
+      diskBytes(disk, target_address + i * max * SECTOR_SIZE, LBA + i * max,
+                max, write);
 
   if (remainder)
-    diskBytes(target_address + chunks * max * SECTOR_SIZE, LBA + chunks * max,
-              remainder, write);
+    diskBytes(disk, target_address + chunks * max * SECTOR_SIZE,
+              LBA + chunks * max, remainder, write);
 
   // for (int i = 0; i < sector_count; i++)
   //   diskBytes(target_address + i * 512, LBA + i, 1, false);
@@ -80,13 +114,17 @@ force_inline void diskBytesMax(uint8_t *target_address, uint32_t LBA,
   // diskBytes(target_address, LBA, sector_count, false);
 }
 
-void getDiskBytes(uint8_t *target_address, uint32_t LBA, size_t sector_count) {
-  return diskBytesMax(target_address, LBA, sector_count, false);
+// both go through the page cache (memory/caching.c)
+void getDiskBytes(uint32_t disk, uint8_t *target_address, uint32_t LBA,
+                  size_t sector_count) {
+  if (!sector_count)
+    return;
+  cachingRead(disk, target_address, LBA, sector_count);
 }
 
-void setDiskBytes(const uint8_t *target_address, uint32_t LBA,
+void setDiskBytes(uint32_t disk, const uint8_t *target_address, uint32_t LBA,
                   size_t sector_count) {
-  // bad solution but idc, my code is safe
-  uint8_t *rw_target_address = (uint8_t *)((size_t)target_address);
-  return diskBytesMax(rw_target_address, LBA, sector_count, true);
+  if (!sector_count)
+    return;
+  cachingWrite(disk, target_address, LBA, sector_count);
 }
@@ -1,7 +1,9 @@
 #include <apic.h>
 #include <console.h>
 #include <kb.h>
+#include <kernel_helper.h>
 #include <paging.h>
+#include <schedule.h>
 #include <task.h>
 
 #include <linux.h>
@@ -358,7 +360,7 @@ void kbFinaliseStream() {
   Task *task = taskGet(kbTaskId);
   if (task) {
     task->tmpRecV = kbCurr;
-    task->state = TASK_STATE_READY;
+    schedWake(task);
   }
   kbReset();
 }
@@ -374,6 +376,7 @@ void kbChar(Task *task, char out) {
 
 void kbIrq() {
   char out = handleKbEvent();
+  helperKick(); // kernel console pollers
   if (!kbBuff || !out || !tasksInitiated)
     return;
 
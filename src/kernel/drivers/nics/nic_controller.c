@@ -208,5 +208,5 @@ void netQueueAdd(NIC *nic, uint8_t *packet, uint16_t packetLength) {
   netQueueWrite = (netQueueWrite + 1) % QUEUE_MAX;
 
   // direct the task
-  // netHelperTask->state = TASK_STATE_READY;
+  helperKick();
 }
@@ -11,6 +11,7 @@
 #include <isr.h>
 #include <kb.h>
 #include <kernel_helper.h>
+#include <kstack.h>
 #include <limine.h>
 #include <malloc.h>
 #include <md5.h>
@@ -23,6 +24,7 @@
 #include <rtc.h>
 #include <serial.h>
 #include <shell.h>
+#include <slab.h>
 #include <string.h>
 #include <sys.h>
 #include <syscalls.h>
@@ -31,6 +33,7 @@
 #include <testing.h>
 #include <timer.h>
 #include <util.h>
+#include <vdso.h>
 #include <vga.h>
 #include <vmm.h>
 
@@ -51,18 +54,21 @@ void _start(void) {
   initiateConsole();
   clearScreen();
 
-  // None of the two depend on paging
+  // None of the three depend on paging
   initiatePMM();
   initiateVMM();
+  initiateSlab();
 
   initiateGDT();
   LinkedListInit(&dsIrqHandler, sizeof(irqHandler));
   initiateACPI(); // needed for APIC setup
   initiateISR();
   initiatePaging();
+  initiateKernelStacks();
 
   debugf("\n====== REACHED SYSTEM ======\n");
   initiateApicTimer(); // mouse needs a timer
+  initiateVdso();      // after the tsc's calibrated
   LinkedListInit(&dsMountPoint, sizeof(MountPoint));
   fsMount("/dev/", CONNECTOR_DEV, 0, 0); // mouse & kb need it
   initiateKb();
@@ -1,11 +1,15 @@
+#include <caching.h>
 #include <console.h>
 #include <dev.h>
+#include <elf.h>
 #include <kernel_helper.h>
+#include <kstack.h>
 #include <nic_controller.h>
 #include <paging.h>
 #include <poll.h>
 #include <system.h>
 #include <task.h>
+#include <timer.h>
 #include <types.h>
 #include <util.h>
 #include <vmm.h>
@@ -15,6 +19,25 @@
 // adhering to spinlocks (in contrast with interrupts)
 
 Task *netHelperTask = 0;
+Task *flusherTask = 0;
+Task *readaheadTask = 0;
+Task *pagerTask = 0;
+
+// sleeps on helperWait whenever there's nothing left to do. helperKicked is
+// set by whoever gives it work, before they wake it up
+WaitQueue  helperWait = {0};
+bool       helperKicked = true;
+TimerEvent helperKickRetry = {0};
+
+static void helperKickRetryCb(void *ctx) { helperKick(); }
+
+// safe from anywhere, interrupts included. those can't wait on the queue's
+// lock, so if it's held the wakeup is retried on the next tick
+void helperKick() {
+  __atomic_store_n(&helperKicked, true, __ATOMIC_SEQ_CST);
+  if (!waitQueueWakeOneNoWait(&helperWait))
+    timerArm(&helperKickRetry, timerNanos() + 1000000, helperKickRetryCb, 0);
+}
 
 void helperNet() {
   while (true) {
@@ -41,11 +64,8 @@ void helperReaper() {
     taskFreeChildren(reaperTask); // free the children
 
     // free stacks
-    size_t stackSize = USER_STACK_PAGES * BLOCK_SIZE;
-    void  *tssRsp = (void *)(reaperTask->whileTssRsp - stackSize);
-    void  *syscallRsp = (void *)(reaperTask->whileSyscallRsp - stackSize);
-    VirtualFree(tssRsp, USER_STACK_PAGES);
-    VirtualFree(syscallRsp, USER_STACK_PAGES);
+    KernelStackFree(reaperTask->whileTssRsp);
+    KernelStackFree(reaperTask->whileSyscallRsp);
 
     // free info splits
     taskInfoFsDiscard(reaperTask->infoFs);
@@ -78,27 +98,47 @@ end:
 }
 
 // todo: find cleaner alternatives to this and to the kernel helper as a whole
+// readers normally get woken by inputGenerateEvent() itself, this catches the
+// ones it couldn't (& rings pollers, which can't be done from interrupts)
 void helperVolatilePoll() {
   if (!consoleDisabled) // kernel io
     pollInstanceRing(69, EPOLLIN);
   for (int i = 0; i < lastInputEvent; i++) {
     if (atomicRead64(&devInputEvents[i].deviceEvents.readPtr) !=
-        atomicRead64(&devInputEvents[i].deviceEvents.writePtr))
+        atomicRead64(&devInputEvents[i].deviceEvents.writePtr)) {
+      waitQueueWakeAll(&devInputEvents[i].readers);
       pollInstanceRing((size_t)&devInputEvents[i], EPOLLIN);
+    }
   }
 }
 
 void kernelHelpEntry() {
+  WaitQueueEntry wait;
   while (true) {
+    waitQueuePrepare(&helperWait, &wait);
+    if (!__atomic_exchange_n(&helperKicked, false, __ATOMIC_SEQ_CST)) {
+      waitQueueSleep(&helperWait, &wait, 0);
+      continue;
+    }
+    waitQueueFinish(&helperWait, &wait);
+
     helperNet();
     helperReaper();
     helperVolatilePoll();
-
-    handControl();
   }
 }
 
 void initiateKernelThreads() {
   netHelperTask = taskCreateKernel((size_t)kernelHelpEntry, 0);
   taskNameKernel(netHelperTask, helperCmdline, sizeof(helperCmdline));
+
+  // page cache writeback & readahead (memory/caching.c)
+  flusherTask = taskCreateKernel((size_t)cachingFlusher, 0);
+  taskNameKernel(flusherTask, flusherCmdline, sizeof(flusherCmdline));
+  readaheadTask = taskCreateKernel((size_t)cachingPrefetcher, 0);
+  taskNameKernel(readaheadTask, readaheadCmdline, sizeof(readaheadCmdline));
+
+  // executables' pages (utilities/elf.c)
+  pagerTask = taskCreateKernel((size_t)elfPager, 0);
+  taskNameKernel(pagerTask, pagerCmdline, sizeof(pagerCmdline));
 }
@@ -81,7 +81,7 @@ void weirdTests() {
 
     // uint32_t filesize = 512;
     // uint8_t *out = malloc(filesize);
-    // getDiskBytes(out, 0, 1);
+    // getDiskBytes(0, out, 0, 1);
 
     MD5_CTX *ctx = malloc(sizeof(MD5_CTX));
     MD5_Init(ctx);
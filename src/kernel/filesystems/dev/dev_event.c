@@ -1,4 +1,5 @@
 #include <dev.h>
+#include <kernel_helper.h>
 #include <malloc.h>
 #include <poll.h>
 #include <string.h>
@@ -29,6 +30,10 @@ void inputGenerateEvent(DevInputEvent *item, uint16_t type, uint16_t code,
   assert(CircularIntWrite(&item->deviceEvents, (void *)&event,
                           sizeof(struct input_event)) ==
          sizeof(struct input_event));
+
+  // we're in an interrupt, if the queue's busy the helper gets to it instead
+  waitQueueWakeOneNoWait(&item->readers);
+  helperKick(); // for pollers
 }
 
 // /dev/input/eventX userspace stuff
@@ -46,14 +51,17 @@ size_t devInputEventOpen(char *filename, int flags, int mode, OpenFile *fd,
 
 size_t devInputEventRead(OpenFile *fd, uint8_t *out, size_t limit) {
   DevInputEvent *event = fd->dir;
+  WaitQueueEntry wait;
 
   while (true) {
+    // events come in from interrupts, so there's no lock to check them under
+    waitQueuePrepare(&event->readers, &wait);
     size_t cnt = CircularIntRead(&event->deviceEvents, out, limit);
-    if (cnt > 0)
-      return cnt;
-    if (fd->flags & O_NONBLOCK)
-      return ERR(EWOULDBLOCK);
-    if (signalsPendingQuick(currentTask))
+    if (cnt > 0 || fd->flags & O_NONBLOCK) {
+      waitQueueFinish(&event->readers, &wait);
+      return cnt > 0 ? cnt : ERR(EWOULDBLOCK);
+    }
+    if (waitQueueSleep(&event->readers, &wait, 0) == WAIT_SIGNAL)
       return ERR(EINTR);
   }
 }
@@ -124,8 +124,10 @@ bool ptmxClose(OpenFile *fd) {
   pair->masterFds--;
   if (!pair->masterFds && !pair->slaveFds)
     ptyPairCleanup(pair);
-  else
+  else {
     spinlockRelease(&pair->LOCK_PTY);
+    waitQueueWakeAll(&pair->waiters); // the other end might be hung up now
+  }
   return true;
 }
 
@@ -135,7 +137,8 @@ size_t ptmxDataAvail(PtyPair *pair) {
 }
 
 size_t ptmxRead(OpenFile *fd, uint8_t *out, size_t limit) {
-  PtyPair *pair = fd->dir;
+  PtyPair       *pair = fd->dir;
+  WaitQueueEntry wait;
   while (true) {
     spinlockAcquire(&pair->LOCK_PTY);
     if (ptmxDataAvail(pair) > 0)
@@ -148,8 +151,10 @@ size_t ptmxRead(OpenFile *fd, uint8_t *out, size_t limit) {
       spinlockRelease(&pair->LOCK_PTY);
       return ERR(EWOULDBLOCK);
     }
+    waitQueuePrepare(&pair->waiters, &wait);
     spinlockRelease(&pair->LOCK_PTY);
-    handControl();
+    if (waitQueueSleep(&pair->waiters, &wait, 0) == WAIT_SIGNAL)
+      return ERR(EINTR);
   }
 
   size_t toCopy = MIN(limit, ptmxDataAvail(pair));
@@ -159,6 +164,7 @@ size_t ptmxRead(OpenFile *fd, uint8_t *out, size_t limit) {
   pair->ptrMaster -= toCopy;
 
   spinlockRelease(&pair->LOCK_PTY);
+  waitQueueWakeAll(&pair->waiters);
   pollInstanceRing((size_t)pair, EPOLLOUT);
   return toCopy;
 }
@@ -171,6 +177,7 @@ size_t ptmxWrite(OpenFile *fd, uint8_t *in, size_t limit) {
   //   debugf("doned!\n");
   //   return limit;
   // }
+  WaitQueueEntry wait;
   while (true) {
     spinlockAcquire(&pair->LOCK_PTY);
     if (!pair->slaveFds) {
@@ -183,8 +190,10 @@ size_t ptmxWrite(OpenFile *fd, uint8_t *in, size_t limit) {
       spinlockRelease(&pair->LOCK_PTY);
       return ERR(EWOULDBLOCK);
     }
+    waitQueuePrepare(&pair->waiters, &wait);
     spinlockRelease(&pair->LOCK_PTY);
-    handControl();
+    if (waitQueueSleep(&pair->waiters, &wait, 0) == WAIT_SIGNAL)
+      return ERR(EINTR);
   }
 
   // we already have a lock in our hands
@@ -202,6 +211,7 @@ size_t ptmxWrite(OpenFile *fd, uint8_t *in, size_t limit) {
   // hexDump("fr", in, limit, 32, debugf);
 
   spinlockRelease(&pair->LOCK_PTY);
+  waitQueueWakeAll(&pair->waiters);
   pollInstanceRing((size_t)pair, EPOLLIN);
   return limit;
 }
@@ -339,8 +349,10 @@ bool ptsClose(OpenFile *fd) {
   pair->slaveFds--;
   if (!pair->masterFds && !pair->slaveFds)
     ptyPairCleanup(pair);
-  else
+  else {
     spinlockRelease(&pair->LOCK_PTY);
+    waitQueueWakeAll(&pair->waiters); // the other end might be hung up now
+  }
   return true;
 }
 
@@ -362,7 +374,8 @@ size_t ptsDataAvail(PtyPair *pair) {
 }
 
 size_t ptsRead(OpenFile *fd, uint8_t *out, size_t limit) {
-  PtyPair *pair = fd->dir;
+  PtyPair       *pair = fd->dir;
+  WaitQueueEntry wait;
   while (true) {
     spinlockAcquire(&pair->LOCK_PTY);
     if (ptsDataAvail(pair) > 0)
@@ -375,8 +388,10 @@ size_t ptsRead(OpenFile *fd, uint8_t *out, size_t limit) {
       spinlockRelease(&pair->LOCK_PTY);
       return ERR(EWOULDBLOCK);
     }
+    waitQueuePrepare(&pair->waiters, &wait);
     spinlockRelease(&pair->LOCK_PTY);
-    handControl();
+    if (waitQueueSleep(&pair->waiters, &wait, 0) == WAIT_SIGNAL)
+      return ERR(EINTR);
   }
 
   size_t toCopy = MIN(limit, ptsDataAvail(pair));
@@ -386,6 +401,7 @@ size_t ptsRead(OpenFile *fd, uint8_t *out, size_t limit) {
   pair->ptrSlave -= toCopy;
 
   spinlockRelease(&pair->LOCK_PTY);
+  waitQueueWakeAll(&pair->waiters);
   pollInstanceRing((size_t)pair, EPOLLOUT);
   return toCopy;
 }
@@ -414,7 +430,8 @@ size_t ptsWriteInner(PtyPair *pair, uint8_t *in, size_t limit) {
 
 size_t ptsWrite(OpenFile *fd, uint8_t *in, size_t limit) {
   assert(limit <= PTY_BUFF_SIZE); // todo
-  PtyPair *pair = fd->dir;
+  PtyPair       *pair = fd->dir;
+  WaitQueueEntry wait;
   while (true) {
     spinlockAcquire(&pair->LOCK_PTY);
     if (!pair->masterFds) {
@@ -428,14 +445,17 @@ size_t ptsWrite(OpenFile *fd, uint8_t *in, size_t limit) {
       spinlockRelease(&pair->LOCK_PTY);
       return ERR(EWOULDBLOCK);
     }
+    waitQueuePrepare(&pair->waiters, &wait);
     spinlockRelease(&pair->LOCK_PTY);
-    handControl();
+    if (waitQueueSleep(&pair->waiters, &wait, 0) == WAIT_SIGNAL)
+      return ERR(EINTR);
   }
 
   // we already have a lock in our hands
   size_t written = ptsWriteInner(pair, in, limit);
 
   spinlockRelease(&pair->LOCK_PTY);
+  waitQueueWakeAll(&pair->waiters);
   pollInstanceRing((size_t)pair, EPOLLIN);
   return written;
 }
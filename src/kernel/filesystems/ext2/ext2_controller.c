@@ -1,4 +1,6 @@
 #include <bootloader.h>
+#include <caching.h>
+#include <dcache.h>
 #include <ext2.h>
 #include <malloc.h>
 #include <paging.h>
@@ -20,6 +22,7 @@ bool ext2Mount(MountPoint *mount) {
   mount->delete = ext2Delete;
   mount->readlink = ext2Readlink;
   mount->link = ext2Link;
+  mount->sync = ext2Sync;
 
   // assign fsInfo
   mount->fsInfo = malloc(sizeof(Ext2));
@@ -27,12 +30,13 @@ bool ext2Mount(MountPoint *mount) {
   Ext2 *ext2 = EXT2_PTR(mount->fsInfo);
 
   // base offset
+  ext2->disk = mount->disk;
   ext2->offsetBase = mount->mbr.lba_first_sector;
   ext2->offsetSuperblock = mount->mbr.lba_first_sector + 2;
 
   // get superblock
   uint8_t tmp[sizeof(Ext2Superblock)] __attribute__((aligned(2))) = {0};
-  getDiskBytes(tmp, ext2->offsetSuperblock, 2);
+  getDiskBytes(ext2->disk, tmp, ext2->offsetSuperblock, 2);
 
   // store it
   memcpy(&ext2->superblock, tmp, sizeof(Ext2Superblock));
@@ -97,7 +101,7 @@ bool ext2Mount(MountPoint *mount) {
   // remember, very max is block size
   ext2->offsetBGDT = BLOCK_TO_LBA(ext2, 0, ext2->superblock.superblock_idx + 1);
   ext2->bgdts = (Ext2BlockGroup *)malloc(ext2->blockSize);
-  getDiskBytes((void *)ext2->bgdts, ext2->offsetBGDT,
+  getDiskBytes(ext2->disk, (void *)ext2->bgdts, ext2->offsetBGDT,
                DivRoundUp(ext2->blockSize, SECTOR_SIZE));
 
   // set up counting spinlocks for the BGDTs
@@ -109,6 +113,9 @@ bool ext2Mount(MountPoint *mount) {
   ext2->WLOCKS_INODE = (SpinlockCnt *)malloc(bgdtLockSize);
   memset(ext2->WLOCKS_INODE, 0, bgdtLockSize);
 
+  ext2->inodeCache =
+      (Ext2InodeCached **)calloc(EXT2_INODE_HASH, sizeof(Ext2InodeCached *));
+
   ext2->inodeSize = ext2->superblock.extended.inode_size;
   ext2->inodeSizeRounded =
       DivRoundUp(ext2->inodeSize, SECTOR_SIZE) * SECTOR_SIZE;
@@ -217,6 +224,7 @@ size_t ext2Open(char *filename, int flags, int mode, OpenFile *fd,
   spinlockAcquire(&targetObject->LOCK_PROP);
   targetObject->openFds++;
   spinlockRelease(&targetObject->LOCK_PROP);
+  ext2InodeHold(ext2, inode);
 
   Ext2OpenFd *dir = (Ext2OpenFd *)malloc(sizeof(Ext2OpenFd));
   memset(dir, 0, sizeof(Ext2OpenFd));
@@ -262,56 +270,49 @@ size_t ext2Read(OpenFile *fd, uint8_t *buff, size_t naiveLimit) {
   if (limit > (filesize - dir->ptr))
     limit = filesize - dir->ptr;
 
-  size_t blocksRequired = DivRoundUp(limit, ext2->blockSize);
+  // blocks come from the page cache, when they're there
+  size_t start = dir->ptr;
+  spinlockCntReadAcquire(&dir->globalObject->WLOCK_FILE);
+  assert(ext2ReadInner(fd, buff, limit) == limit);
+  spinlockCntReadRelease(&dir->globalObject->WLOCK_FILE);
+
+  fsReadahead(fd, start, limit);
+  return limit;
+}
+
+// gets [offset, offset + len) into the page cache in the background, a run of
+// consecutive blocks at a time
+void ext2Readahead(OpenFile *fd, size_t offset, size_t len) {
+  Ext2       *ext2 = EXT2_PTR(fd->mountPoint->fsInfo);
+  Ext2OpenFd *dir = EXT2_DIR_PTR(fd->dir);
+
+  size_t filesize = ext2GetFilesize(fd);
+  if (!len || offset >= filesize)
+    return;
+  len = MIN(len, filesize - offset);
+
+  size_t first = offset / ext2->blockSize;
+  size_t cnt = (offset + len - 1) / ext2->blockSize - first + 1;
 
   spinlockCntReadAcquire(&dir->globalObject->WLOCK_FILE);
+  uint32_t *blocks = ext2BlockChain(ext2, dir, first, cnt - 1);
+  spinlockCntReadRelease(&dir->globalObject->WLOCK_FILE);
 
-  // find anything as a start that is close
-  spinlockCntReadAcquire(&dir->globalObject->WLOCK_CACHE);
-  size_t           blockIndexStart = dir->ptr / ext2->blockSize;
-  Ext2CacheObject *cacheObj = dir->globalObject->firstCacheObj;
-  while (cacheObj) {
-    if (cacheObj->blockIndex >= blockIndexStart &&
-        cacheObj->blockIndex < (blockIndexStart + blocksRequired))
-      break;
-    cacheObj = cacheObj->next;
-  }
-  spinlockCntReadRelease(&dir->globalObject->WLOCK_CACHE);
-
-  size_t left = limit;
-  for (size_t i = 0; i < (blocksRequired + 1); i++) {
-    if (cacheObj && cacheObj->blockIndex == (blockIndexStart + i)) {
-      // we are in a valid cache region
-      spinlockCntReadAcquire(&dir->globalObject->WLOCK_CACHE);
-      uint32_t rem = dir->ptr % ext2->blockSize;
-      size_t   toCopy = MIN(left, cacheObj->blocks * ext2->blockSize - rem);
-      memcpy(&buff[limit - left], &cacheObj->buff[rem], toCopy);
-      left -= toCopy;
-      i += cacheObj->blocks - 1; // -1 cause it's added automatically
-      dir->ptr += toCopy;
-      cacheObj = cacheObj->next;
-      spinlockCntReadRelease(&dir->globalObject->WLOCK_CACHE);
-    } else {
-      // we are not inside caching, let's see if we're close to it
-      size_t blocksToScan = blocksRequired - i;
-      if (!blocksToScan) // the extra block caused by the rem thing
-        blocksToScan = 1;
-      if (cacheObj)
-        // to_be_scanned = target_location - current_location;
-        blocksToScan = cacheObj->blockIndex - (dir->ptr / ext2->blockSize);
-      uint32_t rem = dir->ptr % ext2->blockSize;
-      size_t   toCopy = MIN(left, blocksToScan * ext2->blockSize - rem);
-      assert(ext2ReadInner(fd, &buff[limit - left], toCopy) == toCopy);
-      left -= toCopy;
-      i += blocksToScan - 1; // -1 cause it's added automatically
+  size_t i = 0;
+  while (i < cnt) {
+    if (!blocks[i]) { // sparse
+      i++;
+      continue;
     }
-    if (left == 0)
-      break;
+    size_t run = 1;
+    while (i + run < cnt && blocks[i + run] == blocks[i] + run)
+      run++;
+    cachingPrefetch(ext2->disk, BLOCK_TO_LBA(ext2, 0, blocks[i]),
+                    (run * ext2->blockSize) / SECTOR_SIZE);
+    i += run;
   }
 
-  assert(left == 0);
-  spinlockCntReadRelease(&dir->globalObject->WLOCK_FILE);
-  return limit;
+  free(blocks);
 }
 
 size_t ext2ReadInner(OpenFile *fd, uint8_t *buff, size_t limit) {
@@ -353,12 +354,12 @@ size_t ext2ReadInner(OpenFile *fd, uint8_t *buff, size_t limit) {
     if (consecEnd) {
       // optimized consecutive cluster reading
       int needed = consecEnd - consecStart + 1;
-      getDiskBytes(&tmp[currBlock * ext2->blockSize],
+      getDiskBytes(ext2->disk, &tmp[currBlock * ext2->blockSize],
                    BLOCK_TO_LBA(ext2, 0, blocks[consecStart]),
                    (needed * ext2->blockSize) / SECTOR_SIZE);
       currBlock += needed;
     } else {
-      getDiskBytes(&tmp[currBlock * ext2->blockSize],
+      getDiskBytes(ext2->disk, &tmp[currBlock * ext2->blockSize],
                    BLOCK_TO_LBA(ext2, 0, blocks[i]),
                    ext2->blockSize / SECTOR_SIZE);
       currBlock++;
@@ -377,15 +378,11 @@ size_t ext2ReadInner(OpenFile *fd, uint8_t *buff, size_t limit) {
     memcpy(&buff[headtoCopy], &tmp[ext2->blockSize], limit - headtoCopy);
   }
 
-  // cache it for later
-  ext2CacheAddSecurely(fd->mountPoint, dir->globalObject, tmp,
-                       dir->ptr / ext2->blockSize, blocksRequired);
-
   dir->ptr += limit; // set pointer
 
   // cleanup
   free(blocks);
-  // VirtualFree(tmp, tmpSize);
+  VirtualFree(tmp, tmpSize);
 
   // debugf("[fd:%d id:%d] read %d bytes\n", fd->id, currentTask->id, curr);
   // debugf("%d / %d\n", dir->ptr, dir->inode.size);
@@ -398,11 +395,6 @@ size_t ext2Write(OpenFile *fd, uint8_t *buff, size_t limit) {
 
   ext2CachePush(ext2, dir);
 
-  // todo! memory leak!
-  spinlockCntWriteAcquire(&dir->globalObject->WLOCK_CACHE);
-  dir->globalObject->firstCacheObj = 0;
-  spinlockCntWriteRelease(&dir->globalObject->WLOCK_CACHE);
-
   if (dir->inode.permission & S_IFDIR)
     return ERR(EISDIR);
 
@@ -425,10 +417,10 @@ size_t ext2Write(OpenFile *fd, uint8_t *buff, size_t limit) {
     uint32_t block = ext2BlockFetch(ext2, &dir->inode, dir->inodeNum,
                                     &dir->lookup, ptrIgnoredBlocks);
     uint8_t *tmp = (uint8_t *)malloc(ext2->blockSize);
-    getDiskBytes(tmp, BLOCK_TO_LBA(ext2, 0, block),
+    getDiskBytes(ext2->disk, tmp, BLOCK_TO_LBA(ext2, 0, block),
                  ext2->blockSize / SECTOR_SIZE);
     memcpy(&tmp[ptrIgnoredBytes], buff, left);
-    setDiskBytes(tmp, BLOCK_TO_LBA(ext2, 0, block),
+    setDiskBytes(ext2->disk, tmp, BLOCK_TO_LBA(ext2, 0, block),
                  ext2->blockSize / SECTOR_SIZE);
 
     free(tmp);
@@ -471,16 +463,17 @@ size_t ext2Write(OpenFile *fd, uint8_t *buff, size_t limit) {
         DivRoundUp((blocksRequired + 1) * ext2->blockSize, BLOCK_SIZE);
     uint8_t *tmp = (uint8_t *)VirtualAllocate(tmpSize);
 
-    // our first block will have junk data in the start!
-    getDiskBytes(tmp, BLOCK_TO_LBA(ext2, 0, blocks[0]),
-                 ext2->blockSize / SECTOR_SIZE);
-
-    // the last block might have junk data at the end!
+    // the last block might have data we're not overwriting at the end, unless
+    // it was just allocated (appending) which saves us a trip to the disk
     int target = blocksRequired - 1;
-    if (target > 0)
-      getDiskBytes(&tmp[target * ext2->blockSize],
-                   BLOCK_TO_LBA(ext2, 0, blocks[target]),
-                   ext2->blockSize / SECTOR_SIZE);
+    if (remainder % ext2->blockSize) {
+      if (startsAt == -1 || target < startsAt)
+        getDiskBytes(ext2->disk, &tmp[target * ext2->blockSize],
+                     BLOCK_TO_LBA(ext2, 0, blocks[target]),
+                     ext2->blockSize / SECTOR_SIZE);
+      else
+        memset(&tmp[target * ext2->blockSize], 0, ext2->blockSize);
+    }
     memcpy(tmp, &buff[left], remainder);
 
     int currBlock = 0;
@@ -515,12 +508,12 @@ size_t ext2Write(OpenFile *fd, uint8_t *buff, size_t limit) {
       if (consecEnd) {
         // optimized consecutive cluster reading
         int needed = consecEnd - consecStart + 1;
-        setDiskBytes(&tmp[currBlock * ext2->blockSize],
+        setDiskBytes(ext2->disk, &tmp[currBlock * ext2->blockSize],
                      BLOCK_TO_LBA(ext2, 0, blocks[consecStart]),
                      (needed * ext2->blockSize) / SECTOR_SIZE);
         currBlock += needed;
       } else {
-        setDiskBytes(&tmp[currBlock * ext2->blockSize],
+        setDiskBytes(ext2->disk, &tmp[currBlock * ext2->blockSize],
                      BLOCK_TO_LBA(ext2, 0, blocks[i]),
                      ext2->blockSize / SECTOR_SIZE);
         currBlock++;
@@ -538,12 +531,17 @@ size_t ext2Write(OpenFile *fd, uint8_t *buff, size_t limit) {
     VirtualFree(tmp, tmpSize);
   }
 
-  if (dir->ptr > dir->inode.size) {
-    // update size
-    dir->inode.size = dir->ptr;
-    dir->inode.num_sectors =
-        ext2BlockSizeCalculate(ext2, dir->inode.size) / SECTOR_SIZE;
-    // todo: use this field properly considering it has indirect blocks too
+  // mtime is also what tells executables' images apart (see ElfImage)
+  uint32_t now = timerBootUnix + timerTicks / 1000;
+  if (dir->ptr > dir->inode.size || dir->inode.mtime != now) {
+    if (dir->ptr > dir->inode.size) {
+      // update size
+      dir->inode.size = dir->ptr;
+      dir->inode.num_sectors =
+          ext2BlockSizeCalculate(ext2, dir->inode.size) / SECTOR_SIZE;
+      // todo: use this field properly considering it has indirect blocks too
+    }
+    dir->inode.mtime = now;
     ext2InodeModifyM(ext2, dir->inodeNum, &dir->inode);
   }
 
@@ -706,7 +704,8 @@ size_t ext2Readlink(MountPoint *mnt, char *path, char *buf, int size,
   if (inode->size > 60) {
     assert(inode->size < ext2->blockSize);
     start = calloc(ext2->blockSize + 1, 1);
-    getDiskBytes((uint8_t *)start, BLOCK_TO_LBA(ext2, 0, inode->blocks[0]),
+    getDiskBytes(ext2->disk, (uint8_t *)start,
+                 BLOCK_TO_LBA(ext2, 0, inode->blocks[0]),
                  ext2->blockSize / SECTOR_SIZE);
   }
 
@@ -728,18 +727,26 @@ cleanup:
 }
 
 bool ext2Close(OpenFile *fd) {
+  Ext2       *ext2 = EXT2_PTR(fd->mountPoint->fsInfo);
   Ext2OpenFd *dir = EXT2_DIR_PTR(fd->dir);
 
   ext2BlockFetchCleanup(&dir->lookup);
 
   spinlockAcquire(&dir->globalObject->LOCK_PROP);
   dir->globalObject->openFds--;
+  bool last = !dir->globalObject->openFds;
   spinlockRelease(&dir->globalObject->LOCK_PROP);
 
+  ext2InodeRelease(ext2, dir->inodeNum);
+  if (last) // nobody's using it, good time to write it back
+    ext2InodeFlush(ext2);
+
   free(fd->dir);
   return true;
 }
 
+void ext2Sync(MountPoint *mnt) { ext2InodeFlush(EXT2_PTR(mnt->fsInfo)); }
+
 bool ext2DuplicateNodeUnsafe(OpenFile *original, OpenFile *orphan) {
   orphan->dir = malloc(sizeof(Ext2OpenFd));
   memcpy(orphan->dir, original->dir, sizeof(Ext2OpenFd));
@@ -767,6 +774,7 @@ bool ext2DuplicateNodeUnsafe(OpenFile *original, OpenFile *orphan) {
   spinlockAcquire(&dirOriginal->globalObject->LOCK_PROP);
   dirOriginal->globalObject->openFds++;
   spinlockRelease(&dirOriginal->globalObject->LOCK_PROP);
+  ext2InodeHold(ext2, dir->inodeNum);
 
   return true;
 }
@@ -897,7 +905,8 @@ size_t ext2Delete(MountPoint *mnt, char *filename, bool directory,
     // directory special: check if the directory is empty first
     uint8_t       *names = (uint8_t *)malloc(ext2->blockSize);
     Ext2Directory *dir = (Ext2Directory *)names;
-    getDiskBytes((uint8_t *)dir, BLOCK_TO_LBA(ext2, 0, inode->blocks[0]),
+    getDiskBytes(ext2->disk, (uint8_t *)dir,
+                 BLOCK_TO_LBA(ext2, 0, inode->blocks[0]),
                  ext2->blockSize / SECTOR_SIZE);
     int i = 0;
     while (((size_t)dir - (size_t)names) < ext2->blockSize) {
@@ -970,8 +979,9 @@ size_t ext2Delete(MountPoint *mnt, char *filename, bool directory,
     // get rid of this inode
     ext2InodeDelete(ext2, inodeNum);
 
-    // if it's a directory inform the parent
+    // if it's a directory inform the parent (and forget what it contained)
     if (inode->permission & S_IFDIR) {
+      dcachePurgeDir(ext2, inodeNum);
       parentInode->hard_links--;
       ext2InodeModifyM(ext2, parentInodeNum, parentInode);
     }
@@ -1058,4 +1068,5 @@ VfsHandlers ext2Handlers = {.open = ext2Open,
                             .getdents64 = ext2Getdents64,
                             .seek = ext2Seek,
                             .getFilesize = ext2GetFilesize,
+                            .readahead = ext2Readahead,
                             .mmap = ext2Mmap};
@@ -1,3 +1,4 @@
+#include <dcache.h>
 #include <dents.h>
 #include <ext2.h>
 #include <malloc.h>
@@ -20,6 +21,17 @@ bool ext2DirAllocate(Ext2 *ext2, uint32_t inodeNum, Ext2Inode *parentDirInode,
   bool ret = false;
   ext2BlockFetchInit(ext2, &control);
 
+  if (ext2DxIndexed(ext2, ino)) {
+    EXT2_DX_RES res =
+        ext2DxAdd(ext2, ino, inodeNum, filename, filenameLen, type, inode);
+    if (res != EXT2_DX_UNUSABLE) {
+      ret = res == EXT2_DX_OK;
+      goto cleanup;
+    }
+    // would only get corrupted by linear insertions
+    ext2DxDrop(ext2, ino, inodeNum);
+  }
+
   int blocksContained = DivRoundUp(ino->size, ext2->blockSize);
   for (int i = 0; i < blocksContained; i++) {
     size_t block = ext2BlockFetch(ext2, ino, inodeNum, &control, blockNum);
@@ -28,7 +40,7 @@ bool ext2DirAllocate(Ext2 *ext2, uint32_t inodeNum, Ext2Inode *parentDirInode,
     blockNum++;
     Ext2Directory *dir = (Ext2Directory *)names;
 
-    getDiskBytes(names, BLOCK_TO_LBA(ext2, 0, block),
+    getDiskBytes(ext2->disk, names, BLOCK_TO_LBA(ext2, 0, block),
                  ext2->blockSize / SECTOR_SIZE);
 
     while (((size_t)dir - (size_t)names) < ext2->blockSize) {
@@ -55,7 +67,7 @@ bool ext2DirAllocate(Ext2 *ext2, uint32_t inodeNum, Ext2Inode *parentDirInode,
       new->filenameLength = filenameLen;
       new->inode = inode;
 
-      setDiskBytes(names, BLOCK_TO_LBA(ext2, 0, block),
+      setDiskBytes(ext2->disk, names, BLOCK_TO_LBA(ext2, 0, block),
                    ext2->blockSize / SECTOR_SIZE);
 
       ret = true;
@@ -66,12 +78,20 @@ bool ext2DirAllocate(Ext2 *ext2, uint32_t inodeNum, Ext2Inode *parentDirInode,
     }
   }
 
+  // a full single block, from now on it's worth indexing
+  if (blocksContained == 1 && ext2DxSupported(ext2) &&
+      !(ino->flags & EXT2_INDEX_FL) && ext2DxConvert(ext2, ino, inodeNum)) {
+    ret = ext2DxAdd(ext2, ino, inodeNum, filename, filenameLen, type, inode) ==
+          EXT2_DX_OK;
+    goto cleanup;
+  }
+
   // means we need to allocate another block for these
   uint32_t group = INODE_TO_BLOCK_GROUP(ext2, inodeNum);
   uint32_t newBlock = ext2BlockFind(ext2, group, 1);
 
   uint8_t *newBlockBuff = names; // reuse names :p
-  getDiskBytes(newBlockBuff, BLOCK_TO_LBA(ext2, 0, newBlock),
+  getDiskBytes(ext2->disk, newBlockBuff, BLOCK_TO_LBA(ext2, 0, newBlock),
                ext2->blockSize / SECTOR_SIZE);
 
   Ext2Directory *new = (Ext2Directory *)(newBlockBuff);
@@ -81,7 +101,7 @@ bool ext2DirAllocate(Ext2 *ext2, uint32_t inodeNum, Ext2Inode *parentDirInode,
   new->filenameLength = filenameLen;
   new->inode = inode;
 
-  setDiskBytes(newBlockBuff, BLOCK_TO_LBA(ext2, 0, newBlock),
+  setDiskBytes(ext2->disk, newBlockBuff, BLOCK_TO_LBA(ext2, 0, newBlock),
                ext2->blockSize / SECTOR_SIZE);
   ext2BlockAssign(ext2, ino, inodeNum, &control, blockNum, newBlock);
 
@@ -92,6 +112,8 @@ bool ext2DirAllocate(Ext2 *ext2, uint32_t inodeNum, Ext2Inode *parentDirInode,
   ret = true;
 
 cleanup:
+  if (ret)
+    dcacheSet(ext2, inodeNum, filename, filenameLen, inode);
   ext2BlockFetchCleanup(&control);
   free(names);
   spinlockRelease(&ext2->LOCK_DIRALLOC);
@@ -99,6 +121,32 @@ cleanup:
   return ret;
 }
 
+// removes filename from a single directory block, if it's there
+bool ext2DirRemoveEntry(Ext2 *ext2, uint8_t *names, char *filename,
+                        uint8_t filenameLen) {
+  Ext2Directory *dir = (Ext2Directory *)names;
+  Ext2Directory *before = 0;
+  while (((size_t)dir - (size_t)names) < ext2->blockSize) {
+    if (dir->inode && filenameLen == dir->filenameLength &&
+        memcmp(dir->filename, filename, filenameLen) == 0) {
+      if (!before) {
+        // it's the first element
+        dir->inode = 0;
+        dir->filenameLength = 0;
+      } else {
+        // it's somewhere in between, meaning there's another element behind
+        before->size += dir->size;
+      }
+      return true;
+    }
+
+    before = dir;
+    dir = (void *)((size_t)dir + dir->size);
+  }
+
+  return false;
+}
+
 bool ext2DirRemove(Ext2 *ext2, Ext2Inode *parentDirInode,
                    uint32_t parentDirInodeNum, char *filename,
                    uint8_t filenameLen) {
@@ -113,6 +161,15 @@ bool ext2DirRemove(Ext2 *ext2, Ext2Inode *parentDirInode,
   bool ret = false;
   ext2BlockFetchInit(ext2, &control);
 
+  if (ext2DxIndexed(ext2, ino)) {
+    EXT2_DX_RES res =
+        ext2DxRemove(ext2, ino, parentDirInodeNum, filename, filenameLen);
+    if (res != EXT2_DX_UNUSABLE) {
+      ret = res == EXT2_DX_OK;
+      goto cleanup;
+    }
+  }
+
   int blocksContained = DivRoundUp(ino->size, ext2->blockSize);
   for (int i = 0; i < blocksContained; i++) {
     size_t block =
@@ -120,38 +177,22 @@ bool ext2DirRemove(Ext2 *ext2, Ext2Inode *parentDirInode,
     if (!block)
       break;
     blockNum++;
-    Ext2Directory *dir = (Ext2Directory *)names;
 
-    getDiskBytes(names, BLOCK_TO_LBA(ext2, 0, block),
+    getDiskBytes(ext2->disk, names, BLOCK_TO_LBA(ext2, 0, block),
                  ext2->blockSize / SECTOR_SIZE);
 
-    Ext2Directory *before = 0;
-    while (((size_t)dir - (size_t)names) < ext2->blockSize) {
-      if (dir->inode && filenameLen == dir->filenameLength &&
-          memcmp(dir->filename, filename, filenameLen) == 0) {
-        // found!
-        if ((size_t)dir == (size_t)names) {
-          // it's the first element
-          assert(!before);
-          dir->inode = 0;
-          dir->filenameLength = 0;
-          setDiskBytes(names, BLOCK_TO_LBA(ext2, 0, block),
-                       ext2->blockSize / SECTOR_SIZE);
-        } else {
-          // it's somewhere in between, meaning there's another element behind
-          before->size += dir->size;
-          setDiskBytes(names, BLOCK_TO_LBA(ext2, 0, block),
-                       ext2->blockSize / SECTOR_SIZE);
-        }
-        // done successfuly!
-        ret = true;
-      }
-
-      before = dir;
-      dir = (void *)((size_t)dir + dir->size);
+    if (ext2DirRemoveEntry(ext2, names, filename, filenameLen)) {
+      setDiskBytes(ext2->disk, names, BLOCK_TO_LBA(ext2, 0, block),
+                   ext2->blockSize / SECTOR_SIZE);
+      // done successfuly!
+      ret = true;
+      break;
     }
   }
 
+cleanup:
+  if (ret)
+    dcacheSet(ext2, parentDirInodeNum, filename, filenameLen, 0);
   ext2BlockFetchCleanup(&control);
   free(names);
   spinlockRelease(&ext2->LOCK_DIRALLOC);
@@ -182,13 +223,13 @@ size_t ext2Getdents64(OpenFile *file, struct linux_dirent64 *start,
     Ext2Directory *dir =
         (Ext2Directory *)((size_t)names + (edir->ptr % ext2->blockSize));
 
-    getDiskBytes(names, BLOCK_TO_LBA(ext2, 0, block),
+    getDiskBytes(ext2->disk, names, BLOCK_TO_LBA(ext2, 0, block),
                  ext2->blockSize / SECTOR_SIZE);
 
     while (((size_t)dir - (size_t)names) < ext2->blockSize) {
-      if (!dir->inode) {
+      if (!dir->inode) { // empty (or an htree index node)
+        edir->ptr += dir->size;
         goto traverse;
-        continue;
       }
 
       unsigned char type = 0;
@@ -0,0 +1,739 @@
+#include <ext2.h>
+#include <malloc.h>
+#include <string.h>
+#include <system.h>
+#include <util.h>
+
+// Hashed directory index (htree) support. Names get hashed, the index maps hash
+// ranges to leaf blocks, and those are plain directory blocks. Lookups/inserts
+// only touch the blocks on a single root->leaf path instead of all of them
+
+#define EXT2_DX_ROOT_INFO 24 // after "." & ".."
+
+// Hash functions (same as every other implementation, obviously)
+
+#define EXT2_DX_TEA_DELTA 0x9E3779B9
+
+static void ext2DxTea(uint32_t buf[4], uint32_t in[4]) {
+  uint32_t sum = 0;
+  uint32_t b0 = buf[0], b1 = buf[1];
+  uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+  for (int n = 0; n < 16; n++) {
+    sum += EXT2_DX_TEA_DELTA;
+    b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+    b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+  }
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+#define EXT2_DX_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define EXT2_DX_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define EXT2_DX_H(x, y, z) ((x) ^ (y) ^ (z))
+#define EXT2_DX_ROUND(f, a, b, c, d, x, s)                                     \
+  (a += f(b, c, d) + (x), a = (a << (s)) | (a >> (32 - (s))))
+#define EXT2_DX_K2 013240474631UL
+#define EXT2_DX_K3 015666365641UL
+
+static void ext2DxHalfMd4(uint32_t buf[4], uint32_t in[8]) {
+  uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  EXT2_DX_ROUND(EXT2_DX_F, a, b, c, d, in[0], 3);
+  EXT2_DX_ROUND(EXT2_DX_F, d, a, b, c, in[1], 7);
+  EXT2_DX_ROUND(EXT2_DX_F, c, d, a, b, in[2], 11);
+  EXT2_DX_ROUND(EXT2_DX_F, b, c, d, a, in[3], 19);
+  EXT2_DX_ROUND(EXT2_DX_F, a, b, c, d, in[4], 3);
+  EXT2_DX_ROUND(EXT2_DX_F, d, a, b, c, in[5], 7);
+  EXT2_DX_ROUND(EXT2_DX_F, c, d, a, b, in[6], 11);
+  EXT2_DX_ROUND(EXT2_DX_F, b, c, d, a, in[7], 19);
+
+  EXT2_DX_ROUND(EXT2_DX_G, a, b, c, d, in[1] + EXT2_DX_K2, 3);
+  EXT2_DX_ROUND(EXT2_DX_G, d, a, b, c, in[3] + EXT2_DX_K2, 5);
+  EXT2_DX_ROUND(EXT2_DX_G, c, d, a, b, in[5] + EXT2_DX_K2, 9);
+  EXT2_DX_ROUND(EXT2_DX_G, b, c, d, a, in[7] + EXT2_DX_K2, 13);
+  EXT2_DX_ROUND(EXT2_DX_G, a, b, c, d, in[0] + EXT2_DX_K2, 3);
+  EXT2_DX_ROUND(EXT2_DX_G, d, a, b, c, in[2] + EXT2_DX_K2, 5);
+  EXT2_DX_ROUND(EXT2_DX_G, c, d, a, b, in[4] + EXT2_DX_K2, 9);
+  EXT2_DX_ROUND(EXT2_DX_G, b, c, d, a, in[6] + EXT2_DX_K2, 13);
+
+  EXT2_DX_ROUND(EXT2_DX_H, a, b, c, d, in[3] + EXT2_DX_K3, 3);
+  EXT2_DX_ROUND(EXT2_DX_H, d, a, b, c, in[7] + EXT2_DX_K3, 9);
+  EXT2_DX_ROUND(EXT2_DX_H, c, d, a, b, in[2] + EXT2_DX_K3, 11);
+  EXT2_DX_ROUND(EXT2_DX_H, b, c, d, a, in[6] + EXT2_DX_K3, 15);
+  EXT2_DX_ROUND(EXT2_DX_H, a, b, c, d, in[1] + EXT2_DX_K3, 3);
+  EXT2_DX_ROUND(EXT2_DX_H, d, a, b, c, in[5] + EXT2_DX_K3, 9);
+  EXT2_DX_ROUND(EXT2_DX_H, c, d, a, b, in[0] + EXT2_DX_K3, 11);
+  EXT2_DX_ROUND(EXT2_DX_H, b, c, d, a, in[4] + EXT2_DX_K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+static uint32_t ext2DxLegacy(char *name, size_t len, bool unsignedChar) {
+  uint32_t hash = 0, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+  for (size_t i = 0; i < len; i++) {
+    int c = unsignedChar ? (int)(uint8_t)name[i] : (int)(int8_t)name[i];
+    hash = hash1 + (hash0 ^ ((uint32_t)c * 7152373));
+    if (hash & 0x80000000)
+      hash -= 0x7fffffff;
+    hash1 = hash0;
+    hash0 = hash;
+  }
+  return hash0 << 1;
+}
+
+static void ext2DxStr2Buf(char *msg, size_t len, uint32_t *buf, int num,
+                          bool unsignedChar) {
+  uint32_t pad = (uint32_t)len | ((uint32_t)len << 8);
+  pad |= pad << 16;
+
+  uint32_t val = pad;
+  if (len > num * 4)
+    len = num * 4;
+  for (size_t i = 0; i < len; i++) {
+    int c = unsignedChar ? (int)(uint8_t)msg[i] : (int)(int8_t)msg[i];
+    val = c + (val << 8);
+    if ((i % 4) == 3) {
+      *buf++ = val;
+      val = pad;
+      num--;
+    }
+  }
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+static uint32_t ext2DxHash(Ext2 *ext2, int version, char *name, size_t len) {
+  uint32_t buf[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+  uint32_t in[8];
+  uint32_t hash = 0;
+
+  uint32_t seed[4];
+  memcpy(seed, ext2->superblock.extended.hash_seed, sizeof(seed));
+  if (seed[0] || seed[1] || seed[2] || seed[3])
+    memcpy(buf, seed, sizeof(buf));
+
+  bool unsignedChar = version >= EXT2_DX_HASH_UNSIGNED;
+  switch (version % EXT2_DX_HASH_UNSIGNED) {
+  case EXT2_DX_HASH_LEGACY:
+    hash = ext2DxLegacy(name, len, unsignedChar);
+    break;
+  case EXT2_DX_HASH_HALF_MD4:
+    for (size_t i = 0; i < len; i += 32) {
+      ext2DxStr2Buf(name + i, len - i, in, 8, unsignedChar);
+      ext2DxHalfMd4(buf, in);
+    }
+    hash = buf[1];
+    break;
+  case EXT2_DX_HASH_TEA:
+    for (size_t i = 0; i < len; i += 16) {
+      ext2DxStr2Buf(name + i, len - i, in, 4, unsignedChar);
+      ext2DxTea(buf, in);
+    }
+    hash = buf[0];
+    break;
+  }
+
+  // lowest bit is reserved for marking collisions, all ones for the end
+  hash &= ~1;
+  if (hash == (0x7fffffffU << 1))
+    hash = (0x7fffffffU - 1) << 1;
+  return hash;
+}
+
+// Index traversal
+
+typedef struct Ext2DxFrame {
+  uint32_t     logical; // directory block
+  uint32_t     block;   // actual one
+  uint8_t     *buff;
+  Ext2DxEntry *entries; // [0] being the count/limit
+  Ext2DxEntry *at;      // the one we went through
+} Ext2DxFrame;
+
+typedef struct Ext2DxPath {
+  Ext2DxFrame frames[EXT2_DX_MAX_LEVELS];
+  int         levels;
+
+  int      version;
+  uint32_t hash;
+
+  Ext2LookupControl control;
+} Ext2DxPath;
+
+#define EXT2_DX_COUNT(entries) (((Ext2DxCountLimit *)(entries))->count)
+#define EXT2_DX_LIMIT(entries) (((Ext2DxCountLimit *)(entries))->limit)
+#define EXT2_DX_ROOT_LIMIT(ext2)                                               \
+  (((ext2)->blockSize - EXT2_DX_ROOT_ENTRIES) / sizeof(Ext2DxEntry))
+#define EXT2_DX_NODE_LIMIT(ext2)                                               \
+  (((ext2)->blockSize - EXT2_DX_NODE_ENTRIES) / sizeof(Ext2DxEntry))
+
+bool ext2DxSupported(Ext2 *ext2) {
+  return ext2->superblock.major >= 1 &&
+         ext2->superblock.extended.optional_feature & EXT2_O_F_DIR_INDEX;
+}
+
+bool ext2DxIndexed(Ext2 *ext2, Ext2Inode *ino) {
+  return ext2DxSupported(ext2) && ino->flags & EXT2_INDEX_FL;
+}
+
+static uint32_t ext2DxRead(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
+                           Ext2LookupControl *control, uint32_t logical,
+                           uint8_t *buff) {
+  if (logical >= DivRoundUp(ino->size, ext2->blockSize))
+    return 0;
+  uint32_t block = ext2BlockFetch(ext2, ino, inodeNum, control, logical);
+  if (!block)
+    return 0;
+  getDiskBytes(ext2->disk, buff, BLOCK_TO_LBA(ext2, 0, block),
+               ext2->blockSize / SECTOR_SIZE);
+  return block;
+}
+
+static void ext2DxWrite(Ext2 *ext2, uint32_t block, uint8_t *buff) {
+  setDiskBytes(ext2->disk, buff, BLOCK_TO_LBA(ext2, 0, block),
+               ext2->blockSize / SECTOR_SIZE);
+}
+
+// appends a fresh block to the directory
+static uint32_t ext2DxGrow(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
+                           Ext2LookupControl *control, uint32_t *logical) {
+  *logical = DivRoundUp(ino->size, ext2->blockSize);
+  uint32_t group = INODE_TO_BLOCK_GROUP(ext2, inodeNum);
+  uint32_t block = ext2BlockFind(ext2, group, 1);
+  if (!block)
+    return 0;
+  ext2BlockAssign(ext2, ino, inodeNum, control, *logical, block);
+
+  ino->num_sectors += ext2->blockSize / SECTOR_SIZE;
+  ino->size += ext2->blockSize;
+  ext2InodeModifyM(ext2, inodeNum, ino);
+  return block;
+}
+
+static void ext2DxPathInit(Ext2 *ext2, Ext2DxPath *path) {
+  memset(path, 0, sizeof(Ext2DxPath));
+  ext2BlockFetchInit(ext2, &path->control);
+}
+
+static void ext2DxPathCleanup(Ext2DxPath *path) {
+  for (int i = 0; i < EXT2_DX_MAX_LEVELS; i++) {
+    if (path->frames[i].buff)
+      free(path->frames[i].buff);
+  }
+  ext2BlockFetchCleanup(&path->control);
+}
+
+// walks the index down to the leaf that should contain name
+static bool ext2DxProbe(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
+                        char *name, size_t len, Ext2DxPath *path) {
+  Ext2DxFrame *frame = &path->frames[0];
+  frame->buff = malloc(ext2->blockSize);
+  frame->logical = 0;
+  frame->block =
+      ext2DxRead(ext2, ino, inodeNum, &path->control, 0, frame->buff);
+  if (!frame->block)
+    return false;
+
+  Ext2DxRootInfo *info = (Ext2DxRootInfo *)(frame->buff + EXT2_DX_ROOT_INFO);
+  if (info->reserved_zero || info->info_length != sizeof(Ext2DxRootInfo) ||
+      info->hash_version > EXT2_DX_HASH_TEA ||
+      info->indirect_levels >= EXT2_DX_MAX_LEVELS)
+    return false;
+
+  path->version = info->hash_version;
+  if (ext2->superblock.extended.flags & EXT2_FLAGS_UNSIGNED_HASH)
+    path->version += EXT2_DX_HASH_UNSIGNED;
+  path->hash = ext2DxHash(ext2, path->version, name, len);
+
+  frame->entries = (Ext2DxEntry *)(frame->buff + EXT2_DX_ROOT_ENTRIES);
+  size_t limit = EXT2_DX_ROOT_LIMIT(ext2);
+  path->levels = 1;
+  while (true) {
+    size_t count = EXT2_DX_COUNT(frame->entries);
+    if (!count || count > limit || EXT2_DX_LIMIT(frame->entries) != limit)
+      return false;
+
+    // last entry with a hash <= ours (the first one covers everything below)
+    Ext2DxEntry *p = frame->entries + 1;
+    Ext2DxEntry *q = frame->entries + count - 1;
+    while (p <= q) {
+      Ext2DxEntry *m = p + (q - p) / 2;
+      if (m->hash > path->hash)
+        q = m - 1;
+      else
+        p = m + 1;
+    }
+    frame->at = p - 1;
+
+    if (path->levels > info->indirect_levels)
+      break;
+
+    Ext2DxFrame *next = &path->frames[path->levels++];
+    next->buff = malloc(ext2->blockSize);
+    next->logical = frame->at->block & EXT2_DX_BLOCK_MASK;
+    next->block = ext2DxRead(ext2, ino, inodeNum, &path->control,
+                             next->logical, next->buff);
+    if (!next->block)
+      return false;
+    next->entries = (Ext2DxEntry *)(next->buff + EXT2_DX_NODE_ENTRIES);
+    limit = EXT2_DX_NODE_LIMIT(ext2);
+    frame = next;
+  }
+
+  return true;
+}
+
+// moves on to the next leaf, if it can still contain our hash (collisions).
+// when it can't, the path is left pointing at the current one
+static uint32_t ext2DxNext(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
+                           Ext2DxPath *path) {
+  int level = path->levels - 1;
+  while (path->frames[level].at + 1 >=
+         path->frames[level].entries +
+             EXT2_DX_COUNT(path->frames[level].entries)) {
+    if (!level)
+      return 0;
+    level--;
+  }
+
+  Ext2DxFrame *frame = &path->frames[level];
+  if (((frame->at + 1)->hash & ~1) != path->hash)
+    return 0;
+  frame->at++;
+
+  while (++level < path->levels) {
+    Ext2DxFrame *next = &path->frames[level];
+    next->logical = frame->at->block & EXT2_DX_BLOCK_MASK;
+    next->block = ext2DxRead(ext2, ino, inodeNum, &path->control,
+                             next->logical, next->buff);
+    if (!next->block)
+      return 0;
+    next->entries = (Ext2DxEntry *)(next->buff + EXT2_DX_NODE_ENTRIES);
+    next->at = next->entries;
+    frame = next;
+  }
+
+  return frame->at->block & EXT2_DX_BLOCK_MASK;
+}
+
+// Leaf blocks
+
+static uint32_t ext2DxLeafFind(Ext2 *ext2, uint8_t *leaf, char *name,
+                               size_t len) {
+  Ext2Directory *dir = (Ext2Directory *)leaf;
+  while (((size_t)dir - (size_t)leaf) < ext2->blockSize) {
+    if (dir->size < sizeof(Ext2Directory))
+      break;
+    if (dir->inode && dir->filenameLength == len &&
+        memcmp(dir->filename, name, len) == 0)
+      return dir->inode;
+    dir = (void *)((size_t)dir + dir->size);
+  }
+  return 0;
+}
+
+#define EXT2_DIR_REC_LEN(len) ((sizeof(Ext2Directory) + (len) + 3) & ~3)
+
+static bool ext2DxLeafPlace(Ext2 *ext2, uint8_t *leaf, char *name,
+                            uint8_t len, uint8_t type, uint32_t inode) {
+  size_t         needed = EXT2_DIR_REC_LEN(len);
+  Ext2Directory *dir = (Ext2Directory *)leaf;
+  while (((size_t)dir - (size_t)leaf) < ext2->blockSize) {
+    if (dir->size < sizeof(Ext2Directory))
+      return false;
+    size_t used = dir->inode ? EXT2_DIR_REC_LEN(dir->filenameLength) : 0;
+    if (dir->size - used >= needed) {
+      Ext2Directory *new = dir;
+      if (used) {
+        new = (void *)((size_t)dir + used);
+        new->size = dir->size - used;
+        dir->size = used;
+      }
+      new->inode = inode;
+      new->type = type;
+      new->filenameLength = len;
+      memcpy(new->filename, name, len);
+      return true;
+    }
+    dir = (void *)((size_t)dir + dir->size);
+  }
+  return false;
+}
+
+typedef struct Ext2DxMap {
+  uint32_t hash;
+  uint16_t offset;
+  uint16_t size;
+} Ext2DxMap;
+
+// packs map[from, to) from src into a fresh block at dst
+static void ext2DxLeafPack(Ext2 *ext2, uint8_t *dst, uint8_t *src,
+                           Ext2DxMap *map, size_t from, size_t to) {
+  Ext2Directory *last = 0;
+  size_t         offset = 0;
+  for (size_t i = from; i < to; i++) {
+    Ext2Directory *entry = (Ext2Directory *)(src + map[i].offset);
+    last = (Ext2Directory *)(dst + offset);
+    memcpy(last, entry, sizeof(Ext2Directory) + entry->filenameLength);
+    last->size = map[i].size;
+    offset += map[i].size;
+  }
+
+  if (last)
+    last->size += ext2->blockSize - offset;
+  else {
+    last = (Ext2Directory *)dst;
+    last->inode = 0;
+    last->filenameLength = 0;
+    last->size = ext2->blockSize;
+  }
+}
+
+static void ext2DxInsert(Ext2DxFrame *frame, uint32_t hash, uint32_t logical) {
+  Ext2DxEntry *new = frame->at + 1;
+  Ext2DxEntry *end = frame->entries + EXT2_DX_COUNT(frame->entries);
+  memmove(new + 1, new, (end - new) * sizeof(Ext2DxEntry));
+  new->hash = hash;
+  new->block = logical;
+  EXT2_DX_COUNT(frame->entries)++;
+}
+
+// makes sure the deepest index node can take another entry
+static bool ext2DxMakeRoom(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
+                           Ext2DxPath *path) {
+  Ext2DxFrame *frame = &path->frames[path->levels - 1];
+  size_t       count = EXT2_DX_COUNT(frame->entries);
+  if (count < EXT2_DX_LIMIT(frame->entries))
+    return true;
+
+  // splitting a node needs room in the root, as big as we go
+  Ext2DxFrame *root = &path->frames[0];
+  if (path->levels > 1 &&
+      EXT2_DX_COUNT(root->entries) >= EXT2_DX_LIMIT(root->entries))
+    return false;
+
+  uint32_t logical = 0;
+  uint32_t block = ext2DxGrow(ext2, ino, inodeNum, &path->control, &logical);
+  if (!block)
+    return false;
+
+  uint8_t       *buff = calloc(ext2->blockSize, 1);
+  Ext2Directory *empty = (Ext2Directory *)buff;
+  empty->size = ext2->blockSize;
+  Ext2DxEntry *entries = (Ext2DxEntry *)(buff + EXT2_DX_NODE_ENTRIES);
+
+  if (path->levels == 1) {
+    // root's full, push all of it one level down
+    memcpy(entries, frame->entries, count * sizeof(Ext2DxEntry));
+    EXT2_DX_LIMIT(entries) = EXT2_DX_NODE_LIMIT(ext2);
+    ext2DxWrite(ext2, block, buff);
+
+    Ext2DxFrame *node = &path->frames[1];
+    node->buff = buff;
+    node->logical = logical;
+    node->block = block;
+    node->entries = entries;
+    node->at = entries + (frame->at - frame->entries);
+
+    EXT2_DX_COUNT(frame->entries) = 1;
+    frame->entries[0].block = logical;
+    frame->at = frame->entries;
+    ((Ext2DxRootInfo *)(frame->buff + EXT2_DX_ROOT_INFO))->indirect_levels = 1;
+    ext2DxWrite(ext2, frame->block, frame->buff);
+
+    path->levels = 2;
+    return true;
+  }
+
+  // split the node in half
+  size_t   half = count / 2;
+  uint32_t hash = frame->entries[half].hash;
+  memcpy(entries, &frame->entries[half], (count - half) * sizeof(Ext2DxEntry));
+  EXT2_DX_LIMIT(entries) = EXT2_DX_LIMIT(frame->entries);
+  EXT2_DX_COUNT(entries) = count - half;
+  EXT2_DX_COUNT(frame->entries) = half;
+
+  ext2DxInsert(root, hash, logical);
+  ext2DxWrite(ext2, block, buff);
+  ext2DxWrite(ext2, frame->block, frame->buff);
+  ext2DxWrite(ext2, root->block, root->buff);
+
+  // follow whichever half we were in
+  if (frame->at >= frame->entries + half) {
+    size_t at = frame->at - frame->entries - half;
+    free(frame->buff);
+    frame->buff = buff;
+    frame->logical = logical;
+    frame->block = block;
+    frame->entries = entries;
+    frame->at = entries + at;
+    root->at++;
+  } else
+    free(buff);
+
+  return true;
+}
+
+// splits a full leaf in two (by hash), then places the new entry
+static bool ext2DxSplit(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
+                        Ext2DxPath *path, uint8_t *leaf, uint32_t leafBlock,
+                        char *name, uint8_t len, uint8_t type, uint32_t inode) {
+  Ext2DxMap *map = malloc(sizeof(Ext2DxMap) * (ext2->blockSize / 12 + 1));
+  size_t     cnt = 0;
+  size_t     total = 0;
+
+  Ext2Directory *dir = (Ext2Directory *)leaf;
+  while (((size_t)dir - (size_t)leaf) < ext2->blockSize) {
+    if (dir->size < sizeof(Ext2Directory))
+      break;
+    if (dir->inode) {
+      Ext2DxMap entry = {
+          .hash = ext2DxHash(ext2, path->version, dir->filename,
+                             dir->filenameLength),
+          .offset = (size_t)dir - (size_t)leaf,
+          .size = EXT2_DIR_REC_LEN(dir->filenameLength)};
+      // insertion sort, they're only a couple hundred at most
+      size_t pos = cnt++;
+      while (pos && map[pos - 1].hash > entry.hash) {
+        map[pos] = map[pos - 1];
+        pos--;
+      }
+      map[pos] = entry;
+      total += entry.size;
+    }
+    dir = (void *)((size_t)dir + dir->size);
+  }
+
+  bool ret = false;
+  if (cnt < 2)
+    goto cleanup;
+
+  // roughly half of the bytes stay
+  size_t split = 0;
+  size_t stays = 0;
+  while (split < cnt - 1 && stays + map[split].size <= total / 2)
+    stays += map[split++].size;
+  if (!split)
+    split = 1;
+
+  uint32_t hash = map[split].hash;
+  bool     continued = hash == map[split - 1].hash;
+
+  uint32_t logical = 0;
+  uint32_t block = ext2DxGrow(ext2, ino, inodeNum, &path->control, &logical);
+  if (!block)
+    goto cleanup;
+
+  uint8_t *kept = calloc(ext2->blockSize, 1);
+  uint8_t *moved = calloc(ext2->blockSize, 1);
+  ext2DxLeafPack(ext2, kept, leaf, map, 0, split);
+  ext2DxLeafPack(ext2, moved, leaf, map, split, cnt);
+
+  uint8_t *target = path->hash >= hash ? moved : kept;
+  ret = ext2DxLeafPlace(ext2, target, name, len, type, inode);
+
+  ext2DxWrite(ext2, leafBlock, kept);
+  ext2DxWrite(ext2, block, moved);
+
+  Ext2DxFrame *frame = &path->frames[path->levels - 1];
+  ext2DxInsert(frame, hash | continued, logical);
+  ext2DxWrite(ext2, frame->block, frame->buff);
+
+  free(kept);
+  free(moved);
+
+cleanup:
+  free(map);
+  return ret;
+}
+
+// Entry points, returning EXT2_DX_UNUSABLE whenever the index is something we
+// can't work with (so callers fall back to treating it as a linear directory)
+
+bool ext2DxLookup(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum, char *name,
+                  size_t len, uint32_t *out) {
+  Ext2DxPath path;
+  ext2DxPathInit(ext2, &path);
+  bool ret = ext2DxProbe(ext2, ino, inodeNum, name, len, &path);
+  if (!ret)
+    goto cleanup;
+
+  *out = 0;
+  uint8_t *leaf = malloc(ext2->blockSize);
+  uint32_t logical =
+      path.frames[path.levels - 1].at->block & EXT2_DX_BLOCK_MASK;
+  while (logical) {
+    if (!ext2DxRead(ext2, ino, inodeNum, &path.control, logical, leaf))
+      break;
+    *out = ext2DxLeafFind(ext2, leaf, name, len);
+    if (*out)
+      break;
+    logical = ext2DxNext(ext2, ino, inodeNum, &path);
+  }
+  free(leaf);
+
+cleanup:
+  ext2DxPathCleanup(&path);
+  return ret;
+}
+
+EXT2_DX_RES ext2DxAdd(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
+                      char *name, uint8_t len, uint8_t type, uint32_t inode) {
+  EXT2_DX_RES ret = EXT2_DX_UNUSABLE;
+  uint8_t    *leaf = malloc(ext2->blockSize);
+  Ext2DxPath  path;
+  ext2DxPathInit(ext2, &path);
+  if (!ext2DxProbe(ext2, ino, inodeNum, name, len, &path))
+    goto cleanup;
+
+  // make sure it isn't there already, ending up on the last leaf our hash can
+  // go in (which is as good of a place for it as the first one)
+  uint32_t block = 0;
+  uint32_t logical =
+      path.frames[path.levels - 1].at->block & EXT2_DX_BLOCK_MASK;
+  while (logical) {
+    block = ext2DxRead(ext2, ino, inodeNum, &path.control, logical, leaf);
+    if (!block)
+      goto cleanup;
+    if (ext2DxLeafFind(ext2, leaf, name, len)) {
+      ret = EXT2_DX_FAIL;
+      goto cleanup;
+    }
+    logical = ext2DxNext(ext2, ino, inodeNum, &path);
+  }
+  if (!block)
+    goto cleanup;
+  for (int i = 1; i < path.levels; i++) {
+    if (!path.frames[i].block) // ext2DxNext() gave up halfway down
+      goto cleanup;
+  }
+
+  if (ext2DxLeafPlace(ext2, leaf, name, len, type, inode)) {
+    ext2DxWrite(ext2, block, leaf);
+    ret = EXT2_DX_OK;
+    goto cleanup;
+  }
+
+  // leaf's full, split it (and make room for that in the index)
+  if (ext2DxMakeRoom(ext2, ino, inodeNum, &path) &&
+      ext2DxSplit(ext2, ino, inodeNum, &path, leaf, block, name, len, type,
+                  inode))
+    ret = EXT2_DX_OK;
+
+cleanup:
+  ext2DxPathCleanup(&path);
+  free(leaf);
+  return ret;
+}
+
+EXT2_DX_RES ext2DxRemove(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
+                         char *name, uint8_t len) {
+  EXT2_DX_RES ret = EXT2_DX_UNUSABLE;
+  uint8_t    *leaf = malloc(ext2->blockSize);
+  Ext2DxPath  path;
+  ext2DxPathInit(ext2, &path);
+  if (!ext2DxProbe(ext2, ino, inodeNum, name, len, &path))
+    goto cleanup;
+
+  ret = EXT2_DX_FAIL;
+  uint32_t logical =
+      path.frames[path.levels - 1].at->block & EXT2_DX_BLOCK_MASK;
+  while (logical) {
+    uint32_t block =
+        ext2DxRead(ext2, ino, inodeNum, &path.control, logical, leaf);
+    if (!block)
+      break;
+    if (ext2DirRemoveEntry(ext2, leaf, name, len)) {
+      ext2DxWrite(ext2, block, leaf);
+      ret = EXT2_DX_OK;
+      break;
+    }
+    logical = ext2DxNext(ext2, ino, inodeNum, &path);
+  }
+
+cleanup:
+  ext2DxPathCleanup(&path);
+  free(leaf);
+  return ret;
+}
+
+// turns a full single-block directory into an indexed one: everything past
+// "." & ".." moves into the first leaf and the root takes over block 0
+bool ext2DxConvert(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum) {
+  bool              ret = false;
+  uint8_t          *root = malloc(ext2->blockSize);
+  uint8_t          *leaf = calloc(ext2->blockSize, 1);
+  Ext2LookupControl control = {0};
+  ext2BlockFetchInit(ext2, &control);
+
+  uint32_t rootBlock = ext2DxRead(ext2, ino, inodeNum, &control, 0, root);
+  if (!rootBlock)
+    goto cleanup;
+
+  Ext2Directory *dot = (Ext2Directory *)root;
+  Ext2Directory *dotdot = (Ext2Directory *)(root + EXT2_DIR_REC_LEN(1));
+  if (dot->size != EXT2_DIR_REC_LEN(1) || dot->filenameLength != 1 ||
+      dot->filename[0] != '.' || dotdot->filenameLength != 2 ||
+      memcmp(dotdot->filename, "..", 2) != 0 ||
+      dotdot->size < EXT2_DIR_REC_LEN(2))
+    goto cleanup;
+
+  // the rest keeps its layout, just at the start of its own block
+  size_t rest = dot->size + dotdot->size;
+  if (rest < ext2->blockSize) {
+    memcpy(leaf, root + rest, ext2->blockSize - rest);
+    Ext2Directory *dir = (Ext2Directory *)leaf;
+    size_t         offset = 0;
+    while (offset + dir->size < ext2->blockSize - rest) {
+      if (dir->size < sizeof(Ext2Directory))
+        goto cleanup;
+      offset += dir->size;
+      dir = (Ext2Directory *)(leaf + offset);
+    }
+    dir->size += rest;
+  } else {
+    Ext2Directory *empty = (Ext2Directory *)leaf;
+    empty->size = ext2->blockSize;
+  }
+
+  uint32_t logical = 0;
+  uint32_t leafBlock = ext2DxGrow(ext2, ino, inodeNum, &control, &logical);
+  if (!leafBlock)
+    goto cleanup;
+  ext2DxWrite(ext2, leafBlock, leaf);
+
+  dotdot->size = ext2->blockSize - dot->size;
+  Ext2DxRootInfo *info = (Ext2DxRootInfo *)(root + EXT2_DX_ROOT_INFO);
+  memset(info, 0, sizeof(Ext2DxRootInfo));
+  info->hash_version = ext2->superblock.extended.def_hash_version;
+  if (info->hash_version > EXT2_DX_HASH_TEA)
+    info->hash_version = EXT2_DX_HASH_HALF_MD4;
+  info->info_length = sizeof(Ext2DxRootInfo);
+
+  Ext2DxEntry *entries = (Ext2DxEntry *)(root + EXT2_DX_ROOT_ENTRIES);
+  EXT2_DX_LIMIT(entries) = EXT2_DX_ROOT_LIMIT(ext2);
+  EXT2_DX_COUNT(entries) = 1;
+  entries[0].block = logical;
+  ext2DxWrite(ext2, rootBlock, root);
+
+  ino->flags |= EXT2_INDEX_FL;
+  ext2InodeModifyM(ext2, inodeNum, ino);
+  ret = true;
+
+cleanup:
+  ext2BlockFetchCleanup(&control);
+  free(leaf);
+  free(root);
+  return ret;
+}
+
+// stop treating it as indexed (it'll still read fine linearly)
+void ext2DxDrop(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum) {
+  ino->flags &= ~EXT2_INDEX_FL;
+  ext2InodeModifyM(ext2, inodeNum, ino);
+}
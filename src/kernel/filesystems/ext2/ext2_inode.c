@@ -3,7 +3,66 @@
 #include <system.h>
 #include <util.h>
 
-Ext2Inode *ext2InodeFetch(Ext2 *ext2, size_t inode) {
+// Inode cache: on-disk inodes get read once and served from memory after
+// that. Modifications only touch the cached copy & mark it dirty, getting
+// written back in batches by ext2InodeFlush() (sorted, so inodes sharing an
+// inode table block go out with a single write)
+
+#define EXT2_INODE_HASHED(ext2, inode)                                         \
+  (&(ext2)->inodeCache[(inode) % EXT2_INODE_HASH])
+
+// lookup/lru/trim helpers below assume LOCK_INODE_CACHE is held
+static Ext2InodeCached *ext2InodeCacheLookup(Ext2 *ext2, size_t inode) {
+  Ext2InodeCached *browse = *EXT2_INODE_HASHED(ext2, inode);
+  while (browse) {
+    if (browse->inode == inode)
+      return browse;
+    browse = browse->hashNext;
+  }
+  return 0;
+}
+
+static void ext2InodeLruUnlink(Ext2 *ext2, Ext2InodeCached *cached) {
+  if (cached->lruPrev)
+    cached->lruPrev->lruNext = cached->lruNext;
+  else
+    ext2->inodeLruHead = cached->lruNext;
+  if (cached->lruNext)
+    cached->lruNext->lruPrev = cached->lruPrev;
+  else
+    ext2->inodeLruTail = cached->lruPrev;
+}
+
+static void ext2InodeLruPush(Ext2 *ext2, Ext2InodeCached *cached) {
+  cached->lruPrev = 0;
+  cached->lruNext = ext2->inodeLruHead;
+  if (ext2->inodeLruHead)
+    ext2->inodeLruHead->lruPrev = cached;
+  ext2->inodeLruHead = cached;
+  if (!ext2->inodeLruTail)
+    ext2->inodeLruTail = cached;
+}
+
+// gets rid of clean & unused ones when there's too many of them
+static void ext2InodeCacheTrim(Ext2 *ext2) {
+  Ext2InodeCached *browse = ext2->inodeLruTail;
+  while (browse && ext2->inodeCached > EXT2_INODE_CACHE_MAX) {
+    Ext2InodeCached *prev = browse->lruPrev;
+    if (!browse->dirty && !browse->refs) {
+      Ext2InodeCached **hashed = EXT2_INODE_HASHED(ext2, browse->inode);
+      while (*hashed != browse)
+        hashed = &(*hashed)->hashNext;
+      *hashed = browse->hashNext;
+      ext2InodeLruUnlink(ext2, browse);
+      ext2->inodeCached--;
+      free(browse);
+    }
+    browse = prev;
+  }
+}
+
+// reads it off of the disk, without the cache lock held
+static void ext2InodeRead(Ext2 *ext2, size_t inode, uint8_t *out) {
   uint32_t group = INODE_TO_BLOCK_GROUP(ext2, inode);
   uint32_t index = INODE_TO_INDEX(ext2, inode);
 
@@ -19,41 +78,159 @@ Ext2Inode *ext2InodeFetch(Ext2 *ext2, size_t inode) {
       BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].inode_table) + leftoversLba;
 
   uint8_t *buf = (uint8_t *)malloc(len);
-  getDiskBytes(buf, lba, len / SECTOR_SIZE);
-  Ext2Inode *tmp = (Ext2Inode *)(buf + leftoversRem);
-
-  Ext2Inode *ret = (Ext2Inode *)malloc(ext2->inodeSize);
-  memcpy(ret, tmp, ext2->inodeSize);
+  getDiskBytes(ext2->disk, buf, lba, len / SECTOR_SIZE);
+  memcpy(out, buf + leftoversRem, ext2->inodeSize);
 
   free(buf);
   spinlockCntReadRelease(&ext2->WLOCKS_INODE[group]);
+}
+
+// returns the cached copy (loading it if needed) with LOCK_INODE_CACHE held
+static Ext2InodeCached *ext2InodeCacheGet(Ext2 *ext2, size_t inode) {
+  spinlockAcquire(&ext2->LOCK_INODE_CACHE);
+  Ext2InodeCached *cached = ext2InodeCacheLookup(ext2, inode);
+  if (cached) {
+    ext2InodeLruUnlink(ext2, cached);
+    ext2InodeLruPush(ext2, cached);
+    return cached;
+  }
+  spinlockRelease(&ext2->LOCK_INODE_CACHE);
+
+  Ext2InodeCached *target =
+      calloc(sizeof(Ext2InodeCached) + ext2->inodeSize, 1);
+  target->inode = inode;
+  ext2InodeRead(ext2, inode, target->data);
+
+  spinlockAcquire(&ext2->LOCK_INODE_CACHE);
+  cached = ext2InodeCacheLookup(ext2, inode);
+  if (cached) { // someone else got to it first (maybe even modified it)
+    free(target);
+    ext2InodeLruUnlink(ext2, cached);
+    ext2InodeLruPush(ext2, cached);
+    return cached;
+  }
+
+  Ext2InodeCached **hashed = EXT2_INODE_HASHED(ext2, inode);
+  target->hashNext = *hashed;
+  *hashed = target;
+  ext2InodeLruPush(ext2, target);
+  ext2->inodeCached++;
+  ext2InodeCacheTrim(ext2);
+  return target;
+}
+
+Ext2Inode *ext2InodeFetch(Ext2 *ext2, size_t inode) {
+  Ext2Inode *ret = (Ext2Inode *)malloc(ext2->inodeSize);
+
+  Ext2InodeCached *cached = ext2InodeCacheGet(ext2, inode);
+  memcpy(ret, cached->data, ext2->inodeSize);
+  spinlockRelease(&ext2->LOCK_INODE_CACHE);
+
   return ret;
 }
 
 // IMPORTANT! Remember to manually set the lock **before** calling
 void ext2InodeModifyM(Ext2 *ext2, size_t inode, Ext2Inode *target) {
-  uint32_t group = INODE_TO_BLOCK_GROUP(ext2, inode);
-  uint32_t index = INODE_TO_INDEX(ext2, inode);
+  Ext2InodeCached *cached = ext2InodeCacheGet(ext2, inode);
+  memcpy(cached->data, target, sizeof(Ext2Inode));
+  if (!cached->dirty) {
+    cached->dirty = true;
+    ext2->inodeDirty++;
+  }
+  bool flush = ext2->inodeDirty >= EXT2_INODE_DIRTY_BATCH;
+  spinlockRelease(&ext2->LOCK_INODE_CACHE);
 
-  spinlockCntWriteAcquire(&ext2->WLOCKS_INODE[group]);
+  if (flush)
+    ext2InodeFlush(ext2);
+}
 
-  size_t leftovers = index * ext2->inodeSize;
-  size_t leftoversLba = leftovers / SECTOR_SIZE;
-  size_t leftoversRem = leftovers % SECTOR_SIZE;
+// open files keep their inode around
+void ext2InodeHold(Ext2 *ext2, size_t inode) {
+  Ext2InodeCached *cached = ext2InodeCacheGet(ext2, inode);
+  cached->refs++;
+  spinlockRelease(&ext2->LOCK_INODE_CACHE);
+}
 
-  // large enough just in case
-  size_t len = DivRoundUp(ext2->inodeSize * 4, SECTOR_SIZE) * SECTOR_SIZE;
-  size_t lba =
-      BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].inode_table) + leftoversLba;
+void ext2InodeRelease(Ext2 *ext2, size_t inode) {
+  spinlockAcquire(&ext2->LOCK_INODE_CACHE);
+  Ext2InodeCached *cached = ext2InodeCacheLookup(ext2, inode);
+  assert(cached && cached->refs);
+  cached->refs--;
+  spinlockRelease(&ext2->LOCK_INODE_CACHE);
+}
 
-  uint8_t *buf = (uint8_t *)malloc(len);
-  getDiskBytes(buf, lba, len / SECTOR_SIZE);
-  Ext2Inode *tmp = (Ext2Inode *)(buf + leftoversRem);
-  memcpy(tmp, target, sizeof(Ext2Inode));
-  setDiskBytes(buf, lba, len / SECTOR_SIZE);
+void ext2InodeFlush(Ext2 *ext2) {
+  spinlockAcquire(&ext2->LOCK_INODE_FLUSH);
 
-  free(buf);
-  spinlockCntWriteRelease(&ext2->WLOCKS_INODE[group]);
+  spinlockAcquire(&ext2->LOCK_INODE_CACHE);
+  size_t max = ext2->inodeDirty;
+  spinlockRelease(&ext2->LOCK_INODE_CACHE);
+  if (!max) {
+    spinlockRelease(&ext2->LOCK_INODE_FLUSH);
+    return;
+  }
+
+  Ext2InodeCached **batch = malloc(sizeof(Ext2InodeCached *) * max);
+  uint8_t          *data = malloc(ext2->inodeSize * max);
+
+  // take a snapshot of everything dirty, sorted by inode number. they're
+  // pinned until written, so nobody re-reads them off the disk in the meantime
+  spinlockAcquire(&ext2->LOCK_INODE_CACHE);
+  size_t           cnt = 0;
+  Ext2InodeCached *browse = ext2->inodeLruHead;
+  while (browse && cnt < max) {
+    if (browse->dirty) {
+      size_t pos = cnt++;
+      while (pos && batch[pos - 1]->inode > browse->inode) {
+        batch[pos] = batch[pos - 1];
+        pos--;
+      }
+      batch[pos] = browse;
+      browse->dirty = false;
+      browse->refs++;
+      ext2->inodeDirty--;
+    }
+    browse = browse->lruNext;
+  }
+  for (size_t i = 0; i < cnt; i++)
+    memcpy(&data[i * ext2->inodeSize], batch[i]->data, ext2->inodeSize);
+  spinlockRelease(&ext2->LOCK_INODE_CACHE);
+
+  // one read-modify-write per inode table block
+  uint8_t *block = malloc(ext2->blockSize);
+  size_t   i = 0;
+  while (i < cnt) {
+    uint32_t group = INODE_TO_BLOCK_GROUP(ext2, batch[i]->inode);
+    size_t   offset = INODE_TO_INDEX(ext2, batch[i]->inode) * ext2->inodeSize;
+    size_t   tableBlock = offset / ext2->blockSize;
+    size_t   lba = BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].inode_table) +
+                 (tableBlock * ext2->blockSize) / SECTOR_SIZE;
+
+    spinlockCntWriteAcquire(&ext2->WLOCKS_INODE[group]);
+    getDiskBytes(ext2->disk, block, lba, ext2->blockSize / SECTOR_SIZE);
+    while (i < cnt) {
+      uint32_t inode = batch[i]->inode;
+      offset = INODE_TO_INDEX(ext2, inode) * ext2->inodeSize;
+      if (INODE_TO_BLOCK_GROUP(ext2, inode) != group ||
+          offset / ext2->blockSize != tableBlock)
+        break;
+      memcpy(&block[offset % ext2->blockSize], &data[i * ext2->inodeSize],
+             ext2->inodeSize);
+      i++;
+    }
+    setDiskBytes(ext2->disk, block, lba, ext2->blockSize / SECTOR_SIZE);
+    spinlockCntWriteRelease(&ext2->WLOCKS_INODE[group]);
+  }
+
+  spinlockAcquire(&ext2->LOCK_INODE_CACHE);
+  for (i = 0; i < cnt; i++)
+    batch[i]->refs--;
+  spinlockRelease(&ext2->LOCK_INODE_CACHE);
+
+  free(block);
+  free(data);
+  free(batch);
+  spinlockRelease(&ext2->LOCK_INODE_FLUSH);
 }
 
 void ext2InodeDelete(Ext2 *ext2, size_t inode) {
@@ -68,10 +245,10 @@ void ext2InodeDelete(Ext2 *ext2, size_t inode) {
   size_t lba = BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].inode_bitmap);
 
   uint8_t *buf = (uint8_t *)malloc(ext2->blockSize);
-  getDiskBytes(buf, lba, ext2->blockSize / SECTOR_SIZE);
+  getDiskBytes(ext2->disk, buf, lba, ext2->blockSize / SECTOR_SIZE);
   assert(buf[where] & (1 << remainder));
   buf[where] &= ~(1 << remainder);
-  setDiskBytes(buf, lba, ext2->blockSize / SECTOR_SIZE);
+  setDiskBytes(ext2->disk, buf, lba, ext2->blockSize / SECTOR_SIZE);
 
   free(buf);
 
@@ -122,7 +299,8 @@ uint32_t ext2InodeFindL(Ext2 *ext2, int group) {
   uint32_t ret = 0;
   uint8_t *buff = malloc(ext2->blockSize);
 
-  getDiskBytes(buff, BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].inode_bitmap),
+  getDiskBytes(ext2->disk, buff,
+               BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].inode_bitmap),
                ext2->blockSize / SECTOR_SIZE);
 
   int firstInodeDiv = 0;
@@ -150,7 +328,8 @@ cleanup:
     uint32_t where = ret / 8;
     uint32_t remainder = ret % 8;
     buff[where] |= (1 << remainder);
-    setDiskBytes(buff, BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].inode_bitmap),
+    setDiskBytes(ext2->disk, buff,
+                 BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].inode_bitmap),
                  ext2->blockSize / SECTOR_SIZE);
 
     // set the bgdt accordingly
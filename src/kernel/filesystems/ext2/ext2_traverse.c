@@ -1,3 +1,4 @@
+#include <dcache.h>
 #include <ext2.h>
 #include <malloc.h>
 #include <string.h>
@@ -7,6 +8,11 @@
 
 uint32_t ext2Traverse(Ext2 *ext2, size_t initInode, char *search,
                       size_t searchLength) {
+  size_t cached = 0;
+  if (dcacheLookup(ext2, initInode, search, searchLength, &cached))
+    return cached;
+  uint64_t seq = dcacheSeq();
+
   uint32_t   ret = 0;
   Ext2Inode *ino = ext2InodeFetch(ext2, initInode);
   uint8_t   *names = (uint8_t *)malloc(ext2->blockSize);
@@ -16,6 +22,13 @@ uint32_t ext2Traverse(Ext2 *ext2, size_t initInode, char *search,
 
   ext2BlockFetchInit(ext2, &control);
 
+  uint32_t found = 0;
+  if (ext2DxIndexed(ext2, ino) &&
+      ext2DxLookup(ext2, ino, initInode, search, searchLength, &found)) {
+    ret = found;
+    goto cleanup;
+  }
+
   int blocksContained = DivRoundUp(ino->size, ext2->blockSize);
   for (int i = 0; i < blocksContained; i++) {
     size_t block = ext2BlockFetch(ext2, ino, initInode, &control, blockNum);
@@ -24,7 +37,7 @@ uint32_t ext2Traverse(Ext2 *ext2, size_t initInode, char *search,
       break;
     Ext2Directory *dir = (Ext2Directory *)names;
 
-    getDiskBytes(names, BLOCK_TO_LBA(ext2, 0, block),
+    getDiskBytes(ext2->disk, names, BLOCK_TO_LBA(ext2, 0, block),
                  ext2->blockSize / SECTOR_SIZE);
 
     while (((size_t)dir - (size_t)names) < ext2->blockSize) {
@@ -43,6 +56,7 @@ uint32_t ext2Traverse(Ext2 *ext2, size_t initInode, char *search,
   }
 
 cleanup:
+  dcacheFill(ext2, initInode, search, searchLength, ret, seq);
   ext2BlockFetchCleanup(&control);
   free(ino);
   free(names);
@@ -80,7 +94,7 @@ uint32_t ext2TraversePath(Ext2 *ext2, char *path, size_t initInode, bool follow,
           start = (char *)calloc(ext2->blockSize + 1, 1);
           symlinkTarget = (char *)calloc(len + inode->size + 2,
                                          1); // extra just in case
-          getDiskBytes((uint8_t *)start,
+          getDiskBytes(ext2->disk, (uint8_t *)start,
                        BLOCK_TO_LBA(ext2, 0, inode->blocks[0]),
                        ext2->blockSize / SECTOR_SIZE);
         } else {
@@ -74,7 +74,7 @@ uint32_t ext2BlockFetch(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
     if (control->tmp1Block != tmp1block) {
       control->tmp1Block = tmp1block;
       // control->tmp1 = (uint32_t *)malloc(ext2->blockSize);
-      getDiskBytes((void *)control->tmp1, tmp1block,
+      getDiskBytes(ext2->disk, (void *)control->tmp1, tmp1block,
                    ext2->blockSize / SECTOR_SIZE);
     }
     result = control->tmp1[curr - 12];
@@ -88,7 +88,7 @@ uint32_t ext2BlockFetch(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
     if (control->tmp1Block != tmp1block) {
       control->tmp1Block = tmp1block;
       // control->tmp2 = (uint32_t *)malloc(ext2->blockSize);
-      getDiskBytes((void *)control->tmp1, tmp1block,
+      getDiskBytes(ext2->disk, (void *)control->tmp1, tmp1block,
                    ext2->blockSize / SECTOR_SIZE);
     }
 
@@ -102,7 +102,7 @@ uint32_t ext2BlockFetch(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
     }
     if (control->tmp2Block != tmp2block) {
       control->tmp2Block = tmp2block;
-      getDiskBytes((void *)control->tmp2, tmp2block,
+      getDiskBytes(ext2->disk, (void *)control->tmp2, tmp2block,
                    ext2->blockSize / SECTOR_SIZE);
     }
     result = control->tmp2[rem];
@@ -143,13 +143,13 @@ void ext2BlockAssign(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
     if (control->tmp1Block != tmp1block) {
       control->tmp1Block = tmp1block;
       // control->tmp1 = (uint32_t *)malloc(ext2->blockSize);
-      getDiskBytes((void *)control->tmp1, tmp1block,
+      getDiskBytes(ext2->disk, (void *)control->tmp1, tmp1block,
                    ext2->blockSize / SECTOR_SIZE);
     }
     if (noninit) // todo: also depend on inode->blockSize globally instead of 0s
       memset(control->tmp1, 0, ext2->blockSize);
     control->tmp1[curr - 12] = val;
-    setDiskBytes((void *)control->tmp1, tmp1block,
+    setDiskBytes(ext2->disk, (void *)control->tmp1, tmp1block,
                  ext2->blockSize / SECTOR_SIZE);
     goto cleanup;
   } /*else if (curr < baseDoubly) {
@@ -159,7 +159,7 @@ void ext2BlockAssign(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
     if (control->tmp1Block != tmp1block) {
       control->tmp1Block = tmp1block;
       // control->tmp2 = (uint32_t *)malloc(ext2->blockSize);
-      getDiskBytes((void *)control->tmp1, tmp1block,
+      getDiskBytes(ext2->disk, (void *)control->tmp1, tmp1block,
                    ext2->blockSize / SECTOR_SIZE);
     }
 
@@ -171,7 +171,7 @@ void ext2BlockAssign(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
       return 0;
     if (control->tmp2Block != tmp2block) {
       control->tmp2Block = tmp2block;
-      getDiskBytes((void *)control->tmp2, tmp2block,
+      getDiskBytes(ext2->disk, (void *)control->tmp2, tmp2block,
                    ext2->blockSize / SECTOR_SIZE);
     }
     return control->tmp2[rem];
@@ -216,7 +216,8 @@ uint32_t ext2BlockFindL(Ext2 *ext2, int group, uint32_t amnt) {
   uint32_t ret = 0;
   uint8_t *buff = malloc(ext2->blockSize);
 
-  getDiskBytes(buff, BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].block_bitmap),
+  getDiskBytes(ext2->disk, buff,
+               BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].block_bitmap),
                ext2->blockSize / SECTOR_SIZE);
 
   uint32_t foundBlk = 0;
@@ -244,7 +245,8 @@ cleanup:
       uint32_t remainder = (foundBlk + i) % 8;
       buff[where] |= (1 << remainder);
     }
-    setDiskBytes(buff, BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].block_bitmap),
+    setDiskBytes(ext2->disk, buff,
+                 BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].block_bitmap),
                  ext2->blockSize / SECTOR_SIZE);
 
     // set the bgdt accordingly
@@ -269,13 +271,15 @@ void ext2BlockDelete(Ext2 *ext2, uint32_t group, uint32_t index) {
 
   uint8_t *buff = malloc(ext2->blockSize);
 
-  getDiskBytes(buff, BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].block_bitmap),
+  getDiskBytes(ext2->disk, buff,
+               BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].block_bitmap),
                ext2->blockSize / SECTOR_SIZE);
 
   uint32_t where = index / 8;
   uint32_t remainder = index % 8;
   buff[where] &= ~(1 << remainder);
-  setDiskBytes(buff, BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].block_bitmap),
+  setDiskBytes(ext2->disk, buff,
+               BLOCK_TO_LBA(ext2, 0, ext2->bgdts[group].block_bitmap),
                ext2->blockSize / SECTOR_SIZE);
 
   // set the bgdt accordingly
@@ -317,7 +321,7 @@ force_inline bool isPowerOf(int n, int power) {
 // IMPORTANT! Remember to manually set the spinlock **before** calling
 void ext2BgdtPushM(Ext2 *ext2) {
   // the one directly below the superblock
-  setDiskBytes((void *)ext2->bgdts, ext2->offsetBGDT,
+  setDiskBytes(ext2->disk, (void *)ext2->bgdts, ext2->offsetBGDT,
                DivRoundUp(ext2->blockSize, SECTOR_SIZE));
 
   for (int i = 1; i < ext2->blockGroups; i++) {
@@ -326,7 +330,7 @@ void ext2BgdtPushM(Ext2 *ext2) {
       continue;
 
     // has a backup/copy...
-    setDiskBytes(
+    setDiskBytes(ext2->disk, 
         (void *)ext2->bgdts,
         BLOCK_TO_LBA(ext2, 0, i * ext2->superblock.blocks_per_group + 1),
         DivRoundUp(ext2->blockSize, SECTOR_SIZE));
@@ -335,14 +339,15 @@ void ext2BgdtPushM(Ext2 *ext2) {
 
 // IMPORTANT! Remember to manually set the spinlock **before** calling
 void ext2SuperblockPushM(Ext2 *ext2) {
-  setDiskBytes((void *)(&ext2->superblock), ext2->offsetSuperblock, 2);
+  setDiskBytes(ext2->disk, (void *)(&ext2->superblock), ext2->offsetSuperblock,
+               2);
 
   for (int i = 1; i < ext2->blockGroups; i++) {
     if (!(i == 0 || i == 1 || isPowerOf(i, 3) || isPowerOf(i, 5) ||
           isPowerOf(i, 7)))
       continue;
 
-    setDiskBytes((void *)(&ext2->superblock),
+    setDiskBytes(ext2->disk, (void *)(&ext2->superblock),
                  BLOCK_TO_LBA(ext2, 0, i * ext2->superblock.blocks_per_group),
                  2);
   }
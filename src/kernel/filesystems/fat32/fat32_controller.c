@@ -22,11 +22,12 @@ bool fat32Mount(MountPoint *mount) {
   FAT32 *fat = FAT_PTR(mount->fsInfo);
 
   // base offset
+  fat->disk = mount->disk;
   fat->offsetBase = mount->mbr.lba_first_sector; // 2048 (in LBA)
 
   // get first sector
   uint8_t firstSec[SECTOR_SIZE] __attribute__((aligned(2))) = {0};
-  getDiskBytes(firstSec, fat->offsetBase, 1);
+  getDiskBytes(fat->disk, firstSec, fat->offsetBase, 1);
 
   // store it
   memcpy(&fat->bootsec, firstSec, sizeof(FAT32BootSector));
@@ -43,12 +44,6 @@ bool fat32Mount(MountPoint *mount) {
       fat->offsetFats +
       fat->bootsec.table_count * fat->bootsec.extended_section.table_size_32;
 
-  for (int i = 0; i < FAT32_CACHE_MAX; i++) {
-    fat->cacheBase[i] = FAT32_CACHE_BAD;
-    fat->cache[i] = malloc(LBA_TO_OFFSET(fat->bootsec.sectors_per_cluster));
-    memset(fat->cache[i], 0, LBA_TO_OFFSET(fat->bootsec.sectors_per_cluster));
-  }
-
   // done :")
   return true;
 }
@@ -133,7 +128,7 @@ size_t fat32Read(OpenFile *fd, uint8_t *buff, size_t limit) {
       // optimized consecutive cluster reading
       int      needed = consecEnd - consecStart + 1;
       uint8_t *optimizedBytes = malloc(needed * bytesPerCluster);
-      getDiskBytes(optimizedBytes,
+      getDiskBytes(fat->disk, optimizedBytes,
                    fat32ClusterToLBA(fat, fatLookup[consecStart]),
                    needed * fat->bootsec.sectors_per_cluster);
 
@@ -152,7 +147,7 @@ size_t fat32Read(OpenFile *fd, uint8_t *buff, size_t limit) {
 
       free(optimizedBytes);
     } else {
-      getDiskBytes(bytes, fat32ClusterToLBA(fat, fatLookup[i]),
+      getDiskBytes(fat->disk, bytes, fat32ClusterToLBA(fat, fatLookup[i]),
                    fat->bootsec.sectors_per_cluster);
 
       for (uint32_t i = offsetStarting; i < bytesPerCluster; i++) {
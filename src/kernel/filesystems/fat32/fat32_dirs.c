@@ -31,7 +31,8 @@ size_t fat32Getdents64(OpenFile *file, struct linux_dirent64 *start,
       goto cleanup;
 
     uint32_t offsetStarting = fatDir->ptr % bytesPerCluster;
-    getDiskBytes(bytes, fat32ClusterToLBA(fat, fatDir->directoryCurr),
+    getDiskBytes(fat->disk, bytes,
+                 fat32ClusterToLBA(fat, fatDir->directoryCurr),
                  fat->bootsec.sectors_per_cluster);
 
     for (uint32_t i = offsetStarting; i < bytesPerCluster;
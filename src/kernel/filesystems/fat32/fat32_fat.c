@@ -3,31 +3,9 @@
 #include <system.h>
 #include <util.h>
 
-uint32_t fat32FATcacheLookup(FAT32 *fat, uint32_t offset) {
-  for (int i = 0; i < FAT32_CACHE_MAX; i++) {
-    if (fat->cacheBase[i] == offset)
-      return i;
-  }
-
-  return FAT32_CACHE_BAD;
-}
-
-void fat32FATcacheAdd(FAT32 *fat, uint32_t offset, uint8_t *bytes) {
-  if (fat->cacheCurr >= FAT32_CACHE_MAX)
-    fat->cacheCurr = 0;
-  fat->cacheBase[fat->cacheCurr] = offset;
-  memcpy(fat->cache[fat->cacheCurr], bytes, SECTOR_SIZE);
-  fat->cacheCurr++;
-}
-
+// FAT sectors end up in the page cache like everything else
 void fat32FATfetch(FAT32 *fat, uint32_t offsetSector, uint8_t *bytes) {
-  uint32_t cacheRes = fat32FATcacheLookup(fat, offsetSector);
-  if (cacheRes != FAT32_CACHE_BAD) {
-    memcpy(bytes, fat->cache[cacheRes], SECTOR_SIZE);
-    return;
-  }
-  getDiskBytes(bytes, offsetSector, 1);
-  fat32FATcacheAdd(fat, offsetSector, bytes);
+  getDiskBytes(fat->disk, bytes, offsetSector, 1);
 }
 
 uint32_t fat32FATtraverse(FAT32 *fat, uint32_t offset) {
@@ -18,7 +18,7 @@ FAT32TraverseResult fat32Traverse(FAT32 *fat, uint32_t initDirectory,
   int     lfnLast = -1;
 
   while (true) {
-    getDiskBytes(bytes, fat32ClusterToLBA(fat, directory),
+    getDiskBytes(fat->disk, bytes, fat32ClusterToLBA(fat, directory),
                  fat->bootsec.sectors_per_cluster);
 
     for (int i = 0; i < LBA_TO_OFFSET(fat->bootsec.sectors_per_cluster);
@@ -3,6 +3,7 @@
 #include <dents.h>
 #include <malloc.h>
 #include <proc.h>
+#include <slab.h>
 #include <string.h>
 #include <system.h>
 #include <task.h>
@@ -30,15 +31,20 @@ size_t meminfoRead(OpenFile *fd, uint8_t *out, size_t limit) {
   size_t free = total - allocated;
 
   size_t cached = cachingInfoBlocks() * BLOCK_SIZE / 1024;
-  size_t available = free + cached;
+  size_t dirty = cachingInfoDirty() * BLOCK_SIZE / 1024;
+  size_t available = free + cached - dirty;
+  size_t slab = slabInfoPages() * BLOCK_SIZE / 1024;
 
   size_t length = snprintf(buff, 1024,
+                           "%-15s %10lu kB\n"
+                           "%-15s %10lu kB\n"
                            "%-15s %10lu kB\n"
                            "%-15s %10lu kB\n"
                            "%-15s %10lu kB\n"
                            "%-15s %10lu kB\n",
                            "MemTotal:", total, "MemFree:", free,
-                           "MemAvailable:", available, "Cached:", cached);
+                           "MemAvailable:", available, "Cached:", cached,
+                           "Dirty:", dirty, "Slab:", slab);
 
   size_t toCopy = MIN(length - fd->pointer, limit);
   memcpy(out, buff, toCopy);
@@ -353,13 +359,22 @@ size_t procGetdents64(OpenFile *fd, struct linux_dirent64 *start,
   struct linux_dirent64 *dirp = (struct linux_dirent64 *)start;
   size_t                 allocatedlimit = 0;
 
+  // walks the id index (bucket by bucket, each sorted), ->pointer being the
+  // last tgid we handed out so we can pick it up right after that one
   spinlockCntReadAcquire(&TASK_LL_MODIFY);
-  char  filename[32] = {0};
-  Task *browse = firstTask;
-  while (browse) {
+  char     filename[32] = {0};
+  uint32_t bucket = TASK_HASH(initPtr);
+  Task    *browse = taskIdHash[bucket];
+  while (browse && browse->id <= initPtr)
+    browse = browse->idNext;
+  while (true) {
+    while (!browse && ++bucket < TASK_HASH_SIZE)
+      browse = taskIdHash[bucket];
+    if (!browse)
+      break;
     // id == tgid so we don't have duplicates. todo thread killing elsewhere
     if (browse->id == browse->tgid && browse->state != TASK_STATE_DEAD &&
-        browse->tgid > initPtr) {
+        browse->tgid) {
       size_t out = snprintf(filename, 32, "%d", browse->tgid);
       assert(out > 0 && out <= 32); // bounds
       DENTS_RES res = dentsAdd(start, &dirp, &allocatedlimit, hardlimit,
@@ -374,7 +389,7 @@ size_t procGetdents64(OpenFile *fd, struct linux_dirent64 *start,
 
       fd->pointer = browse->tgid;
     }
-    browse = browse->next;
+    browse = browse->idNext;
   }
 
 cleanup:
@@ -1,8 +1,10 @@
 #include <disk.h>
+#include <elf.h>
 #include <ext2.h>
 #include <fat32.h>
 #include <malloc.h>
 #include <poll.h>
+#include <slab.h>
 #include <string.h>
 #include <syscalls.h>
 #include <system.h>
@@ -13,11 +15,13 @@
 
 // Simple VFS abstraction to manage filesystems
 
+SlabCache openFileCache = SLAB_CACHE("open_file", sizeof(OpenFile), 0);
+
 OpenFile *fsRegisterNode(Task *task, size_t id) {
   TaskInfoFiles *files = task->infoFiles;
   spinlockCntWriteAcquire(&files->WLOCK_FILES);
   // debugf("reg %d\n", id);
-  OpenFile *file = calloc(sizeof(OpenFile), 1);
+  OpenFile *file = slabAlloc(&openFileCache);
   file->id = id;
   assert(AVLAllocate((void **)&files->firstFile, id, (avlval)file));
   spinlockCntWriteRelease(&files->WLOCK_FILES);
@@ -75,7 +79,7 @@ OpenFile *fsOpenGeneric(char *filename, Task *task, int flags, int mode) {
     // no mountpoint for this
     fsUnregisterNode(task, target);
     fsIdRemove(task->infoFiles, target->id);
-    free(target);
+    slabFree(&openFileCache, target);
     free(safeFilename);
     return 0;
   }
@@ -95,7 +99,7 @@ OpenFile *fsOpenGeneric(char *filename, Task *task, int flags, int mode) {
       // failed to open
       fsUnregisterNode(task, target);
       fsIdRemove(task->infoFiles, target->id);
-      free(target);
+      slabFree(&openFileCache, target);
       free(safeFilename);
 
       if (symlink && ret != ERR(ELOOP)) {
@@ -110,6 +114,9 @@ OpenFile *fsOpenGeneric(char *filename, Task *task, int flags, int mode) {
     }
     free(safeFilename);
   }
+
+  if (flags & O_TRUNC)
+    elfImageInvalidate(target);
   return target;
 }
 
@@ -134,7 +141,7 @@ OpenFile *fsUserDuplicateNode(void *taskPtr, OpenFile *original,
   // target->id = fsIdFind(files);
 
   if (!fsUserDuplicateNodeUnsafe(original, orphan)) {
-    free(orphan);
+    slabFree(&openFileCache, orphan);
     return 0;
   }
   return orphan;
@@ -178,7 +185,7 @@ bool fsCloseGeneric(OpenFile *file, Task *task) {
   epollCloseNotify(file);
   if (!(file->closeFlags & VFS_CLOSE_FLAG_RETAIN_ID))
     fsIdRemove(task->infoFiles, file->id);
-  free(file);
+  slabFree(&openFileCache, file);
   return res;
 }
 
@@ -247,6 +254,10 @@ size_t fsWrite(OpenFile *file, uint8_t *in, uint32_t limit) {
 cleanup:
   if (!file->handlers->internalPoll)
     spinlockRelease(&file->LOCK_OPERATIONS);
+
+  // executables can't be served from stale images after being modified
+  if (!RET_IS_ERR(ret) && ret)
+    elfImageInvalidate(file);
   return ret;
 }
 
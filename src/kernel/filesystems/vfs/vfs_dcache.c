@@ -0,0 +1,260 @@
+#include <dcache.h>
+#include <malloc.h>
+#include <spinlock.h>
+#include <string.h>
+#include <system.h>
+#include <util.h>
+
+// Directory entry cache, so repeated path lookups don't hit the disk. Entries
+// are (filesystem, parent inode, name) -> inode, with inode 0 caching the fact
+// that something doesn't exist. Filesystems fill it on lookups and keep it in
+// sync whenever they add/remove directory entries. Mountpoints live in here as
+// well (pinned, under fs 0 with their full path), so resolving which one a
+// path belongs to is just a lookup per path component
+
+Dentry *dcacheHash[DCACHE_HASH_SIZE] = {0};
+Dentry *dcacheLruHead = 0; // most recently used
+Dentry *dcacheLruTail = 0; // least recently used
+
+size_t   dcacheEntries = 0;
+uint64_t dcacheSeqNum = 0; // bumped on every modification, see dcacheFill()
+
+Spinlock LOCK_DCACHE = ATOMIC_FLAG_INIT;
+
+// fnv-1a, fed one character at a time so mountpoints can be hashed as we go
+#define DCACHE_FNV_OFFSET 14695981039346656037ULL
+#define DCACHE_FNV_PRIME 1099511628211ULL
+
+static uint64_t dcacheHashStart(void *fs, size_t parent) {
+  uint64_t hash = DCACHE_FNV_OFFSET;
+  hash = (hash ^ (size_t)fs) * DCACHE_FNV_PRIME;
+  hash = (hash ^ parent) * DCACHE_FNV_PRIME;
+  return hash;
+}
+
+static uint64_t dcacheHashStep(uint64_t hash, char c) {
+  return (hash ^ (uint8_t)c) * DCACHE_FNV_PRIME;
+}
+
+static uint32_t dcacheHashFold(uint64_t hash) {
+  return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static uint32_t dcacheHashName(void *fs, size_t parent, char *name,
+                               size_t len) {
+  uint64_t hash = dcacheHashStart(fs, parent);
+  for (size_t i = 0; i < len; i++)
+    hash = dcacheHashStep(hash, name[i]);
+  return dcacheHashFold(hash);
+}
+
+static Dentry *dcacheAllocate(void *fs, size_t parent, char *name, size_t len,
+                              size_t inode) {
+  Dentry *dentry = calloc(sizeof(Dentry) + len, 1);
+  dentry->fs = fs;
+  dentry->parent = parent;
+  dentry->inode = inode;
+  dentry->hash = dcacheHashName(fs, parent, name, len);
+  dentry->len = len;
+  memcpy(dentry->name, name, len);
+  return dentry;
+}
+
+// everything below (up until dcacheSeq()) assumes LOCK_DCACHE is held
+static Dentry *dcacheFind(void *fs, size_t parent, char *name, size_t len,
+                          uint32_t hash) {
+  Dentry *browse = dcacheHash[hash % DCACHE_HASH_SIZE];
+  while (browse) {
+    if (browse->hash == hash && browse->fs == fs && browse->parent == parent &&
+        browse->len == len && memcmp(browse->name, name, len) == 0)
+      return browse;
+    browse = browse->hashNext;
+  }
+  return 0;
+}
+
+static void dcacheLruUnlink(Dentry *dentry) {
+  if (dentry->lruPrev)
+    dentry->lruPrev->lruNext = dentry->lruNext;
+  else
+    dcacheLruHead = dentry->lruNext;
+  if (dentry->lruNext)
+    dentry->lruNext->lruPrev = dentry->lruPrev;
+  else
+    dcacheLruTail = dentry->lruPrev;
+}
+
+static void dcacheLruPush(Dentry *dentry) {
+  dentry->lruPrev = 0;
+  dentry->lruNext = dcacheLruHead;
+  if (dcacheLruHead)
+    dcacheLruHead->lruPrev = dentry;
+  dcacheLruHead = dentry;
+  if (!dcacheLruTail)
+    dcacheLruTail = dentry;
+}
+
+static void dcacheTouch(Dentry *dentry) {
+  if (dentry->mount || dcacheLruHead == dentry)
+    return;
+  dcacheLruUnlink(dentry);
+  dcacheLruPush(dentry);
+}
+
+static void dcacheInsert(Dentry *dentry) {
+  size_t bucket = dentry->hash % DCACHE_HASH_SIZE;
+  dentry->hashNext = dcacheHash[bucket];
+  dcacheHash[bucket] = dentry;
+  if (dentry->mount)
+    return;
+  dcacheLruPush(dentry);
+  dcacheEntries++;
+}
+
+static void dcacheRemove(Dentry *dentry) {
+  Dentry **browse = &dcacheHash[dentry->hash % DCACHE_HASH_SIZE];
+  while (*browse != dentry)
+    browse = &(*browse)->hashNext;
+  *browse = dentry->hashNext;
+  if (dentry->mount)
+    return;
+  dcacheLruUnlink(dentry);
+  dcacheEntries--;
+}
+
+static void dcacheTrim() {
+  while (dcacheEntries > DCACHE_MAX && dcacheLruTail) {
+    Dentry *dentry = dcacheLruTail;
+    dcacheRemove(dentry);
+    free(dentry);
+  }
+}
+
+uint64_t dcacheSeq() {
+  spinlockAcquire(&LOCK_DCACHE);
+  uint64_t seq = dcacheSeqNum;
+  spinlockRelease(&LOCK_DCACHE);
+  return seq;
+}
+
+// returns whether we know anything, with *inode being 0 if it doesn't exist
+bool dcacheLookup(void *fs, size_t parent, char *name, size_t len,
+                  size_t *inode) {
+  uint32_t hash = dcacheHashName(fs, parent, name, len);
+
+  spinlockAcquire(&LOCK_DCACHE);
+  Dentry *dentry = dcacheFind(fs, parent, name, len, hash);
+  if (dentry) {
+    dcacheTouch(dentry);
+    *inode = dentry->inode;
+  }
+  spinlockRelease(&LOCK_DCACHE);
+
+  return dentry != 0;
+}
+
+// caches the result of a lookup. seq should be grabbed via dcacheSeq() before
+// reading the directory, so anything that changed meanwhile isn't overwritten
+// with stale info
+void dcacheFill(void *fs, size_t parent, char *name, size_t len, size_t inode,
+                uint64_t seq) {
+  Dentry *dentry = dcacheAllocate(fs, parent, name, len, inode);
+
+  spinlockAcquire(&LOCK_DCACHE);
+  bool insert = seq == dcacheSeqNum &&
+                !dcacheFind(fs, parent, name, len, dentry->hash);
+  if (insert) {
+    dcacheInsert(dentry);
+    dcacheTrim();
+  }
+  spinlockRelease(&LOCK_DCACHE);
+
+  if (!insert)
+    free(dentry);
+}
+
+// a directory entry was added (or removed, with inode 0)
+void dcacheSet(void *fs, size_t parent, char *name, size_t len, size_t inode) {
+  Dentry *dentry = dcacheAllocate(fs, parent, name, len, inode);
+
+  spinlockAcquire(&LOCK_DCACHE);
+  dcacheSeqNum++;
+  Dentry *existing = dcacheFind(fs, parent, name, len, dentry->hash);
+  if (existing) {
+    existing->inode = inode;
+    dcacheTouch(existing);
+  } else {
+    dcacheInsert(dentry);
+    dcacheTrim();
+  }
+  spinlockRelease(&LOCK_DCACHE);
+
+  if (existing)
+    free(dentry);
+}
+
+// a directory went away, its inode might get reused so forget its children
+void dcachePurgeDir(void *fs, size_t parent) {
+  spinlockAcquire(&LOCK_DCACHE);
+  dcacheSeqNum++;
+  for (size_t i = 0; i < DCACHE_HASH_SIZE; i++) {
+    Dentry *browse = dcacheHash[i];
+    while (browse) {
+      Dentry *next = browse->hashNext;
+      if (browse->fs == fs && browse->parent == parent) {
+        dcacheRemove(browse);
+        free(browse);
+      }
+      browse = next;
+    }
+  }
+  spinlockRelease(&LOCK_DCACHE);
+}
+
+// mountpoints are stored with their prefix minus the trailing slash
+void dcacheMountAdd(MountPoint *mnt) {
+  size_t  len = strlength(mnt->prefix) - 1;
+  Dentry *dentry = dcacheAllocate(0, 0, mnt->prefix, len, 0);
+  dentry->mount = mnt;
+
+  spinlockAcquire(&LOCK_DCACHE);
+  dcacheInsert(dentry);
+  spinlockRelease(&LOCK_DCACHE);
+}
+
+void dcacheMountRemove(MountPoint *mnt) {
+  size_t   len = strlength(mnt->prefix) - 1;
+  uint32_t hash = dcacheHashName(0, 0, mnt->prefix, len);
+
+  spinlockAcquire(&LOCK_DCACHE);
+  Dentry *dentry = dcacheFind(0, 0, mnt->prefix, len, hash);
+  if (dentry && dentry->mount == mnt)
+    dcacheRemove(dentry);
+  else
+    dentry = 0;
+  spinlockRelease(&LOCK_DCACHE);
+
+  if (dentry)
+    free(dentry);
+}
+
+// finds the deepest mountpoint a (sanitized) path lives in
+MountPoint *dcacheMountResolve(char *filename) {
+  MountPoint *ret = 0;
+  uint64_t    hash = dcacheHashStart(0, 0);
+
+  spinlockAcquire(&LOCK_DCACHE);
+  for (size_t i = 0;; i++) {
+    if (filename[i] == '/' || filename[i] == '\0') {
+      Dentry *dentry = dcacheFind(0, 0, filename, i, dcacheHashFold(hash));
+      if (dentry)
+        ret = dentry->mount;
+    }
+    if (filename[i] == '\0')
+      break;
+    hash = dcacheHashStep(hash, filename[i]);
+  }
+  spinlockRelease(&LOCK_DCACHE);
+
+  return ret;
+}
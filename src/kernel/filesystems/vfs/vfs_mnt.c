@@ -1,3 +1,5 @@
+#include <caching.h>
+#include <dcache.h>
 #include <dev.h>
 #include <disk.h>
 #include <ext2.h>
@@ -28,15 +30,16 @@ bool fsUnmount(MountPoint *mnt) {
   //   break;
   // }
 
+  dcacheMountRemove(mnt); // no dentries pointing at it afterwards
   free(mnt->prefix);
   free(mnt);
 
   return true;
 }
 
-bool isFat(mbr_partition *mbr) {
+bool isFat(uint32_t disk, mbr_partition *mbr) {
   uint8_t *rawArr = (uint8_t *)malloc(SECTOR_SIZE);
-  getDiskBytes(rawArr, mbr->lba_first_sector, 1);
+  getDiskBytes(disk, rawArr, mbr->lba_first_sector, 1);
 
   bool ret = (rawArr[66] == 0x28 || rawArr[66] == 0x29);
 
@@ -70,7 +73,7 @@ MountPoint *fsMount(char *prefix, CONNECTOR connector, uint32_t disk,
       return 0;
     }
 
-    if (isFat(&mount->mbr)) {
+    if (isFat(disk, &mount->mbr)) {
       mount->filesystem = FS_FATFS;
       ret = fat32Mount(mount);
     } else if (isExt2(&mount->mbr)) {
@@ -101,32 +104,30 @@ MountPoint *fsMount(char *prefix, CONNECTOR connector, uint32_t disk,
     return 0;
   }
 
+  dcacheMountAdd(mount);
+
   if (!systemDiskInit && strlength(prefix) == 1 && prefix[0] == '/')
     systemDiskInit = true;
   return mount;
 }
 
-typedef struct {
-  char       *filename;
-  MountPoint *largestAddr;
-  uint32_t    largestLen;
-} MountPointCbArgs;
-void fsDetermineMountPointCb(void *data, void *ctx) {
-  MountPoint       *browse = data;
-  MountPointCbArgs *p = ctx;
-
-  size_t len = strlength(browse->prefix) - 1; // without trailing /
-  if (len >= p->largestLen && memcmp(p->filename, browse->prefix, len) == 0 &&
-      (p->filename[len] == '/' || p->filename[len] == '\0')) {
-    p->largestAddr = browse;
-    p->largestLen = len;
-  }
+MountPoint *fsDetermineMountPoint(char *filename) {
+  return dcacheMountResolve(filename);
 }
 
-MountPoint *fsDetermineMountPoint(char *filename) {
-  MountPointCbArgs args = {.filename = filename};
-  LinkedListTraverse(&dsMountPoint, fsDetermineMountPointCb, &args);
-  return args.largestAddr;
+void fsSyncAllCb(void *data, void *ctx) {
+  MountPoint *browse = data;
+  if (browse->sync)
+    browse->sync(browse);
+}
+
+// pushes whatever's lingering in filesystem caches into the page cache
+void fsSyncMetadata() { LinkedListTraverse(&dsMountPoint, fsSyncAllCb, 0); }
+
+// ...and all the way down to the disk
+void fsSyncAll() {
+  fsSyncMetadata();
+  cachingSync();
 }
 
 // make SURE to free both! also returns non-safe filename, obviously
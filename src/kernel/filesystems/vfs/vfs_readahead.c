@@ -0,0 +1,63 @@
+#include <linux.h>
+#include <util.h>
+#include <vfs.h>
+
+// Sequential read detection. Filesystems call fsReadahead() after every read
+// with where it started, and as long as reads keep picking up where the last
+// one left off, a window (doubling every time, up to VFS_READAHEAD_MAX) ahead
+// of the reader is handed to the filesystem's readahead handler. It queues
+// that up in the page cache asynchronously, so by the time the reader gets
+// there it's just a memcpy
+
+void fsReadahead(OpenFile *fd, size_t start, size_t len) {
+  if (!fd->handlers->readahead || fd->fadvise == POSIX_FADV_RANDOM || !len)
+    return;
+
+  size_t end = start + len;
+  if (start != fd->raNext) {
+    // seeked around, start over once it looks sequential again
+    fd->raNext = end;
+    fd->raWindow = 0;
+    fd->raAhead = 0;
+    return;
+  }
+  fd->raNext = end;
+
+  if (!fd->raWindow)
+    fd->raWindow = fd->fadvise == POSIX_FADV_SEQUENTIAL ? VFS_READAHEAD_MAX
+                                                        : VFS_READAHEAD_MIN;
+  else
+    fd->raWindow = MIN(fd->raWindow * 2, VFS_READAHEAD_MAX);
+
+  // only go again once the reader has eaten through half of what's prefetched
+  size_t ahead = MAX(fd->raAhead, end);
+  size_t target = end + fd->raWindow;
+  if (ahead - end > fd->raWindow / 2)
+    return;
+
+  fd->handlers->readahead(fd, ahead, target - ahead);
+  fd->raAhead = target;
+}
+
+size_t fsAdvise(OpenFile *fd, size_t offset, size_t len, int advice) {
+  switch (advice) {
+  case POSIX_FADV_NORMAL:
+  case POSIX_FADV_RANDOM:
+  case POSIX_FADV_SEQUENTIAL:
+    fd->fadvise = advice;
+    fd->raWindow = 0;
+    break;
+  case POSIX_FADV_WILLNEED:
+    // it's a hint, don't go queueing up more than the cache can take at once
+    len = len ? MIN(len, VFS_WILLNEED_MAX) : VFS_WILLNEED_MAX;
+    if (fd->handlers->readahead)
+      fd->handlers->readahead(fd, offset, len);
+    break;
+  case POSIX_FADV_DONTNEED:
+  case POSIX_FADV_NOREUSE:
+    break; // the lru takes care of it
+  default:
+    return ERR(EINVAL);
+  }
+  return 0;
+}
@@ -113,7 +113,7 @@ size_t fbUserMmap(size_t addr, size_t length, int prot, int flags, OpenFile *fd,
   size_t physStart = fb.phys;
   for (int i = 0; i < targPages; i++) {
     VirtualMap(0x150000000000 + i * PAGE_SIZE, physStart + i * PAGE_SIZE,
-               PF_RW | PF_USER | PF_CACHE_WC);
+               PF_RW | PF_USER | PF_SHARED | PF_CACHE_WC);
   } // todo: get rid of hardcoded location!
   return 0x150000000000;
 }
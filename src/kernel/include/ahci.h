@@ -387,6 +387,19 @@ static const AHCI_DEVICE ahci_ids[] = {
 #define ATA_CMD_READ_DMA_EX 0x25
 #define ATA_CMD_WRITE_DMA 0xCA
 #define ATA_CMD_WRITE_DMA_EX 0x35
+#define ATA_CMD_READ_FPDMA_QUEUED 0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
+#define ATA_CMD_IDENTIFY 0xEC
+#define ATA_CMD_FLUSH_CACHE 0xE7
+#define ATA_CMD_FLUSH_CACHE_EX 0xEA
+
+// IDENTIFY DEVICE words
+#define ATA_IDENT_QUEUE_DEPTH 75 // 4:0 -> max depth - 1
+#define ATA_IDENT_SATA_CAP 76
+#define ATA_IDENT_SATA_CAP_NCQ (1 << 8)
+
+#define HBA_CAP_SNCQ (1 << 30)
+#define HBA_CAP_NCS(cap) ((((cap) >> 8) & 0x1F) + 1) // command slots
 
 #define HBA_PxCMD_ST 0x0001
 #define HBA_PxCMD_FRE 0x0010
@@ -413,6 +426,10 @@ static const AHCI_DEVICE ahci_ids[] = {
 
 #define HBA_PxIS_TFES (1 << 30)
 
+// D2H register, PIO setup, DMA setup, set device bits (NCQ) & task file error
+#define HBA_PxIE_DEFAULT                                                       \
+  ((1 << 0) | (1 << 1) | (1 << 2) | (1 << 3) | HBA_PxIS_TFES)
+
 typedef volatile struct tagHBA_PORT {
   uint32_t clb;       // 0x00, command list base address, 1K-byte aligned
   uint32_t clbu;      // 0x04, command list base address upper 32 bits
@@ -564,11 +581,22 @@ typedef enum {
 
 typedef struct ahci ahci;
 
+// Command slot bookkeeping, shared with the interrupt handler (atomics only!)
+typedef struct AhciPort {
+  bool     ncq;       // FPDMA QUEUED commands, otherwise plain DMA ones
+  uint32_t slotsMask; // usable command slots
+  uint32_t slotsUsed; // claimed (being prepared, in flight or being released)
+  uint32_t inflight;  // issued to the HBA, not completed yet
+
+  struct Task *waiting[32]; // asleep on each slot
+} AhciPort;
+
 struct ahci {
   void              *clbVirt[32];
   void              *ctbaVirt[32];
-  uint32_t           sata;            // bitmap (32 ports -> 32 bits)
-  uint32_t           cmdSlotsPreping; // bitmap (32 cmdslots -> 32 bits)
+  uint32_t           sata; // bitmap (32 ports -> 32 bits)
+  AhciPort           ports[32];
+  bool               irqReady; // completions are interrupt driven
   const AHCI_DEVICE *bsdInfo;
   HBA_MEM           *mem;
 };
@@ -578,5 +606,6 @@ bool ahciRead(ahci *ahciPtr, uint32_t portId, HBA_PORT *port, uint32_t startl,
               uint32_t starth, uint32_t count, uint8_t *buff);
 bool ahciWrite(ahci *ahciPtr, uint32_t portId, HBA_PORT *port, uint32_t startl,
                uint32_t starth, uint32_t count, uint8_t *buff);
+bool ahciFlush(ahci *ahciPtr, uint32_t portId, HBA_PORT *port);
 
 #endif
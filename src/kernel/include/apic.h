@@ -18,6 +18,7 @@
 #define APIC_REGISTER_TIMER_CURRCNT 0x390
 #define APIC_REGISTER_TIMER_DIV 0x3E0
 
+#define APIC_LVT_TIMER_MODE_ONESHOT (0 << 17)
 #define APIC_LVT_TIMER_MODE_PERIODIC (1 << 17)
 
 // APIC quick access
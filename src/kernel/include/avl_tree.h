@@ -17,8 +17,10 @@ typedef struct __attribute__((packed)) AVLheader {
 
 // global thing for all BSTs
 avlval AVLLookup(void *root, avlkey key);
+avlval AVLLookupFloor(void *root, avlkey key);
 
 void *AVLAllocate(void **AVLfirstPtr, avlkey key, avlval value);
 bool  AVLUnregister(void **AVLfirstPtr, avlkey key);
+void  AVLFreeNode(AVLheader *node); // for tearing whole trees down by hand
 
 #endif
@@ -1,8 +1,62 @@
+#include "bitmap.h"
+#include "disk.h"
 #include "types.h"
 
 #ifndef CACHING_H
 #define CACHING_H
 
+#define CACHE_PAGE_SECTORS (BLOCK_SIZE / SECTOR_SIZE)
+#define CACHE_HASH_SIZE 4096
+#define CACHE_RUN_MAX 32          // pages read/written at once
+#define CACHE_MIN_FREE_DIV 16     // start evicting with less than 1/16 free
+#define CACHE_DIRTY_DIV 8         // writers flush themselves past 1/8 dirty
+#define CACHE_FLUSH_INTERVAL 1000 // ms between flusher wakeups
+#define CACHE_DIRTY_EXPIRE 5000   // ms before dirty pages get written back
+#define CACHE_PREFETCH_QUEUE 64   // pending readahead requests
+
+typedef struct CachePage {
+  struct CachePage *hashNext;
+  struct CachePage *lruNext;
+  struct CachePage *lruPrev;
+
+  // dirty pages are off the lru (so never evicted), on the dirty list instead
+  struct CachePage *dirtyNext;
+  struct CachePage *dirtyPrev;
+
+  uint32_t disk;
+  uint64_t index; // lba / CACHE_PAGE_SECTORS (lbas span the whole disk)
+  uint8_t *buff;
+
+  bool     dirty;
+  bool     writeback; // being written to the disk right now
+  uint64_t dirtied;   // timerTicks when it first got dirty
+} CachePage;
+
+typedef struct CachePrefetch {
+  uint32_t disk;
+  uint64_t lba;
+  size_t   sectors;
+} CachePrefetch;
+
+uint64_t cacheDirtyExpire; // in ms, CACHE_DIRTY_EXPIRE by default
+
+void cachingRead(uint32_t disk, uint8_t *out, uint64_t lba, size_t sectors);
+// pulls them in the background, a hint that can be dropped
+void cachingPrefetch(uint32_t disk, uint64_t lba, size_t sectors);
+void cachingPrefetcher();
+void cachingWrite(uint32_t disk, const uint8_t *in, uint64_t lba,
+                  size_t sectors);
+
+// memory pressure, returns how many pages were let go of
+size_t cachingReclaim(size_t pages);
+// same, but done later by the flusher (for whoever can't wait on locks)
+void cachingReclaimAsync(size_t pages);
+
+// writes back everything dirty, returning once it's on the disk
+void cachingSync();
+void cachingFlusher();
+
 size_t cachingInfoBlocks();
+size_t cachingInfoDirty();
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,39 @@
+#include "types.h"
+#include "vfs.h"
+
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#define DCACHE_HASH_SIZE 2048
+#define DCACHE_MAX 8192 // mountpoints don't count
+
+typedef struct Dentry {
+  struct Dentry *hashNext;
+  struct Dentry *lruNext; // mountpoints aren't on the lru
+  struct Dentry *lruPrev;
+
+  void    *fs;     // filesystem-specific (0 for mountpoints)
+  size_t   parent; // parent directory's inode
+  size_t   inode;  // 0 means it doesn't exist (negative)
+  uint32_t hash;
+
+  MountPoint *mount; // mountpoints only
+
+  uint32_t len;
+  char     name[];
+} Dentry;
+
+uint64_t dcacheSeq();
+bool     dcacheLookup(void *fs, size_t parent, char *name, size_t len,
+                      size_t *inode);
+void     dcacheFill(void *fs, size_t parent, char *name, size_t len,
+                    size_t inode, uint64_t seq);
+void     dcacheSet(void *fs, size_t parent, char *name, size_t len,
+                   size_t inode);
+void     dcachePurgeDir(void *fs, size_t parent);
+
+void        dcacheMountAdd(MountPoint *mnt);
+void        dcacheMountRemove(MountPoint *mnt);
+MountPoint *dcacheMountResolve(char *filename);
+
+#endif
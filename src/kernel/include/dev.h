@@ -27,6 +27,7 @@ typedef struct DevInputEvent {
 
   size_t          timesOpened;
   CircularInt     deviceEvents;
+  WaitQueue       readers; // woken up by the kernel helper
   struct input_id inputid;
 
   size_t properties;
@@ -48,7 +49,8 @@ void inputGenerateEvent(DevInputEvent *item, uint16_t type, uint16_t code,
 typedef struct PtyPair {
   LLheader _ll;
 
-  Spinlock LOCK_PTY;
+  Spinlock  LOCK_PTY;
+  WaitQueue waiters; // both ends, readers & writers alike
 
   int masterFds;
   int slaveFds;
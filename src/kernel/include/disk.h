@@ -26,8 +26,17 @@ typedef struct {
 bool openDisk(uint32_t disk, uint8_t partition, mbr_partition *out);
 bool validateMbr(uint8_t *mbrSector);
 
-void getDiskBytes(uint8_t *target_address, uint32_t LBA, size_t sector_count);
-void setDiskBytes(const uint8_t *target_address, uint32_t LBA,
+// straight to the disk, skipping the page cache
+void diskBytesUncached(uint32_t disk, uint8_t *target_address, uint32_t LBA,
+                       size_t sector_count, bool write);
+
+// has the drive commit its write cache, false if there's no such disk
+bool diskFlush(uint32_t disk);
+
+// LBAs are always relative to the start of the disk (not the partition)
+void getDiskBytes(uint32_t disk, uint8_t *target_address, uint32_t LBA,
+                  size_t sector_count);
+void setDiskBytes(uint32_t disk, const uint8_t *target_address, uint32_t LBA,
                   size_t sector_count);
 
 #endif
\ No newline at end of file
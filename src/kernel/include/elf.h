@@ -97,7 +97,59 @@ enum Elf_Type {
 #ifndef ELF_H
 #define ELF_H
 
+#define ELF_IMAGE_IDLE_MAX 16 // unused images kept around for the next exec
+#define ELF_PAGER_QUEUE 64    // pending page reads (one per sleeping task)
+
+// An executable (or interpreter) file, shared by everyone running it. Pages of
+// the file are read in on the first fault that needs them and stay in memory
+// for as long as the image does, mapped copy-on-write wherever possible
+typedef struct ElfImage {
+  struct ElfImage *next;
+
+  // what it was loaded from, a modified file ends up with a new image
+  MountPoint *mnt;
+  size_t      inode;
+  uint64_t    mtime;
+  size_t      size;
+  bool        stale; // written to since, only around for whoever's using it
+
+  size_t   refs;     // mappings (and execs) using it, idle when 0
+  uint64_t lastUsed; // when it went idle
+
+  Spinlock  LOCK_IMAGE; // the file (its pointer) & frames
+  OpenFile *file;
+  size_t   *frames; // one per page of the file, 0 until read in
+  size_t    pages;
+
+  // elf header & program headers, read in upfront
+  Elf64_Ehdr *ehdr;
+  uint8_t    *head;
+} ElfImage;
+
+typedef struct ElfPagerReq {
+  uint64_t  taskId; // to be woken up after (if it's still around)
+  ElfImage *image;
+  size_t    off;
+} ElfPagerReq;
+
+bool  elf_check_file(Elf64_Ehdr *hdr);
 Task *elfExecute(char *filepath, uint32_t argc, char **argv, uint32_t envc,
                  char **envv, bool startup);
 
+ElfImage *elfImageGet(char *filepath);
+void      elfImageHold(ElfImage *image);
+void      elfImageRelease(ElfImage *image);
+size_t    elfImageRead(ElfImage *image, void *out, size_t off, size_t len);
+
+// the file got written to (or truncated), its images can't be reused anymore
+void elfImageInvalidate(OpenFile *file);
+// memory pressure, frees idle images & returns how many frames that gave back
+size_t elfImageReclaim(size_t pages);
+
+// page fault side, see VirtualDemandFault() & the isr
+int  elfImagePage(ElfImage *image, size_t off, bool write, size_t *phys,
+                  bool *shared);
+bool elfPagerRequest(void *task, size_t virt);
+void elfPager();
+
 #endif
\ No newline at end of file
@@ -23,6 +23,16 @@
 #define EXT2_R_F_JOURNAL_REPLAY 0x0004
 #define EXT2_R_F_JOURNAL_DEVICE 0x0008
 
+// Optional feature Flags
+#define EXT2_O_F_DIR_INDEX 0x0020
+
+// Superblock flags
+#define EXT2_FLAGS_SIGNED_HASH 0x0001
+#define EXT2_FLAGS_UNSIGNED_HASH 0x0002
+
+// Inode flags
+#define EXT2_INDEX_FL 0x00001000 // hashed directory (htree)
+
 // FileSystem State
 #define EXT2_FS_S_CLEAN 1
 #define EXT2_FS_S_ERRORS 2
@@ -51,7 +61,22 @@ typedef struct Ext2SuperblockExtended {
   uint32_t journal_device;
   uint32_t orphan_head;
 
-  char reserved[1024 - 236];
+  uint32_t hash_seed[4];
+  uint8_t  def_hash_version;
+  uint8_t  journal_backup_type;
+  uint16_t desc_size;
+  uint32_t default_mount_opts;
+  uint32_t first_meta_bg;
+  uint32_t mkfs_time;
+  uint32_t journal_blocks[17];
+  uint32_t blocks_count_hi;
+  uint32_t r_blocks_count_hi;
+  uint32_t free_blocks_count_hi;
+  uint16_t min_extra_isize;
+  uint16_t want_extra_isize;
+  uint32_t flags;
+
+  char reserved[1024 - 356];
 } Ext2SuperblockExtended;
 
 typedef struct Ext2Superblock {
@@ -132,19 +157,64 @@ typedef struct Ext2Directory {
   char     filename[0];
 } Ext2Directory;
 
+// htree (hashed directory index) on-disk structures. Block 0 holds the root
+// (hidden behind the ".." entry), other index nodes look like a single empty
+// entry spanning the whole block, so linear readers skip right past them
+#define EXT2_DX_HASH_LEGACY 0
+#define EXT2_DX_HASH_HALF_MD4 1
+#define EXT2_DX_HASH_TEA 2
+#define EXT2_DX_HASH_UNSIGNED 3 // add to the above
+#define EXT2_DX_MAX_LEVELS 2    // root + one level of index nodes
+#define EXT2_DX_BLOCK_MASK 0x00ffffff
+
+typedef struct Ext2DxRootInfo {
+  uint32_t reserved_zero;
+  uint8_t  hash_version;
+  uint8_t  info_length; // 8
+  uint8_t  indirect_levels;
+  uint8_t  unused_flags;
+} Ext2DxRootInfo;
+
+typedef struct Ext2DxEntry {
+  uint32_t hash; // the first one's is the count/limit instead
+  uint32_t block;
+} Ext2DxEntry;
+
+typedef struct Ext2DxCountLimit {
+  uint16_t limit;
+  uint16_t count;
+} Ext2DxCountLimit;
+
+#define EXT2_DX_ROOT_ENTRIES 32 // "." + ".." + Ext2DxRootInfo
+#define EXT2_DX_NODE_ENTRIES 8  // empty Ext2Directory
+
+typedef enum EXT2_DX_RES {
+  EXT2_DX_OK = 0,
+  EXT2_DX_FAIL = 1,     // already exists (add) or not found (remove)
+  EXT2_DX_UNUSABLE = 2, // corrupt/unsupported index, go linear
+} EXT2_DX_RES;
+
 #define EXT2_MAX_CONSEC_DIRALLOC 32
 #define EXT2_MAX_CONSEC_BLOCK 32
 #define EXT2_MAX_CONSEC_INODE 32
 #define EXT2_MAX_CONSEC_WRITE 32
 
-typedef struct Ext2CacheObject {
-  struct Ext2CacheObject *next;
-  struct Ext2CacheObject *prev;
+// cached copy of an on-disk inode (see ext2_inode.c)
+typedef struct Ext2InodeCached {
+  struct Ext2InodeCached *hashNext;
+  struct Ext2InodeCached *lruNext;
+  struct Ext2InodeCached *lruPrev;
 
-  uint32_t blockIndex;
-  uint8_t *buff;
-  uint32_t blocks; // size = this * ext2->blockSize
-} Ext2CacheObject;
+  uint32_t inode;
+  uint32_t refs; // open files (& flushes) pin it
+  bool     dirty;
+
+  uint8_t data[]; // ext2->inodeSize long
+} Ext2InodeCached;
+
+#define EXT2_INODE_HASH 256
+#define EXT2_INODE_CACHE_MAX 1024
+#define EXT2_INODE_DIRTY_BATCH 32
 
 // basically something that has been accessed even once in the whole system
 typedef struct Ext2FoundObject {
@@ -160,15 +230,11 @@ typedef struct Ext2FoundObject {
 
   // global file lock
   SpinlockCnt WLOCK_FILE; // todo
-
-  // cache lock
-  SpinlockCnt WLOCK_CACHE;
-
-  // caching
-  Ext2CacheObject *firstCacheObj;
 } Ext2FoundObject;
 
 typedef struct Ext2 {
+  uint32_t disk;
+
   // various offsets
   size_t offsetBase;
   size_t offsetSuperblock;
@@ -220,6 +286,15 @@ typedef struct Ext2 {
   Spinlock LOCK_SUPERBLOCK_WRITE;
 
   Spinlock LOCK_DIRALLOC;
+
+  // inode cache
+  Spinlock          LOCK_INODE_CACHE;
+  Spinlock          LOCK_INODE_FLUSH;
+  Ext2InodeCached **inodeCache; // EXT2_INODE_HASH buckets
+  Ext2InodeCached  *inodeLruHead;
+  Ext2InodeCached  *inodeLruTail;
+  size_t            inodeCached;
+  size_t            inodeDirty;
 } Ext2;
 
 typedef struct Ext2LookupControl {
@@ -268,6 +343,8 @@ size_t ext2Open(char *filename, int flags, int mode, OpenFile *fd,
 bool   ext2Close(OpenFile *fd);
 size_t ext2Read(OpenFile *fd, uint8_t *buff, size_t limit);
 size_t ext2ReadInner(OpenFile *fd, uint8_t *buff, size_t limit);
+void   ext2Readahead(OpenFile *fd, size_t offset, size_t len);
+void   ext2Sync(MountPoint *mnt);
 bool   ext2Stat(MountPoint *mnt, char *filename, struct stat *target,
                 char **symlinkResolve);
 bool   ext2Lstat(MountPoint *mnt, char *filename, struct stat *target,
@@ -314,6 +391,9 @@ uint32_t ext2TraversePath(Ext2 *ext2, char *path, size_t initInode, bool follow,
 Ext2Inode *ext2InodeFetch(Ext2 *ext2, size_t inode);
 void       ext2InodeModifyM(Ext2 *ext2, size_t inode, Ext2Inode *target);
 void       ext2InodeDelete(Ext2 *ext2, size_t inode);
+void       ext2InodeHold(Ext2 *ext2, size_t inode);
+void       ext2InodeRelease(Ext2 *ext2, size_t inode);
+void       ext2InodeFlush(Ext2 *ext2);
 
 uint32_t ext2InodeFindL(Ext2 *ext2, int group);
 uint32_t ext2InodeFind(Ext2 *ext2, int groupSuggestion);
@@ -330,10 +410,22 @@ void ext2SuperblockPushM(Ext2 *ext2);
 bool ext2DirRemove(Ext2 *ext2, Ext2Inode *parentDirInode,
                    uint32_t parentDirInodeNum, char *filename,
                    uint8_t filenameLen);
+bool ext2DirRemoveEntry(Ext2 *ext2, uint8_t *names, char *filename,
+                        uint8_t filenameLen);
+
+// ext2_htree.c
+bool        ext2DxSupported(Ext2 *ext2);
+bool        ext2DxIndexed(Ext2 *ext2, Ext2Inode *ino);
+bool        ext2DxLookup(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
+                         char *name, size_t len, uint32_t *out);
+EXT2_DX_RES ext2DxAdd(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
+                      char *name, uint8_t len, uint8_t type, uint32_t inode);
+EXT2_DX_RES ext2DxRemove(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum,
+                         char *name, uint8_t len);
+bool        ext2DxConvert(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum);
+void        ext2DxDrop(Ext2 *ext2, Ext2Inode *ino, uint32_t inodeNum);
 
 // ext2_caching.c
-void ext2CacheAddSecurely(MountPoint *mnt, Ext2FoundObject *global,
-                          uint8_t *buff, size_t blockIndex, size_t blocks);
 void ext2CachePush(Ext2 *ext2, Ext2OpenFd *fd);
 
 // finale
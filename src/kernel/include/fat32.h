@@ -96,9 +96,9 @@ typedef struct FAT32LFN {
 } __attribute__((packed)) FAT32LFN;
 // fat->bootsec.table_count * fat->bootsec.extended_section.table_size_32
 
-#define FAT32_CACHE_BAD 0xFFFFFFFF
-#define FAT32_CACHE_MAX 32
 typedef struct FAT32 {
+  uint32_t disk;
+
   // various offsets
   size_t offsetBase;
   size_t offsetFats;
@@ -106,11 +106,6 @@ typedef struct FAT32 {
 
   // better "waste" some memory to be safe
   FAT32BootSector bootsec;
-
-  // store old FATs for easier lookup
-  uint8_t *cache[FAT32_CACHE_MAX];
-  uint32_t cacheBase[FAT32_CACHE_MAX];
-  int      cacheCurr;
 } FAT32;
 
 typedef struct FAT32OpenFd {
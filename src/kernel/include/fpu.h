@@ -0,0 +1,36 @@
+#include "types.h"
+
+#ifndef FPU_H
+#define FPU_H
+
+#define FPU_LEGACY_SIZE 512 // fxsave's area, what every save area starts with
+#define FPU_ALIGN 64        // xsave wants its areas aligned to this
+
+// signal frames carry the whole area, the way linux lays it out
+#define FPU_FRAME_MAGIC1 0x46505853
+#define FPU_FRAME_MAGIC2 0x46505845
+
+size_t   fpuSize;     // per-task save area (cpuid 0xD), 0 until initiated
+uint64_t fpuXcr0;     // components xsave covers (0 if we're on fxsave)
+bool     fpuXsaveopt; // skips components that are unmodified/initial
+
+struct Task;
+
+void initiateFpu();
+
+void *fpuAllocate(); // a fresh save area (in its initial state)
+void  fpuFree(struct Task *task);
+
+// the fpu gets switched lazily (CR0.TS), so the registers might still hold a
+// task's state well after it's been switched away from
+void fpuSchedule(struct Task *next);
+bool fpuTrap(); // #NM, false if it isn't ours to handle
+
+void fpuSave(struct Task *task);    // task->fpuenv is up to date afterwards
+void fpuDiscard(struct Task *task); // task->fpuenv got changed, reload it
+
+size_t fpuFrameSize();
+void   fpuFrameStore(struct Task *task, void *frame);
+void   fpuFrameLoad(struct Task *task, void *frame);
+
+#endif
@@ -62,6 +62,13 @@ typedef struct GDTPtr {
 #define GDT_USER_DATA 72
 #define GDT_TSS 80
 
-void initiateGDT();
+// double faults run on a stack of their own (ist1), as the one they happened
+// on might be the problem (see kstack.h)
+#define GDT_IST_DOUBLE_FAULT 1
+#define GDT_IST_PAGES 4
+
+void   initiateGDT();
+void   gdtSetup(GDTEntries *gdt, GDTPtr *gdtr, TSSPtr *tss, size_t ist);
+size_t gdtIstAllocate();
 
 #endif
\ No newline at end of file
@@ -14,6 +14,11 @@
 #define MSRID_LSTAR 0xC0000082
 #define MSRID_FMASK 0xC0000084
 
+// Page fault error code bits
+#define PAGE_FAULT_PRESENT (1 << 0) // Caused by a protection violation
+#define PAGE_FAULT_WRITE (1 << 1)   // Caused by a write access
+#define PAGE_FAULT_USER (1 << 2)    // Happened while on CPL==3
+
 #define RFLAGS_IF (1 << 9)
 #define RFLAGS_DF (1 << 10)
 
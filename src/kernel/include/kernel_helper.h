@@ -5,7 +5,11 @@
 #define KERNEL_HELPER_H
 
 Task *netHelperTask;
+Task *flusherTask;
+Task *readaheadTask;
+Task *pagerTask;
 void  kernelHelpEntry();
+void  helperKick();
 
 Spinlock LOCK_REAPER;
 Task    *reaperTask;
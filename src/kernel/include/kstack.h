@@ -0,0 +1,24 @@
+#include "paging.h"
+#include "types.h"
+
+#ifndef KSTACK_H
+#define KSTACK_H
+
+// every stack sits on top of an unmapped guard page, to catch overflows
+#define KSTACK_PAGES 8 // 32KiB, way more than anything in here needs
+#define KSTACK_SIZE (KSTACK_PAGES * PAGE_SIZE)
+#define KSTACK_SLOT_SIZE (KSTACK_SIZE + PAGE_SIZE)
+
+#define KSTACK_SLOTS 16384  // at most this many at once
+#define KSTACK_CACHE_MAX 64 // freed ones kept mapped, for reuse
+
+void initiateKernelStacks();
+
+// both work with the top of the stack (what rsp starts off as)
+size_t KernelStackAllocate();
+void   KernelStackFree(size_t top);
+
+// whether virt is the guard page below some stack (overflows)
+bool KernelStackGuard(size_t virt);
+
+#endif
@@ -1561,5 +1561,6 @@ typedef struct termios {
 #define FUTEX_CMP_REQUEUE_PI_PRIVATE (FUTEX_CMP_REQUEUE_PI | FUTEX_PRIVATE_FLAG)
 
 #define FUTEX_WAITERS 0x80000000
+#define FUTEX_BITSET_MATCH_ANY 0xffffffff
 
 #endif
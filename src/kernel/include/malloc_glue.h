@@ -15,4 +15,12 @@ int     ACQUIRE_LOCK(Spinlock *lock);
 int     RELEASE_LOCK(Spinlock *lock);
 int     INITIAL_LOCK(Spinlock *lock);
 
+// malloc.c is built with USE_DL_PREFIX, the plain names are in malloc_glue.c
+// so objects living on slabs can be handed back to them
+void *dlmalloc(size_t bytes);
+void *dlcalloc(size_t n_elements, size_t elem_size);
+void *dlrealloc(void *oldmem, size_t bytes);
+void *dlmemalign(size_t alignment, size_t bytes);
+void  dlfree(void *mem);
+
 #endif
\ No newline at end of file
@@ -4,17 +4,19 @@
 #define PAGING_H
 
 // Page [*] flags
-#define PF_PRESENT (1 << 0) // Page is present in the table
-#define PF_RW (1 << 1)      // Read-write
-#define PF_USER (1 << 2)    // User-mode (CPL==3) access allowed
-#define PF_PWT (1 << 3)     // Page write-thru
-#define PF_PCD (1 << 4)     // Cache disable
-#define PF_ACCESS (1 << 5)  // Indicates whether page was accessed
-#define PF_DIRTY (1 << 6)   // Indicates whether 4K page was written
-#define PF_PS (1 << 7)      // Page size (valid for PD and PDPT only)
-#define PF_PAT (1 << 7)     // Page Attribute Table (valid for PT only)
-#define PF_GLOBAL (1 << 8)  // Indicates the page is globally cached
-#define PF_SHARED (1 << 9)  // Userland page is shared
+#define PF_PRESENT (1 << 0)   // Page is present in the table
+#define PF_RW (1 << 1)        // Read-write
+#define PF_USER (1 << 2)      // User-mode (CPL==3) access allowed
+#define PF_PWT (1 << 3)       // Page write-thru
+#define PF_PCD (1 << 4)       // Cache disable
+#define PF_ACCESS (1 << 5)    // Indicates whether page was accessed
+#define PF_DIRTY (1 << 6)     // Indicates whether 4K page was written
+#define PF_PS (1 << 7)        // Page size (valid for PD and PDPT only)
+#define PF_PAT (1 << 7)       // Page Attribute Table (valid for PT only)
+#define PF_GLOBAL (1 << 8)    // Indicates the page is globally cached
+#define PF_SHARED (1 << 9)    // Userland page is shared
+#define PF_COW (1 << 10)      // Userland page is copy-on-write
+#define PF_PROTNONE (1 << 11) // Userland page that's PROT_NONE (no PF_USER)
 // #define PF_SYSTEM (1 << 9)  // Page used by the kernel
 
 // Region caching (following the Limine protocol)
@@ -65,6 +67,9 @@
 #define USER_HEAP_START 0x600000000000
 #define USER_STACK_BOTTOM 0x800000000000
 
+// Kernel (syscall & interrupt) stacks, a whole pml4 entry of their own
+#define KERNEL_STACKS_START 0xffffff0000000000
+
 #define P_PHYS_ADDR(x) ((x) & ~0xFFF)
 
 void initiatePaging();
@@ -72,10 +77,27 @@ void initiatePaging();
 void VirtualMapL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
                  uint64_t flags);
 void VirtualMap(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
-// uint32_t VirtualUnmap(uint32_t virt_addr);
 size_t VirtualToPhysicalL(uint64_t *pagedir, size_t virt_addr);
 size_t VirtualToPhysical(size_t virt_addr);
 
+size_t *VirtualPageEntryL(uint64_t *pagedir, size_t virt_addr);
+void    VirtualPopulateL(uint64_t *pagedir, size_t virt_addr, size_t pages,
+                         uint64_t flags);
+
+// userland ranges (munmap, mprotect), flushing the TLB as they go
+void VirtualUnmapL(uint64_t *pagedir, size_t virt_addr, size_t pages);
+void VirtualProtectL(uint64_t *pagedir, size_t virt_addr, size_t pages,
+                     int prot);
+void VirtualInvalidateRange(size_t virt_addr, size_t pages);
+
+// Lazily handled page faults' results
+#define FAULT_NONE 0     // not something we handle (genuine fault)
+#define FAULT_RESOLVED 1 // page is now properly there
+#define FAULT_BUSY 2     // couldn't do it without waiting, try again later
+#define FAULT_FILE 3     // needs reading from the disk (see elfPagerRequest())
+int VirtualCopyOnWrite(uint64_t *pagedir, size_t virt_addr);
+int VirtualDemandFault(void *task, size_t virt_addr, bool write);
+
 uint64_t *GetPageDirectory();
 uint64_t *GetTaskPageDirectory(void *task);
 void      ChangePageDirectory(uint64_t *pd);
@@ -11,4 +11,11 @@ void initiatePMM();
 size_t PhysicalAllocate(int pages);
 void   PhysicalFree(size_t ptr, int pages);
 
+void PhysicalShare(size_t ptr);
+
+// Interrupt context variants (they won't wait on the PMM lock)
+size_t PhysicalAllocateNoWait(int pages);
+bool   PhysicalShareNoWait(size_t ptr);
+size_t PhysicalUnshare(size_t ptr);
+
 #endif
@@ -6,4 +6,12 @@
 uint64_t rsp_fix(uint64_t rsp);
 void     schedule(uint64_t rsp);
 
+struct Task;
+
+// wakeups (& teardown) need to go through these, to reach the ready queue
+void schedWake(struct Task *task);
+void schedSignalWake(struct Task *task);
+void schedRemove(struct Task *task);
+bool schedHasWork();
+
 #endif
\ No newline at end of file
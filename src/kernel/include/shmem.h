@@ -0,0 +1,25 @@
+#include "spinlock.h"
+#include "types.h"
+
+#ifndef SHMEM_H
+#define SHMEM_H
+
+// Backing of shared anonymous mappings (MAP_SHARED | MAP_ANONYMOUS). Every
+// address space mapping it (fork() children included) faults in the exact
+// same frames, so writes are seen by all of them
+typedef struct SharedMemory {
+  Spinlock LOCK_SHM;
+  size_t   refs; // mappings using it, freed when 0
+
+  size_t *frames; // one per page, 0 until first touched
+  size_t  pages;
+} SharedMemory;
+
+SharedMemory *sharedMemoryAllocate(size_t pages);
+void          sharedMemoryHold(SharedMemory *shm);
+void          sharedMemoryRelease(SharedMemory *shm);
+
+// interrupt context (see VirtualDemandFault()), hands out a reference
+int sharedMemoryPage(SharedMemory *shm, size_t index, size_t *phys);
+
+#endif
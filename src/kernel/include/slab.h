@@ -0,0 +1,63 @@
+#include "bitmap.h"
+#include "types.h"
+#include "util.h"
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#define SLAB_PAGES 4 // a power of 2, so slabs come naturally aligned
+#define SLAB_SIZE (SLAB_PAGES * BLOCK_SIZE)
+#define SLAB_ALIGN 16    // every object is aligned to this
+#define SLAB_EMPTY_MAX 1 // empty slabs a cache holds onto
+
+typedef void (*SlabCtor)(void *obj);
+
+typedef struct Slab {
+  struct Slab      *next;
+  struct Slab      *prev;
+  struct SlabCache *cache;
+
+  void    *freeList; // free objects link through their first word
+  uint32_t used;
+  uint32_t total;
+} Slab;
+
+typedef struct SlabCache {
+  char    *name;
+  size_t   size; // rounded up to SLAB_ALIGN
+  SlabCtor ctor; // ran on every allocation, after zeroing it out
+
+  Spinlock LOCK_SLAB;
+
+  Slab  *partial;
+  Slab  *full;
+  Slab  *empty;
+  size_t emptyCnt;
+
+  size_t objects; // handed out right now
+  size_t slabs;
+
+  struct SlabCache *next; // on the global list, once it's been used
+  bool              registered;
+} SlabCache;
+
+#define SLAB_CACHE(_name, _size, _ctor)                                        \
+  {.name = (_name),                                                            \
+   .size = DivRoundUp((_size), SLAB_ALIGN) * SLAB_ALIGN,                       \
+   .ctor = (_ctor),                                                            \
+   .LOCK_SLAB = ATOMIC_FLAG_INIT}
+
+void initiateSlab();
+
+void *slabAlloc(SlabCache *cache);
+void  slabFree(SlabCache *cache, void *ptr);
+
+// generic size classes, for when there's no dedicated cache (not zeroed)
+void *slabMalloc(size_t size);
+
+// the cache ptr belongs to, if it's on a slab at all
+SlabCache *slabOwner(void *ptr);
+
+size_t slabInfoPages();
+
+#endif
@@ -14,24 +14,57 @@ typedef atomic_flag Spinlock;
 
 void spinlockAcquire(Spinlock *lock);
 void spinlockRelease(Spinlock *lock);
+bool spinlockTryAcquire(Spinlock *lock);
 
 typedef struct SpinlockCnt {
   Spinlock LOCK;
   int64_t  cnt;
 } SpinlockCnt;
 
+// Wait queues, for sleeping until something happens. Entries live on the
+// sleepers' stacks. Goes like: waitQueuePrepare(), check the condition, then
+// either waitQueueSleep() or waitQueueFinish(). Anyone who changes it after
+// the prepare (& wakes the queue) will wake us, so no wakeup can get lost in
+// between. Nothing in between can sleep on anything else though!
+#define WAIT_WOKEN 0
+#define WAIT_TIMEOUT 1
+#define WAIT_SIGNAL 2
+
+typedef struct WaitQueueEntry {
+  struct WaitQueueEntry *next;
+  struct Task           *task;
+  bool                   queued; // cleared by whoever wakes it up
+} WaitQueueEntry;
+
+typedef struct WaitQueue {
+  Spinlock        LOCK_WAIT;
+  WaitQueueEntry *first;
+  WaitQueueEntry *last;
+} WaitQueue;
+
 typedef struct Semaphore {
-  Spinlock LOCK;
-  uint32_t cnt;
-  uint8_t  invalid;
+  Spinlock  LOCK;
+  uint32_t  cnt;
+  uint8_t   invalid;
+  WaitQueue waiters;
 } Semaphore;
 
 void spinlockCntReadAcquire(SpinlockCnt *lock);
 void spinlockCntReadRelease(SpinlockCnt *lock);
 
 void spinlockCntWriteAcquire(SpinlockCnt *lock);
+bool spinlockCntWriteTryAcquire(SpinlockCnt *lock);
 void spinlockCntWriteRelease(SpinlockCnt *lock);
 
+void waitQueuePrepare(WaitQueue *wq, WaitQueueEntry *entry);
+int  waitQueueSleep(WaitQueue *wq, WaitQueueEntry *entry, uint64_t expiry);
+int  waitQueueSleepUninterruptible(WaitQueue *wq, WaitQueueEntry *entry,
+                                   uint64_t expiry);
+void waitQueueFinish(WaitQueue *wq, WaitQueueEntry *entry);
+bool waitQueueWakeOne(WaitQueue *wq);
+bool waitQueueWakeOneNoWait(WaitQueue *wq);
+int  waitQueueWakeAll(WaitQueue *wq);
+
 bool semaphoreWait(Semaphore *sem, uint32_t timeout);
 void semaphorePost(Semaphore *sem);
 
@@ -20,6 +20,9 @@ void     outportl(uint16_t portid, uint32_t value);
 uint64_t rdmsr(uint32_t msrid);
 uint64_t wrmsr(uint32_t msrid, uint64_t value);
 
+// Time Stamp Counter
+uint64_t rdtsc();
+
 // Streaming SIMD Extensions
 void initiateSSE();
 
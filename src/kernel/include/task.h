@@ -2,6 +2,7 @@
 #include "isr.h"
 #include "linked_list.h"
 #include "system.h"
+#include "timer.h"
 #include "types.h"
 #include "vfs.h"
 
@@ -17,6 +18,9 @@
 #define helperCmdline ("kernel")
 #define dummyCmdline ("dummy")
 #define lwipCmdline ("lwip")
+#define flusherCmdline ("flusher")
+#define readaheadCmdline ("readahead")
+#define pagerCmdline ("pager")
 
 typedef struct {
   uint64_t edi;
@@ -38,6 +42,8 @@ typedef enum TASK_STATE {
   TASK_STATE_BLOCKED = 8,
   TASK_STATE_SIGKILLED = 9,
   TASK_STATE_FUTEX = 10,
+  TASK_STATE_PAGING = 11,          // waiting on the pager (utilities/elf.c)
+  TASK_STATE_UNINTERRUPTIBLE = 12, // blocked, signals don't wake it up
   TASK_STATE_DUMMY = 69,
 } TASK_STATE;
 
@@ -63,10 +69,21 @@ TaskInfoFs *taskInfoFsAllocate();
 TaskInfoFs *taskInfoFsClone(TaskInfoFs *old);
 void        taskInfoFsDiscard(TaskInfoFs *target);
 
+#define MAPPING_PROT_DEFAULT (PROT_READ | PROT_WRITE | PROT_EXEC)
+
 typedef struct UserspaceMapping {
   void  *virt; // it is the key aswell
   size_t pages;
   bool   onDemand;
+  int    prot; // PROT_*, what faults on it get mapped as
+
+  // executable's pages, backed by their image (on demand as well)
+  struct ElfImage *image;
+  size_t           imageBase; // where the image's 0 lies
+
+  // MAP_SHARED | MAP_ANONYMOUS, same frames for everyone mapping it
+  struct SharedMemory *shared;
+  size_t               sharedPage; // what page of it virt is
 } UserspaceMapping;
 
 typedef struct TaskInfoPagedir {
@@ -89,9 +106,26 @@ TaskInfoPagedir *taskInfoPdAllocate(bool pagedir);
 TaskInfoPagedir *taskInfoPdClone(TaskInfoPagedir *old);
 void             taskInfoPdDiscard(TaskInfoPagedir *target);
 
+// LOCK_PD should be held for these. they only keep track of the ranges, the
+// page tables themselves are left to the caller (see VirtualUnmapL() & co)
+UserspaceMapping *taskInfoPdMappingFind(TaskInfoPagedir *info, size_t virt);
+void taskInfoPdMappingAdd(TaskInfoPagedir *info, size_t virt, size_t pages,
+                          bool onDemand, int prot);
+void taskInfoPdMappingAddImage(TaskInfoPagedir *info, size_t virt,
+                               size_t pages, struct ElfImage *image,
+                               size_t imageBase);
+void taskInfoPdMappingAddShared(TaskInfoPagedir *info, size_t virt,
+                                size_t pages, struct SharedMemory *shared,
+                                size_t sharedPage, int prot);
+void taskInfoPdMappingRemove(TaskInfoPagedir *info, size_t virt,
+                             size_t pages);
+void taskInfoPdMappingProtect(TaskInfoPagedir *info, size_t virt,
+                              size_t pages, int prot);
+
 typedef struct IntTimerInternal {
-  uint64_t at;    // checked agains timerTicks (ms)
-  uint64_t reset; // reset value (ms)
+  uint64_t   at;    // checked agains timerTicks (ms)
+  uint64_t   reset; // reset value (ms)
+  TimerEvent event;
 } IntTimerInternal;
 
 typedef struct TaskInfoSignal {
@@ -164,7 +198,7 @@ struct Task {
 
   // PLEASE assert() it is zero after use and zero it manually if state changes
   // are involved. It WILL NOT care at which point a wakeup happens and how
-  // disruptive the context can be!
+  // disruptive the context can be! In timerNanos()
   size_t forcefulWakeupTimeUnsafe;
 
   termios  term;
@@ -188,8 +222,7 @@ struct Task {
   TaskInfoFiles   *infoFiles;
   TaskInfoSignal  *infoSignals;
 
-  __attribute__((aligned(16))) uint8_t fpuenv[512];
-  uint32_t                             mxcsr;
+  uint8_t *fpuenv; // fpuSize bytes (see cpu/fpu.c), 0 for kernel tasks
 
   bool noInformParent;
 
@@ -200,12 +233,35 @@ struct Task {
 
   uint64_t extras; // extra flags
 
+  uint64_t cpuNanos; // time spent running, up until cpuSince
+  uint64_t cpuSince; // timerNanos() when it last got scheduled in
+
+  // scheduler queues (multitasking/schedule.c), only touched with ints off
+  bool       readyQueued;
+  Task      *readyNext;
+  Task      *readyPrev;
+  TimerEvent sleepTimer; // for forcefulWakeupTimeUnsafe
+
   Task *parent;
   Task *next;
+
+  // lookup indices (see multitasking/task.c), under TASK_LL_MODIFY
+  Task *idNext;
+  Task *pgrpNext;
+  Task *pgrpPrev;
+  Task *sessionNext;
+  Task *sessionPrev;
 };
 
 SpinlockCnt TASK_LL_MODIFY;
 
+// tasks are hashed by id, process group & session, so none of those lookups
+// have to walk the entire list
+#define TASK_HASH_SIZE 256
+#define TASK_HASH(key) ((uint32_t)(key) & (TASK_HASH_SIZE - 1))
+
+Task *taskIdHash[TASK_HASH_SIZE]; // chains sorted by id
+
 Task *firstTask;
 Task *currentTask;
 
@@ -213,25 +269,10 @@ Task *dummyTask;
 
 bool tasksInitiated;
 
-typedef struct BlockedTask {
-  LLheader _ll;
-
-  Task *task;
-} BlockedTask;
-
-typedef struct Blocking {
-  // also needs a parent lock to be reliable! this is just for the LL
-  Spinlock  LOCK_LL_BLOCKED;
-  LLcontrol dsBlockedTask; // struct BlockedTask
-} Blocking;
-
 // needed for libraries that still depend on some sort of errno
 // should be safe as it's per-thread
 #define errno (currentTask->kernelErrno)
 
-void taskBlock(Blocking *blocking, Task *task, Spinlock *releaseAfter,
-               bool apply);
-void taskUnblock(Blocking *blocking);
 void taskSpinlockExit(Task *task, Spinlock *lock);
 
 void initiateTasks();
@@ -254,9 +295,20 @@ Task  *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, int cloneFlags,
                 bool spinup);
 void   taskFilesCopy(Task *original, Task *target, bool respectCOE);
 
-Task *taskListAllocate();
+Task *taskListAllocate(uint32_t id);
 void  taskListDestroy(Task *target);
 
+// these re-index the task, so nothing else should write the fields directly
+void taskSetId(Task *task, uint32_t id);
+void taskSetPgid(Task *task, int pgid);
+void taskSetSid(Task *task, int sid);
+
+// TASK_LL_MODIFY has to be held (read) while walking these
+Task *taskPgrpFirst(int pgid);
+Task *taskPgrpNext(Task *task);
+Task *taskSessionFirst(int sid);
+Task *taskSessionNext(Task *task);
+
 uint64_t taskGenerateId();
 void     taskCallReaper(Task *target);
 
@@ -11,7 +11,36 @@ uint64_t timerBootUnix;
 
 uint64_t apicFreq;
 
+// TSC clocksource, calibrated against the pit at boot. Frequency stays 0 if
+// there's no invariant tsc, leaving everything at timerTicks resolution
+#define TIMER_TSC_SHIFT 32
+
+uint64_t timerTscFreq; // in Hz
+uint64_t timerTscBoot; // tsc value at timerTicks = 0
+uint64_t timerTscMult; // ns = (tsc - timerTscBoot) * mult >> TIMER_TSC_SHIFT
+
+uint64_t timerNanos(); // monotonic, since boot
+
+// One-shot events on the timer wheel, fired from the timer interrupt (so with
+// ints off & nothing that could yield). Zeroed events are valid & disarmed
+typedef void (*TimerCallback)(void *ctx);
+
+typedef struct TimerEvent {
+  uint64_t            at; // in timerNanos()
+  TimerCallback       callback;
+  void               *ctx;
+  bool                armed;
+  struct TimerEvent **slot; // wheel slot it's on
+  struct TimerEvent  *next;
+  struct TimerEvent  *prev;
+} TimerEvent;
+
+void timerArm(TimerEvent *event, uint64_t at, TimerCallback callback,
+              void *ctx);
+void timerDisarm(TimerEvent *event);
+
 void     timerTick(uint64_t rsp);
+void     timerSetDeadline(bool idle);
 uint32_t sleep(uint32_t time);
 void     initiateApicTimer();
 
@@ -20,7 +20,8 @@ VfsHandlers unixAcceptHandlers;
 
 typedef struct UnixSocketPair {
   // common mutex
-  Spinlock LOCK_PAIR;
+  Spinlock  LOCK_PAIR;
+  WaitQueue waiters; // both ends & connect(), on any change
 
   // accept()/server
   bool     established;
@@ -46,7 +47,8 @@ typedef struct UnixSocket {
   int      timesOpened;
 
   // accept()
-  bool acceptWouldBlock;
+  bool      acceptWouldBlock;
+  WaitQueue acceptWaiters;
 
   // bind()
   char *bindAddr;
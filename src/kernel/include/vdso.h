@@ -0,0 +1,31 @@
+#include "types.h"
+
+#ifndef VDSO_H
+#define VDSO_H
+
+// vDSO: a tiny shared object (see vdso/) mapped into every process, which
+// answers time queries straight from a page the kernel keeps up to date,
+// without ever entering it. The data page sits right below the image
+#define VDSO_BASE 0x7FFF00000000
+#define VDSO_DATA (VDSO_BASE - 0x1000)
+
+#define AT_SYSINFO_EHDR 33
+
+// Shared with userspace, read under the seq lock
+typedef struct VdsoData {
+  uint32_t seq; // odd while the kernel's in the middle of updating it
+  uint32_t tsc; // tsc* below are usable (see timerNanos())
+
+  uint64_t tscBoot;
+  uint64_t tscMult;
+  uint64_t tscShift;
+
+  uint64_t bootUnix; // timerBootUnix
+  uint64_t ticks;    // timerTicks, all there is to go by without the tsc
+} VdsoData;
+
+void initiateVdso();
+void vdsoUpdate();
+void vdsoMap(uint64_t *pagedir);
+
+#endif
@@ -94,6 +94,7 @@ typedef size_t (*SpecialSendto)(OpenFile *fd, uint8_t *in, size_t limit,
 typedef int (*SpecialInternalPoll)(OpenFile *fd, int events);
 typedef int (*SpecialAddWatchlist)(OpenFile *fd, int rwsLevel, bool add);
 typedef size_t (*SpecialReportKey)(OpenFile *fd);
+typedef void (*SpecialReadahead)(OpenFile *fd, size_t offset, size_t len);
 
 typedef struct VfsHandlers {
   SpecialReadHandler  read;
@@ -106,6 +107,7 @@ typedef struct VfsHandlers {
   SpecialGetFilesize  getFilesize;
   SpecialPoll         poll;
   SpecialFcntl        fcntl; // it's extra
+  SpecialReadahead    readahead;
 
   // networking
   SpecialBind        bind;
@@ -145,6 +147,7 @@ typedef size_t (*MntReadlink)(MountPoint *mnt, char *path, char *buf, int size,
                               char **symlinkResolve);
 typedef size_t (*MntLink)(MountPoint *mnt, char *filename, char *target,
                           char **symlinkResolve, char **symlinkResolveTarget);
+typedef void (*MntSync)(MountPoint *mnt);
 
 struct MountPoint {
   LLheader _ll;
@@ -155,9 +158,6 @@ struct MountPoint {
   uint8_t   partition; // mbr allows for 4 partitions / disk
   CONNECTOR connector;
 
-  // essential for mm
-  size_t blocksCached;
-
   FS filesystem;
 
   VfsHandlers *handlers;
@@ -167,6 +167,7 @@ struct MountPoint {
   MntDelete delete;
   MntReadlink readlink;
   MntLink     link;
+  MntSync     sync;
 
   mbr_partition mbr;
   void         *fsInfo;
@@ -198,8 +199,25 @@ struct OpenFile {
   MountPoint *mountPoint;
   void       *dir;
   void       *fakefs;
+
+  // readahead state (vfs_readahead.c)
+  int    fadvise;  // POSIX_FADV_*
+  size_t raNext;   // where a sequential read would continue from
+  size_t raWindow; // how far past that we want prefetched
+  size_t raAhead;  // prefetched up until here
 };
 
+#define POSIX_FADV_NORMAL 0
+#define POSIX_FADV_RANDOM 1
+#define POSIX_FADV_SEQUENTIAL 2
+#define POSIX_FADV_WILLNEED 3
+#define POSIX_FADV_DONTNEED 4
+#define POSIX_FADV_NOREUSE 5
+
+#define VFS_READAHEAD_MIN 16384
+#define VFS_READAHEAD_MAX 262144
+#define VFS_WILLNEED_MAX 4194304
+
 LLcontrol dsMountPoint; // struct MountPoint
 
 #define SEEK_SET 0  // start + offset
@@ -240,11 +258,17 @@ bool fsLstatByFilename(void *task, char *filename, stat *target);
 // vfs_poll.c
 void fsInformReady(OpenFile *fd, int epollEvents);
 
+// vfs_readahead.c
+void   fsReadahead(OpenFile *fd, size_t start, size_t len);
+size_t fsAdvise(OpenFile *fd, size_t offset, size_t len, int advice);
+
 // vfs_mount.c
 MountPoint *fsMount(char *prefix, CONNECTOR connector, uint32_t disk,
                     uint8_t partition);
 bool        fsUnmount(MountPoint *mnt);
 MountPoint *fsDetermineMountPoint(char *filename);
+void        fsSyncMetadata();
+void        fsSyncAll();
 char       *fsResolveSymlink(MountPoint *mnt, char *symlink);
 
 #endif
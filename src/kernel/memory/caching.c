@@ -1,14 +1,484 @@
+#include <bootloader.h>
 #include <caching.h>
+#include <disk.h>
+#include <elf.h>
+#include <malloc.h>
+#include <pmm.h>
 #include <system.h>
+#include <timer.h>
+#include <util.h>
 #include <vfs.h>
+#include <vmm.h>
 
-void cachingInfoCb(void *data, void *ctx) {
-  MountPoint *fs = data;
-  *(size_t *)ctx += fs->blocksCached;
+// Page cache sitting right on top of the disk, so every filesystem (and raw
+// reads) get it for free. Pages are BLOCK_SIZE long, indexed by their disk &
+// LBA and evicted from the least recently used end once memory gets tight.
+// Writes only land in here, getting written back by the flusher thread once
+// they've been dirty for long enough (or by whoever calls cachingSync()),
+// sorted & coalesced
+
+CachePage *cacheHash[CACHE_HASH_SIZE] = {0};
+CachePage *cacheLruHead = 0; // most recently used
+CachePage *cacheLruTail = 0; // least recently used
+CachePage *cacheSpare = 0;   // unused page structs
+
+CachePage *cacheDirtyHead = 0; // most recently dirtied
+CachePage *cacheDirtyTail = 0; // dirty for the longest
+
+size_t   cachePages = 0;
+size_t   cacheDirtyPages = 0;
+uint64_t cacheWriteSeq = 0; // bumped on every write, see cachingRead()
+uint64_t cacheDirtyExpire = CACHE_DIRTY_EXPIRE;
+
+bool      cacheFlusherKicked = false;
+size_t    cacheReclaimPending = 0; // pages the flusher should let go of
+WaitQueue cacheFlusherWait = {0};
+
+CachePrefetch cachePrefetchQueue[CACHE_PREFETCH_QUEUE];
+size_t        cachePrefetchRead = 0;
+size_t        cachePrefetchWrite = 0;
+
+Spinlock LOCK_CACHE = ATOMIC_FLAG_INIT;
+Spinlock LOCK_CACHE_FLUSH = ATOMIC_FLAG_INIT; // one writeback at a time
+Spinlock LOCK_CACHE_PREFETCH = ATOMIC_FLAG_INIT;
+
+WaitQueue cachePrefetchWait = {0};
+
+#define CACHE_HASH(disk, index) (((index) + (disk) * 31) % CACHE_HASH_SIZE)
+
+// everything below (up until cachingRead()) assumes LOCK_CACHE is held
+static CachePage *cacheLookup(uint32_t disk, uint64_t index) {
+  CachePage *browse = cacheHash[CACHE_HASH(disk, index)];
+  while (browse) {
+    if (browse->disk == disk && browse->index == index)
+      return browse;
+    browse = browse->hashNext;
+  }
+  return 0;
+}
+
+static void cacheLruUnlink(CachePage *page) {
+  if (page->lruPrev)
+    page->lruPrev->lruNext = page->lruNext;
+  else
+    cacheLruHead = page->lruNext;
+  if (page->lruNext)
+    page->lruNext->lruPrev = page->lruPrev;
+  else
+    cacheLruTail = page->lruPrev;
 }
 
-size_t cachingInfoBlocks() {
-  size_t ret = 0;
-  LinkedListTraverse(&dsMountPoint, cachingInfoCb, &ret);
-  return ret;
+static void cacheLruPush(CachePage *page) {
+  page->lruPrev = 0;
+  page->lruNext = cacheLruHead;
+  if (cacheLruHead)
+    cacheLruHead->lruPrev = page;
+  cacheLruHead = page;
+  if (!cacheLruTail)
+    cacheLruTail = page;
 }
+
+static void cacheTouch(CachePage *page) {
+  if (page->dirty || page->writeback || cacheLruHead == page)
+    return;
+  cacheLruUnlink(page);
+  cacheLruPush(page);
+}
+
+static void cacheInsert(CachePage *page) {
+  size_t bucket = CACHE_HASH(page->disk, page->index);
+  page->hashNext = cacheHash[bucket];
+  cacheHash[bucket] = page;
+  cacheLruPush(page);
+  cachePages++;
+}
+
+// off the lru and onto the dirty list, if it wasn't there already
+static void cacheMarkDirty(CachePage *page) {
+  if (page->dirty)
+    return;
+  if (!page->writeback)
+    cacheLruUnlink(page);
+  page->dirty = true;
+  page->dirtied = timerTicks;
+  page->dirtyPrev = 0;
+  page->dirtyNext = cacheDirtyHead;
+  if (cacheDirtyHead)
+    cacheDirtyHead->dirtyPrev = page;
+  cacheDirtyHead = page;
+  if (!cacheDirtyTail)
+    cacheDirtyTail = page;
+  cacheDirtyPages++;
+}
+
+// it's about to be written back, stays off the lru until that's done
+static void cacheMarkClean(CachePage *page) {
+  if (page->dirtyPrev)
+    page->dirtyPrev->dirtyNext = page->dirtyNext;
+  else
+    cacheDirtyHead = page->dirtyNext;
+  if (page->dirtyNext)
+    page->dirtyNext->dirtyPrev = page->dirtyPrev;
+  else
+    cacheDirtyTail = page->dirtyPrev;
+  page->dirty = false;
+  page->writeback = true;
+  cacheDirtyPages--;
+}
+
+static void cacheRemove(CachePage *page) {
+  CachePage **browse = &cacheHash[CACHE_HASH(page->disk, page->index)];
+  while (*browse != page)
+    browse = &(*browse)->hashNext;
+  *browse = page->hashNext;
+  cacheLruUnlink(page);
+  cachePages--;
+}
+
+// page structs are kept around instead of free()'d, since eviction can happen
+// from inside of malloc() itself (see cachingReclaim())
+static void cacheRelease(CachePage *page) {
+  VirtualFree(page->buff, 1);
+  page->buff = 0;
+  page->hashNext = cacheSpare;
+  cacheSpare = page;
+}
+
+static CachePage *cacheSpareTake() {
+  CachePage *page = cacheSpare;
+  if (page)
+    cacheSpare = page->hashNext;
+  return page;
+}
+
+// takes LOCK_CACHE itself, unlike everything around it
+static CachePage *cachePageNew(uint32_t disk, uint64_t index,
+                               uint8_t *buff) {
+  spinlockAcquire(&LOCK_CACHE);
+  CachePage *page = cacheSpareTake();
+  spinlockRelease(&LOCK_CACHE);
+  if (!page)
+    page = malloc(sizeof(CachePage));
+  memset(page, 0, sizeof(CachePage));
+  page->disk = disk;
+  page->index = index;
+  page->buff = buff;
+  return page;
+}
+
+// takes up to pages off the lru end
+static size_t cacheEvict(size_t pages) {
+  size_t evicted = 0;
+  while (evicted < pages && cacheLruTail) {
+    CachePage *page = cacheLruTail;
+    cacheRemove(page);
+    cacheRelease(page);
+    evicted++;
+  }
+  return evicted;
+}
+
+// how many pages we'd like to let go of, to keep some memory free
+static size_t cachePressure() {
+  size_t total = bootloader.mmTotal / BLOCK_SIZE;
+  size_t used = physical.allocatedSizeInBlocks;
+  size_t minFree = total / CACHE_MIN_FREE_DIV;
+  if (used + minFree < total)
+    return 0;
+  return MIN(used + minFree - total, cachePages);
+}
+
+// out can be null, for just bringing stuff into the cache
+void cachingRead(uint32_t disk, uint8_t *out, uint64_t lba, size_t sectors) {
+  uint64_t first = lba / CACHE_PAGE_SECTORS;
+  uint64_t last = (lba + sectors - 1) / CACHE_PAGE_SECTORS;
+
+  uint64_t index = first;
+  while (index <= last) {
+    // sectors of this page that we're after
+    uint64_t pageLba = index * CACHE_PAGE_SECTORS;
+    uint64_t start = MAX(lba, pageLba);
+
+    spinlockAcquire(&LOCK_CACHE);
+    CachePage *hit = cacheLookup(disk, index);
+    if (hit) {
+      uint64_t end = MIN(lba + sectors, pageLba + CACHE_PAGE_SECTORS);
+      cacheTouch(hit);
+      if (out)
+        memcpy(&out[(start - lba) * SECTOR_SIZE],
+               &hit->buff[(start - pageLba) * SECTOR_SIZE],
+               (end - start) * SECTOR_SIZE);
+      spinlockRelease(&LOCK_CACHE);
+      index++;
+      continue;
+    }
+
+    // a run of missing pages, read in one go
+    uint64_t runEnd = index + 1;
+    while (runEnd <= last && (runEnd - index) < CACHE_RUN_MAX &&
+           !cacheLookup(disk, runEnd))
+      runEnd++;
+    uint64_t seq = cacheWriteSeq;
+    cacheEvict(cachePressure());
+    spinlockRelease(&LOCK_CACHE);
+
+    size_t   run = runEnd - index;
+    uint8_t *buff = VirtualAllocate(run);
+    diskBytesUncached(disk, buff, pageLba, run * CACHE_PAGE_SECTORS, false);
+
+    uint64_t end = MIN(lba + sectors, runEnd * CACHE_PAGE_SECTORS);
+    if (out)
+      memcpy(&out[(start - lba) * SECTOR_SIZE],
+             &buff[(start - pageLba) * SECTOR_SIZE],
+             (end - start) * SECTOR_SIZE);
+
+    // hand the pages over to the cache
+    for (size_t i = 0; i < run; i++) {
+      CachePage *page = cachePageNew(disk, index + i, &buff[i * BLOCK_SIZE]);
+
+      spinlockAcquire(&LOCK_CACHE);
+      // a write that came in meanwhile might have made what we read stale
+      if (seq == cacheWriteSeq && !cacheLookup(disk, page->index))
+        cacheInsert(page);
+      else
+        cacheRelease(page);
+      spinlockRelease(&LOCK_CACHE);
+    }
+
+    index = runEnd;
+  }
+}
+
+void cachingPrefetch(uint32_t disk, uint64_t lba, size_t sectors) {
+  spinlockAcquire(&LOCK_CACHE_PREFETCH);
+  size_t next = (cachePrefetchWrite + 1) % CACHE_PREFETCH_QUEUE;
+  bool   queued = next != cachePrefetchRead;
+  if (queued) {
+    cachePrefetchQueue[cachePrefetchWrite].disk = disk;
+    cachePrefetchQueue[cachePrefetchWrite].lba = lba;
+    cachePrefetchQueue[cachePrefetchWrite].sectors = sectors;
+    cachePrefetchWrite = next;
+  }
+  spinlockRelease(&LOCK_CACHE_PREFETCH);
+
+  if (queued)
+    waitQueueWakeOne(&cachePrefetchWait);
+}
+
+// readahead thread, works through whatever cachingPrefetch() queued up
+void cachingPrefetcher() {
+  WaitQueueEntry wait;
+  while (true) {
+    spinlockAcquire(&LOCK_CACHE_PREFETCH);
+    bool          empty = cachePrefetchRead == cachePrefetchWrite;
+    CachePrefetch req = cachePrefetchQueue[cachePrefetchRead];
+    if (!empty)
+      cachePrefetchRead = (cachePrefetchRead + 1) % CACHE_PREFETCH_QUEUE;
+    spinlockRelease(&LOCK_CACHE_PREFETCH);
+
+    if (!empty) {
+      cachingRead(req.disk, 0, req.lba, req.sectors);
+      continue;
+    }
+
+    // sleep till the next one
+    waitQueuePrepare(&cachePrefetchWait, &wait);
+    if (cachePrefetchRead == cachePrefetchWrite)
+      waitQueueSleep(&cachePrefetchWait, &wait, 0);
+    else
+      waitQueueFinish(&cachePrefetchWait, &wait);
+  }
+}
+
+// sorting order for writeback, by disk & then position on it
+static bool cacheKeyAfter(CachePage *a, CachePage *b) {
+  return a->disk != b->disk ? a->disk > b->disk : a->index > b->index;
+}
+
+// writes back pages dirty since cutoff (or before), sorted by their key so
+// neighbouring ones go out in one disk command. holds LOCK_CACHE_FLUSH all the
+// way through, so anyone syncing also waits for an ongoing writeback to land
+static void cacheWriteback(uint64_t cutoff) {
+  spinlockAcquire(&LOCK_CACHE_FLUSH);
+
+  spinlockAcquire(&LOCK_CACHE);
+  size_t max = cacheDirtyPages;
+  spinlockRelease(&LOCK_CACHE);
+  if (!max) {
+    spinlockRelease(&LOCK_CACHE_FLUSH);
+    return;
+  }
+
+  CachePage **batch = malloc(sizeof(CachePage *) * max);
+  uint8_t    *bounce = VirtualAllocate(CACHE_RUN_MAX);
+
+  spinlockAcquire(&LOCK_CACHE);
+  size_t     cnt = 0;
+  CachePage *browse = cacheDirtyTail;
+  while (browse && cnt < max && browse->dirtied <= cutoff) {
+    CachePage *prev = browse->dirtyPrev;
+    size_t     pos = cnt++;
+    while (pos && cacheKeyAfter(batch[pos - 1], browse)) {
+      batch[pos] = batch[pos - 1];
+      pos--;
+    }
+    batch[pos] = browse;
+    cacheMarkClean(browse);
+    browse = prev;
+  }
+  spinlockRelease(&LOCK_CACHE);
+
+  size_t i = 0;
+  while (i < cnt) {
+    size_t run = 1;
+    while (i + run < cnt && run < CACHE_RUN_MAX &&
+           batch[i + run]->disk == batch[i]->disk &&
+           batch[i + run]->index == batch[i]->index + run)
+      run++;
+
+    // snapshot, writers can keep going at them meanwhile (re-dirtying them)
+    spinlockAcquire(&LOCK_CACHE);
+    for (size_t j = 0; j < run; j++)
+      memcpy(&bounce[j * BLOCK_SIZE], batch[i + j]->buff, BLOCK_SIZE);
+    spinlockRelease(&LOCK_CACHE);
+
+    diskBytesUncached(batch[i]->disk, bounce,
+                      batch[i]->index * CACHE_PAGE_SECTORS,
+                      run * CACHE_PAGE_SECTORS, true);
+
+    spinlockAcquire(&LOCK_CACHE);
+    for (size_t j = 0; j < run; j++) {
+      CachePage *page = batch[i + j];
+      page->writeback = false;
+      if (!page->dirty)
+        cacheLruPush(page);
+    }
+    spinlockRelease(&LOCK_CACHE);
+
+    i += run;
+  }
+
+  VirtualFree(bounce, CACHE_RUN_MAX);
+  free(batch);
+  spinlockRelease(&LOCK_CACHE_FLUSH);
+}
+
+// past this many dirty pages writers have to write back themselves, past half
+// of it the flusher gets woken up early
+static size_t cacheDirtyLimit() {
+  return bootloader.mmTotal / BLOCK_SIZE / CACHE_DIRTY_DIV;
+}
+
+void cachingWrite(uint32_t disk, const uint8_t *in, uint64_t lba,
+                  size_t sectors) {
+  uint64_t first = lba / CACHE_PAGE_SECTORS;
+  uint64_t last = (lba + sectors - 1) / CACHE_PAGE_SECTORS;
+
+  for (uint64_t index = first; index <= last; index++) {
+    uint64_t pageLba = index * CACHE_PAGE_SECTORS;
+    uint64_t start = MAX(lba, pageLba);
+    uint64_t end = MIN(lba + sectors, pageLba + CACHE_PAGE_SECTORS);
+
+    spinlockAcquire(&LOCK_CACHE);
+    CachePage *page = cacheLookup(disk, index);
+    while (!page) {
+      uint64_t seq = cacheWriteSeq;
+      spinlockRelease(&LOCK_CACHE);
+
+      // whatever we aren't overwriting has to come from the disk
+      uint8_t *buff = VirtualAllocate(1);
+      if (end - start != CACHE_PAGE_SECTORS)
+        diskBytesUncached(disk, buff, pageLba, CACHE_PAGE_SECTORS, false);
+      CachePage *fresh = cachePageNew(disk, index, buff);
+
+      spinlockAcquire(&LOCK_CACHE);
+      page = cacheLookup(disk, index);
+      if (page)
+        cacheRelease(fresh); // beaten to it
+      else if (seq == cacheWriteSeq || end - start == CACHE_PAGE_SECTORS) {
+        cacheInsert(fresh);
+        page = fresh;
+      } else
+        cacheRelease(fresh); // might've gone through & got evicted, re-read
+    }
+
+    memcpy(&page->buff[(start - pageLba) * SECTOR_SIZE],
+           &in[(start - lba) * SECTOR_SIZE], (end - start) * SECTOR_SIZE);
+    cacheMarkDirty(page);
+    cacheWriteSeq++;
+    spinlockRelease(&LOCK_CACHE);
+  }
+
+  // throttle whoever's dirtying faster than the disk can keep up
+  size_t limit = cacheDirtyLimit();
+  if (cacheDirtyPages >= limit)
+    cacheWriteback((uint64_t)(-1));
+  else if (cacheDirtyPages >= limit / 2 && !cacheFlusherKicked) {
+    cacheFlusherKicked = true;
+    waitQueueWakeOne(&cacheFlusherWait);
+  }
+}
+
+// everything's on the disks (and out of their volatile write caches) after
+void cachingSync() {
+  cacheWriteback((uint64_t)(-1));
+  for (uint32_t disk = 0; diskFlush(disk); disk++)
+    ;
+}
+
+// background writeback thread, also pushes filesystem metadata into the cache
+// every time around so it ages in here like everything else
+void cachingFlusher() {
+  WaitQueueEntry wait;
+  while (true) {
+    waitQueuePrepare(&cacheFlusherWait, &wait);
+    if (cacheFlusherKicked || cacheReclaimPending)
+      waitQueueFinish(&cacheFlusherWait, &wait);
+    else
+      waitQueueSleep(&cacheFlusherWait, &wait,
+                     timerNanos() + CACHE_FLUSH_INTERVAL * 1000000ULL);
+
+    // someone ran out of memory where they couldn't reclaim themselves
+    asm volatile("cli");
+    size_t reclaim = cacheReclaimPending;
+    cacheReclaimPending = 0;
+    asm volatile("sti");
+    if (reclaim && cachingReclaim(reclaim) < reclaim)
+      elfImageReclaim(reclaim);
+
+    fsSyncMetadata();
+
+    // woken up early? there's too much dirty stuff lying around
+    uint64_t cutoff = timerTicks - MIN(timerTicks, cacheDirtyExpire);
+    if (cacheFlusherKicked)
+      cutoff = timerTicks;
+    cacheFlusherKicked = false;
+    cacheWriteback(cutoff);
+  }
+}
+
+size_t cachingReclaim(size_t pages) {
+  // might be called with the lock held (allocating from in here)
+  if (!spinlockTryAcquire(&LOCK_CACHE))
+    return 0;
+  size_t freed = cacheEvict(pages);
+  spinlockRelease(&LOCK_CACHE);
+  return freed;
+}
+
+void cachingReclaimAsync(size_t pages) {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  cacheReclaimPending += pages;
+  if (ints)
+    asm volatile("sti");
+
+  // waking it might have to wait on the queue's lock, so that's only done
+  // with interrupts on. otherwise it'll get to it on its next timeout
+  if (ints)
+    waitQueueWakeOne(&cacheFlusherWait);
+}
+
+size_t cachingInfoBlocks() { return cachePages; }
+
+size_t cachingInfoDirty() { return cacheDirtyPages; }
@@ -0,0 +1,102 @@
+#include <bootloader.h>
+#include <kstack.h>
+#include <paging.h>
+#include <pmm.h>
+#include <system.h>
+#include <util.h>
+
+// Kernel stacks (the ones syscalls & interrupts run on). They live in their own
+// region instead of the HHDM, so the page right below each of them can be left
+// unmapped: overflowing one faults instead of silently trashing whatever is
+// next to it. The region is carved into fixed slots (guard + stack), and freed
+// stacks are kept mapped on a small cache, since tasks come & go a lot.
+
+uint8_t kstackSlots[KSTACK_SLOTS / 8] = {0}; // which slots are taken
+size_t  kstackSlotHint = 0;                  // no free slot before this one
+
+size_t kstackCache = 0; // top of the first cached stack, linked through them
+size_t kstackCached = 0;
+
+Spinlock LOCK_KSTACK = ATOMIC_FLAG_INIT;
+
+#define KSTACK_SLOT_BASE(slot) (KERNEL_STACKS_START + (slot) * KSTACK_SLOT_SIZE)
+#define KSTACK_SLOT_OF(virt) (((virt) - KERNEL_STACKS_START) / KSTACK_SLOT_SIZE)
+
+// cached stacks store the next one at their very bottom
+#define KSTACK_CACHE_NEXT(top) (*(size_t *)((top) - KSTACK_SIZE))
+
+void initiateKernelStacks() {
+  // page directories copy the kernel's pml4, so it has to be there up front for
+  // every one of them to see the stacks
+  uint64_t *pml4 = GetPageDirectory();
+  size_t    index = PML4E(AMD64_MM_STRIPSX(KERNEL_STACKS_START));
+  if (pml4[index] & PF_PRESENT) {
+    debugf("[kstack] Region is already in use! pml4{%ld}\n", index);
+    panic();
+  }
+
+  size_t pdp = PhysicalAllocate(1);
+  memset((void *)(pdp + bootloader.hhdmOffset), 0, PAGE_SIZE);
+  pml4[index] = pdp | PF_PRESENT | PF_RW;
+}
+
+size_t KernelStackAllocate() {
+  spinlockAcquire(&LOCK_KSTACK);
+  if (kstackCache) {
+    size_t top = kstackCache;
+    kstackCache = KSTACK_CACHE_NEXT(top);
+    kstackCached--;
+    spinlockRelease(&LOCK_KSTACK);
+    return top;
+  }
+
+  size_t slot = kstackSlotHint;
+  while (slot < KSTACK_SLOTS && bitmapGenericGet(kstackSlots, slot))
+    slot++;
+  if (slot == KSTACK_SLOTS) {
+    debugf("[kstack] Ran out of kernel stacks!\n");
+    panic();
+  }
+  bitmapGenericSet(kstackSlots, slot, true);
+  kstackSlotHint = slot + 1;
+  spinlockRelease(&LOCK_KSTACK);
+
+  // physically contiguous, as drivers might dma to/from buffers on it
+  size_t base = KSTACK_SLOT_BASE(slot) + PAGE_SIZE; // guard stays unmapped
+  size_t phys = PhysicalAllocate(KSTACK_PAGES);
+  for (int i = 0; i < KSTACK_PAGES; i++)
+    VirtualMap(base + i * PAGE_SIZE, phys + i * PAGE_SIZE, PF_RW);
+
+  return base + KSTACK_SIZE;
+}
+
+void KernelStackFree(size_t top) {
+  spinlockAcquire(&LOCK_KSTACK);
+  if (kstackCached < KSTACK_CACHE_MAX) {
+    KSTACK_CACHE_NEXT(top) = kstackCache;
+    kstackCache = top;
+    kstackCached++;
+    spinlockRelease(&LOCK_KSTACK);
+    return;
+  }
+  spinlockRelease(&LOCK_KSTACK);
+
+  // mapping to 0 gives the frame back as well
+  size_t base = top - KSTACK_SIZE;
+  for (int i = 0; i < KSTACK_PAGES; i++)
+    VirtualMap(base + i * PAGE_SIZE, 0, 0);
+
+  size_t slot = KSTACK_SLOT_OF(base);
+  spinlockAcquire(&LOCK_KSTACK);
+  bitmapGenericSet(kstackSlots, slot, false);
+  if (slot < kstackSlotHint)
+    kstackSlotHint = slot;
+  spinlockRelease(&LOCK_KSTACK);
+}
+
+bool KernelStackGuard(size_t virt) {
+  if (virt < KERNEL_STACKS_START ||
+      virt >= KSTACK_SLOT_BASE((size_t)KSTACK_SLOTS))
+    return false;
+  return (virt - KERNEL_STACKS_START) % KSTACK_SLOT_SIZE < PAGE_SIZE;
+}
@@ -1,4 +1,5 @@
 #include <malloc_glue.h>
+#include <slab.h>
 #include <system.h>
 #include <util.h>
 #include <vmm.h>
@@ -57,3 +58,33 @@ int INITIAL_LOCK(Spinlock *lock) {
   RELEASE_LOCK(lock);
   return 0;
 }
+
+// the kernel's malloc family, see malloc_glue.h
+void *malloc(size_t size) { return dlmalloc(size); }
+
+void *calloc(size_t num, size_t size) { return dlcalloc(num, size); }
+
+void *memalign(size_t alignment, size_t size) {
+  return dlmemalign(alignment, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  SlabCache *cache = slabOwner(ptr);
+  if (!cache)
+    return dlrealloc(ptr, size);
+
+  if (size <= cache->size)
+    return ptr;
+  void *new = dlmalloc(size);
+  memcpy(new, ptr, cache->size);
+  slabFree(cache, ptr);
+  return new;
+}
+
+void free(void *ptr) {
+  SlabCache *cache = slabOwner(ptr);
+  if (cache)
+    slabFree(cache, ptr);
+  else
+    dlfree(ptr);
+}
@@ -1,10 +1,13 @@
 #include <bitmap.h>
 #include <bootloader.h>
+#include <elf.h>
 #include <fb.h>
 #include <limine.h>
+#include <linux.h>
 #include <malloc.h>
 #include <paging.h>
 #include <pmm.h>
+#include <shmem.h>
 #include <system.h>
 #include <task.h>
 #include <types.h>
@@ -25,6 +28,11 @@
 #define HHDMoffset (bootloader.hhdmOffset)
 uint64_t *globalPagedir = 0;
 
+// Mapped (as copy-on-write) on reads of demand-zero pages that weren't touched
+size_t pagingZeroPage = 0;
+
+size_t PagingPhysAllocate(bool wait);
+
 void initiatePaging() {
   // debugf("phys{%lx} virt{%lx}\n", bootloader.kernelPhysBase,
   //        bootloader.kernelVirtBase);
@@ -90,6 +98,8 @@ void initiatePaging() {
   uint64_t pdVirt = pdPhys + bootloader.hhdmOffset;
   globalPagedir = (uint64_t *)pdVirt;
 
+  pagingZeroPage = PagingPhysAllocate(true);
+
   // VirtualSeek(bootloader.hhdmOffset);
 }
 
@@ -154,10 +164,32 @@ uint64_t *GetTaskPageDirectory(void *taskPtr) {
   return ret;
 }
 
-void invalidate(uint64_t vaddr) { asm volatile("invlpg %0" ::"m"(vaddr)); }
+void invalidate(uint64_t vaddr) {
+  asm volatile("invlpg (%0)" ::"r"(vaddr) : "memory");
+}
+
+// past a point, a single cr3 reload beats invlpg'ing every page
+#define INVALIDATE_RANGE_MAX 32
+void VirtualInvalidateRange(size_t virt_addr, size_t pages) {
+  if (pages > INVALIDATE_RANGE_MAX) {
+    uint64_t cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    asm volatile("mov %0, %%cr3" ::"r"(cr3) : "memory");
+    return;
+  }
+  for (size_t i = 0; i < pages; i++)
+    invalidate(virt_addr + i * PAGE_SIZE);
+}
+
+// the framebuffer's frames aren't the PMM's to free
+static bool PagingFramebuffer(size_t phys) {
+  return phys >= fb.phys && phys < fb.phys + (fb.width * fb.height * 4);
+}
 
-size_t PagingPhysAllocate() {
-  size_t phys = PhysicalAllocate(1);
+size_t PagingPhysAllocate(bool wait) {
+  size_t phys = wait ? PhysicalAllocate(1) : PhysicalAllocateNoWait(1);
+  if (!phys)
+    return 0;
 
   void *virt = (void *)(phys + HHDMoffset);
   memset(virt, 0, PAGE_SIZE);
@@ -167,58 +199,73 @@ size_t PagingPhysAllocate() {
 
 SpinlockCnt WLOCK_PAGING = {0};
 
-void VirtualMap(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
-  VirtualMapL(globalPagedir, virt_addr, phys_addr, flags);
-}
-
-void VirtualMapL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
-                 uint64_t flags) {
-  if (virt_addr % PAGE_SIZE) {
-    debugf("[paging] Tried to map non-aligned address! virt{%lx} phys{%lx}\n",
-           virt_addr, phys_addr);
-    panic();
-  }
+// Same as VirtualPageEntryL(), but creates any missing page layers. Without
+// waiting, it returns 0 if the PMM is busy (WLOCK_PAGING should be held)
+size_t *VirtualPageEntryCreateL(uint64_t *pagedir, size_t virt_addr,
+                                bool wait) {
   virt_addr = AMD64_MM_STRIPSX(virt_addr);
 
-  if (!virt_addr)
-    debugf("[paging] WARNING! Mapping virt_addr{0}! phys{%lx}\n", phys_addr);
-
   uint32_t pml4_index = PML4E(virt_addr);
   uint32_t pdp_index = PDPTE(virt_addr);
   uint32_t pd_index = PDE(virt_addr);
   uint32_t pt_index = PTE(virt_addr);
 
-  spinlockCntWriteAcquire(&WLOCK_PAGING);
   if (!(pagedir[pml4_index] & PF_PRESENT)) {
-    size_t target = PagingPhysAllocate();
+    size_t target = PagingPhysAllocate(wait);
+    if (!target)
+      return 0;
     pagedir[pml4_index] = target | PF_PRESENT | PF_RW | PF_USER;
   }
   size_t *pdp = (size_t *)(PTE_GET_ADDR(pagedir[pml4_index]) + HHDMoffset);
 
   if (!(pdp[pdp_index] & PF_PRESENT)) {
-    size_t target = PagingPhysAllocate();
+    size_t target = PagingPhysAllocate(wait);
+    if (!target)
+      return 0;
     pdp[pdp_index] = target | PF_PRESENT | PF_RW | PF_USER;
   }
   size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[pdp_index]) + HHDMoffset);
 
   if (!(pd[pd_index] & PF_PRESENT)) {
-    size_t target = PagingPhysAllocate();
+    size_t target = PagingPhysAllocate(wait);
+    if (!target)
+      return 0;
     pd[pd_index] = target | PF_PRESENT | PF_RW | PF_USER;
   }
   size_t *pt = (size_t *)(PTE_GET_ADDR(pd[pd_index]) + HHDMoffset);
 
-  if (pt[pt_index] & PF_PRESENT &&
-      !(PTE_GET_ADDR(pt[pt_index]) >= fb.phys &&
-        PTE_GET_ADDR(pt[pt_index]) < fb.phys + (fb.width * fb.height * 4))) {
-    PhysicalFree(PTE_GET_ADDR(pt[pt_index]), 1);
+  return &pt[pt_index];
+}
+
+void VirtualMap(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
+  VirtualMapL(globalPagedir, virt_addr, phys_addr, flags);
+}
+
+void VirtualMapL(uint64_t *pagedir, uint64_t virt_addr, uint64_t phys_addr,
+                 uint64_t flags) {
+  if (virt_addr % PAGE_SIZE) {
+    debugf("[paging] Tried to map non-aligned address! virt{%lx} phys{%lx}\n",
+           virt_addr, phys_addr);
+    panic();
+  }
+  virt_addr = AMD64_MM_STRIPSX(virt_addr);
+
+  if (!virt_addr)
+    debugf("[paging] WARNING! Mapping virt_addr{0}! phys{%lx}\n", phys_addr);
+
+  spinlockCntWriteAcquire(&WLOCK_PAGING);
+  size_t *entry = VirtualPageEntryCreateL(pagedir, virt_addr, true);
+
+  if (*entry & PF_PRESENT && !PagingFramebuffer(PTE_GET_ADDR(*entry))) {
+    PhysicalFree(PTE_GET_ADDR(*entry), 1);
     // debugf("[paging] Overwrite (without unmapping) WARN! virt{%lx}
     // phys{%lx}\n",
     //        virt_addr, phys_addr);
   }
   if (!phys_addr) // todo: proper unmapping
-    pt[pt_index] = 0;
+    *entry = 0;
   else
-    pt[pt_index] = (P_PHYS_ADDR(phys_addr)) | PF_PRESENT | flags; // | PF_RW
+    *entry = (P_PHYS_ADDR(phys_addr)) | PF_PRESENT | flags; // | PF_RW
 
   invalidate(virt_addr);
   spinlockCntWriteRelease(&WLOCK_PAGING);
@@ -286,9 +333,245 @@ size_t VirtualToPhysical(size_t virt_addr) {
   return VirtualToPhysicalL(globalPagedir, virt_addr);
 }
 
-uint32_t VirtualUnmap(uint32_t virt_addr) {
-  // not really used anywhere atm, sooooo idc
-  return 0;
+// Walks the page layers without allocating any of them, so it returns 0 when
+// there's no page table for virt_addr (the entry itself might not be present)
+size_t *VirtualPageEntryL(uint64_t *pagedir, size_t virt_addr) {
+  virt_addr = AMD64_MM_STRIPSX(virt_addr);
+
+  if (!(pagedir[PML4E(virt_addr)] & PF_PRESENT))
+    return 0;
+  size_t *pdp =
+      (size_t *)(PTE_GET_ADDR(pagedir[PML4E(virt_addr)]) + HHDMoffset);
+
+  if (!(pdp[PDPTE(virt_addr)] & PF_PRESENT) || pdp[PDPTE(virt_addr)] & PF_PS)
+    return 0;
+  size_t *pd = (size_t *)(PTE_GET_ADDR(pdp[PDPTE(virt_addr)]) + HHDMoffset);
+
+  if (!(pd[PDE(virt_addr)] & PF_PRESENT) || pd[PDE(virt_addr)] & PF_PS)
+    return 0;
+  size_t *pt = (size_t *)(PTE_GET_ADDR(pd[PDE(virt_addr)]) + HHDMoffset);
+
+  return &pt[PTE(virt_addr)];
+}
+
+// Gives zeroed frames to every (non-present) page of a range, up front
+void VirtualPopulateL(uint64_t *pagedir, size_t virt_addr, size_t pages,
+                      uint64_t flags) {
+  for (size_t i = 0; i < pages; i++) {
+    spinlockCntWriteAcquire(&WLOCK_PAGING);
+    size_t *entry =
+        VirtualPageEntryCreateL(pagedir, virt_addr + i * PAGE_SIZE, true);
+    if (!(*entry & PF_PRESENT))
+      *entry = PagingPhysAllocate(true) | PF_PRESENT | flags;
+    spinlockCntWriteRelease(&WLOCK_PAGING);
+  }
+}
+
+// Called on write faults (and before writing to userland via the HHDM). As
+// it's ran from interrupt contexts, it can't wait on any locks; if they're
+// held, the faulting instruction will just have to try again.
+int VirtualCopyOnWrite(uint64_t *pagedir, size_t virt_addr) {
+  virt_addr &= ~0xFFF;
+  if (!spinlockCntWriteTryAcquire(&WLOCK_PAGING))
+    return FAULT_BUSY;
+
+  int     ret = FAULT_NONE;
+  size_t *entry = VirtualPageEntryL(pagedir, virt_addr);
+  if (!entry || !(*entry & PF_PRESENT) || !(*entry & PF_COW))
+    goto cleanup;
+
+  size_t phys = PhysicalUnshare(PTE_GET_ADDR(*entry));
+  if (!phys) {
+    ret = FAULT_BUSY;
+    goto cleanup;
+  }
+
+  *entry = phys | ((PTE_GET_FLAGS(*entry) & ~PF_COW) | PF_RW);
+  invalidate(virt_addr);
+  ret = FAULT_RESOLVED;
+
+cleanup:
+  spinlockCntWriteRelease(&WLOCK_PAGING);
+  return ret;
+}
+
+// Called on faults of non-present pages. Anonymous regions (mmap, brk) are
+// only recorded on the task's mappings and get their frames here, on first
+// touch. Reads are given the zero page, until they're written to (via COW).
+// Executables' regions get theirs from the image they were loaded from, and
+// shared ones from their SharedMemory.
+int VirtualDemandFault(void *taskPtr, size_t virt_addr, bool write) {
+  Task            *task = (Task *)taskPtr;
+  TaskInfoPagedir *info = task->infoPd;
+  virt_addr &= ~0xFFF;
+
+  // not looking at the task's own address space
+  if (task->pagedirOverride)
+    return FAULT_NONE;
+
+  if (!spinlockTryAcquire(&info->LOCK_PD))
+    return FAULT_BUSY;
+  UserspaceMapping *mapping = taskInfoPdMappingFind(info, virt_addr);
+  bool              onDemand = mapping && mapping->onDemand;
+  ElfImage         *image = onDemand ? mapping->image : 0;
+  size_t            imageBase = onDemand ? mapping->imageBase : 0;
+  SharedMemory     *shared = onDemand ? mapping->shared : 0;
+  int               prot = onDemand ? mapping->prot : PROT_NONE;
+  size_t            sharedPage = 0;
+  if (shared)
+    sharedPage = mapping->sharedPage +
+                 (virt_addr - (size_t)mapping->virt) / PAGE_SIZE;
+  spinlockRelease(&info->LOCK_PD);
+  if (!onDemand)
+    return FAULT_NONE;
+
+  // PROT_NONE, or writing where it's not allowed (see VirtualProtectEntry())
+  bool writable = prot & PROT_WRITE;
+  if (!(prot & (PROT_READ | PROT_WRITE | PROT_EXEC)) || (write && !writable))
+    return FAULT_NONE;
+  // (ints are off all the way through, so the image can't go away meanwhile)
+
+  if (!spinlockCntWriteTryAcquire(&WLOCK_PAGING))
+    return FAULT_BUSY;
+
+  int     ret = FAULT_BUSY;
+  size_t *entry = VirtualPageEntryCreateL(info->pagedir, virt_addr, false);
+  if (!entry)
+    goto cleanup;
+
+  if (*entry & PF_PRESENT) {
+    // another thread got here first
+    ret = FAULT_RESOLVED;
+    goto cleanup;
+  }
+
+  if (image) {
+    size_t phys = 0;
+    bool   shared = false;
+    ret = elfImagePage(image, virt_addr - imageBase, write, &phys, &shared);
+    if (ret == FAULT_RESOLVED)
+      *entry = phys | PF_PRESENT | PF_USER |
+               (writable ? (shared ? PF_COW : PF_RW) : 0);
+    goto cleanup;
+  }
+
+  if (shared) {
+    // everyone's the same frame, reads included (no zero page)
+    size_t phys = 0;
+    ret = sharedMemoryPage(shared, sharedPage, &phys);
+    if (ret == FAULT_RESOLVED)
+      *entry = phys | PF_PRESENT | PF_USER | PF_SHARED | (writable ? PF_RW : 0);
+    goto cleanup;
+  }
+
+  if (write) {
+    size_t phys = PagingPhysAllocate(false);
+    if (!phys)
+      goto cleanup;
+    *entry = phys | PF_PRESENT | PF_RW | PF_USER;
+  } else {
+    if (!PhysicalShareNoWait(pagingZeroPage))
+      goto cleanup;
+    *entry = pagingZeroPage | PF_PRESENT | PF_USER | (writable ? PF_COW : 0);
+  }
+  ret = FAULT_RESOLVED;
+
+cleanup:
+  spinlockCntWriteRelease(&WLOCK_PAGING);
+  return ret;
+}
+
+// Frees virt's page table if nothing's left on it, and its page directory
+// after it if that's empty too. pdp tables are never freed, as the pml4
+// entries pointing to them are copied around (see PageDirectoryAllocate())
+static void VirtualPruneL(uint64_t *pagedir, size_t virt_addr) {
+  virt_addr = AMD64_MM_STRIPSX(virt_addr);
+  if (!(pagedir[PML4E(virt_addr)] & PF_PRESENT))
+    return;
+  size_t *pdp =
+      (size_t *)(PTE_GET_ADDR(pagedir[PML4E(virt_addr)]) + HHDMoffset);
+
+  size_t *pdpEntry = &pdp[PDPTE(virt_addr)];
+  if (!(*pdpEntry & PF_PRESENT) || *pdpEntry & PF_PS)
+    return;
+  size_t *pd = (size_t *)(PTE_GET_ADDR(*pdpEntry) + HHDMoffset);
+
+  size_t *pdEntry = &pd[PDE(virt_addr)];
+  if (!(*pdEntry & PF_PRESENT) || *pdEntry & PF_PS)
+    return;
+  size_t *pt = (size_t *)(PTE_GET_ADDR(*pdEntry) + HHDMoffset);
+
+  for (int i = 0; i < 512; i++) {
+    if (pt[i])
+      return;
+  }
+  PhysicalFree(PTE_GET_ADDR(*pdEntry), 1);
+  *pdEntry = 0;
+
+  for (int i = 0; i < 512; i++) {
+    if (pd[i])
+      return;
+  }
+  PhysicalFree(PTE_GET_ADDR(*pdpEntry), 1);
+  *pdpEntry = 0;
+}
+
+// Userland pages of the range are dropped (along with their frames, if we were
+// the last ones using them) & page tables left empty get freed
+void VirtualUnmapL(uint64_t *pagedir, size_t virt_addr, size_t pages) {
+  size_t end = virt_addr + pages * PAGE_SIZE;
+  spinlockCntWriteAcquire(&WLOCK_PAGING);
+  for (size_t virt = virt_addr; virt < end; virt += PAGE_SIZE) {
+    size_t *entry = VirtualPageEntryL(pagedir, virt);
+    if (!entry) { // no page table, skip whatever it would've covered
+      virt = (virt & ~(PAGE_SIZE_LARGE - 1)) + PAGE_SIZE_LARGE - PAGE_SIZE;
+      continue;
+    }
+    if (!(*entry & PF_PRESENT) || !(*entry & (PF_USER | PF_PROTNONE)))
+      continue;
+    if (!PagingFramebuffer(PTE_GET_ADDR(*entry)))
+      PhysicalFree(PTE_GET_ADDR(*entry), 1);
+    *entry = 0;
+  }
+
+  for (size_t virt = virt_addr & ~(PAGE_SIZE_LARGE - 1); virt < end;
+       virt += PAGE_SIZE_LARGE)
+    VirtualPruneL(pagedir, virt);
+  VirtualInvalidateRange(virt_addr, pages); // (paging structure caches too)
+  spinlockCntWriteRelease(&WLOCK_PAGING);
+}
+
+// What a userland entry becomes under prot. Private pages are kept either
+// PF_RW or PF_COW while writable and neither while they're not, so giving
+// write access back never lets anyone write to a frame that's still shared
+// with someone else: the first write goes through VirtualCopyOnWrite()
+static size_t VirtualProtectEntry(size_t entry, int prot) {
+  entry = (entry & ~PF_PROTNONE) | PF_USER;
+  if (!(prot & (PROT_READ | PROT_WRITE | PROT_EXEC)))
+    return (entry & ~PF_USER) | PF_PROTNONE; // still ours, just unreachable
+  if (entry & PF_SHARED)
+    return prot & PROT_WRITE ? entry | PF_RW : entry & ~PF_RW;
+  if (!(prot & PROT_WRITE))
+    return entry & ~(PF_RW | PF_COW);
+  return entry & PF_RW ? entry : entry | PF_COW;
+}
+
+// Updates what's already mapped in place, nothing is faulted in
+void VirtualProtectL(uint64_t *pagedir, size_t virt_addr, size_t pages,
+                     int prot) {
+  size_t end = virt_addr + pages * PAGE_SIZE;
+  spinlockCntWriteAcquire(&WLOCK_PAGING);
+  for (size_t virt = virt_addr; virt < end; virt += PAGE_SIZE) {
+    size_t *entry = VirtualPageEntryL(pagedir, virt);
+    if (!entry) {
+      virt = (virt & ~(PAGE_SIZE_LARGE - 1)) + PAGE_SIZE_LARGE - PAGE_SIZE;
+      continue;
+    }
+    if (*entry & PF_PRESENT && *entry & (PF_USER | PF_PROTNONE))
+      *entry = VirtualProtectEntry(*entry, prot);
+  }
+  VirtualInvalidateRange(virt_addr, pages);
+  spinlockCntWriteRelease(&WLOCK_PAGING);
 }
 
 uint64_t *PageDirectoryAllocate() {
@@ -332,11 +615,12 @@ void PageDirectoryFree(uint64_t *page_dir) {
             continue;
 
           // we only free mappings related to userland (ones from ELF)
-          if (!(pt[pt_index] & PF_USER))
+          if (!(pt[pt_index] & (PF_USER | PF_PROTNONE)))
             continue;
 
           uint64_t phys = PTE_GET_ADDR(pt[pt_index]);
-          PhysicalFree(phys, 1);
+          if (!PagingFramebuffer(phys))
+            PhysicalFree(phys, 1);
           pt[pt_index] = 0;
         }
       }
@@ -346,6 +630,8 @@ void PageDirectoryFree(uint64_t *page_dir) {
   spinlockCntWriteRelease(&WLOCK_PAGING);
 }
 
+// Nothing is copied here! Private pages become read-only on both sides and
+// get their own frame on the first write (see VirtualCopyOnWrite())
 void PageDirectoryUserDuplicate(uint64_t *source, uint64_t *target) {
   spinlockCntReadAcquire(&WLOCK_PAGING);
   for (int pml4_index = 0; pml4_index < 512; pml4_index++) {
@@ -368,23 +654,27 @@ void PageDirectoryUserDuplicate(uint64_t *source, uint64_t *target) {
             continue;
 
           // we only duplicate mappings related to userland (ones from ELF)
-          if (!(pt[pt_index] & PF_USER))
+          if (!(pt[pt_index] & (PF_USER | PF_PROTNONE)))
             continue;
 
-          size_t physSource = PTE_GET_ADDR(pt[pt_index]);
-          size_t physTarget =
-              (pt[pt_index] & PF_SHARED) ? physSource : PagingPhysAllocate();
+          size_t phys = PTE_GET_ADDR(pt[pt_index]);
+          size_t flags = PTE_GET_FLAGS(pt[pt_index]) & ~(PF_ACCESS | PF_DIRTY);
 
           size_t virt =
               BITS_TO_VIRT_ADDR(pml4_index, pdp_index, pd_index, pt_index);
 
-          void *ptrSource = (void *)(physSource + HHDMoffset);
-          void *ptrTarget = (void *)(physTarget + HHDMoffset);
+          // writable private pages can no longer be written to directly
+          if (!(flags & PF_SHARED) && flags & PF_RW) {
+            flags = (flags & ~PF_RW) | PF_COW;
+            pt[pt_index] = phys | flags;
+            invalidate(virt);
+          }
 
-          memcpy(ptrTarget, ptrSource, PAGE_SIZE);
+          // the target is now an owner too
+          PhysicalShare(phys);
 
           spinlockCntReadRelease(&WLOCK_PAGING);
-          VirtualMapL(target, virt, physTarget, PF_RW | PF_USER);
+          VirtualMapL(target, virt, phys, flags);
           spinlockCntReadAcquire(&WLOCK_PAGING);
         }
       }
@@ -1,4 +1,6 @@
 #include <bootloader.h>
+#include <caching.h>
+#include <elf.h>
 #include <paging.h>
 #include <pmm.h>
 #include <system.h>
@@ -7,6 +9,118 @@
 
 // Physical memory space manager/allocator
 
+// Buddy allocator: free blocks of 2^order frames (aligned to their size) sit
+// on per-order lists, linked through the free frames themselves (via the
+// HHDM). Blocks are split on allocation and merged with their buddy (block ^
+// 2^order) on free, so both are O(log n). The bitmap is only used for laying
+// out the usable regions on boot.
+#define PMM_MAX_ORDER 16 // 256MiB, framebuffers & such go past 4MiB
+
+typedef struct PhysicalFreeBlock {
+  struct PhysicalFreeBlock *next;
+  struct PhysicalFreeBlock *prev;
+} PhysicalFreeBlock;
+
+PhysicalFreeBlock *physicalFreeLists[PMM_MAX_ORDER + 1] = {0};
+
+// (order + 1) of the free block starting at each frame, 0 if there is none
+uint8_t *physicalOrders = 0;
+
+// Extra owners of each frame (on top of the one that allocated it), used to
+// share userland pages between page directories (copy-on-write & such)
+uint32_t *physicalRefs = 0;
+
+#define BUDDY_PTR(block)                                                       \
+  ((PhysicalFreeBlock *)((block) * BLOCK_SIZE + bootloader.hhdmOffset))
+#define BUDDY_BLOCK(ptr) (((size_t)(ptr) - bootloader.hhdmOffset) / BLOCK_SIZE)
+
+void BuddyListAdd(size_t block, int order) {
+  PhysicalFreeBlock *free = BUDDY_PTR(block);
+  free->prev = 0;
+  free->next = physicalFreeLists[order];
+  if (free->next)
+    free->next->prev = free;
+  physicalFreeLists[order] = free;
+  physicalOrders[block] = order + 1;
+}
+
+void BuddyListRemove(size_t block, int order) {
+  PhysicalFreeBlock *free = BUDDY_PTR(block);
+  if (free->prev)
+    free->prev->next = free->next;
+  else
+    physicalFreeLists[order] = free->next;
+  if (free->next)
+    free->next->prev = free->prev;
+  physicalOrders[block] = 0;
+}
+
+// Gives a block back, merging it with its buddy for as long as that is free
+void BuddyFree(size_t block, int order) {
+  if (physicalOrders[block]) {
+    debugf("[pmm] Double free! block{%lx} order{%d}\n", block, order);
+    return;
+  }
+
+  while (order < PMM_MAX_ORDER) {
+    size_t buddy = block ^ (1UL << order);
+    if (buddy >= physical.BitmapSizeInBlocks ||
+        physicalOrders[buddy] != order + 1)
+      break;
+    BuddyListRemove(buddy, order);
+    block &= ~(1UL << order);
+    order++;
+  }
+
+  BuddyListAdd(block, order);
+}
+
+// Splits an arbitrary range into the biggest aligned blocks possible
+void BuddyFreeRange(size_t block, size_t blocks) {
+  while (blocks) {
+    int order = 0;
+    while (order < PMM_MAX_ORDER && !(block & (1UL << order)) &&
+           (2UL << order) <= blocks)
+      order++;
+    BuddyFree(block, order);
+    block += 1UL << order;
+    blocks -= 1UL << order;
+  }
+}
+
+size_t BuddyAllocate(size_t blocks) {
+  if (!blocks)
+    return INVALID_BLOCK;
+
+  int order = 0;
+  while ((1UL << order) < blocks)
+    order++;
+  if (order > PMM_MAX_ORDER)
+    return INVALID_BLOCK;
+
+  int found = order;
+  while (found <= PMM_MAX_ORDER && !physicalFreeLists[found])
+    found++;
+  if (found > PMM_MAX_ORDER)
+    return INVALID_BLOCK;
+
+  size_t block = BUDDY_BLOCK(physicalFreeLists[found]);
+  BuddyListRemove(block, found);
+
+  // split it down, giving back the upper halves
+  while (found > order) {
+    found--;
+    BuddyListAdd(block + (1UL << found), found);
+  }
+
+  // and whatever is over what we were asked for (non power of 2 sizes)
+  if ((1UL << order) > blocks)
+    BuddyFreeRange(block + blocks, (1UL << order) - blocks);
+
+  physical.allocatedSizeInBlocks += blocks;
+  return block;
+}
+
 void initiatePMM() {
   DS_Bitmap *bitmap = &physical; // pointer to pmm bitmap (used later)
   bitmap->ready = false;         // for bitmap dependency of vmm
@@ -14,20 +128,24 @@ void initiatePMM() {
   physical.BitmapSizeInBlocks = DivRoundUp(bootloader.mmTotal, BLOCK_SIZE);
   physical.BitmapSizeInBytes = DivRoundUp(physical.BitmapSizeInBlocks, 8);
 
+  size_t refsOffset = DivRoundUp(physical.BitmapSizeInBytes, 8) * 8;
+  size_t refsSize = physical.BitmapSizeInBlocks * sizeof(uint32_t);
+  size_t ordersOffset = refsOffset + refsSize;
+  size_t ordersSize = physical.BitmapSizeInBlocks * sizeof(uint8_t);
+  size_t metadataSize = ordersOffset + ordersSize;
+
   struct limine_memmap_entry *mm = 0;
 
   for (int i = 0; i < bootloader.mmEntryCnt; i++) {
     struct limine_memmap_entry *entry = bootloader.mmEntries[i];
-    if (entry->type != LIMINE_MEMMAP_USABLE ||
-        entry->length < physical.BitmapSizeInBytes)
+    if (entry->type != LIMINE_MEMMAP_USABLE || entry->length < metadataSize)
       continue;
     mm = entry;
     break;
   }
 
   if (!mm) {
-    debugf("[pmm] Not enough memory: required{%lx}!\n",
-           physical.BitmapSizeInBytes);
+    debugf("[pmm] Not enough memory: required{%lx}!\n", metadataSize);
     panic();
     return;
   }
@@ -36,6 +154,11 @@ void initiatePMM() {
   physical.Bitmap = (uint8_t *)(bitmapStartPhys + bootloader.hhdmOffset);
 
   memset(physical.Bitmap, 0xff, physical.BitmapSizeInBytes);
+
+  physicalRefs = (uint32_t *)((size_t)physical.Bitmap + refsOffset);
+  memset(physicalRefs, 0, refsSize);
+  physicalOrders = (uint8_t *)((size_t)physical.Bitmap + ordersOffset);
+  memset(physicalOrders, 0, ordersSize);
   for (int i = 0; i < bootloader.mmEntryCnt; i++) {
     struct limine_memmap_entry *entry = bootloader.mmEntries[i];
     if (entry->type == LIMINE_MEMMAP_USABLE)
@@ -47,7 +170,17 @@ void initiatePMM() {
       MarkRegion(bitmap, (void *)entry->base, entry->length, 1);
   }
 
-  MarkRegion(bitmap, (void *)bitmapStartPhys, physical.BitmapSizeInBytes, 1);
+  MarkRegion(bitmap, (void *)bitmapStartPhys, metadataSize, 1);
+
+  // hand every free run over to the buddy lists
+  size_t runStart = 0;
+  for (size_t block = 0; block <= physical.BitmapSizeInBlocks; block++) {
+    if (block < physical.BitmapSizeInBlocks && !BitmapGet(bitmap, block))
+      continue;
+    if (block > runStart)
+      BuddyFreeRange(runStart, block - runStart);
+    runStart = block + 1;
+  }
   physical.allocatedSizeInBlocks = 0;
 
   debugf("[pmm] Bitmap initiated: bitmapStartPhys{0x%lx} size{%lx}\n",
@@ -61,21 +194,123 @@ Spinlock LOCK_PMM = ATOMIC_FLAG_INIT;
 
 size_t PhysicalAllocate(int pages) {
   spinlockAcquire(&LOCK_PMM);
-  size_t phys = (size_t)BitmapAllocate(&physical, pages);
+  size_t block = BuddyAllocate(pages);
   spinlockRelease(&LOCK_PMM);
 
-  if (!phys) {
+  // let go of some of the page cache (or executable images) & try again
+  while (block == INVALID_BLOCK &&
+         (cachingReclaim(pages) || elfImageReclaim(pages))) {
+    spinlockAcquire(&LOCK_PMM);
+    block = BuddyAllocate(pages);
+    spinlockRelease(&LOCK_PMM);
+  }
+
+  if (block == INVALID_BLOCK) {
     debugf("[vmm::alloc] Physical kernel memory ran out!\n");
     panic();
   }
 
-  return phys;
+  return (size_t)ToPtr(&physical, block);
+}
+
+// Won't wait on the lock (for interrupt contexts), returning 0 if it's held or
+// if memory ran out
+size_t PhysicalAllocateNoWait(int pages) {
+  if (!spinlockTryAcquire(&LOCK_PMM))
+    return 0;
+  size_t block = BuddyAllocate(pages);
+  spinlockRelease(&LOCK_PMM);
+
+  // can't reclaim from in here, have the flusher do it & let them retry
+  if (block == INVALID_BLOCK) {
+    cachingReclaimAsync(pages);
+    return 0;
+  }
+
+  return (size_t)ToPtr(&physical, block);
 }
 
 void PhysicalFree(size_t ptr, int pages) {
-  // maybe verify no double-frees are occuring..
+  spinlockAcquire(&LOCK_PMM);
+  size_t base = ToBlock(&physical, (void *)ptr);
+  size_t end = base + pages;
+  if (end > physical.BitmapSizeInBlocks)
+    end = physical.BitmapSizeInBlocks; // not ours to manage (mmio & such)
+
+  // frames still used by someone else split the range up
+  size_t runStart = base;
+  for (size_t block = base; block <= end; block++) {
+    if (block < end && !physicalRefs[block])
+      continue;
+    if (block > runStart) {
+      BuddyFreeRange(runStart, block - runStart);
+      physical.allocatedSizeInBlocks -= block - runStart;
+    }
+    if (block < end)
+      physicalRefs[block]--;
+    runStart = block + 1;
+  }
+  spinlockRelease(&LOCK_PMM);
+}
+
+void PhysicalShareInner(size_t block) {
+  if (physicalRefs[block] == UINT32_MAX) {
+    debugf("[pmm] Frame shared too many times! block{%lx}\n", block);
+    panic();
+  }
+  physicalRefs[block]++;
+}
+
+// Adds an owner to a frame, which then needs an extra PhysicalFree() to go
+void PhysicalShare(size_t ptr) {
+  size_t block = ToBlock(&physical, (void *)ptr);
+  if (block >= physical.BitmapSizeInBlocks)
+    return; // not ours to manage (mmio & such)
 
   spinlockAcquire(&LOCK_PMM);
-  MarkRegion(&physical, (void *)ptr, pages * BLOCK_SIZE, 0);
+  PhysicalShareInner(block);
+  spinlockRelease(&LOCK_PMM);
+}
+
+bool PhysicalShareNoWait(size_t ptr) {
+  size_t block = ToBlock(&physical, (void *)ptr);
+  if (block >= physical.BitmapSizeInBlocks)
+    return true;
+
+  if (!spinlockTryAcquire(&LOCK_PMM))
+    return false;
+  PhysicalShareInner(block);
   spinlockRelease(&LOCK_PMM);
+  return true;
+}
+
+// Gives whoever is writing to a shared frame one of their own (with the old
+// contents) and drops their reference from the old one. If nobody else is
+// using it anymore, the same frame is simply handed back. Since it's called
+// from interrupt contexts it won't wait on the lock, returning 0 when busy
+// (or out of memory).
+size_t PhysicalUnshare(size_t ptr) {
+  if (!spinlockTryAcquire(&LOCK_PMM))
+    return 0;
+
+  size_t block = ToBlock(&physical, (void *)ptr);
+  if (block >= physical.BitmapSizeInBlocks || !physicalRefs[block]) {
+    spinlockRelease(&LOCK_PMM);
+    return ptr; // we're the last ones left
+  }
+
+  // out of memory, the fault gets retried once the flusher's made some room
+  size_t newBlock = BuddyAllocate(1);
+  if (newBlock == INVALID_BLOCK) {
+    spinlockRelease(&LOCK_PMM);
+    cachingReclaimAsync(1);
+    return 0;
+  }
+  size_t new = (size_t)ToPtr(&physical, newBlock);
+  physicalRefs[block]--;
+  spinlockRelease(&LOCK_PMM);
+
+  memcpy((void *)(new + bootloader.hhdmOffset),
+         (void *)(ptr + bootloader.hhdmOffset), BLOCK_SIZE);
+  return new;
 }
@@ -0,0 +1,69 @@
+#include <bootloader.h>
+#include <malloc.h>
+#include <paging.h>
+#include <pmm.h>
+#include <shmem.h>
+#include <util.h>
+
+// Shared anonymous memory. The object holds a reference to each of its frames
+// and every page table entry pointing to one holds another, so a frame sticks
+// around for as long as anyone has it mapped (munmap() included) and the
+// whole thing goes once the last mapping of it does
+
+SharedMemory *sharedMemoryAllocate(size_t pages) {
+  SharedMemory *shm = calloc(sizeof(SharedMemory), 1);
+  shm->refs = 1;
+  shm->pages = pages;
+  shm->frames = calloc(sizeof(size_t), pages);
+  return shm;
+}
+
+void sharedMemoryHold(SharedMemory *shm) {
+  spinlockAcquire(&shm->LOCK_SHM);
+  shm->refs++;
+  spinlockRelease(&shm->LOCK_SHM);
+}
+
+void sharedMemoryRelease(SharedMemory *shm) {
+  spinlockAcquire(&shm->LOCK_SHM);
+  assert(shm->refs);
+  shm->refs--;
+  bool last = !shm->refs;
+  spinlockRelease(&shm->LOCK_SHM);
+  if (!last)
+    return;
+
+  // whoever still has them mapped keeps them alive
+  for (size_t i = 0; i < shm->pages; i++) {
+    if (shm->frames[i])
+      PhysicalFree(shm->frames[i], 1);
+  }
+  free(shm->frames);
+  free(shm);
+}
+
+int sharedMemoryPage(SharedMemory *shm, size_t index, size_t *phys) {
+  if (index >= shm->pages)
+    return FAULT_NONE;
+  if (!spinlockTryAcquire(&shm->LOCK_SHM))
+    return FAULT_BUSY;
+
+  int ret = FAULT_BUSY;
+  if (!shm->frames[index]) {
+    size_t frame = PhysicalAllocateNoWait(1);
+    if (!frame)
+      goto cleanup;
+    memset((void *)(frame + bootloader.hhdmOffset), 0, PAGE_SIZE);
+    shm->frames[index] = frame;
+  }
+
+  // the mapping's own reference
+  if (!PhysicalShareNoWait(shm->frames[index]))
+    goto cleanup;
+  *phys = shm->frames[index];
+  ret = FAULT_RESOLVED;
+
+cleanup:
+  spinlockRelease(&shm->LOCK_SHM);
+  return ret;
+}
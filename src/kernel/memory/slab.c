@@ -0,0 +1,208 @@
+#include <bootloader.h>
+#include <malloc.h>
+#include <pmm.h>
+#include <slab.h>
+#include <system.h>
+#include <util.h>
+#include <vmm.h>
+
+// Slab allocator for small, fixed-size kernel objects (tasks, open files, list
+// & tree nodes, network buffers..). Each cache carves SLAB_SIZE blocks from the
+// PMM into equally sized objects and keeps them on a free list, so allocating
+// or freeing one is a couple of pointer swaps under the cache's own lock
+// instead of going through dlmalloc's global one. The slab header lives at the
+// (naturally aligned) start of the block, so an object's slab is just its
+// address rounded down. A bitmap over the physical frames tells slab blocks
+// apart from everything else, so a plain free() can hand them back as well.
+
+#define SLAB_HEADER (DivRoundUp(sizeof(Slab), SLAB_ALIGN) * SLAB_ALIGN)
+#define SLAB_OF(ptr) ((Slab *)((size_t)(ptr) & ~((size_t)SLAB_SIZE - 1)))
+
+DS_Bitmap slabFrames = {0}; // first frame of every slab
+
+SlabCache *slabCaches = 0; // ones that have been used at least once
+Spinlock   LOCK_SLAB_GLOBAL = ATOMIC_FLAG_INIT;
+
+// generic size classes, see slabMalloc()
+SlabCache slabGeneric[] = {
+    SLAB_CACHE("generic-32", 32, 0),     SLAB_CACHE("generic-64", 64, 0),
+    SLAB_CACHE("generic-96", 96, 0),     SLAB_CACHE("generic-128", 128, 0),
+    SLAB_CACHE("generic-192", 192, 0),   SLAB_CACHE("generic-256", 256, 0),
+    SLAB_CACHE("generic-512", 512, 0),   SLAB_CACHE("generic-1024", 1024, 0),
+    SLAB_CACHE("generic-2048", 2048, 0),
+};
+
+void initiateSlab() {
+  slabFrames.ready = false;
+  slabFrames.mem_start = bootloader.hhdmOffset;
+  slabFrames.BitmapSizeInBlocks = physical.BitmapSizeInBlocks;
+  slabFrames.BitmapSizeInBytes = DivRoundUp(slabFrames.BitmapSizeInBlocks, 8);
+
+  slabFrames.Bitmap = (uint8_t *)VirtualAllocate(
+      DivRoundUp(slabFrames.BitmapSizeInBytes, BLOCK_SIZE));
+  memset(slabFrames.Bitmap, 0, slabFrames.BitmapSizeInBytes);
+
+  slabFrames.ready = true;
+}
+
+// everything below (up until slabCreate()) assumes cache->LOCK_SLAB is held
+static Slab **slabList(SlabCache *cache, Slab *slab) {
+  if (!slab->used)
+    return &cache->empty;
+  if (slab->used == slab->total)
+    return &cache->full;
+  return &cache->partial;
+}
+
+static void slabListAdd(SlabCache *cache, Slab *slab) {
+  Slab **list = slabList(cache, slab);
+  slab->prev = 0;
+  slab->next = *list;
+  if (slab->next)
+    slab->next->prev = slab;
+  *list = slab;
+  if (!slab->used)
+    cache->emptyCnt++;
+}
+
+static void slabListRemove(SlabCache *cache, Slab *slab) {
+  Slab **list = slabList(cache, slab);
+  if (slab->prev)
+    slab->prev->next = slab->next;
+  else
+    *list = slab->next;
+  if (slab->next)
+    slab->next->prev = slab->prev;
+  if (!slab->used)
+    cache->emptyCnt--;
+}
+
+static Slab *slabCreate(SlabCache *cache) {
+  size_t phys = PhysicalAllocate(SLAB_PAGES);
+  Slab  *slab = (Slab *)(phys + bootloader.hhdmOffset);
+  slab->next = 0;
+  slab->prev = 0;
+  slab->cache = cache;
+  slab->used = 0;
+  slab->total = (SLAB_SIZE - SLAB_HEADER) / cache->size;
+
+  // lay the free list out in address order
+  void **last = &slab->freeList;
+  for (uint32_t i = 0; i < slab->total; i++) {
+    void *obj = (void *)((size_t)slab + SLAB_HEADER + i * cache->size);
+    *last = obj;
+    last = (void **)obj;
+  }
+  *last = 0;
+
+  spinlockAcquire(&LOCK_SLAB_GLOBAL);
+  BitmapSet(&slabFrames, phys / BLOCK_SIZE, true);
+  if (!cache->registered) {
+    cache->registered = true;
+    cache->next = slabCaches;
+    slabCaches = cache;
+  }
+  spinlockRelease(&LOCK_SLAB_GLOBAL);
+
+  return slab;
+}
+
+static void slabDestroy(Slab *slab) {
+  size_t phys = (size_t)slab - bootloader.hhdmOffset;
+
+  spinlockAcquire(&LOCK_SLAB_GLOBAL);
+  BitmapSet(&slabFrames, phys / BLOCK_SIZE, false);
+  spinlockRelease(&LOCK_SLAB_GLOBAL);
+
+  PhysicalFree(phys, SLAB_PAGES);
+}
+
+static void *slabAllocRaw(SlabCache *cache) {
+  spinlockAcquire(&cache->LOCK_SLAB);
+  while (!cache->partial && !cache->empty) {
+    // the pmm might reclaim stuff (& free() into us), so not under our lock
+    spinlockRelease(&cache->LOCK_SLAB);
+    Slab *fresh = slabCreate(cache);
+    spinlockAcquire(&cache->LOCK_SLAB);
+    slabListAdd(cache, fresh);
+    cache->slabs++;
+  }
+
+  Slab *slab = cache->partial ? cache->partial : cache->empty;
+  slabListRemove(cache, slab);
+  void *obj = slab->freeList;
+  slab->freeList = *(void **)obj;
+  slab->used++;
+  slabListAdd(cache, slab);
+  cache->objects++;
+  spinlockRelease(&cache->LOCK_SLAB);
+
+  return obj;
+}
+
+// zeroed out & ready to go (via the constructor, if there is one)
+void *slabAlloc(SlabCache *cache) {
+  void *obj = slabAllocRaw(cache);
+  memset(obj, 0, cache->size);
+  if (cache->ctor)
+    cache->ctor(obj);
+  return obj;
+}
+
+void slabFree(SlabCache *cache, void *ptr) {
+  if (!ptr)
+    return;
+
+  Slab *slab = SLAB_OF(ptr);
+  if (slab->cache != cache) {
+    debugf("[slab] Bad free! cache{%s} ptr{%lx}\n", cache->name, ptr);
+    panic();
+  }
+
+  Slab *trim = 0;
+
+  spinlockAcquire(&cache->LOCK_SLAB);
+  slabListRemove(cache, slab);
+  *(void **)ptr = slab->freeList;
+  slab->freeList = ptr;
+  slab->used--;
+  cache->objects--;
+  if (!slab->used && cache->emptyCnt >= SLAB_EMPTY_MAX) {
+    trim = slab; // plenty of empty ones around already
+    cache->slabs--;
+  } else
+    slabListAdd(cache, slab);
+  spinlockRelease(&cache->LOCK_SLAB);
+
+  if (trim)
+    slabDestroy(trim);
+}
+
+void *slabMalloc(size_t size) {
+  for (size_t i = 0; i < sizeof(slabGeneric) / sizeof(slabGeneric[0]); i++) {
+    if (size <= slabGeneric[i].size)
+      return slabAllocRaw(&slabGeneric[i]);
+  }
+  return malloc(size);
+}
+
+SlabCache *slabOwner(void *ptr) {
+  if (!slabFrames.ready || (size_t)ptr < bootloader.hhdmOffset)
+    return 0;
+
+  size_t block = ToBlock(&slabFrames, SLAB_OF(ptr));
+  if (block >= slabFrames.BitmapSizeInBlocks ||
+      !BitmapGet(&slabFrames, block))
+    return 0;
+
+  return SLAB_OF(ptr)->cache;
+}
+
+size_t slabInfoPages() {
+  size_t pages = 0;
+  spinlockAcquire(&LOCK_SLAB_GLOBAL);
+  for (SlabCache *browse = slabCaches; browse; browse = browse->next)
+    pages += browse->slabs * SLAB_PAGES;
+  spinlockRelease(&LOCK_SLAB_GLOBAL);
+  return pages;
+}
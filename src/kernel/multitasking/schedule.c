@@ -1,4 +1,5 @@
 #include <bootloader.h>
+#include <fpu.h>
 #include <gdt.h>
 #include <isr.h>
 #include <malloc.h>
@@ -17,72 +18,144 @@
 
 extern TSSPtr *tssPtr;
 
+// Runnable tasks, in a circular list. Tasks that stopped being ready are only
+// dropped once the scheduler comes across them (or switches away from them),
+// so putting them back via schedWake() is all that's needed to wake one up.
+Task *schedReady = 0;
+
+bool schedHasWork() { return schedReady != 0; }
+
+// ints have to be off for all of the queue helpers below
+static void schedReadyAdd(Task *task) {
+  if (task->readyQueued)
+    return;
+  task->readyQueued = true;
+  if (!schedReady) {
+    task->readyNext = task;
+    task->readyPrev = task;
+    schedReady = task;
+    return;
+  }
+
+  // at the back of the line (right before the head)
+  task->readyNext = schedReady;
+  task->readyPrev = schedReady->readyPrev;
+  schedReady->readyPrev->readyNext = task;
+  schedReady->readyPrev = task;
+}
+
+static void schedReadyRemove(Task *task) {
+  if (!task->readyQueued)
+    return;
+  task->readyQueued = false;
+  if (task->readyNext == task) {
+    schedReady = 0;
+    return;
+  }
+
+  task->readyPrev->readyNext = task->readyNext;
+  task->readyNext->readyPrev = task->readyPrev;
+  if (schedReady == task)
+    schedReady = task->readyNext;
+}
+
+// forcefulWakeupTimeUnsafe went off (from the timer interrupt)
+static void schedTimeout(void *ctx) {
+  Task *task = (Task *)ctx;
+  // no race! the task has to already have been suspended to end up here
+  if (task->state == TASK_STATE_READY || !task->forcefulWakeupTimeUnsafe ||
+      task->forcefulWakeupTimeUnsafe > timerNanos())
+    return;
+  task->state = TASK_STATE_READY;
+  task->extras |= EXTRAS_INVOLUTARY_WAKEUP;
+  task->forcefulWakeupTimeUnsafe = 0;
+  // ^ is here to avoid interference with future statuses
+  schedReadyAdd(task);
+}
+
+// back to the syscall handler which returns -EINTR (& handles the signal)
+static bool schedRevive(Task *task) {
+  if (task->state == TASK_STATE_READY ||
+      !signalsRevivableState(task->state) || !signalsPendingQuick(task))
+    return false;
+  task->extras |= EXTRAS_INVOLUTARY_WAKEUP;
+  task->forcefulWakeupTimeUnsafe = 0; // needed
+  task->state = TASK_STATE_READY;
+  schedReadyAdd(task);
+  timerDisarm(&task->sleepTimer);
+  return true;
+}
+
+void schedWake(Task *task) {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  // late wakeups can't bring back whoever's dying (the reaper handles those)
+  if (task->state != TASK_STATE_DEAD &&
+      task->state != TASK_STATE_SIGKILLED) {
+    task->state = TASK_STATE_READY;
+    schedReadyAdd(task);
+    timerDisarm(&task->sleepTimer);
+  }
+  if (ints)
+    asm volatile("sti");
+}
+
+void schedSignalWake(Task *task) {
+  if (task == currentTask)
+    return; // will get caught when switching away
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  if (schedRevive(task))
+    assert(task->registers.cs & GDT_KERNEL_CODE);
+  if (ints)
+    asm volatile("sti");
+}
+
+void schedRemove(Task *task) {
+  bool ints = checkInterrupts();
+  asm volatile("cli");
+  schedReadyRemove(task);
+  timerDisarm(&task->sleepTimer);
+  if (ints)
+    asm volatile("sti");
+}
+
 void schedule(uint64_t rsp) {
   if (!tasksInitiated)
     return;
 
-  // try to find a next task
   AsmPassedInterrupt *cpu = (AsmPassedInterrupt *)rsp;
-  Task               *next = currentTask->next;
-  if (!next)
-    next = firstTask;
-
-  int fullRun = 0;
-  while (next->state != TASK_STATE_READY) {
-    if (signalsRevivableState(next->state) && signalsPendingQuick(next)) {
-      // back to the syscall handler which returns -EINTR (& handles the signal)
-      assert(next->registers.cs & GDT_KERNEL_CODE);
-      next->extras |= EXTRAS_INVOLUTARY_WAKEUP;
-      next->forcefulWakeupTimeUnsafe = 0; // needed
-      next->state = TASK_STATE_READY;
-      break;
-    }
-    if (next->forcefulWakeupTimeUnsafe &&
-        next->forcefulWakeupTimeUnsafe <= timerTicks) {
-      // no race! the task has to already have been suspended to end up here
-      next->state = TASK_STATE_READY;
-      next->extras |= EXTRAS_INVOLUTARY_WAKEUP;
-      next->forcefulWakeupTimeUnsafe = 0;
-      // ^ is here to avoid interference with future statuses
-      break;
-    }
-    next = next->next;
-    if (!next) {
-      fullRun++;
-      if (fullRun > 2)
-        break;
-      next = firstTask;
-    }
+  Task               *old = currentTask;
+
+  // the old one is going to sleep (or got revived right as it tried to)
+  bool asleep = old != dummyTask && old->state != TASK_STATE_READY;
+  if (asleep && !schedRevive(old)) {
+    schedReadyRemove(old);
+    if (old->forcefulWakeupTimeUnsafe)
+      timerArm(&old->sleepTimer, old->forcefulWakeupTimeUnsafe, schedTimeout,
+               old);
+  }
+
+  // try to find a next task
+  Task *next = old->readyQueued ? old->readyNext : schedReady;
+  while (next && next->state != TASK_STATE_READY) {
+    Task *after = next->readyNext;
+    schedReadyRemove(next);
+    next = schedReady ? after : 0;
   }
 
   // found no task
   if (!next)
     next = dummyTask;
 
-  Task *old = currentTask;
-
   currentTask = next;
 
-  if (old->state != TASK_STATE_READY && old->spinlockQueueEntry) {
+  if (asleep && old->spinlockQueueEntry) {
     // taskSpinlockExit(). maybe also todo on exit cleanup
     spinlockRelease(old->spinlockQueueEntry);
     old->spinlockQueueEntry = 0;
   }
 
-  if (!next->kernel_task) {
-    // per-process timers
-    uint64_t rtAt = atomicRead64(&next->infoSignals->itimerReal.at);
-    uint64_t rtReset = atomicRead64(&next->infoSignals->itimerReal.reset);
-    if (rtAt && rtAt <= timerTicks) {
-      // issue signal
-      atomicBitmapSet(&next->sigPendingList, SIGALRM);
-      if (!rtReset)
-        atomicWrite64(&next->infoSignals->itimerReal.at, 0);
-      else
-        atomicWrite64(&next->infoSignals->itimerReal.at, timerTicks + rtReset);
-    }
-  }
-
 #if SCHEDULE_DEBUG
   // if (old->id != 0 || next->id != 0)
   debugf("[scheduler] Switching context: id{%d} -> id{%d}\n", old->id,
@@ -101,6 +174,11 @@ void schedule(uint64_t rsp) {
     }
   }
 
+  // CPU time accounting (CLOCK_*_CPUTIME_ID)
+  uint64_t now = timerNanos();
+  old->cpuNanos += now - old->cpuSince;
+  next->cpuSince = now;
+
   // Change TSS rsp0 (software multitasking)
   tssPtr->rsp0 = next->whileTssRsp;
   threadInfo.syscall_stack = next->whileSyscallRsp;
@@ -123,16 +201,8 @@ void schedule(uint64_t rsp) {
   // Apply pagetable (not needed!)
   // ChangePageDirectoryUnsafe(next->pagedir);
 
-  // Save & load appropriate FPU state
-  if (!old->kernel_task) {
-    asm volatile(" fxsave %0 " ::"m"(old->fpuenv));
-    asm("stmxcsr (%%rax)" : : "a"(&old->mxcsr));
-  }
-
-  if (!next->kernel_task) {
-    asm volatile(" fxrstor %0 " ::"m"(next->fpuenv));
-    asm("ldmxcsr (%%rax)" : : "a"(&next->mxcsr));
-  }
+  // FPU state is only swapped once next actually uses it (see cpu/fpu.c)
+  fpuSchedule(next);
 
   // Cleanup any old tasks left dead (not needed!)
   // if (old->state == TASK_STATE_DEAD)
@@ -151,6 +221,8 @@ void schedule(uint64_t rsp) {
   uint64_t *pagedir =
       next->pagedirOverride ? next->pagedirOverride : next->infoPd->pagedir;
   ChangePageDirectoryFake(pagedir);
+  // next timer interrupt: end of the time slice or the next timer (if idle)
+  timerSetDeadline(next == dummyTask);
   // ^ just for globalPagedir to update (note potential race cond)
   asm_finalize((size_t)iretqRsp, VirtualToPhysical((size_t)pagedir));
 }
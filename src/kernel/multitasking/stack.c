@@ -4,6 +4,7 @@
 #include <string.h>
 #include <system.h>
 #include <util.h>
+#include <vdso.h>
 
 // Stack creation for userland & kernelspace tasks
 
@@ -96,6 +97,9 @@ void stackGenerateUser(Task *target, uint32_t argc, char **argv, uint32_t envc,
   // aux: AT_NULL
   PUSH_TO_STACK(target->registers.usermode_rsp, size_t, (size_t)0);
   PUSH_TO_STACK(target->registers.usermode_rsp, size_t, (size_t)0);
+  // aux: AT_SYSINFO_EHDR
+  PUSH_TO_STACK(target->registers.usermode_rsp, size_t, (size_t)VDSO_BASE);
+  PUSH_TO_STACK(target->registers.usermode_rsp, uint64_t, AT_SYSINFO_EHDR);
   // aux: AT_RANDOM
   PUSH_TO_STACK(target->registers.usermode_rsp, size_t,
                 (size_t)randomByteStart);
@@ -1,12 +1,15 @@
+#include <fpu.h>
 #include <gdt.h>
 #include <isr.h>
 #include <kernel_helper.h>
+#include <kstack.h>
 #include <linked_list.h>
 #include <linux.h>
 #include <malloc.h>
 #include <paging.h>
 #include <pmm.h>
 #include <schedule.h>
+#include <slab.h>
 #include <stack.h>
 #include <string.h>
 #include <syscalls.h>
@@ -18,6 +21,8 @@
 
 SpinlockCnt TASK_LL_MODIFY = {0};
 
+SlabCache taskCache = SLAB_CACHE("task", sizeof(Task), 0);
+
 void taskAttachDefTermios(Task *task) {
   memset(&task->term, 0, sizeof(termios));
   task->term.c_iflag = BRKINT | ICRNL | INPCK | ISTRIP | IXON;
@@ -44,11 +49,131 @@ void taskAttachDefTermios(Task *task) {
   }
 }
 
+// indices, see task.h. the id chains are kept sorted so /proc can resume
+// listing from wherever it left off
+Task *taskIdHash[TASK_HASH_SIZE] = {0};
+Task *taskPgrpHash[TASK_HASH_SIZE] = {0};
+Task *taskSessionHash[TASK_HASH_SIZE] = {0};
+
+static void taskIdLink(Task *task) {
+  Task **link = &taskIdHash[TASK_HASH(task->id)];
+  while (*link && (*link)->id < task->id)
+    link = &(*link)->idNext;
+  task->idNext = *link;
+  *link = task;
+}
+
+static void taskIdUnlink(Task *task) {
+  Task **link = &taskIdHash[TASK_HASH(task->id)];
+  while (*link && *link != task)
+    link = &(*link)->idNext;
+  assert(*link);
+  *link = task->idNext;
+  task->idNext = 0;
+}
+
+static void taskPgrpLink(Task *task) {
+  Task **head = &taskPgrpHash[TASK_HASH(task->pgid)];
+  task->pgrpPrev = 0;
+  task->pgrpNext = *head;
+  if (*head)
+    (*head)->pgrpPrev = task;
+  *head = task;
+}
+
+static void taskPgrpUnlink(Task *task) {
+  if (task->pgrpPrev)
+    task->pgrpPrev->pgrpNext = task->pgrpNext;
+  else
+    taskPgrpHash[TASK_HASH(task->pgid)] = task->pgrpNext;
+  if (task->pgrpNext)
+    task->pgrpNext->pgrpPrev = task->pgrpPrev;
+  task->pgrpNext = 0;
+  task->pgrpPrev = 0;
+}
+
+static void taskSessionLink(Task *task) {
+  Task **head = &taskSessionHash[TASK_HASH(task->sid)];
+  task->sessionPrev = 0;
+  task->sessionNext = *head;
+  if (*head)
+    (*head)->sessionPrev = task;
+  *head = task;
+}
+
+static void taskSessionUnlink(Task *task) {
+  if (task->sessionPrev)
+    task->sessionPrev->sessionNext = task->sessionNext;
+  else
+    taskSessionHash[TASK_HASH(task->sid)] = task->sessionNext;
+  if (task->sessionNext)
+    task->sessionNext->sessionPrev = task->sessionPrev;
+  task->sessionNext = 0;
+  task->sessionPrev = 0;
+}
+
+void taskSetId(Task *task, uint32_t id) {
+  spinlockCntWriteAcquire(&TASK_LL_MODIFY);
+  taskIdUnlink(task);
+  task->id = id;
+  taskIdLink(task);
+  spinlockCntWriteRelease(&TASK_LL_MODIFY);
+}
+
+void taskSetPgid(Task *task, int pgid) {
+  spinlockCntWriteAcquire(&TASK_LL_MODIFY);
+  taskPgrpUnlink(task);
+  task->pgid = pgid;
+  taskPgrpLink(task);
+  spinlockCntWriteRelease(&TASK_LL_MODIFY);
+}
+
+void taskSetSid(Task *task, int sid) {
+  spinlockCntWriteAcquire(&TASK_LL_MODIFY);
+  taskSessionUnlink(task);
+  task->sid = sid;
+  taskSessionLink(task);
+  spinlockCntWriteRelease(&TASK_LL_MODIFY);
+}
+
+// buckets are shared between groups, hence the filtering
+Task *taskPgrpFirst(int pgid) {
+  Task *browse = taskPgrpHash[TASK_HASH(pgid)];
+  while (browse && browse->pgid != pgid)
+    browse = browse->pgrpNext;
+  return browse;
+}
+
+Task *taskPgrpNext(Task *task) {
+  Task *browse = task->pgrpNext;
+  while (browse && browse->pgid != task->pgid)
+    browse = browse->pgrpNext;
+  return browse;
+}
+
+Task *taskSessionFirst(int sid) {
+  Task *browse = taskSessionHash[TASK_HASH(sid)];
+  while (browse && browse->sid != sid)
+    browse = browse->sessionNext;
+  return browse;
+}
+
+Task *taskSessionNext(Task *task) {
+  Task *browse = task->sessionNext;
+  while (browse && browse->sid != task->sid)
+    browse = browse->sessionNext;
+  return browse;
+}
+
 // although there are locks on these two functions, they are EXTREMELY unsafe!
-Task *taskListAllocate() {
+Task *taskListAllocate(uint32_t id) {
   spinlockCntWriteAcquire(&TASK_LL_MODIFY);
-  Task *target = (Task *)malloc(sizeof(Task));
-  memset(target, 0, sizeof(Task)); // TASK_STATE_DEAD is 0 too
+  Task *target = slabAlloc(&taskCache); // TASK_STATE_DEAD is 0 too
+  target->id = id;
+  taskIdLink(target);
+  taskPgrpLink(target); // pgid & sid are 0 until they get set
+  taskSessionLink(target);
+
   asm volatile("cli");
   Task *browse = firstTask;
   while (browse) {
@@ -67,6 +192,10 @@ Task *taskListAllocate() {
 // will NEVER be the first one
 void taskListDestroy(Task *target) {
   spinlockCntWriteAcquire(&TASK_LL_MODIFY);
+  taskIdUnlink(target);
+  taskPgrpUnlink(target);
+  taskSessionUnlink(target);
+
   asm volatile("cli");
   Task *prev = firstTask;
   while (prev) {
@@ -79,12 +208,14 @@ void taskListDestroy(Task *target) {
   prev->next = target->next;
   asm volatile("sti");
   spinlockCntWriteRelease(&TASK_LL_MODIFY);
-  free(target); // finally, destroy it
+  schedRemove(target);
+  fpuFree(target);
+  slabFree(&taskCache, target); // finally, destroy it
 }
 
 Task *taskCreate(uint32_t id, uint64_t rip, bool kernel_task, uint64_t *pagedir,
                  uint32_t argc, char **argv) {
-  Task *target = taskListAllocate();
+  Task *target = taskListAllocate(id);
 
   uint64_t code_selector =
       kernel_task ? GDT_KERNEL_CODE : (GDT_USER_CODE | DPL_USER);
@@ -99,9 +230,8 @@ Task *taskCreate(uint32_t id, uint64_t rip, bool kernel_task, uint64_t *pagedir,
   target->registers.rflags = 0x200; // enable interrupts
   target->registers.rip = rip;
 
-  target->id = id;
   target->tgid = id;
-  target->sid = 1; // to dummy
+  taskSetSid(target, 1); // to dummy
   target->ctrlPty = -1;
   target->kernel_task = kernel_task;
   target->state = TASK_STATE_CREATED; // TASK_STATE_READY
@@ -109,15 +239,8 @@ Task *taskCreate(uint32_t id, uint64_t rip, bool kernel_task, uint64_t *pagedir,
   target->infoPd = taskInfoPdAllocate(false);
   target->infoPd->pagedir = pagedir; // no lock cause only we use it
 
-  void  *tssRsp = VirtualAllocate(USER_STACK_PAGES);
-  size_t tssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(tssRsp, 0, tssRspSize);
-  target->whileTssRsp = (uint64_t)tssRsp + tssRspSize;
-
-  void  *syscalltssRsp = VirtualAllocate(USER_STACK_PAGES);
-  size_t syscalltssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(syscalltssRsp, 0, syscalltssRspSize);
-  target->whileSyscallRsp = (uint64_t)syscalltssRsp + syscalltssRspSize;
+  target->whileTssRsp = KernelStackAllocate();
+  target->whileSyscallRsp = KernelStackAllocate();
 
   target->infoFs = taskInfoFsAllocate();
   target->infoFiles = taskInfoFilesAllocate();
@@ -126,9 +249,8 @@ Task *taskCreate(uint32_t id, uint64_t rip, bool kernel_task, uint64_t *pagedir,
   LinkedListInit(&target->dsChildTerminated, sizeof(KilledInfo));
   LinkedListInit(&target->dsSysIntr, sizeof(TaskSysInterrupted));
 
-  memset(target->fpuenv, 0, 512);
-  ((uint16_t *)target->fpuenv)[0] = 0x37f;
-  target->mxcsr = 0x1f80;
+  if (!kernel_task)
+    target->fpuenv = fpuAllocate();
 
   taskAttachDefTermios(target);
 
@@ -152,7 +274,7 @@ void taskNameKernel(Task *target, const char *str, int len) {
   target->cmdlineLen = len;
 }
 
-void taskCreateFinish(Task *task) { task->state = TASK_STATE_READY; }
+void taskCreateFinish(Task *task) { schedWake(task); }
 
 void taskAdjustHeap(Task *task, size_t new_heap_end, size_t *start,
                     size_t *end) {
@@ -167,19 +289,17 @@ void taskAdjustHeap(Task *task, size_t new_heap_end, size_t *start,
   size_t new_page_top = DivRoundUp(new_heap_end, PAGE_SIZE);
 
   if (new_page_top > old_page_top) {
+    size_t virt = old_page_top * PAGE_SIZE;
     size_t num = new_page_top - old_page_top;
 
-    for (size_t i = 0; i < num; i++) {
-      size_t virt = old_page_top * PAGE_SIZE + i * PAGE_SIZE;
-      if (VirtualToPhysical(virt))
-        continue;
-
-      size_t phys = PhysicalAllocate(1);
-
-      VirtualMap(virt, phys, PF_RW | PF_USER);
+    // frames are given out on the first touch (see VirtualDemandFault())
+    taskInfoPdMappingAdd(task->infoPd, virt, num, true,
+                         MAPPING_PROT_DEFAULT);
 
-      memset((void *)virt, 0, PAGE_SIZE);
-    }
+    // ..but whoever's setting up another task (elf, stack) writes to it from
+    // an overriden pagedir, where nothing's handled lazily
+    if (task != currentTask)
+      VirtualPopulateL(task->infoPd->pagedir, virt, num, PF_RW | PF_USER);
   } else if (new_page_top < old_page_top) {
     debugf("[task] New page is lower than old page: id{%d}\n", task->id);
     taskKill(task->id, 139);
@@ -220,14 +340,15 @@ void taskKill(uint32_t id, uint16_t ret) {
     if (task->parent->state == TASK_STATE_WAITING_CHILD ||
         (task->parent->state == TASK_STATE_WAITING_CHILD_SPECIFIC &&
          task->parent->waitingForPid == task->id))
-      task->parent->state = TASK_STATE_READY;
+      schedWake(task->parent);
     spinlockRelease(&task->parent->LOCK_CHILD_TERM);
     atomicBitmapSet(&task->parent->sigPendingList, SIGCHLD);
+    schedSignalWake(task->parent);
   }
 
   // vfork() children need to notify parents no matter what
   if (task->parent->state == TASK_STATE_WAITING_VFORK)
-    task->parent->state = TASK_STATE_READY;
+    schedWake(task->parent);
 
   if (task->tidptr) {
     // *task->tidptr = 0;
@@ -246,6 +367,7 @@ void taskKill(uint32_t id, uint16_t ret) {
   // the "reaper" thread will finish everything in a safe context
   taskCallReaper(task);
   task->state = TASK_STATE_DEAD;
+  helperKick();
 
   if (currentTask == task) {
     // we're most likely in a syscall context, so...
@@ -282,12 +404,11 @@ void taskFreeChildren(Task *task) {
 
 Task *taskGet(uint32_t id) {
   spinlockCntReadAcquire(&TASK_LL_MODIFY);
-  Task *browse = firstTask;
-  while (browse) {
-    if (browse->id == id)
-      break;
-    browse = browse->next;
-  }
+  Task *browse = taskIdHash[TASK_HASH(id)];
+  while (browse && browse->id < id)
+    browse = browse->idNext;
+  if (browse && browse->id != id)
+    browse = 0;
   spinlockCntReadRelease(&TASK_LL_MODIFY);
   return browse;
 }
@@ -353,7 +474,7 @@ void taskFilesCopy(Task *original, Task *target, bool respectCOE) {
 
 Task *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, int cloneFlags,
                bool spinup) {
-  Task *target = taskListAllocate();
+  Task *target = taskListAllocate(taskGenerateId());
 
   if (!(cloneFlags & CLONE_VM)) {
     target->infoPd = taskInfoPdClone(currentTask->infoPd);
@@ -365,10 +486,9 @@ Task *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, int cloneFlags,
     target->infoPd = share; // share it yk!
   }
 
-  target->id = taskGenerateId();
   target->tgid = target->id;
-  target->pgid = currentTask->pgid;
-  target->sid = currentTask->sid;
+  taskSetPgid(target, currentTask->pgid);
+  taskSetSid(target, currentTask->sid);
   target->ctrlPty = currentTask->ctrlPty;
   target->kernel_task = currentTask->kernel_task;
   target->state = TASK_STATE_CREATED;
@@ -384,15 +504,8 @@ Task *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, int cloneFlags,
 
   // target->registers = currentTask->registers;
   memcpy(&target->registers, cpu, sizeof(AsmPassedInterrupt));
-  void  *tssRsp = VirtualAllocate(USER_STACK_PAGES);
-  size_t tssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(tssRsp, 0, tssRspSize);
-  target->whileTssRsp = (uint64_t)tssRsp + tssRspSize;
-
-  void  *syscalltssRsp = VirtualAllocate(USER_STACK_PAGES);
-  size_t syscalltssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(syscalltssRsp, 0, syscalltssRspSize);
-  target->whileSyscallRsp = (uint64_t)syscalltssRsp + syscalltssRspSize;
+  target->whileTssRsp = KernelStackAllocate();
+  target->whileSyscallRsp = KernelStackAllocate();
 
   target->fsbase = currentTask->fsbase;
   target->gsbase = currentTask->gsbase;
@@ -455,17 +568,15 @@ Task *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, int cloneFlags,
   target->registers.usermode_rsp = rsp;
   target->registers.usermode_ss = GDT_USER_DATA | DPL_USER;
 
-  // since the scheduler, our fpu state might've changed
-  asm volatile(" fxsave %0 " ::"m"(currentTask->fpuenv));
-  asm("stmxcsr (%%rax)" : : "a"(&currentTask->mxcsr));
-
   // yk
   target->parent = currentTask;
-  target->pgid = currentTask->pgid;
 
-  // fpu stuff
-  memcpy(target->fpuenv, currentTask->fpuenv, 512);
-  target->mxcsr = currentTask->mxcsr;
+  // fpu stuff, the registers might be ahead of our area (see cpu/fpu.c)
+  if (currentTask->fpuenv) {
+    target->fpuenv = fpuAllocate();
+    fpuSave(currentTask);
+    memcpy(target->fpuenv, currentTask->fpuenv, fpuSize);
+  }
 
   target->extras = currentTask->extras;
 
@@ -475,69 +586,37 @@ Task *taskFork(AsmPassedInterrupt *cpu, uint64_t rsp, int cloneFlags,
   return target;
 }
 
-// todo! WONKY DS & RETHINK THIS SYSTEM!!
-void taskBlock(Blocking *blocking, Task *task, Spinlock *releaseAfter,
-               bool apply) {
-  assert(task == currentTask); // otherwise, it exits with ptr dangling
-  if (!apply)
-    assert(!releaseAfter);
-  spinlockAcquire(&blocking->LOCK_LL_BLOCKED);
-
-  // it's rare enough more than one task is blocked together, go through it
-  BlockedTask *browse = (BlockedTask *)blocking->dsBlockedTask.firstObject;
-  while (browse) {
-    if (browse->task == task)
-      debugf("[task::blocking] WARNING! Duplicate task!\n");
-    browse = (BlockedTask *)browse->_ll.next;
-  }
-
-  BlockedTask *blockedTask =
-      LinkedListAllocate(&blocking->dsBlockedTask, sizeof(BlockedTask));
-  blockedTask->task = task;
-  spinlockRelease(&blocking->LOCK_LL_BLOCKED);
-
-  // finally block
-  if (apply) {
-    if (releaseAfter)
-      taskSpinlockExit(task, releaseAfter);
-    task->state = TASK_STATE_BLOCKED;
-  }
-}
-
-void taskUnblock(Blocking *blocking) {
-  spinlockAcquire(&blocking->LOCK_LL_BLOCKED);
-  BlockedTask *browse = (BlockedTask *)blocking->dsBlockedTask.firstObject;
-  while (browse) {
-    BlockedTask *next = (BlockedTask *)browse->_ll.next;
-    if (browse->task) {
-      Task *task = browse->task;
-      if (task->state != TASK_STATE_DEAD)
-        task->state = TASK_STATE_READY;
-    }
-    LinkedListRemove(&blocking->dsBlockedTask, sizeof(BlockedTask), browse);
-    browse = next;
-  }
-  spinlockRelease(&blocking->LOCK_LL_BLOCKED);
-}
-
 // Will release lock when task isn't running via the kernel helper
 void taskSpinlockExit(Task *task, Spinlock *lock) {
   assert(!task->spinlockQueueEntry);
   task->spinlockQueueEntry = lock;
 }
 
+// Idle task, halts until an interrupt comes in (the timer only fires when
+// there's something due). The check & hlt are done with ints off, so that a
+// wakeup can't slip in between the two
 void kernelDummyEntry() {
-  while (true)
-    asm volatile("pause");
+  while (true) {
+    asm volatile("cli");
+    if (schedHasWork()) {
+      asm volatile("sti");
+      handControl();
+      continue;
+    }
+    asm volatile("sti; hlt");
+  }
 }
 
 void initiateTasks() {
-  firstTask = (Task *)malloc(sizeof(Task));
-  memset(firstTask, 0, sizeof(Task));
+  firstTask = slabAlloc(&taskCache);
 
   currentTask = firstTask;
   currentTask->id = KERNEL_TASK_ID;
-  currentTask->state = TASK_STATE_READY;
+  taskIdLink(currentTask);
+  taskPgrpLink(currentTask);
+  taskSessionLink(currentTask);
+  currentTask->state = TASK_STATE_READY; // (slab objects start off as DEAD)
+  schedWake(currentTask);
   currentTask->infoPd = taskInfoPdAllocate(false);
   currentTask->infoPd->pagedir = GetPageDirectory();
   currentTask->kernel_task = true;
@@ -549,10 +628,7 @@ void initiateTasks() {
   LinkedListInit(&currentTask->dsSysIntr, sizeof(TaskSysInterrupted));
   taskNameKernel(currentTask, entryCmdline, sizeof(entryCmdline));
 
-  void  *tssRsp = VirtualAllocate(USER_STACK_PAGES);
-  size_t tssRspSize = USER_STACK_PAGES * BLOCK_SIZE;
-  memset(tssRsp, 0, tssRspSize);
-  currentTask->whileTssRsp = (uint64_t)tssRsp + tssRspSize;
+  currentTask->whileTssRsp = KernelStackAllocate();
   taskAttachDefTermios(currentTask);
 
   debugf("[tasks] Current execution ready for multitasking\n");
@@ -1,3 +1,4 @@
+#include <elf.h>
 #include <gdt.h>
 #include <isr.h>
 #include <kernel_helper.h>
@@ -7,6 +8,7 @@
 #include <paging.h>
 #include <pmm.h>
 #include <schedule.h>
+#include <shmem.h>
 #include <stack.h>
 #include <string.h>
 #include <syscalls.h>
@@ -64,6 +66,196 @@ TaskInfoPagedir *taskInfoPdAllocate(bool pagedir) {
   return target;
 }
 
+// Userspace mappings (sorted by start, see UserspaceMapping). They never
+// overlap, anything landing on top of existing ones cuts them up first
+UserspaceMapping *taskInfoPdMappingFind(TaskInfoPagedir *info, size_t virt) {
+  UserspaceMapping *mapping =
+      (UserspaceMapping *)AVLLookupFloor(info->mappings, virt);
+  if (!mapping || virt >= (size_t)mapping->virt + mapping->pages * PAGE_SIZE)
+    return 0;
+  return mapping;
+}
+
+static size_t taskInfoPdMappingEnd(UserspaceMapping *mapping) {
+  return (size_t)mapping->virt + mapping->pages * PAGE_SIZE;
+}
+
+// lets go of whatever's backing it (not unregistered here)
+static void taskInfoPdMappingDrop(UserspaceMapping *mapping) {
+  if (mapping->image)
+    elfImageRelease(mapping->image);
+  if (mapping->shared)
+    sharedMemoryRelease(mapping->shared);
+  free(mapping);
+}
+
+// same range & backing, holding onto the latter as well
+static UserspaceMapping *taskInfoPdMappingCopy(UserspaceMapping *mapping) {
+  UserspaceMapping *copy = malloc(sizeof(UserspaceMapping));
+  *copy = *mapping;
+  if (copy->image)
+    elfImageHold(copy->image);
+  if (copy->shared)
+    sharedMemoryHold(copy->shared);
+  return copy;
+}
+
+// makes sure nothing straddles virt, by cutting whatever does in two
+static void taskInfoPdMappingSplit(TaskInfoPagedir *info, size_t virt) {
+  UserspaceMapping *mapping = taskInfoPdMappingFind(info, virt);
+  if (!mapping || (size_t)mapping->virt == virt)
+    return;
+
+  size_t            before = (virt - (size_t)mapping->virt) / PAGE_SIZE;
+  UserspaceMapping *tail = taskInfoPdMappingCopy(mapping);
+  tail->virt = (void *)virt;
+  tail->pages = mapping->pages - before;
+  if (tail->shared)
+    tail->sharedPage += before; // (imageBase is absolute, so it stays)
+  mapping->pages = before;
+  AVLAllocate((void **)&info->mappings, virt, (avlval)tail);
+}
+
+// right next to each other & backed the same way, so they can be one
+static bool taskInfoPdMappingJoinable(UserspaceMapping *first,
+                                      UserspaceMapping *second) {
+  return taskInfoPdMappingEnd(first) == (size_t)second->virt &&
+         first->onDemand == second->onDemand && first->prot == second->prot &&
+         first->image == second->image &&
+         first->imageBase == second->imageBase &&
+         first->shared == second->shared &&
+         (!first->shared ||
+          first->sharedPage + first->pages == second->sharedPage);
+}
+
+// joins the mapping with its neighbours where possible (it might be freed)
+static void taskInfoPdMappingMerge(TaskInfoPagedir *info,
+                                   UserspaceMapping *mapping) {
+  UserspaceMapping *prev = 0;
+  if (mapping->virt)
+    prev = (UserspaceMapping *)AVLLookupFloor(info->mappings,
+                                              (size_t)mapping->virt - 1);
+  if (prev && taskInfoPdMappingJoinable(prev, mapping)) {
+    prev->pages += mapping->pages;
+    AVLUnregister((void **)&info->mappings, (size_t)mapping->virt);
+    taskInfoPdMappingDrop(mapping);
+    mapping = prev;
+  }
+
+  UserspaceMapping *next = (UserspaceMapping *)AVLLookup(
+      info->mappings, taskInfoPdMappingEnd(mapping));
+  if (next && taskInfoPdMappingJoinable(mapping, next)) {
+    mapping->pages += next->pages;
+    AVLUnregister((void **)&info->mappings, (size_t)next->virt);
+    taskInfoPdMappingDrop(next);
+  }
+}
+
+void taskInfoPdMappingRemove(TaskInfoPagedir *info, size_t virt,
+                             size_t pages) {
+  size_t end = virt + pages * PAGE_SIZE;
+  taskInfoPdMappingSplit(info, virt);
+  taskInfoPdMappingSplit(info, end);
+
+  // everything touching the range now lies entirely inside of it
+  while (true) {
+    UserspaceMapping *mapping =
+        (UserspaceMapping *)AVLLookupFloor(info->mappings, end - 1);
+    if (!mapping || (size_t)mapping->virt < virt)
+      break;
+    AVLUnregister((void **)&info->mappings, (size_t)mapping->virt);
+    taskInfoPdMappingDrop(mapping);
+  }
+}
+
+void taskInfoPdMappingProtect(TaskInfoPagedir *info, size_t virt,
+                              size_t pages, int prot) {
+  size_t end = virt + pages * PAGE_SIZE;
+  taskInfoPdMappingSplit(info, virt);
+  taskInfoPdMappingSplit(info, end);
+
+  // back to front, merging as we go (whatever's joined was already handled)
+  size_t cursor = end;
+  while (cursor > virt) {
+    UserspaceMapping *mapping =
+        (UserspaceMapping *)AVLLookupFloor(info->mappings, cursor - 1);
+    if (!mapping || (size_t)mapping->virt < virt)
+      break;
+    mapping->prot = prot;
+    cursor = (size_t)mapping->virt;
+    taskInfoPdMappingMerge(info, mapping);
+  }
+}
+
+// anonymous memory, replacing whatever was recorded on the range
+void taskInfoPdMappingAdd(TaskInfoPagedir *info, size_t virt, size_t pages,
+                          bool onDemand, int prot) {
+  taskInfoPdMappingRemove(info, virt, pages);
+
+  UserspaceMapping *mapping = calloc(sizeof(UserspaceMapping), 1);
+  mapping->virt = (void *)virt;
+  mapping->pages = pages;
+  mapping->onDemand = onDemand;
+  mapping->prot = prot;
+  AVLAllocate((void **)&info->mappings, virt, (avlval)mapping);
+  taskInfoPdMappingMerge(info, mapping); // heap growth & such
+}
+
+// an executable's (or interpreter's) span, faulted in from its image. these
+// are only ever added on a fresh address space, so no merging is done
+void taskInfoPdMappingAddImage(TaskInfoPagedir *info, size_t virt,
+                               size_t pages, ElfImage *image,
+                               size_t imageBase) {
+  UserspaceMapping *mapping = calloc(sizeof(UserspaceMapping), 1);
+  mapping->virt = (void *)virt;
+  mapping->pages = pages;
+  mapping->onDemand = true;
+  mapping->prot = MAPPING_PROT_DEFAULT;
+  mapping->image = image;
+  mapping->imageBase = imageBase;
+  elfImageHold(image);
+  AVLAllocate((void **)&info->mappings, virt, (avlval)mapping);
+}
+
+// a shared region, see shmem.h. its page tables entries are marked with
+// PF_SHARED so fork() leaves them be (see PageDirectoryUserDuplicate())
+void taskInfoPdMappingAddShared(TaskInfoPagedir *info, size_t virt,
+                                size_t pages, SharedMemory *shared,
+                                size_t sharedPage, int prot) {
+  taskInfoPdMappingRemove(info, virt, pages);
+
+  UserspaceMapping *mapping = calloc(sizeof(UserspaceMapping), 1);
+  mapping->virt = (void *)virt;
+  mapping->pages = pages;
+  mapping->onDemand = true;
+  mapping->prot = prot;
+  mapping->shared = shared;
+  mapping->sharedPage = sharedPage;
+  sharedMemoryHold(shared);
+  AVLAllocate((void **)&info->mappings, virt, (avlval)mapping);
+  taskInfoPdMappingMerge(info, mapping);
+}
+
+// the target's a fresh address space, so they're taken over as they are
+void taskInfoPdMappingsClone(TaskInfoPagedir *target, AVLheader *browse) {
+  if (!browse)
+    return;
+  UserspaceMapping *mapping = (UserspaceMapping *)browse->value;
+  AVLAllocate((void **)&target->mappings, (size_t)mapping->virt,
+              (avlval)taskInfoPdMappingCopy(mapping));
+  taskInfoPdMappingsClone(target, browse->left);
+  taskInfoPdMappingsClone(target, browse->right);
+}
+
+void taskInfoPdMappingsFree(AVLheader *browse) {
+  if (!browse)
+    return;
+  taskInfoPdMappingsFree(browse->left);
+  taskInfoPdMappingsFree(browse->right);
+  taskInfoPdMappingDrop((UserspaceMapping *)browse->value);
+  AVLFreeNode(browse);
+}
+
 TaskInfoPagedir *taskInfoPdClone(TaskInfoPagedir *old) {
   TaskInfoPagedir *new = taskInfoPdAllocate(true);
 
@@ -74,6 +266,8 @@ TaskInfoPagedir *taskInfoPdClone(TaskInfoPagedir *old) {
 
   new->mmap_start = old->mmap_start;
   new->mmap_end = old->mmap_end;
+
+  taskInfoPdMappingsClone(new, old->mappings);
   spinlockRelease(&old->LOCK_PD);
 
   return new;
@@ -84,6 +278,8 @@ void taskInfoPdDiscard(TaskInfoPagedir *target) {
   target->utilizedBy--;
   if (!target->utilizedBy) {
     PageDirectoryFree(target->pagedir);
+    taskInfoPdMappingsFree(target->mappings);
+    target->mappings = 0;
     // todo: find a safe way to free target
     // cannot be done w/the current layout as it's done inside taskKill and the
     // scheduler needs it in case it's switched in between (will point to
@@ -140,6 +336,7 @@ void taskInfoSignalDiscard(TaskInfoSignal *target) {
   spinlockAcquire(&target->LOCK_SIGNAL);
   target->utilizedBy--;
   if (!target->utilizedBy) {
+    timerDisarm(&target->itimerReal.event);
     free(target);
   } else
     spinlockRelease(&target->LOCK_SIGNAL);
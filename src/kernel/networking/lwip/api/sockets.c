@@ -2604,6 +2604,9 @@ event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
   } else {
     SYS_ARCH_UNPROTECT(lev);
   }
+#ifdef LWIP_HOOK_SOCKET_EVENT
+  LWIP_HOOK_SOCKET_EVENT(s, evt);
+#endif
   done_socket(sock);
 }
 
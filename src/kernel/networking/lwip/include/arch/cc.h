@@ -3,6 +3,7 @@
 #include "linux.h"
 #include "malloc.h"
 #include "memory.h"
+#include "slab.h"
 #include "system.h"
 #include "task.h"
 #include "types.h"
@@ -6,7 +6,11 @@
 #define CUSTOM_LWIPOPTS_H
 
 #define LWIP_PROVIDE_ERRNO 1
-#define MEM_LIBC_MALLOC 1
+// heap buffers (PBUF_RAM & such) come off the slab size classes
+#define MEM_CUSTOM_ALLOCATOR 1
+#define MEM_CUSTOM_MALLOC slabMalloc
+#define MEM_CUSTOM_FREE free
+#define MEM_CUSTOM_CALLOC calloc
 #define LWIP_NO_CTYPE_H 1
 #define LWIP_NO_UNISTD_H 1
 #define __DEFINED_ssize_t 1
@@ -39,6 +43,10 @@
 #define SYS_LIGHTWEIGHT_PROT 0
 #define LWIP_COMPAT_SOCKETS 0
 
+// wakes up anyone sleeping on the socket (networking/socket.c)
+void socketEventNotify(int s, int evt);
+#define LWIP_HOOK_SOCKET_EVENT(s, evt) socketEventNotify((s), (evt))
+
 typedef struct mboxBlock {
   LLheader _ll;
 
@@ -12,6 +12,7 @@
 #include <timer.h>
 
 #include <linked_list.h>
+#include <schedule.h>
 
 // lwip glue code for tivOS
 
@@ -130,7 +131,7 @@ void sys_mbox_post_unsafe(sys_mbox_t *q, void *msg) {
     mboxBlock *next = (mboxBlock *)(browse->_ll.next);
     if (browse->write == false) {
       browse->task->forcefulWakeupTimeUnsafe = 0;
-      browse->task->state = TASK_STATE_READY;
+      schedWake(browse->task);
       LinkedListRemove(&q->firstBlock, sizeof(mboxBlock), browse);
     }
     browse = next;
@@ -181,7 +182,7 @@ u32_t sys_arch_mbox_fetch(sys_mbox_t *q, void **msg, u32_t timeout) {
       return SYS_ARCH_TIMEOUT;
     }
     if (timeout)
-      currentTask->forcefulWakeupTimeUnsafe = timeStart + timeout;
+      currentTask->forcefulWakeupTimeUnsafe = (timeStart + timeout) * 1000000;
     mboxBlock *block = LinkedListAllocate(&q->firstBlock, sizeof(mboxBlock));
     block->task = currentTask;
     block->write = false;
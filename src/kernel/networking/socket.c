@@ -6,27 +6,57 @@
 #include <task.h>
 #include <timer.h>
 
+#include <lwip/api.h>
 #include <lwip/sockets.h>
 
 // Lwip wrapper for userland sockets
 
+// lwip fds are indices on its own socket array, one queue for each of them
+WaitQueue socketWaiters[MEMP_NUM_NETCONN];
+
+// lwip's event_callback() (via LWIP_HOOK_SOCKET_EVENT) on any socket change
+void socketEventNotify(int s, int evt) {
+  if (evt == NETCONN_EVT_RCVMINUS || evt == NETCONN_EVT_SENDMINUS)
+    return; // can't make anything possible
+  int index = s - LWIP_SOCKET_OFFSET;
+  if (index >= 0 && index < MEMP_NUM_NETCONN)
+    waitQueueWakeAll(&socketWaiters[index]);
+}
+
+// sleeps until one of events (or an error) shows up on the socket. Returns 0
+// if that happened, or the errno to bail with
+int socketWait(OpenFile *fd, int events, bool nonblock) {
+  UserSocket    *userSocket = (UserSocket *)fd->dir;
+  WaitQueue     *wq = &socketWaiters[userSocket->lwipFd - LWIP_SOCKET_OFFSET];
+  WaitQueueEntry wait;
+
+  events |= EPOLLERR | EPOLLHUP;
+  while (true) {
+    waitQueuePrepare(wq, &wait);
+    if (fd->handlers->internalPoll(fd, events) & events) {
+      waitQueueFinish(wq, &wait);
+      return 0;
+    }
+    if (nonblock) {
+      waitQueueFinish(wq, &wait);
+      return EAGAIN;
+    }
+    if (waitQueueSleep(wq, &wait, 0) == WAIT_SIGNAL)
+      return EINTR;
+  }
+}
+
 size_t socketSend(OpenFile *fd, uint8_t *out, size_t limit, int flags) {
   UserSocket *userSocket = (UserSocket *)fd->dir;
 
-  int lwipOut = -1;
+  bool nonblock = fd->flags & O_NONBLOCK || flags & MSG_DONTWAIT;
+  int  lwipOut = -1;
   while (true) {
-    if (!(fd->handlers->internalPoll(fd, EPOLLOUT) & EPOLLOUT)) {
-      if (fd->flags & O_NONBLOCK || flags & MSG_DONTWAIT) {
-        lwipOut = -1;
-        errno = EAGAIN;
-        break;
-      }
-      if (signalsPendingQuick(currentTask)) {
-        lwipOut = -1;
-        errno = EINTR;
-        break;
-      }
-      continue;
+    int err = socketWait(fd, EPOLLOUT, nonblock);
+    if (err) {
+      lwipOut = -1;
+      errno = err;
+      break;
     }
     lwipOut = lwip_send(userSocket->lwipFd, out, limit, flags);
     if (lwipOut >= 0 || errno != EAGAIN)
@@ -41,20 +71,14 @@ size_t socketSend(OpenFile *fd, uint8_t *out, size_t limit, int flags) {
 size_t socketRecv(OpenFile *fd, uint8_t *in, size_t limit, int flags) {
   UserSocket *userSocket = (UserSocket *)fd->dir;
 
-  int lwipOut = -1;
+  bool nonblock = fd->flags & O_NONBLOCK || flags & MSG_DONTWAIT;
+  int  lwipOut = -1;
   while (true) {
-    if (!(fd->handlers->internalPoll(fd, EPOLLIN) & EPOLLIN)) {
-      if (fd->flags & O_NONBLOCK || flags & MSG_DONTWAIT) {
-        lwipOut = -1;
-        errno = EAGAIN;
-        break;
-      }
-      if (signalsPendingQuick(currentTask)) {
-        lwipOut = -1;
-        errno = EINTR;
-        break;
-      }
-      continue;
+    int err = socketWait(fd, EPOLLIN, nonblock);
+    if (err) {
+      lwipOut = -1;
+      errno = err;
+      break;
     }
     lwipOut = lwip_recv(userSocket->lwipFd, in, limit, flags);
     if (lwipOut >= 0 || errno != EAGAIN)
@@ -153,18 +177,11 @@ size_t socketSendto(OpenFile *fd, uint8_t *buff, size_t len, int flags,
 
   int lwipOut = -1;
   while (true) {
-    if (!(fd->handlers->internalPoll(fd, EPOLLOUT) & EPOLLOUT)) {
-      if (fd->flags & O_NONBLOCK) {
-        lwipOut = -1;
-        errno = EAGAIN;
-        break;
-      }
-      if (signalsPendingQuick(currentTask)) {
-        lwipOut = -1;
-        errno = EINTR;
-        break;
-      }
-      continue;
+    int err = socketWait(fd, EPOLLOUT, fd->flags & O_NONBLOCK);
+    if (err) {
+      lwipOut = -1;
+      errno = err;
+      break;
     }
     lwipOut = lwip_sendto(userSocket->lwipFd, buff, len, flags, (void *)aligned,
                           MIN(16, addrlen));
@@ -210,21 +227,14 @@ size_t socketRecvfrom(OpenFile *fd, uint8_t *out, size_t limit, int flags,
   if (!addr || !len)
     return socketRecv(fd, out, limit, flags);
 
+  // poll first, cause lwip's recvfrom() is really weird sometimes
   int lwipOut = -1;
   while (true) {
-    if (!(fd->handlers->internalPoll(fd, EPOLLIN) & EPOLLIN)) {
-      // do a workaround cause lwip's recvfrom() is really weird sometimes
-      if (fd->flags & O_NONBLOCK) {
-        lwipOut = -1;
-        errno = EAGAIN;
-        break;
-      }
-      if (signalsPendingQuick(currentTask)) {
-        lwipOut = -1;
-        errno = EINTR;
-        break;
-      }
-      continue;
+    int err = socketWait(fd, EPOLLIN, fd->flags & O_NONBLOCK);
+    if (err) {
+      lwipOut = -1;
+      errno = err;
+      break;
     }
     lwipOut =
         lwip_recvfrom(userSocket->lwipFd, out, limit, flags, (void *)addr, len);
@@ -285,18 +295,11 @@ size_t socketRecvmsg(OpenFile *fd, struct msghdr_linux *msg, int flags) {
 
   int lwipOut = -1;
   while (true) {
-    if (!(fd->handlers->internalPoll(fd, EPOLLIN) & EPOLLIN)) {
-      if (fd->flags & O_NONBLOCK) {
-        lwipOut = -1;
-        errno = EAGAIN;
-        break;
-      }
-      if (signalsPendingQuick(currentTask)) {
-        lwipOut = -1;
-        errno = EINTR;
-        break;
-      }
-      continue;
+    int err = socketWait(fd, EPOLLIN, fd->flags & O_NONBLOCK);
+    if (err) {
+      lwipOut = -1;
+      errno = err;
+      break;
     }
     lwipOut = lwip_recvmsg(userSocket->lwipFd, (void *)msg, flags);
     if (lwipOut >= 0 || errno != EAGAIN)
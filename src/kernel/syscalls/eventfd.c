@@ -12,8 +12,9 @@
 typedef struct EventFd {
   uint64_t counter;
 
-  int      utilizedBy;
-  Spinlock LOCK_EVENTFD;
+  int       utilizedBy;
+  Spinlock  LOCK_EVENTFD;
+  WaitQueue waiters; // readers & writers both
 } EventFd;
 
 size_t eventFdOpen(uint64_t initValue, int flags) {
@@ -67,7 +68,8 @@ bool eventFdClose(OpenFile *fd) {
 size_t eventFdRead(OpenFile *fd, uint8_t *out, size_t limit) {
   if (limit < 8)
     return ERR(EINVAL);
-  EventFd *eventFd = fd->dir;
+  EventFd       *eventFd = fd->dir;
+  WaitQueueEntry wait;
   while (true) {
     spinlockAcquire(&eventFd->LOCK_EVENTFD);
     if (eventFd->counter != 0)
@@ -80,13 +82,16 @@ size_t eventFdRead(OpenFile *fd, uint8_t *out, size_t limit) {
       spinlockRelease(&eventFd->LOCK_EVENTFD);
       return ERR(EWOULDBLOCK);
     }
+    waitQueuePrepare(&eventFd->waiters, &wait);
     spinlockRelease(&eventFd->LOCK_EVENTFD);
-    handControl();
+    if (waitQueueSleep(&eventFd->waiters, &wait, 0) == WAIT_SIGNAL)
+      return ERR(EINTR);
   }
 
   atomicWrite64((void *)out, eventFd->counter);
   eventFd->counter = 0;
   spinlockRelease(&eventFd->LOCK_EVENTFD);
+  waitQueueWakeAll(&eventFd->waiters);
   pollInstanceRing((size_t)fd->dir, EPOLLOUT);
   return 8;
 }
@@ -95,7 +100,8 @@ size_t eventFdWrite(OpenFile *fd, uint8_t *in, size_t limit) {
   uint64_t toAdd = atomicRead64((void *)in);
   if (limit < 8 || toAdd == 0xffffffffffffffff)
     return ERR(EINVAL);
-  EventFd *eventFd = fd->dir;
+  EventFd       *eventFd = fd->dir;
+  WaitQueueEntry wait;
   while (true) {
     spinlockAcquire(&eventFd->LOCK_EVENTFD);
     if (!(toAdd > 0xffffffffffffffff - eventFd->counter))
@@ -108,12 +114,15 @@ size_t eventFdWrite(OpenFile *fd, uint8_t *in, size_t limit) {
       spinlockRelease(&eventFd->LOCK_EVENTFD);
       return ERR(EWOULDBLOCK);
     }
+    waitQueuePrepare(&eventFd->waiters, &wait);
     spinlockRelease(&eventFd->LOCK_EVENTFD);
-    handControl();
+    if (waitQueueSleep(&eventFd->waiters, &wait, 0) == WAIT_SIGNAL)
+      return ERR(EINTR);
   }
 
   eventFd->counter += toAdd;
   spinlockRelease(&eventFd->LOCK_EVENTFD);
+  waitQueueWakeAll(&eventFd->waiters);
   pollInstanceRing((size_t)fd->dir, EPOLLIN);
   return 8;
 }
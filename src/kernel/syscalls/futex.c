@@ -1,56 +1,326 @@
+#include <bootloader.h>
 #include <console.h>
 #include <fb.h>
 #include <kb.h>
 #include <linux.h>
 #include <malloc.h>
 #include <paging.h>
+#include <schedule.h>
+#include <slab.h>
 #include <syscalls.h>
 #include <system.h>
 #include <task.h>
 #include <timer.h>
 
-#include <avl_tree.h>
 #include <linked_list.h>
 
 // Futex syscall for fast userspace locking
 
+// Futexes are keyed by their word's address space & virtual address, or by its
+// physical address when it's on shared memory (that others might have mapped
+// elsewhere), and hashed into buckets, each with its own lock. One only exists
+// for as long as somebody is waiting on it: the last waiter to leave frees it.
+#define FUTEX_HASH_SIZE 256
+
+typedef struct FutexKey {
+  void  *space; // page directory for private ones, 0 for shared ones
+  size_t addr;  // virtual for private ones, physical for shared ones
+} FutexKey;
+
 typedef struct FutexAsleep {
   LLheader _ll;
 
   struct Futex *above;
+  FutexKey      key; // above's, what to lock to get to it
 
-  bool  awoken;
-  Task *task;
+  uint32_t bitset;
+  bool     awoken;
+  Task    *task;
 } FutexAsleep;
 
 typedef struct Futex {
-  Spinlock LOCK_PROP;
+  struct Futex *next; // in the bucket
+  FutexKey      key;
 
   LLcontrol firstAsleep; // struct FutexAsleep
-  // int          pid; // really it is tgid but whatever
 } Futex;
 
-// todo: find some sensible way to clean all of these up after use
-AVLheader *firstFutex = 0;
-Spinlock   LOCK_AVL_FUTEX = {0};
+typedef struct FutexBucket {
+  Spinlock LOCK_BUCKET;
+  Futex   *firstFutex;
+} FutexBucket;
+
+FutexBucket futexBuckets[FUTEX_HASH_SIZE] = {0};
+
+SlabCache futexCache = SLAB_CACHE("futex", sizeof(Futex), 0);
+
+bool futexKeyEqual(FutexKey *a, FutexKey *b) {
+  return a->space == b->space && a->addr == b->addr;
+}
+
+FutexBucket *futexBucket(FutexKey *key) {
+  uint64_t hash = ((key->addr >> 2) ^ (size_t)key->space) *
+                  0x9e3779b97f4a7c15ULL; // fibonacci hashing
+  return &futexBuckets[(hash >> 32) % FUTEX_HASH_SIZE];
+}
+
+// the ones below assume the bucket's lock is held
+Futex *futexLookup(FutexBucket *bucket, FutexKey *key) {
+  Futex *browse = bucket->firstFutex;
+  while (browse) {
+    if (futexKeyEqual(&browse->key, key))
+      return browse;
+    browse = browse->next;
+  }
+  return 0;
+}
 
-Futex *futexFind(size_t phys) {
-  spinlockAcquire(&LOCK_AVL_FUTEX);
-  Futex *futex = (Futex *)AVLLookup(firstFutex, phys);
+Futex *futexGet(FutexBucket *bucket, FutexKey *key) {
+  Futex *futex = futexLookup(bucket, key);
   if (futex)
-    goto cleanup;
+    return futex;
 
-  // not found, create it
-  futex = calloc(sizeof(Futex), 1);
-  AVLAllocate((void **)&firstFutex, phys, (avlval)futex);
+  futex = slabAlloc(&futexCache);
+  futex->key = *key;
   LinkedListInit(&futex->firstAsleep, sizeof(FutexAsleep));
-cleanup:
-  spinlockAcquire(&futex->LOCK_PROP);
-  spinlockRelease(&LOCK_AVL_FUTEX);
+  futex->next = bucket->firstFutex;
+  bucket->firstFutex = futex;
   return futex;
 }
 
-// todo: ensure addr exists on-demand (when implemented)
+// gets rid of it if there's no-one waiting on it anymore
+void futexPut(FutexBucket *bucket, Futex *futex) {
+  if (futex->firstAsleep.firstObject)
+    return;
+
+  Futex **browse = &bucket->firstFutex;
+  while (*browse != futex)
+    browse = &(*browse)->next;
+  *browse = futex->next;
+  slabFree(&futexCache, futex);
+}
+
+// at the back of the line, like LinkedListAllocate() does
+void futexAppend(Futex *futex, FutexAsleep *asleep) {
+  asleep->_ll.next = 0;
+  asleep->above = futex;
+  asleep->key = futex->key;
+
+  LLheader *browse = futex->firstAsleep.firstObject;
+  if (!browse) {
+    futex->firstAsleep.firstObject = (LLheader *)asleep;
+    return;
+  }
+  while (browse->next)
+    browse = browse->next;
+  browse->next = (LLheader *)asleep;
+}
+
+int futexWakeUnsafe(Futex *futex, uint32_t max, uint32_t bitset) {
+  FutexAsleep *browse = (FutexAsleep *)futex->firstAsleep.firstObject;
+  uint32_t     awokenCnt = 0;
+  while (browse && awokenCnt < max) {
+    if (!browse->awoken && browse->bitset & bitset) {
+      browse->task->forcefulWakeupTimeUnsafe = 0;
+      schedWake(browse->task);
+      browse->awoken = true;
+      awokenCnt++; // ack
+    }
+    browse = (FutexAsleep *)browse->_ll.next;
+  }
+  return awokenCnt;
+}
+
+// lowest address first, so two requeues can't deadlock each other
+void futexLockPair(FutexBucket *bucket1, FutexBucket *bucket2) {
+  if (bucket1 > bucket2) {
+    FutexBucket *tmp = bucket1;
+    bucket1 = bucket2;
+    bucket2 = tmp;
+  }
+  spinlockAcquire(&bucket1->LOCK_BUCKET);
+  if (bucket2 != bucket1)
+    spinlockAcquire(&bucket2->LOCK_BUCKET);
+}
+
+void futexUnlockPair(FutexBucket *bucket1, FutexBucket *bucket2) {
+  if (bucket2 != bucket1)
+    spinlockRelease(&bucket2->LOCK_BUCKET);
+  spinlockRelease(&bucket1->LOCK_BUCKET);
+}
+
+// Private futexes (and words on memory that isn't shared to begin with) go by
+// their virtual address, as copy-on-write can move them to another frame any
+// time. Shared memory's frames stay put though, and that's the only thing that
+// the ones mapping it have in common. Makes sure the page is there (on-demand)
+bool futexKey(uint32_t *addr, bool private, FutexKey *key) {
+  uint64_t *pagedir = GetPageDirectory();
+  atomicRead32(addr);
+
+  size_t *entry = VirtualPageEntryL(pagedir, (size_t)addr);
+  if (private || !entry || !(*entry & PF_SHARED)) {
+    key->space = pagedir;
+    key->addr = (size_t)addr;
+    return true;
+  }
+
+  key->space = 0;
+  key->addr = VirtualToPhysical((size_t)addr);
+  return key->addr != 0;
+}
+
+// Reads the word through the HHDM, so it can't fault (with a bucket's lock
+// held, where that'd be fatal). False if it's not mapped in anymore
+bool futexPeek(uint32_t *addr, uint32_t *out) {
+  size_t phys = VirtualToPhysical((size_t)addr);
+  if (!phys)
+    return false;
+  *out = atomicRead32((uint32_t *)(phys + bootloader.hhdmOffset));
+  return true;
+}
+
+// FUTEX_WAIT takes a relative timeout, FUTEX_WAIT_BITSET an absolute one (on
+// CLOCK_MONOTONIC, or CLOCK_REALTIME with FUTEX_CLOCK_REALTIME). Returns the
+// timerNanos() to wake up at (0 for none), or -1 if it's passed
+uint64_t futexWakeupAt(struct timespec *utime, bool absolute, bool realtime) {
+  if (!utime)
+    return 0;
+
+  uint64_t ns = utime->tv_sec * 1000000000ULL + utime->tv_nsec;
+  if (!absolute)
+    return timerNanos() + ns;
+
+  uint64_t bootNs = realtime ? timerBootUnix * 1000000000ULL : 0;
+  if (ns <= bootNs + timerNanos())
+    return (uint64_t)-1;
+  return ns - bootNs;
+}
+
+size_t futexWait(uint32_t *addr, FutexKey *key, uint32_t value,
+                 uint32_t bitset, uint64_t wakeupAt) {
+  // read (& faulted in) before taking the lock, then checked again with it
+  // held so a wakeup can't slip in between
+  if (atomicRead32(addr) != value)
+    return ERR(EAGAIN);
+
+  FutexBucket *bucket = futexBucket(key);
+  spinlockAcquire(&bucket->LOCK_BUCKET);
+
+  uint32_t current = 0;
+  if (!futexPeek(addr, &current) || current != value) {
+    spinlockRelease(&bucket->LOCK_BUCKET);
+    return ERR(EAGAIN);
+  }
+  if (wakeupAt == (uint64_t)-1) {
+    spinlockRelease(&bucket->LOCK_BUCKET);
+    return ERR(ETIMEDOUT);
+  }
+
+  Futex       *futex = futexGet(bucket, key);
+  FutexAsleep *asleep =
+      LinkedListAllocate(&futex->firstAsleep, sizeof(FutexAsleep));
+  asleep->above = futex;
+  asleep->key = *key;
+  asleep->bitset = bitset;
+  asleep->task = currentTask;
+
+  taskSpinlockExit(currentTask, &bucket->LOCK_BUCKET);
+  currentTask->forcefulWakeupTimeUnsafe = wakeupAt;
+  currentTask->state = TASK_STATE_FUTEX;
+  while (currentTask->state != TASK_STATE_READY)
+    handControl();
+  assert(!currentTask->forcefulWakeupTimeUnsafe);
+
+  // we might've been requeued meanwhile, so chase after it. the key is only
+  // ever changed with its bucket's lock held, so a torn read just won't match
+  while (true) {
+    FutexKey current = asleep->key;
+    bucket = futexBucket(&current);
+    spinlockAcquire(&bucket->LOCK_BUCKET);
+    if (futexKeyEqual(&asleep->key, &current))
+      break;
+    spinlockRelease(&bucket->LOCK_BUCKET);
+  }
+
+  // figure out what happened to wake us up from our nap
+  size_t ret = 0;
+  if (!asleep->awoken) { // either timeout, or a pending signal
+    if (signalsPendingQuick(currentTask))
+      ret = ERR(EINTR);
+    else
+      ret = ERR(ETIMEDOUT);
+  }
+
+  // get rid of it, we are done
+  futex = asleep->above;
+  assert(LinkedListRemove(&futex->firstAsleep, sizeof(FutexAsleep), asleep));
+  futexPut(bucket, futex);
+  spinlockRelease(&bucket->LOCK_BUCKET);
+
+  return ret;
+}
+
+size_t futexWake(FutexKey *key, uint32_t max, uint32_t bitset) {
+  FutexBucket *bucket = futexBucket(key);
+  spinlockAcquire(&bucket->LOCK_BUCKET);
+  Futex *futex = futexLookup(bucket, key);
+  int    awokenCnt = futex ? futexWakeUnsafe(futex, max, bitset) : 0;
+  spinlockRelease(&bucket->LOCK_BUCKET);
+
+  return awokenCnt;
+}
+
+// wakes up to max, then moves up to maxMoved of the rest over to key2
+size_t futexRequeue(uint32_t *addr, FutexKey *key, FutexKey *key2, uint32_t max,
+                    uint32_t maxMoved, bool cmp, uint32_t cmpValue) {
+  if (cmp && atomicRead32(addr) != cmpValue)
+    return ERR(EAGAIN);
+
+  FutexBucket *bucket = futexBucket(key);
+  FutexBucket *bucket2 = futexBucket(key2);
+  futexLockPair(bucket, bucket2);
+
+  uint32_t current = 0;
+  if (cmp && (!futexPeek(addr, &current) || current != cmpValue)) {
+    futexUnlockPair(bucket, bucket2);
+    return ERR(EAGAIN);
+  }
+
+  Futex *futex = futexLookup(bucket, key);
+  if (!futex) {
+    futexUnlockPair(bucket, bucket2);
+    return 0;
+  }
+
+  uint32_t awokenCnt = futexWakeUnsafe(futex, max, FUTEX_BITSET_MATCH_ANY);
+  uint32_t movedCnt = 0;
+
+  Futex       *futex2 = 0;
+  FutexAsleep *browse = (FutexAsleep *)futex->firstAsleep.firstObject;
+  while (browse && movedCnt < maxMoved) {
+    FutexAsleep *next = (FutexAsleep *)browse->_ll.next;
+    if (browse->awoken) {
+      browse = next;
+      continue;
+    }
+
+    movedCnt++;
+    if (!futexKeyEqual(key, key2)) { // onto itself is just a (weird) no-op
+      if (!futex2)
+        futex2 = futexGet(bucket2, key2);
+      assert(LinkedListUnregister(&futex->firstAsleep, sizeof(FutexAsleep),
+                                  browse));
+      futexAppend(futex2, browse);
+    }
+    browse = next;
+  }
+
+  futexPut(bucket, futex);
+  futexUnlockPair(bucket, bucket2);
+
+  return awokenCnt + movedCnt;
+}
+
 size_t futexSyscall(uint32_t *addr, int op, uint32_t value,
                     struct timespec *utime, uint32_t *addr2, uint32_t value3) {
   /* Don't use currentTask here as FUTEX_WAKE is used by task exit */
@@ -58,152 +328,60 @@ size_t futexSyscall(uint32_t *addr, int op, uint32_t value,
   /*debugf("FUTEX! HIDE THE KIDS!! addr{%lx} op{%x} value{%d} utime{%lx} "
          "uaddr2{%lx} value3{%d}\n",
          addr, op, value, utime, addr2, value3);*/
-  if (op & FUTEX_CLOCK_REALTIME) {
-    debugf("[futex] Seriously, it uses FUTEX_CLOCK_REALTIME: op{%x}\n", op);
-    panic();
-  }
 
-  // todo: we wont care about private rn
-  // bool private = op & FUTEX_PRIVATE_FLAG;
-  op &= ~FUTEX_PRIVATE_FLAG;
+  bool private = op & FUTEX_PRIVATE_FLAG;
+  bool realtime = op & FUTEX_CLOCK_REALTIME;
+  op &= FUTEX_CMD_MASK;
 
-  size_t phys = 0;
-  if (op == FUTEX_WAIT || op == FUTEX_WAKE || op == FUTEX_REQUEUE) {
-    if (!addr || ((size_t)addr % 4) != 0)
-      return ERR(EINVAL);
-    phys = VirtualToPhysical((size_t)addr);
-    assert(phys);
-    dbgSysExtraf("phys{%lx}", phys);
-  }
+  if (realtime && op != FUTEX_WAIT && op != FUTEX_WAIT_BITSET)
+    return ERR(ENOSYS);
+
+  if (!addr || ((size_t)addr % 4) != 0)
+    return ERR(EINVAL);
 
-  size_t phys2 = 0;
-  if (op == FUTEX_REQUEUE) {
+  FutexKey key2 = {0};
+  if (op == FUTEX_REQUEUE || op == FUTEX_CMP_REQUEUE) {
     if (!addr2 || ((size_t)addr2 % 4) != 0)
       return ERR(EINVAL);
-    phys2 = VirtualToPhysical((size_t)addr2);
-    assert(phys2);
-    dbgSysExtraf("phys2{%lx}", phys2);
+    if (!futexKey(addr2, private, &key2))
+      return ERR(EFAULT);
+    dbgSysExtraf("key2{%lx:%lx}", key2.space, key2.addr);
   }
 
-  switch (op) {
-  case FUTEX_WAIT: {
-    if (atomicRead32(addr) != value)
-      return ERR(EAGAIN);
-    size_t ret = -1;
-
-    Futex *futex = futexFind(phys);
-    // if (private)
-    //   futex->pid = currentTask->pgid;
-
-    FutexAsleep *asleep =
-        LinkedListAllocate(&futex->firstAsleep, sizeof(FutexAsleep));
-    asleep->above = futex;
-    asleep->task = currentTask;
-
-    // spinlockRelease(&futex->LOCK_PROP);
-    taskSpinlockExit(currentTask, &futex->LOCK_PROP);
-    if (utime)
-      currentTask->forcefulWakeupTimeUnsafe =
-          timerTicks + DivRoundUp(utime->tv_nsec, 1000000) +
-          utime->tv_sec * 1000;
-    currentTask->state = TASK_STATE_FUTEX;
-    while (currentTask->state != TASK_STATE_READY)
-      handControl();
-    assert(!currentTask->forcefulWakeupTimeUnsafe);
-
-    // figure out what happened to wake us up from our nap
-    Futex *newfutex = asleep->above; // might've changed!
-    spinlockAcquire(&newfutex->LOCK_PROP);
-    if (asleep->awoken)
-      ret = 0;
-    else { // either timeout, or a pending signal
-      if (signalsPendingQuick(currentTask))
-        ret = ERR(EINTR);
-      else
-        ret = ERR(ETIMEDOUT);
-    }
+  if ((op == FUTEX_WAIT_BITSET || op == FUTEX_WAKE_BITSET) && !value3)
+    return ERR(EINVAL);
 
-    // get rid of it, we are done
-    assert(
-        LinkedListRemove(&newfutex->firstAsleep, sizeof(FutexAsleep), asleep));
-    spinlockRelease(&newfutex->LOCK_PROP);
+  FutexKey key = {0};
+  if (!futexKey(addr, private, &key))
+    return ERR(EFAULT);
+  dbgSysExtraf("key{%lx:%lx}", key.space, key.addr);
 
-    return ret;
+  switch (op) {
+  case FUTEX_WAIT:
+    return futexWait(addr, &key, value, FUTEX_BITSET_MATCH_ANY,
+                     futexWakeupAt(utime, false, realtime));
     break;
-  }
-  case FUTEX_WAKE: {
-    /* Don't use currentTask here as FUTEX_WAKE is used by task exit */
-    uint8_t currentTask = 0;
-    (void)currentTask;
-
-    Futex       *futex = futexFind(phys);
-    FutexAsleep *browse = (FutexAsleep *)futex->firstAsleep.firstObject;
-    int          awokenCnt = 0;
-
-    while (browse) {
-      if (!browse->awoken && awokenCnt < value) {
-        // wake it up
-        browse->task->forcefulWakeupTimeUnsafe = 0;
-        browse->task->state = TASK_STATE_READY;
-        browse->awoken = true;
-        awokenCnt++; // ack
-      }
-      browse = (FutexAsleep *)browse->_ll.next;
-    }
-    spinlockRelease(&futex->LOCK_PROP);
-
-    return awokenCnt;
+  case FUTEX_WAIT_BITSET:
+    return futexWait(addr, &key, value, value3,
+                     futexWakeupAt(utime, true, realtime));
     break;
-  }
-  case FUTEX_REQUEUE: {
-    Futex *futex = futexFind(phys);
-    Futex *futex2 = futexFind(phys2);
-
-    FutexAsleep *browse = (FutexAsleep *)futex->firstAsleep.firstObject;
-    int          awokenCnt = 0;
-    int          movedCnt = 0;
-
-    while (browse) {
-      if (!browse->awoken && awokenCnt < value) {
-        // wake it up
-        browse->task->forcefulWakeupTimeUnsafe = 0;
-        browse->task->state = TASK_STATE_READY;
-        browse->awoken = true;
-        awokenCnt++; // ack
-      } else if (!browse->awoken && movedCnt < (uint32_t)(size_t)(utime)) {
-        // move those
-        movedCnt++;
-        FutexAsleep *next = (FutexAsleep *)browse->_ll.next;
-        assert(LinkedListUnregister(&futex->firstAsleep, sizeof(FutexAsleep),
-                                    browse));
-        browse->_ll.next = 0;
-        browse->above = futex2;
-        // LinkedListPushFrontUnsafe((void **)&futex2->firstAsleep, browse);
-        FutexAsleep *b = (FutexAsleep *)futex2->firstAsleep.firstObject;
-        if (!b)
-          futex2->firstAsleep.firstObject = (LLheader *)browse;
-        else {
-          while (b) {
-            if (!b->_ll.next)
-              break;
-            b = (FutexAsleep *)b->_ll.next;
-          }
-          b->_ll.next = (void *)browse;
-        }
-        browse = next;
-        continue;
-      }
-      browse = (FutexAsleep *)browse->_ll.next;
-    }
-    spinlockRelease(&futex2->LOCK_PROP);
-    spinlockRelease(&futex->LOCK_PROP);
-
-    return awokenCnt + movedCnt;
+  case FUTEX_WAKE:
+    return futexWake(&key, value, FUTEX_BITSET_MATCH_ANY);
+    break;
+  case FUTEX_WAKE_BITSET:
+    return futexWake(&key, value, value3);
+    break;
+  case FUTEX_REQUEUE:
+    // utime doubles as the amount to requeue
+    return futexRequeue(addr, &key, &key2, value, (uint32_t)(size_t)utime,
+                        false, 0);
+    break;
+  case FUTEX_CMP_REQUEUE:
+    return futexRequeue(addr, &key, &key2, value, (uint32_t)(size_t)utime,
+                        true, value3);
     break;
-  }
   default:
     debugf("[futex] Invalid operation{%x}\n", op);
-    panic();
     return ERR(ENOSYS);
     break;
   }
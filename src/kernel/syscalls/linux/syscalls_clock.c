@@ -1,4 +1,5 @@
 #include <linux.h>
+#include <schedule.h>
 #include <syscalls.h>
 #include <system.h>
 #include <task.h>
@@ -12,12 +13,13 @@ static size_t syscallNanosleep(struct timespec *duration,
   if (duration->tv_sec < 0)
     return -EINVAL;
 
-  size_t ms = duration->tv_sec * 1000 + duration->tv_nsec / 1000000;
-  currentTask->forcefulWakeupTimeUnsafe = timerTicks + ms;
+  // the timer wheel rounds it up, so we never wake up early
+  uint64_t ns = duration->tv_sec * 1000000000ULL + duration->tv_nsec;
+  currentTask->forcefulWakeupTimeUnsafe = timerNanos() + ns;
   currentTask->state = TASK_STATE_BLOCKED;
   do
     handControl();
-  while (currentTask->forcefulWakeupTimeUnsafe > timerTicks);
+  while (currentTask->forcefulWakeupTimeUnsafe > timerNanos());
   assert(!currentTask->forcefulWakeupTimeUnsafe);
   if (signalsPendingQuick(currentTask))
     return ERR(EINTR);
@@ -33,6 +35,33 @@ uint64_t timeval_to_ms(struct timeval tv) {
   return (uint64_t)tv.tv_sec * 1000 + DivRoundUp(tv.tv_usec, 1000);
 }
 
+// ITIMER_REAL went off (from the timer interrupt), SIGALRM goes to the first
+// thread sharing the signal info, like it used to on whichever got scheduled
+static void itimerRealFire(void *ctx) {
+  TaskInfoSignal *info = (TaskInfoSignal *)ctx;
+
+  // ints are off, so the task list can't change under us
+  Task *target = firstTask;
+  while (target) {
+    if (target->infoSignals == info && target->state != TASK_STATE_DEAD)
+      break;
+    target = target->next;
+  }
+  if (target) {
+    atomicBitmapSet(&target->sigPendingList, SIGALRM);
+    schedSignalWake(target);
+  }
+
+  uint64_t rtReset = atomicRead64(&info->itimerReal.reset);
+  if (!rtReset) {
+    atomicWrite64(&info->itimerReal.at, 0);
+    return;
+  }
+  uint64_t at = timerTicks + rtReset;
+  atomicWrite64(&info->itimerReal.at, at);
+  timerArm(&info->itimerReal.event, at * 1000000, itimerRealFire, info);
+}
+
 #define SYSCALL_SETITIMER 38
 static size_t syscallSetitimer(int which, struct itimerval *value,
                                struct itimerval *old) {
@@ -56,50 +85,81 @@ static size_t syscallSetitimer(int which, struct itimerval *value,
 
     dbgSysExtraf("val{%ld} int{%ld}", targValue, targInterval);
 
+    TaskInfoSignal *info = currentTask->infoSignals;
     asm volatile("cli"); // just in case
-    if (targValue)
-      atomicWrite64(&currentTask->infoSignals->itimerReal.at,
-                    timerTicks + targValue);
-    else
-      atomicWrite64(&currentTask->infoSignals->itimerReal.at, 0);
-    atomicWrite64(&currentTask->infoSignals->itimerReal.reset, targInterval);
+    atomicWrite64(&info->itimerReal.reset, targInterval);
+    if (targValue) {
+      uint64_t at = timerTicks + targValue;
+      atomicWrite64(&info->itimerReal.at, at);
+      timerArm(&info->itimerReal.event, at * 1000000, itimerRealFire, info);
+    } else {
+      atomicWrite64(&info->itimerReal.at, 0);
+      timerDisarm(&info->itimerReal.event);
+    }
     asm volatile("sti");
   }
 
   return 0;
 }
 
+// ns the calling thread (or its whole thread group) has spent running
+static uint64_t clockCpuNanos(bool process) {
+  bool ints = checkInterrupts();
+  asm volatile("cli"); // so the running slice can't get accounted under us
+  uint64_t nanos = currentTask->cpuNanos + timerNanos() - currentTask->cpuSince;
+  if (ints)
+    asm volatile("sti");
+  if (!process)
+    return nanos;
+
+  spinlockCntReadAcquire(&TASK_LL_MODIFY);
+  Task *browse = firstTask;
+  while (browse) {
+    if (browse->tgid == currentTask->tgid && browse != currentTask)
+      nanos += atomicRead64(&browse->cpuNanos);
+    browse = browse->next;
+  }
+  spinlockCntReadRelease(&TASK_LL_MODIFY);
+  return nanos;
+}
+
 #define SYSCALL_CLOCK_GETTIME 228
 static size_t syscallClockGettime(int which, timespec *spec) {
+  uint64_t nanos = 0;
   switch (which) {
-  case CLOCK_MONOTONIC: // <- todo
-  case 6:               // CLOCK_MONOTONIC_COARSE
-  case 4:               // CLOCK_MONOTONIC_RAW
-  case CLOCK_REALTIME: {
-    size_t time = timerBootUnix * 1000 + timerTicks;
-    spec->tv_sec = time / 1000;
-    spec->tv_nsec = (time % 1000) * 1000000;
-    // todo: accurancy
-    return 0;
+  case CLOCK_REALTIME:
+  case CLOCK_REALTIME_COARSE:
+    nanos = timerBootUnix * 1000000000ULL + timerNanos();
     break;
-  }
-  case CLOCK_BOOTTIME: {
-    size_t time = timerBootUnix * 1000;
-    spec->tv_sec = time / 1000;
-    spec->tv_nsec = (time % 1000) * 1000000;
-    return 0;
+  case CLOCK_MONOTONIC:
+  case CLOCK_MONOTONIC_RAW:
+  case CLOCK_MONOTONIC_COARSE:
+  case CLOCK_BOOTTIME: // we never suspend
+    nanos = timerNanos();
+    break;
+  case CLOCK_PROCESS_CPUTIME_ID:
+    nanos = clockCpuNanos(true);
+    break;
+  case CLOCK_THREAD_CPUTIME_ID:
+    nanos = clockCpuNanos(false);
     break;
-  }
   default:
     dbgSysStubf("clock not supported\n");
     return ERR(EINVAL);
     break;
   }
+
+  spec->tv_sec = nanos / 1000000000;
+  spec->tv_nsec = nanos % 1000000000;
+  return 0;
 }
 
 #define SYSCALL_CLOCK_GETRES 229
 static size_t syscallClockGetres(int which, timespec *spec) {
-  spec->tv_nsec = 1000000; // 1ms for every clock
+  if (!spec)
+    return 0;
+  spec->tv_sec = 0;
+  spec->tv_nsec = timerTscFreq ? 1 : 1000000; // ns with the tsc, ms otherwise
   return 0;
 }
 
@@ -117,6 +117,8 @@ static size_t syscallGetegid() {
 static size_t syscallSetpgid(int pid, int pgid) {
   if (!pid)
     pid = currentTask->id;
+  if (!pgid)
+    pgid = pid; // setpgid(0, 0), what setpgrp() does
 
   Task *task = taskGet(pid);
   if (!task) {
@@ -124,7 +126,20 @@ static size_t syscallSetpgid(int pid, int pgid) {
     return ERR(EPERM);
   }
 
-  task->pgid = pgid;
+  // joining someone else's group, it has to exist in the same session
+  if (pgid != pid) {
+    spinlockCntReadAcquire(&TASK_LL_MODIFY);
+    Task *member = taskSessionFirst(task->sid);
+    while (member && member->pgid != pgid)
+      member = taskSessionNext(member);
+    spinlockCntReadRelease(&TASK_LL_MODIFY);
+    if (!member) {
+      dbgSysExtraf("no group{%d} in session{%d}", pgid, task->sid);
+      return ERR(EPERM);
+    }
+  }
+
+  taskSetPgid(task, pgid);
   return 0;
 }
 
@@ -138,11 +153,15 @@ static size_t syscallGetppid() {
 
 #define SYSCALL_SETSID 112
 static size_t syscallSetsid() {
-  if (currentTask->tgid == currentTask->pgid)
+  // can't lead a session while a group with our id is around
+  spinlockCntReadAcquire(&TASK_LL_MODIFY);
+  Task *member = taskPgrpFirst(currentTask->tgid);
+  spinlockCntReadRelease(&TASK_LL_MODIFY);
+  if (member)
     return ERR(EPERM);
 
-  currentTask->sid = currentTask->tgid;
-  currentTask->pgid = currentTask->tgid;
+  taskSetSid(currentTask, currentTask->tgid);
+  taskSetPgid(currentTask, currentTask->tgid);
   currentTask->ctrlPty = -1;
   return 0;
 }
@@ -1,3 +1,4 @@
+#include <caching.h>
 #include <fat32.h>
 #include <linked_list.h>
 #include <linux.h>
@@ -293,7 +294,45 @@ static size_t syscallFsync(int fd) {
   OpenFile *browse = fsUserGetNode(currentTask, fd);
   if (!browse)
     return ERR(EBADF);
-  return 0; // none of our filesystems care enough about write caching
+  // the page cache doesn't know which file its pages belong to, so the whole
+  // disk goes (which ext2 on its own wasn't that far from anyways)
+  if (browse->mountPoint && browse->mountPoint->sync)
+    browse->mountPoint->sync(browse->mountPoint);
+  cachingSync();
+  return 0;
+}
+
+// data & metadata go out together either way
+#define SYSCALL_FDATASYNC 75
+static size_t syscallFdatasync(int fd) { return syscallFsync(fd); }
+
+#define SYSCALL_SYNC 162
+static size_t syscallSync() {
+  fsSyncAll();
+  return 0;
+}
+
+#define SYSCALL_SYNCFS 306
+static size_t syscallSyncfs(int fd) { return syscallFsync(fd); }
+
+#define SYSCALL_READAHEAD 187
+static size_t syscallReadahead(int fd, size_t offset, size_t count) {
+  OpenFile *browse = fsUserGetNode(currentTask, fd);
+  if (!browse)
+    return ERR(EBADF);
+  if (!browse->handlers->readahead)
+    return ERR(EINVAL);
+  return fsAdvise(browse, offset, count, POSIX_FADV_WILLNEED);
+}
+
+#define SYSCALL_FADVISE64 221
+static size_t syscallFadvise64(int fd, size_t offset, size_t len, int advice) {
+  OpenFile *browse = fsUserGetNode(currentTask, fd);
+  if (!browse)
+    return ERR(EBADF);
+  if (!browse->handlers->seek) // pipes, sockets & such
+    return ERR(ESPIPE);
+  return fsAdvise(browse, offset, len, advice);
 }
 
 #define SYSCALL_MKDIR 83
@@ -607,6 +646,11 @@ void syscallRegFs() {
   registerSyscall(SYSCALL_LINK, syscallLink);
   registerSyscall(SYSCALL_LINKAT, syscallLinkat);
   registerSyscall(SYSCALL_FSYNC, syscallFsync);
+  registerSyscall(SYSCALL_FDATASYNC, syscallFdatasync);
+  registerSyscall(SYSCALL_SYNC, syscallSync);
+  registerSyscall(SYSCALL_SYNCFS, syscallSyncfs);
+  registerSyscall(SYSCALL_READAHEAD, syscallReadahead);
+  registerSyscall(SYSCALL_FADVISE64, syscallFadvise64);
 
   registerSyscall(SYSCALL_IOCTL, syscallIoctl);
   registerSyscall(SYSCALL_READV, syscallReadV);
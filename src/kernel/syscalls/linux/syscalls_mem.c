@@ -1,9 +1,17 @@
 #include <linux.h>
 #include <paging.h>
+#include <shmem.h>
 #include <syscalls.h>
 #include <task.h>
 #include <util.h>
 
+// MAP_POPULATE, frames up front (writable at first, then brought down to prot)
+static void syscallMmapPopulate(size_t virt, size_t pages, int prot) {
+  VirtualPopulateL(GetPageDirectory(), virt, pages, PF_RW | PF_USER);
+  if (!(prot & PROT_WRITE))
+    VirtualProtectL(GetPageDirectory(), virt, pages, prot);
+}
+
 #define SYSCALL_MMAP 9
 static uint64_t syscallMmap(size_t addr, size_t length, int prot, int flags,
                             int fd, size_t pgoffset) {
@@ -15,49 +23,58 @@ static uint64_t syscallMmap(size_t addr, size_t length, int prot, int flags,
   if (!addr)
     flags &= ~MAP_FIXED;
 
-  if (flags & MAP_FIXED && flags & MAP_ANONYMOUS) {
-    size_t pages = DivRoundUp(length, PAGE_SIZE);
+  TaskInfoPagedir *info = currentTask->infoPd;
+  size_t           pages = DivRoundUp(length, PAGE_SIZE);
+
+  if (fd == -1 && flags & MAP_ANONYMOUS && flags & MAP_SHARED) {
+    // frames come in on first touch, from the object (see shmem.h)
+    SharedMemory *shared = sharedMemoryAllocate(pages);
+
+    spinlockAcquire(&info->LOCK_PD);
+    size_t base = info->mmap_end;
+    if (flags & MAP_FIXED) {
+      base = addr;
+      VirtualUnmapL(info->pagedir, base, pages); // whatever was there is gone
+      if (base + length > info->mmap_end)
+        info->mmap_end = base + length;
+    } else
+      info->mmap_end += length;
+    taskInfoPdMappingAddShared(info, base, pages, shared, 0, prot);
+    spinlockRelease(&info->LOCK_PD);
+
+    sharedMemoryRelease(shared); // the mapping holds onto it
+    return base;
+  }
 
-    spinlockAcquire(&currentTask->infoPd->LOCK_PD);
+  if (flags & MAP_FIXED && flags & MAP_ANONYMOUS) {
+    spinlockAcquire(&info->LOCK_PD);
+    // whatever was there is gone, fresh (zeroed) pages come in on first touch
+    VirtualUnmapL(info->pagedir, addr, pages);
     size_t end = addr + pages * PAGE_SIZE;
-    if (end > currentTask->infoPd->mmap_end)
-      currentTask->infoPd->mmap_end = end;
-    spinlockRelease(&currentTask->infoPd->LOCK_PD);
-
-    for (int i = 0; i < pages; i++)
-      VirtualMap(addr + i * PAGE_SIZE, PhysicalAllocate(1), PF_RW | PF_USER);
+    if (end > info->mmap_end)
+      info->mmap_end = end;
+    taskInfoPdMappingAdd(info, addr, pages, true, prot);
+    spinlockRelease(&info->LOCK_PD);
 
-    memset((void *)addr, 0, pages * PAGE_SIZE);
+    if (flags & MAP_POPULATE)
+      syscallMmapPopulate(addr, pages, prot);
     return addr;
   }
 
   if (!addr && fd == -1 &&
-      (flags & ~MAP_FIXED & ~MAP_PRIVATE) ==
+      (flags & ~MAP_FIXED & ~MAP_PRIVATE & ~MAP_POPULATE) ==
           MAP_ANONYMOUS) { // before: !addr &&
-    spinlockAcquire(&currentTask->infoPd->LOCK_PD);
-    size_t curr = currentTask->infoPd->mmap_end;
-    taskAdjustHeap(currentTask, currentTask->infoPd->mmap_end + length,
-                   &currentTask->infoPd->mmap_start,
-                   &currentTask->infoPd->mmap_end);
-    spinlockRelease(&currentTask->infoPd->LOCK_PD);
-    memset((void *)curr, 0, length);
+    spinlockAcquire(&info->LOCK_PD);
+    size_t curr = info->mmap_end;
+    taskAdjustHeap(currentTask, info->mmap_end + length, &info->mmap_start,
+                   &info->mmap_end);
+    if (prot != MAPPING_PROT_DEFAULT)
+      taskInfoPdMappingProtect(info, curr, pages, prot);
+    spinlockRelease(&info->LOCK_PD);
+
+    if (flags & MAP_POPULATE)
+      syscallMmapPopulate(curr, pages, prot);
     return curr;
-  } else if (!addr && fd == -1 &&
-             (flags & ~MAP_FIXED & ~MAP_PRIVATE & ~MAP_SHARED) ==
-                 MAP_ANONYMOUS &&
-             (flags & ~MAP_FIXED & ~MAP_PRIVATE & ~MAP_ANONYMOUS) ==
-                 MAP_SHARED) {
-    debugf("[syscalls::mmap] FATAL! Shared memory is unstable asf!\n");
-    panic();
-    /*size_t base = currentTask->mmap_end;
-    size_t pages = DivRoundUp(length, PAGE_SIZE);
-    currentTask->mmap_end += pages * PAGE_SIZE;
-
-    for (int i = 0; i < pages; i++)
-      VirtualMap(base + i * PAGE_SIZE, PhysicalAllocate(1),
-                 PF_RW | PF_USER | PF_SHARED);
-
-    return base;*/
   } else if (fd != -1) {
     OpenFile *file = fsUserGetNode(currentTask, fd);
     if (!file)
@@ -78,56 +95,82 @@ static uint64_t syscallMmap(size_t addr, size_t length, int prot, int flags,
 
 #define SYSCALL_MPROTECT 10
 static size_t syscallMprotect(uint64_t start, uint64_t len, uint64_t prot) {
-  // todo
+  if ((start % PAGE_SIZE) != 0 || start + len < start ||
+      start + len > USER_STACK_BOTTOM)
+    return ERR(EINVAL);
+
+  prot &= ~(PROT_GROWSDOWN | PROT_GROWSUP); // todo: extend to the mapping
+  if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC))
+    return ERR(EINVAL);
+  if (!len)
+    return 0;
+
+  // pages outside of any mapping (stacks & such) get updated all the same
+  size_t           pages = DivRoundUp(len, PAGE_SIZE);
+  TaskInfoPagedir *info = currentTask->infoPd;
+  spinlockAcquire(&info->LOCK_PD);
+  taskInfoPdMappingProtect(info, start, pages, prot);
+  VirtualProtectL(info->pagedir, start, pages, prot);
+  spinlockRelease(&info->LOCK_PD);
   return 0;
 }
 
 #define SYSCALL_MUNMAP 11
 static size_t syscallMunmap(uint64_t addr, size_t len) {
-  if ((addr % PAGE_SIZE) != 0 || !len)
+  if ((addr % PAGE_SIZE) != 0 || !len || addr + len < addr ||
+      addr + len > USER_STACK_BOTTOM)
     return ERR(EINVAL);
 
-  spinlockAcquire(&currentTask->infoPd->LOCK_PD);
-  bool insideBounds = addr >= currentTask->infoPd->mmap_start &&
-                      (addr + len) <= currentTask->infoPd->mmap_end;
-  spinlockRelease(&currentTask->infoPd->LOCK_PD);
-  if (!insideBounds)
-    return ERR(EINVAL);
-
-  size_t pages = DivRoundUp(len, PAGE_SIZE);
-  for (size_t i = 0; i < pages; i++) {
-    size_t phys = VirtualToPhysical(addr + i * PAGE_SIZE);
-    if (!phys)
-      continue;
-    // debugf("%lx %lx\n", addr + i * PAGE_SIZE, phys);
-    VirtualMap(addr + i * PAGE_SIZE, 0, PF_USER);
-    // PhysicalFree(phys, 1); will be done by ^
-  }
+  size_t           pages = DivRoundUp(len, PAGE_SIZE);
+  size_t           end = addr + pages * PAGE_SIZE;
+  TaskInfoPagedir *info = currentTask->infoPd;
+  spinlockAcquire(&info->LOCK_PD);
+  taskInfoPdMappingRemove(info, addr, pages);
+  VirtualUnmapL(info->pagedir, addr, pages);
+
+  // the top of the mmap area can be handed out again
+  if (addr >= info->mmap_start && addr < info->mmap_end &&
+      end >= info->mmap_end)
+    info->mmap_end = addr;
+  spinlockRelease(&info->LOCK_PD);
   return 0;
 }
 
 #define SYSCALL_BRK 12
 static uint64_t syscallBrk(uint64_t brk) {
-  size_t ret = 0;
-  spinlockAcquire(&currentTask->infoPd->LOCK_PD);
+  size_t           ret = 0;
+  TaskInfoPagedir *info = currentTask->infoPd;
+  spinlockAcquire(&info->LOCK_PD);
 
   if (!brk) {
-    ret = currentTask->infoPd->heap_end;
+    ret = info->heap_end;
     goto cleanup;
   }
 
-  if (brk < currentTask->infoPd->heap_end) {
-    dbgSysFailf("inside heap limits");
-    ret = -1;
+  if (brk <= info->heap_end) {
+    if (brk < info->heap_start) {
+      dbgSysFailf("behind heap start");
+      ret = -1;
+      goto cleanup;
+    }
+
+    // given back (malloc trimming), pages past the new top are dropped
+    size_t top = DivRoundUp(brk, PAGE_SIZE) * PAGE_SIZE;
+    size_t oldTop = DivRoundUp(info->heap_end, PAGE_SIZE) * PAGE_SIZE;
+    if (oldTop > top) {
+      taskInfoPdMappingRemove(info, top, (oldTop - top) / PAGE_SIZE);
+      VirtualUnmapL(info->pagedir, top, (oldTop - top) / PAGE_SIZE);
+    }
+    info->heap_end = brk;
+    ret = info->heap_end;
     goto cleanup;
   }
 
-  taskAdjustHeap(currentTask, brk, &currentTask->infoPd->heap_start,
-                 &currentTask->infoPd->heap_end);
+  taskAdjustHeap(currentTask, brk, &info->heap_start, &info->heap_end);
 
-  ret = currentTask->infoPd->heap_end;
+  ret = info->heap_end;
 cleanup:
-  spinlockRelease(&currentTask->infoPd->LOCK_PD);
+  spinlockRelease(&info->LOCK_PD);
   return ret;
 }
 
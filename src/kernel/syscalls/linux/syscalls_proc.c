@@ -4,6 +4,7 @@
 #include <linked_list.h>
 #include <linux.h>
 #include <malloc.h>
+#include <schedule.h>
 #include <string.h>
 #include <syscalls.h>
 #include <system.h>
@@ -250,15 +251,15 @@ static size_t syscallExecve(char *filename, char **argv, char **envp) {
     return ERR(ENOENT);
 
   int targetId = currentTask->id;
-  currentTask->id = taskGenerateId();
+  taskSetId(currentTask, taskGenerateId());
   int targetTgid = currentTask->tgid;
   currentTask->tgid = currentTask->id; // better way to do alladat
 
-  ret->id = targetId;
+  taskSetId(ret, targetId);
   ret->tgid = targetTgid;
   ret->parent = currentTask->parent;
-  ret->pgid = currentTask->pgid;
-  ret->sid = currentTask->sid;
+  taskSetPgid(ret, currentTask->pgid);
+  taskSetSid(ret, currentTask->sid);
   ret->ctrlPty = currentTask->ctrlPty;
   ret->sigBlockList = currentTask->sigBlockList;
   taskInfoFsDiscard(ret->infoFs);
@@ -274,7 +275,7 @@ static size_t syscallExecve(char *filename, char **argv, char **envp) {
 
   taskCreateFinish(ret);
   if (currentTask->parent->state == TASK_STATE_WAITING_VFORK)
-    currentTask->parent->state = TASK_STATE_READY;
+    schedWake(currentTask->parent);
 
   currentTask->noInformParent = true;
   taskKill(currentTask->id, 0);
@@ -403,9 +404,11 @@ static size_t syscallReboot(int magic1, int magic2, uint32_t cmd, void *arg) {
     return ERR(EINVAL);
   switch (cmd) {
   case LINUX_REBOOT_CMD_POWER_OFF:
+    fsSyncAll();
     return acpiPoweroff();
     break;
   case LINUX_REBOOT_CMD_RESTART:
+    fsSyncAll();
     return acpiReboot();
     break;
   default:
@@ -431,6 +434,7 @@ static void syscallExitGroup(int return_code) {
     if (browse->tgid == currentTask->tgid && browse->id != currentTask->id) {
       // found one of ours!
       atomicBitmapSet(&browse->sigPendingList, SIGKILL);
+      schedSignalWake(browse);
     }
     browse = browse->next;
   }
@@ -1,4 +1,5 @@
 #include <linux.h>
+#include <schedule.h>
 #include <syscalls.h>
 #include <task.h>
 #include <util.h>
@@ -109,26 +110,20 @@ static size_t syscallKill(int pid, int sig) {
   }
 
   if (pid > 0) {
-    // specific tgid
-    spinlockCntReadAcquire(&TASK_LL_MODIFY);
-    Task *target = firstTask;
-    while (target) {
-      if (target->tgid == pid)
-        break;
-      target = target->next;
-    }
-    spinlockCntReadRelease(&TASK_LL_MODIFY);
-    if (!target || target->state == TASK_STATE_DEAD)
+    // specific tgid, whose leader has that same id
+    Task *target = taskGet(pid);
+    if (!target || target->tgid != pid || target->state == TASK_STATE_DEAD)
       return ERR(ESRCH);
     atomicBitmapSet(&target->sigPendingList, sig);
+    schedSignalWake(target);
   } else if (!pid) {
     // sent to every process in our group
     spinlockCntReadAcquire(&TASK_LL_MODIFY);
-    Task *target = firstTask;
+    Task *target = taskPgrpFirst(currentTask->pgid);
     while (target) {
-      if (target->pgid == currentTask->pgid)
-        atomicBitmapSet(&target->sigPendingList, sig);
-      target = target->next;
+      atomicBitmapSet(&target->sigPendingList, sig);
+      schedSignalWake(target);
+      target = taskPgrpNext(target);
     }
     spinlockCntReadRelease(&TASK_LL_MODIFY);
   } else if (pid == -1) {
@@ -139,6 +134,7 @@ static size_t syscallKill(int pid, int sig) {
     while (target) {
       cnt++;
       atomicBitmapSet(&target->sigPendingList, sig);
+      schedSignalWake(target);
       target = target->next;
     }
     spinlockCntReadRelease(&TASK_LL_MODIFY);
@@ -147,11 +143,11 @@ static size_t syscallKill(int pid, int sig) {
   } else if (pid < -1) {
     // -pid process group
     spinlockCntReadAcquire(&TASK_LL_MODIFY);
-    Task *target = firstTask;
+    Task *target = taskPgrpFirst(-pid);
     while (target) {
-      if (target->pgid == -pid)
-        atomicBitmapSet(&target->sigPendingList, sig);
-      target = target->next;
+      atomicBitmapSet(&target->sigPendingList, sig);
+      schedSignalWake(target);
+      target = taskPgrpNext(target);
     }
     spinlockCntReadRelease(&TASK_LL_MODIFY);
   }
@@ -161,17 +157,11 @@ static size_t syscallKill(int pid, int sig) {
 
 #define SYSCALL_TKILL 200
 static size_t syscallTkill(int pid, int sig) {
-  spinlockCntReadAcquire(&TASK_LL_MODIFY);
-  Task *target = firstTask;
-  while (target) {
-    if (target->id == pid)
-      break;
-    target = target->next;
-  }
-  spinlockCntReadRelease(&TASK_LL_MODIFY);
+  Task *target = taskGet(pid);
   if (!target || target->state == TASK_STATE_DEAD)
     return ERR(ESRCH);
   atomicBitmapSet(&target->sigPendingList, sig);
+  schedSignalWake(target);
   return 0;
 }
 
@@ -17,9 +17,9 @@ typedef struct PipeInfo {
   int writeFds;
   int readFds;
 
-  Spinlock LOCK;
-  Blocking blockingRead;
-  Blocking blockingWrite;
+  Spinlock  LOCK;
+  WaitQueue readers;
+  WaitQueue writers;
 } PipeInfo;
 
 typedef struct PipeSpecific PipeSpecific;
@@ -49,9 +49,6 @@ size_t pipeOpen(int *fds) {
   info->readFds = 1;
   info->writeFds = 1;
 
-  LinkedListInit(&info->blockingRead.dsBlockedTask, sizeof(BlockedTask));
-  LinkedListInit(&info->blockingWrite.dsBlockedTask, sizeof(BlockedTask));
-
   PipeSpecific *readSpec = (PipeSpecific *)malloc(sizeof(PipeSpecific));
   readSpec->write = false;
   readSpec->info = info;
@@ -99,6 +96,7 @@ size_t pipeRead(OpenFile *fd, uint8_t *out, size_t limit) {
   PipeInfo     *pipe = spec->info;
 
   // if there are no more write items, don't hang
+  WaitQueueEntry wait;
   while (true) {
     spinlockAcquire(&pipe->LOCK);
     if (pipe->writeFds == 0 || pipe->assigned > 0)
@@ -107,8 +105,10 @@ size_t pipeRead(OpenFile *fd, uint8_t *out, size_t limit) {
       spinlockRelease(&pipe->LOCK);
       return ERR(EWOULDBLOCK);
     }
-    taskBlock(&pipe->blockingRead, currentTask, &pipe->LOCK, true);
-    handControl();
+    waitQueuePrepare(&pipe->readers, &wait);
+    spinlockRelease(&pipe->LOCK);
+    if (waitQueueSleep(&pipe->readers, &wait, 0) == WAIT_SIGNAL)
+      return ERR(EINTR);
   }
 
   if (!pipe->assigned) {
@@ -124,8 +124,8 @@ size_t pipeRead(OpenFile *fd, uint8_t *out, size_t limit) {
   memcpy(out, pipe->buf, toCopy);
   pipe->assigned -= toCopy;
   memmove(pipe->buf, &pipe->buf[toCopy], PIPE_BUFF - toCopy);
-  taskUnblock(&pipe->blockingWrite);
   spinlockRelease(&pipe->LOCK);
+  waitQueueWakeAll(&pipe->writers);
   pollInstanceRing((size_t)pipe, EPOLLOUT);
 
   return toCopy;
@@ -134,6 +134,8 @@ size_t pipeRead(OpenFile *fd, uint8_t *out, size_t limit) {
 size_t pipeWriteInner(OpenFile *fd, uint8_t *in, size_t limit) {
   PipeSpecific *spec = (PipeSpecific *)fd->dir;
   PipeInfo     *pipe = spec->info;
+
+  WaitQueueEntry wait;
   while (true) {
     spinlockAcquire(&pipe->LOCK);
     if ((pipe->assigned + limit) <= PIPE_BUFF)
@@ -147,15 +149,17 @@ size_t pipeWriteInner(OpenFile *fd, uint8_t *in, size_t limit) {
       spinlockRelease(&pipe->LOCK);
       return ERR(EWOULDBLOCK);
     }
-    taskBlock(&pipe->blockingWrite, currentTask, &pipe->LOCK, true);
-    handControl();
+    waitQueuePrepare(&pipe->writers, &wait);
+    spinlockRelease(&pipe->LOCK);
+    if (waitQueueSleep(&pipe->writers, &wait, 0) == WAIT_SIGNAL)
+      return ERR(EINTR);
   }
 
   // we already have a spinlock!
   memcpy(&pipe->buf[pipe->assigned], in, limit);
   pipe->assigned += limit;
-  taskUnblock(&pipe->blockingRead);
   spinlockRelease(&pipe->LOCK);
+  waitQueueWakeAll(&pipe->readers);
   pollInstanceRing((size_t)pipe, EPOLLIN);
 
   return limit;
@@ -171,6 +175,8 @@ size_t pipeWrite(OpenFile *fd, uint8_t *in, size_t limit) {
       while (cycle != PIPE_BUFF) {
         size_t innerRet =
             pipeWriteInner(fd, in + i * PIPE_BUFF + cycle, PIPE_BUFF - cycle);
+        if (innerRet == ERR(EINTR) && (ret + cycle))
+          return ret + cycle; // a signal cut us short, report what went in
         if (RET_IS_ERR(innerRet))
           return innerRet; // cycle || ret ignored since only EPIPE & EAGAIN
         cycle += innerRet;
@@ -183,6 +189,8 @@ size_t pipeWrite(OpenFile *fd, uint8_t *in, size_t limit) {
     while (cycle != remainder) {
       size_t innerRet = pipeWriteInner(fd, in + chunks * PIPE_BUFF + cycle,
                                        remainder - cycle);
+      if (innerRet == ERR(EINTR) && (ret + cycle))
+        return ret + cycle;
       if (RET_IS_ERR(innerRet))
         return innerRet; // cycle || ret ignored since only EPIPE & EAGAIN
       cycle += innerRet;
@@ -234,19 +242,20 @@ bool pipeCloseEnd(OpenFile *readFd) {
     pipe->readFds--;
 
   int pollWith = 0;
-  if (!pipe->writeFds) { // edge case
-    taskUnblock(&pipe->blockingRead);
+  if (!pipe->writeFds) // edge case
     pollWith |= EPOLLHUP;
-  }
-  if (!pipe->readFds) { // edge case (more aggressive)
-    taskUnblock(&pipe->blockingWrite);
+  if (!pipe->readFds) // edge case (more aggressive)
     pollWith |= EPOLLERR;
-  }
 
   if (!pipe->readFds && !pipe->writeFds)
-    free(pipe);
-  else
+    free(pipe); // nobody left to be sleeping on it
+  else {
     spinlockRelease(&pipe->LOCK);
+    if (pollWith & EPOLLHUP)
+      waitQueueWakeAll(&pipe->readers);
+    if (pollWith & EPOLLERR)
+      waitQueueWakeAll(&pipe->writers);
+  }
 
   if (pollWith)
     pollInstanceRing((size_t)pipe, pollWith);
@@ -5,6 +5,7 @@
 #include <linux.h>
 #include <malloc.h>
 #include <poll.h>
+#include <schedule.h>
 #include <syscalls.h>
 #include <task.h>
 #include <timer.h>
@@ -91,7 +92,7 @@ void pollInstanceRingInner(PollInstance *instanceUnsafe, bool involuntary) {
     // maybe not needed since the lock is released...
     assert(!listener->task->spinlockQueueEntry);
     listener->task->forcefulWakeupTimeUnsafe = 0;
-    listener->task->state = TASK_STATE_READY;
+    schedWake(listener->task);
     TaskListeners *next = (TaskListeners *)listener->_ll.next;
     free(listener);
     listener = next;
@@ -351,7 +352,7 @@ size_t epollWait(OpenFile *epollFd, struct epoll_event *events, int maxevents,
 
   // hack'y way but until I implement wake queues, it is what it is
   int    ready = 0;
-  size_t target = timerTicks + timeout;
+  size_t target = timerNanos() + timeout * 1000000ULL;
   do {
     spinlockAcquire(&epoll->LOCK_EPOLL);
     spinlockAcquire(&LOCK_POLL_ROOT); // these two for pollInstanceWait()
@@ -379,7 +380,7 @@ size_t epollWait(OpenFile *epollFd, struct epoll_event *events, int maxevents,
       spinlockRelease(&LOCK_POLL_ROOT);
     }
     // handControl();
-  } while (timeout != 0 && (timeout == -1 || timerTicks < target));
+  } while (timeout != 0 && (timeout == -1 || timerNanos() < target));
 
   // todo (later): check that this is correct for signals
   if (!ready && sigexit)
@@ -483,7 +484,7 @@ size_t poll(struct pollfd *fds, int nfds, int timeout) {
   dbgSysExtraf("0: fd{%d} events{%d}", fds[0].fd, fds[0].events);
   int    ret = 0;
   bool   sigexit = false;
-  size_t target = timerTicks + timeout;
+  size_t target = timerNanos() + timeout * 1000000ULL;
 
   spinlockAcquire(&LOCK_POLL_ROOT);
   PollInstance *instance = pollInstanceAllocate();
@@ -546,7 +547,7 @@ size_t poll(struct pollfd *fds, int nfds, int timeout) {
         handControl();
     }
     // handControl();
-  } while (timeout != 0 && (timeout == -1 || timerTicks < target));
+  } while (timeout != 0 && (timeout == -1 || timerNanos() < target));
 
   pollInstanceDestroy(instance, false);
 
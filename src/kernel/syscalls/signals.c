@@ -1,4 +1,5 @@
 #include <bootloader.h>
+#include <fpu.h>
 #include <gdt.h>
 #include <linked_list.h>
 #include <paging.h>
@@ -19,7 +20,7 @@ extern void    syscall_entry();
 // * uint64_t retaddr;
 // * struct sigcontext ucontext;
 // * struct siginfo info; (optional)
-// * struct fpstate fp;
+// * struct fpstate fp; (the whole xsave area, see fpuFrameStore())
 
 void initiateSignalDefs() {
   signalInternalDecisions[SIGABRT] = SIGNAL_INTERNAL_CORE;
@@ -229,9 +230,6 @@ void signalsPendingHandleSys(void *taskPtr, uint64_t *rsp,
   oldstate.rip = oldstate.rcx; // extra
   oldstate.usermode_rsp = *rsp;
   oldstate.usermode_ss = GDT_USER_DATA | DPL_USER;
-  // since the scheduler, our fpu state might've changed (from task.c)
-  asm volatile(" fxsave %0 " ::"m"(task->fpuenv));
-  asm("stmxcsr (%%rax)" : : "a"(&task->mxcsr));
 
   size_t sigrsp = *rsp;
 
@@ -242,9 +240,9 @@ void signalsPendingHandleSys(void *taskPtr, uint64_t *rsp,
   sigrsp -= PAGE_SIZE;
   sigrsp = (sigrsp / PAGE_SIZE) * PAGE_SIZE;
 
-  sigrsp -= sizeof(struct fpstate);
+  sigrsp -= fpuFrameSize();
   struct fpstate *fpu = (struct fpstate *)sigrsp;
-  memcpy(fpu, task->fpuenv, sizeof(struct fpstate));
+  fpuFrameStore(task, fpu);
 
   sigrsp -= sizeof(struct sigcontext);
   struct sigcontext *ucontext = (struct sigcontext *)sigrsp;
@@ -316,6 +314,13 @@ void signalsPendingHandleSched(void *taskPtr) {
     return;
   }
 
+  // the frame is written via the HHDM, so no fault will bring it in (stacks
+  // are usually on-demand mmap()s) or unshare it for us
+  size_t framePage = task->registers.usermode_rsp - 128 - PAGE_SIZE;
+  if (VirtualDemandFault(task, framePage, true) == FAULT_BUSY ||
+      VirtualCopyOnWrite(task->infoPd->pagedir, framePage) == FAULT_BUSY)
+    return; // still pending, will be handled on the next schedule
+
   // (also SA_NODEFER)
   sigset_t oldMask = task->sigBlockList;
   task->sigBlockList |= (1 << signal) | atomicRead64(&action->sa_mask);
@@ -341,9 +346,9 @@ void signalsPendingHandleSched(void *taskPtr) {
   int    top = PAGE_SIZE;
   size_t region = bootloader.hhdmOffset + regionPhys;
 
-  top -= sizeof(struct fpstate);
+  top -= fpuFrameSize();
   struct fpstate *fpu = (struct fpstate *)(region + top);
-  memcpy(fpu, task->fpuenv, sizeof(struct fpstate));
+  fpuFrameStore(task, fpu);
   int fpuoffset = top;
 
   top -= sizeof(struct sigcontext);
@@ -432,9 +437,8 @@ size_t signalsSigreturnSyscall(void *taskPtr) {
   // this doesn't matter at all since they will be saved, but better be safe
   memcpy(&task->registers, iretqRsp, sizeof(AsmPassedInterrupt));
 
-  memcpy(task->fpuenv, ucontext->fpstate, sizeof(task->fpuenv));
-  task->mxcsr = ucontext->fpstate->mxcsr;
-  asm volatile(" fxrstor %0 " ::"m"(task->fpuenv));
+  if (ucontext->fpstate)
+    fpuFrameLoad(task, ucontext->fpstate);
 
   task->systemCallInProgress = false;
   task->syscallRegs = 0;
@@ -59,8 +59,11 @@ bool unixSocketAcceptClose(OpenFile *fd) {
 
   if (pair->serverFds == 0 && pair->clientFds == 0)
     unixSocketFreePair(pair);
-  else
+  else {
     spinlockRelease(&pair->LOCK_PAIR);
+    if (notify)
+      waitQueueWakeAll(&pair->waiters);
+  }
 
   if (notify)
     pollInstanceRing((size_t)pair, EPOLLHUP);
@@ -78,6 +81,7 @@ size_t unixSocketAcceptRecvfrom(OpenFile *fd, uint8_t *out, size_t limit,
   UnixSocketPair *pair = fd->dir;
   if (!pair->clientFds && CircularReadPoll(&pair->serverBuff) == 0)
     return 0;
+  WaitQueueEntry wait;
   while (true) {
     spinlockAcquire(&pair->LOCK_PAIR);
     if (!pair->clientFds && CircularReadPoll(&pair->serverBuff) == 0) {
@@ -89,7 +93,10 @@ size_t unixSocketAcceptRecvfrom(OpenFile *fd, uint8_t *out, size_t limit,
       return ERR(EWOULDBLOCK);
     } else if (CircularReadPoll(&pair->serverBuff) > 0)
       break;
+    waitQueuePrepare(&pair->waiters, &wait);
     spinlockRelease(&pair->LOCK_PAIR);
+    if (waitQueueSleep(&pair->waiters, &wait, 0) == WAIT_SIGNAL)
+      return ERR(EINTR);
   }
 
   // spinlock already acquired
@@ -97,6 +104,7 @@ size_t unixSocketAcceptRecvfrom(OpenFile *fd, uint8_t *out, size_t limit,
   assert(CircularRead(&pair->serverBuff, out, toCopy) == toCopy);
   bool notify = CircularWritePoll(&pair->serverBuff) > UNIX_SOCK_POLL_EXTRA;
   spinlockRelease(&pair->LOCK_PAIR);
+  waitQueueWakeAll(&pair->waiters);
   if (notify)
     pollInstanceRing((size_t)pair, EPOLLOUT);
 
@@ -116,6 +124,7 @@ size_t unixSocketAcceptSendto(OpenFile *fd, uint8_t *in, size_t limit,
     limit = pair->clientBuffSize;
   }
 
+  WaitQueueEntry wait;
   while (true) {
     spinlockAcquire(&pair->LOCK_PAIR);
     if (!pair->clientFds) {
@@ -128,12 +137,16 @@ size_t unixSocketAcceptSendto(OpenFile *fd, uint8_t *in, size_t limit,
       return ERR(EWOULDBLOCK);
     } else if (CircularWritePoll(&pair->clientBuff) >= limit)
       break;
+    waitQueuePrepare(&pair->waiters, &wait);
     spinlockRelease(&pair->LOCK_PAIR);
+    if (waitQueueSleep(&pair->waiters, &wait, 0) == WAIT_SIGNAL)
+      return ERR(EINTR);
   }
 
   // spinlock already acquired
   assert(CircularWrite(&pair->clientBuff, in, limit) == limit);
   spinlockRelease(&pair->LOCK_PAIR);
+  waitQueueWakeAll(&pair->waiters);
   pollInstanceRing((size_t)pair, EPOLLIN);
 
   return limit;
@@ -335,6 +348,7 @@ size_t unixSocketAccept(OpenFile *fd, sockaddr_linux *addr, uint32_t *len) {
     dbgSysStubf("todo addr");
   }
 
+  WaitQueueEntry wait;
   while (true) {
     spinlockAcquire(&sock->LOCK_SOCK);
     if (sock->connCurr > 0)
@@ -345,8 +359,10 @@ size_t unixSocketAccept(OpenFile *fd, sockaddr_linux *addr, uint32_t *len) {
       return ERR(EWOULDBLOCK);
     } else
       sock->acceptWouldBlock = false;
+    waitQueuePrepare(&sock->acceptWaiters, &wait);
     spinlockRelease(&sock->LOCK_SOCK);
-    handControl();
+    if (waitQueueSleep(&sock->acceptWaiters, &wait, 0) == WAIT_SIGNAL)
+      return ERR(EINTR);
   }
 
   // now pick the first thing! (sock spinlock already engaged)
@@ -357,6 +373,7 @@ size_t unixSocketAccept(OpenFile *fd, sockaddr_linux *addr, uint32_t *len) {
   pair->established = true;
   pair->filename = strdup(sock->bindAddr);
   spinlockRelease(&pair->LOCK_PAIR);
+  waitQueueWakeAll(&pair->waiters); // connect() is waiting on this
 
   OpenFile *acceptFd = unixSocketAcceptCreate(pair);
   sock->backlog[0] = 0; // just in case
@@ -438,18 +455,21 @@ size_t unixSocketConnect(OpenFile *fd, sockaddr_linux *addr, uint32_t len) {
   pair->clientFds = 1;
   parent->backlog[parent->connCurr++] = pair;
   spinlockRelease(&parent->LOCK_SOCK);
+  waitQueueWakeAll(&parent->acceptWaiters);
   pollInstanceRing((size_t)parent, EPOLLIN);
   pollInstanceRing((size_t)pair, EPOLLIN);
 
   // todo!
   assert(!(fd->flags & O_NONBLOCK));
+  WaitQueueEntry wait;
   while (true) {
     spinlockAcquire(&pair->LOCK_PAIR);
     if (pair->established)
       break;
-    spinlockRelease(&pair->LOCK_PAIR);
     // wait for parent to accept this thing and have it's own fd on the side
-    handControl();
+    waitQueuePrepare(&pair->waiters, &wait);
+    spinlockRelease(&pair->LOCK_PAIR);
+    waitQueueSleep(&pair->waiters, &wait, 0); // already on the backlog
   }
   spinlockRelease(&pair->LOCK_PAIR);
 
@@ -483,8 +503,11 @@ bool unixSocketClose(OpenFile *fd) {
       keyToNotify = (size_t)unixSocket->pair;
     if (!unixSocket->pair->clientFds && !unixSocket->pair->serverFds)
       unixSocketFreePair(unixSocket->pair);
-    else
+    else {
       spinlockRelease(&unixSocket->pair->LOCK_PAIR);
+      if (keyToNotify)
+        waitQueueWakeAll(&unixSocket->pair->waiters);
+    }
   }
   if (unixSocket->timesOpened == 0) {
     // destroy it
@@ -512,6 +535,7 @@ size_t unixSocketRecvfrom(OpenFile *fd, uint8_t *out, size_t limit, int flags,
     return ERR(ENOTCONN);
   if (!pair->serverFds && CircularReadPoll(&pair->clientBuff) == 0)
     return 0;
+  WaitQueueEntry wait;
   while (true) {
     spinlockAcquire(&pair->LOCK_PAIR);
     if (!pair->serverFds && CircularReadPoll(&pair->clientBuff) == 0) {
@@ -523,13 +547,17 @@ size_t unixSocketRecvfrom(OpenFile *fd, uint8_t *out, size_t limit, int flags,
       return ERR(EWOULDBLOCK);
     } else if (CircularReadPoll(&pair->clientBuff) > 0)
       break;
+    waitQueuePrepare(&pair->waiters, &wait);
     spinlockRelease(&pair->LOCK_PAIR);
+    if (waitQueueSleep(&pair->waiters, &wait, 0) == WAIT_SIGNAL)
+      return ERR(EINTR);
   }
 
   // spinlock already acquired
   size_t toCopy = MIN(limit, CircularReadPoll(&pair->clientBuff));
   assert(CircularRead(&pair->clientBuff, out, toCopy) == toCopy);
   spinlockRelease(&pair->LOCK_PAIR);
+  waitQueueWakeAll(&pair->waiters);
   pollInstanceRing((size_t)pair, EPOLLOUT);
 
   return toCopy;
@@ -551,6 +579,7 @@ size_t unixSocketSendto(OpenFile *fd, uint8_t *in, size_t limit, int flags,
     limit = pair->serverBuffSize;
   }
 
+  WaitQueueEntry wait;
   while (true) {
     spinlockAcquire(&pair->LOCK_PAIR);
     if (!pair->serverFds) {
@@ -563,12 +592,16 @@ size_t unixSocketSendto(OpenFile *fd, uint8_t *in, size_t limit, int flags,
       return ERR(EWOULDBLOCK);
     } else if (CircularWritePoll(&pair->serverBuff) >= limit)
       break;
+    waitQueuePrepare(&pair->waiters, &wait);
     spinlockRelease(&pair->LOCK_PAIR);
+    if (waitQueueSleep(&pair->waiters, &wait, 0) == WAIT_SIGNAL)
+      return ERR(EINTR);
   }
 
   // spinlock already acquired
   assert(CircularWrite(&pair->serverBuff, in, limit) == limit);
   spinlockRelease(&pair->LOCK_PAIR);
+  waitQueueWakeAll(&pair->waiters);
   pollInstanceRing((size_t)pair, EPOLLIN);
 
   return limit;
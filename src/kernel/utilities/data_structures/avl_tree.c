@@ -1,5 +1,6 @@
 #include <avl_tree.h>
 #include <malloc.h>
+#include <slab.h>
 #include <util.h>
 
 // AVL Tree implementation. As much as I hate recursion, there's a lot of it
@@ -9,13 +10,22 @@
 #define CALC_BALANCE(node)                                                     \
   ((node) ? CALC_HEIGHT((node)->left) - CALC_HEIGHT((node)->right) : 0)
 
+void AVLConstructNode(void *obj) {
+  AVLheader *node = (AVLheader *)obj;
+  node->height = 1; // sane default
+}
+
+SlabCache avlCache =
+    SLAB_CACHE("avl_node", sizeof(AVLheader), AVLConstructNode);
+
 AVLheader *AVLAllocateNode(avlkey key) {
-  AVLheader *node = calloc(sizeof(AVLheader), 1);
+  AVLheader *node = slabAlloc(&avlCache);
   node->key = key;
-  node->height = 1; // sane default
   return node;
 }
 
+void AVLFreeNode(AVLheader *node) { slabFree(&avlCache, node); }
+
 #define COUNT 10
 void AVLDebug(AVLheader *root, int space) {
   // Base case
@@ -144,7 +154,7 @@ AVLheader *AVLUnregisterL(AVLheader *root, avlkey key, avlval *target) {
                                                // the non-empty child
       assert(!(*target));
       *target = temp->value;
-      free(temp);
+      slabFree(&avlCache, temp);
     } else {
       // node with two children: Get the inorder
       // successor (smallest in the right subtree)
@@ -215,3 +225,20 @@ avlval AVLLookup(void *raw, avlkey key) {
     return AVLLookup(root->left, key);
   return root->value;
 }
+
+// Value of the biggest key that's <= key (think ranges sorted by start)
+avlval AVLLookupFloor(void *raw, avlkey key) {
+  AVLheader *browse = raw;
+  avlval     ret = 0;
+  while (browse) {
+    if (key < browse->key)
+      browse = browse->left;
+    else {
+      ret = browse->value;
+      if (key == browse->key)
+        break;
+      browse = browse->right;
+    }
+  }
+  return ret;
+}
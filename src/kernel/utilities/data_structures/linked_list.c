@@ -1,5 +1,6 @@
 #include <linked_list.h>
 #include <malloc.h>
+#include <slab.h>
 #include <util.h>
 
 // Linked Lists (singly, non-circular); basically just allocated structs
@@ -26,7 +27,7 @@ void *LinkedListAllocate(LLcontrol *ll, uint32_t structSize) {
   LinkedListNormal(ll, structSize);
   void **LLfirstPtr = (void **)(&ll->firstObject);
 
-  LLheader *target = (LLheader *)malloc(structSize);
+  LLheader *target = (LLheader *)slabMalloc(structSize);
   memset(target, 0, structSize);
 
   LLheader *curr = (LLheader *)(*LLfirstPtr);
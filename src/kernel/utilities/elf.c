@@ -1,10 +1,12 @@
 #include <bitmap.h>
+#include <bootloader.h>
 #include <console.h>
 #include <elf.h>
 #include <fb.h>
 #include <malloc.h>
 #include <paging.h>
 #include <pmm.h>
+#include <schedule.h>
 #include <stack.h>
 #include <string.h>
 #include <syscalls.h>
@@ -12,6 +14,7 @@
 #include <task.h>
 #include <timer.h>
 #include <util.h>
+#include <vdso.h>
 #include <vfs.h>
 #include <vmm.h>
 
@@ -46,58 +49,463 @@ bool elf_check_file(Elf64_Ehdr *hdr) {
   return true;
 }
 
-void elfProcessLoad(Elf64_Phdr *elf_phdr, uint8_t *out, size_t base) {
-  // Map the (current) program page
-  size_t   startRounded = (elf_phdr->p_vaddr & ~0xFFF);
-  uint64_t pagesRequired = DivRoundUp(
-      (elf_phdr->p_vaddr - startRounded) + elf_phdr->p_memsz, 0x1000);
-  for (int j = 0; j < pagesRequired; j++) {
-    size_t vaddr = (elf_phdr->p_vaddr & ~0xFFF) + j * 0x1000;
-    if (VirtualToPhysical(base + vaddr))
+// Executable images (see ElfImage), the idle ones trimmed in elfImageGet() &
+// under memory pressure
+ElfImage *elfImages = 0;
+Spinlock  LOCK_ELF_IMAGES = ATOMIC_FLAG_INIT;
+
+// Pages that need reading from the disk, worked through by elfPager()
+ElfPagerReq elfPagerQueue[ELF_PAGER_QUEUE];
+size_t      elfPagerRead = 0;
+size_t      elfPagerWrite = 0;
+Spinlock    LOCK_ELF_PAGER = ATOMIC_FLAG_INIT;
+WaitQueue   elfPagerWait = {0};
+
+#define ELF_PHDR(image, i)                                                     \
+  ((Elf64_Phdr *)((image)->head + (image)->ehdr->e_phoff +                     \
+                  (i) * (image)->ehdr->e_phentsize))
+
+// returns how many frames it gave back
+static size_t elfImageFree(ElfImage *image) {
+  size_t freed = 0;
+  for (size_t i = 0; i < image->pages; i++) {
+    if (image->frames[i]) {
+      PhysicalFree(image->frames[i], 1);
+      freed++;
+    }
+  }
+  fsKernelClose(image->file);
+  free(image->frames);
+  free(image->head);
+  free(image);
+  return freed;
+}
+
+static size_t elfImageFrames(ElfImage *image) {
+  size_t ret = 0;
+  for (size_t i = 0; i < image->pages; i++) {
+    if (image->frames[i])
+      ret++;
+  }
+  return ret;
+}
+
+// Unlinks idle images (stale ones first, then the least recently used) until
+// only keep are left or they add up to pages frames, returning them chained
+// for elfImageFree(). LOCK_ELF_IMAGES has to be held
+static ElfImage *elfImageTrimL(size_t keep, size_t pages) {
+  ElfImage *trim = 0;
+  size_t    frames = 0;
+  while (frames < pages) {
+    size_t     idle = 0;
+    ElfImage **oldest = 0;
+    for (ElfImage **b = &elfImages; *b; b = &(*b)->next) {
+      if ((*b)->refs)
+        continue;
+      idle++;
+      if (!oldest || ((*b)->stale != (*oldest)->stale
+                          ? (*b)->stale
+                          : (*b)->lastUsed < (*oldest)->lastUsed))
+        oldest = b;
+    }
+    if (idle <= keep)
+      break;
+    ElfImage *victim = *oldest;
+    *oldest = victim->next;
+    victim->next = trim;
+    trim = victim;
+    frames += elfImageFrames(victim);
+  }
+  return trim;
+}
+
+static size_t elfImageFreeAll(ElfImage *trim) {
+  size_t freed = 0;
+  while (trim) {
+    ElfImage *next = trim->next;
+    freed += elfImageFree(trim);
+    trim = next;
+  }
+  return freed;
+}
+
+// reads straight from the file, LOCK_IMAGE keeps the file pointer ours
+size_t elfImageRead(ElfImage *image, void *out, size_t off, size_t len) {
+  if (off >= image->size)
+    return 0;
+  len = MIN(len, image->size - off);
+
+  spinlockAcquire(&image->LOCK_IMAGE);
+  image->file->handlers->seek(image->file, off, off, SEEK_SET);
+  size_t ret = fsRead(image->file, out, len);
+  spinlockRelease(&image->LOCK_IMAGE);
+
+  return RET_IS_ERR(ret) ? 0 : ret;
+}
+
+// the elf header & program headers (which stackGenerateUser() needs as well)
+static bool elfImageHead(ElfImage *image) {
+  Elf64_Ehdr ehdr = {0};
+  if (elfImageRead(image, &ehdr, 0, sizeof(Elf64_Ehdr)) != sizeof(Elf64_Ehdr))
+    return false;
+  if (!elf_check_file(&ehdr) || ehdr.e_phentsize < sizeof(Elf64_Phdr))
+    return false;
+
+  size_t len = ehdr.e_phoff + ehdr.e_phnum * ehdr.e_phentsize;
+  if (len > image->size)
+    return false;
+
+  image->head = malloc(len);
+  if (elfImageRead(image, image->head, 0, len) != len)
+    return false;
+  image->ehdr = (Elf64_Ehdr *)image->head;
+  return true;
+}
+
+ElfImage *elfImageGet(char *filepath) {
+  OpenFile *file = fsKernelOpen(filepath, O_RDONLY, 0);
+  if (!file)
+    return 0;
+
+  stat stat = {0};
+  if (!file->handlers->seek || !fsStat(file, &stat)) {
+    debugf("[elf] Can't map %s, no seek/stat support!\n", filepath);
+    fsKernelClose(file);
+    return 0;
+  }
+
+  // someone else already running it?
+  spinlockAcquire(&LOCK_ELF_IMAGES);
+  ElfImage *browse = elfImages;
+  while (browse) {
+    if (!browse->stale && browse->mnt == file->mountPoint &&
+        browse->inode == stat.st_ino && browse->mtime == stat.st_mtime &&
+        browse->size == stat.st_size)
+      break;
+    browse = browse->next;
+  }
+  if (browse)
+    browse->refs++;
+  spinlockRelease(&LOCK_ELF_IMAGES);
+
+  if (browse) {
+    fsKernelClose(file);
+    return browse;
+  }
+
+  ElfImage *image = calloc(sizeof(ElfImage), 1);
+  image->mnt = file->mountPoint;
+  image->inode = stat.st_ino;
+  image->mtime = stat.st_mtime;
+  image->size = stat.st_size;
+  image->refs = 1;
+  image->file = file;
+  image->pages = DivRoundUp(image->size, PAGE_SIZE);
+  image->frames = calloc(sizeof(size_t), image->pages);
+  if (!elfImageHead(image)) {
+    debugf("[elf] File %s is not a valid tivOS ELF64 executable!\n", filepath);
+    elfImageFree(image);
+    return 0;
+  }
+
+  // link it in, letting go of the idle ones we've got too many of
+  spinlockAcquire(&LOCK_ELF_IMAGES);
+  image->next = elfImages;
+  elfImages = image;
+  ElfImage *trim = elfImageTrimL(ELF_IMAGE_IDLE_MAX, (size_t)-1);
+  spinlockRelease(&LOCK_ELF_IMAGES);
+
+  elfImageFreeAll(trim);
+  return image;
+}
+
+void elfImageInvalidate(OpenFile *file) {
+  // nothing from this mountpoint? then there's no need to go & stat it
+  spinlockAcquire(&LOCK_ELF_IMAGES);
+  ElfImage *browse = elfImages;
+  while (browse && (browse->stale || browse->mnt != file->mountPoint))
+    browse = browse->next;
+  spinlockRelease(&LOCK_ELF_IMAGES);
+
+  stat stat = {0};
+  if (!browse || !fsStat(file, &stat))
+    return;
+
+  // whoever's running them keeps the old contents, nobody new gets them
+  spinlockAcquire(&LOCK_ELF_IMAGES);
+  for (browse = elfImages; browse; browse = browse->next) {
+    if (browse->mnt == file->mountPoint && browse->inode == stat.st_ino)
+      browse->stale = true;
+  }
+  spinlockRelease(&LOCK_ELF_IMAGES);
+}
+
+// called from the PMM (which might be allocating for us), so it can't wait
+size_t elfImageReclaim(size_t pages) {
+  if (!spinlockTryAcquire(&LOCK_ELF_IMAGES))
+    return 0;
+  ElfImage *trim = elfImageTrimL(0, pages);
+  spinlockRelease(&LOCK_ELF_IMAGES);
+
+  return elfImageFreeAll(trim);
+}
+
+void elfImageHold(ElfImage *image) {
+  spinlockAcquire(&LOCK_ELF_IMAGES);
+  image->refs++;
+  spinlockRelease(&LOCK_ELF_IMAGES);
+}
+
+// never frees anything (could be in the middle of tearing a task down), idle
+// images stick around for the next exec of the same file
+void elfImageRelease(ElfImage *image) {
+  spinlockAcquire(&LOCK_ELF_IMAGES);
+  assert(image->refs);
+  image->refs--;
+  if (!image->refs)
+    image->lastUsed = timerTicks;
+  spinlockRelease(&LOCK_ELF_IMAGES);
+}
+
+// Where a segment's file contents land in the page at off (relative to the
+// image's base). len is 0 for pages that are all bss. Returns false if the
+// segment doesn't reach the page at all
+static bool elfImageChunk(ElfImage *image, Elf64_Phdr *phdr, size_t off,
+                          size_t *at, size_t *fileOff, size_t *len) {
+  if (phdr->p_type != PT_LOAD || !phdr->p_memsz ||
+      phdr->p_vaddr >= off + PAGE_SIZE ||
+      phdr->p_vaddr + phdr->p_memsz <= off)
+    return false;
+
+  size_t start = MAX(off, phdr->p_vaddr);
+  size_t end = MIN(off + PAGE_SIZE, phdr->p_vaddr + phdr->p_filesz);
+  *at = start - off;
+  *fileOff = phdr->p_offset + (start - phdr->p_vaddr);
+  *len = end > start ? end - start : 0;
+
+  // whatever's past the end of the file is zeroes
+  if (*fileOff >= image->size)
+    *len = 0;
+  else
+    *len = MIN(*len, image->size - *fileOff);
+  return true;
+}
+
+// reads the file page in, if it isn't already (can block)
+static void elfImageLoad(ElfImage *image, size_t index) {
+  if (index >= image->pages || image->frames[index])
+    return;
+
+  size_t   phys = PhysicalAllocate(1);
+  uint8_t *frame = (uint8_t *)(phys + bootloader.hhdmOffset);
+  size_t   read = elfImageRead(image, frame, index * PAGE_SIZE, PAGE_SIZE);
+  memset(frame + read, 0, PAGE_SIZE - read);
+
+  // frames are only ever set once, so faults can look at them without locks
+  spinlockAcquire(&image->LOCK_IMAGE);
+  bool lost = image->frames[index] != 0;
+  if (!lost)
+    image->frames[index] = phys;
+  spinlockRelease(&image->LOCK_IMAGE);
+
+  if (lost)
+    PhysicalFree(phys, 1);
+}
+
+// whether every file page the page at off is built from is in memory, or with
+// load, makes sure of it
+static bool elfImageReady(ElfImage *image, size_t off, bool load) {
+  for (int i = 0; i < image->ehdr->e_phnum; i++) {
+    size_t at = 0, fileOff = 0, len = 0;
+    if (!elfImageChunk(image, ELF_PHDR(image, i), off, &at, &fileOff, &len) ||
+        !len)
+      continue;
+    size_t last = (fileOff + len - 1) / PAGE_SIZE;
+    for (size_t index = fileOff / PAGE_SIZE; index <= last; index++) {
+      if (load)
+        elfImageLoad(image, index);
+      else if (!image->frames[index])
+        return false;
+    }
+  }
+  return true;
+}
+
+static void elfImageCopy(ElfImage *image, uint8_t *out, size_t fileOff,
+                         size_t len) {
+  while (len) {
+    size_t   inPage = fileOff % PAGE_SIZE;
+    size_t   chunk = MIN(len, PAGE_SIZE - inPage);
+    uint8_t *frame = (uint8_t *)(image->frames[fileOff / PAGE_SIZE] +
+                                 bootloader.hhdmOffset);
+    memcpy(out, frame + inPage, chunk);
+    out += chunk;
+    fileOff += chunk;
+    len -= chunk;
+  }
+}
+
+// Gives out the frame for the page at off, from interrupt contexts (without
+// waiting on anything). Pages that are a plain page of the file get the image's
+// own frame (shared, so copy-on-write) while the rest (bss, pages with more
+// than one segment, writes) get a private copy. FAULT_FILE means some of the
+// file isn't in memory yet, and needs an elfPagerRequest()
+int elfImagePage(ElfImage *image, size_t off, bool write, size_t *phys,
+                 bool *shared) {
+  if (!elfImageReady(image, off, false))
+    return FAULT_FILE;
+
+  int         covering = 0;
+  Elf64_Phdr *single = 0;
+  size_t      at = 0, fileOff = 0, len = 0;
+  for (int i = 0; i < image->ehdr->e_phnum; i++) {
+    if (!elfImageChunk(image, ELF_PHDR(image, i), off, &at, &fileOff, &len))
+      continue;
+    single = ELF_PHDR(image, i);
+    covering++;
+  }
+
+  if (!write && covering == 1 && len && fileOff >= at &&
+      !((fileOff - at) % PAGE_SIZE) &&
+      (single->p_filesz == single->p_memsz || at + len == PAGE_SIZE)) {
+    size_t frame = image->frames[(fileOff - at) / PAGE_SIZE];
+    if (!PhysicalShareNoWait(frame))
+      return FAULT_BUSY;
+    *phys = frame;
+    *shared = true;
+    return FAULT_RESOLVED;
+  }
+
+  size_t frame = PhysicalAllocateNoWait(1);
+  if (!frame)
+    return FAULT_BUSY;
+  uint8_t *out = (uint8_t *)(frame + bootloader.hhdmOffset);
+  memset(out, 0, PAGE_SIZE);
+  for (int i = 0; i < image->ehdr->e_phnum; i++) {
+    if (elfImageChunk(image, ELF_PHDR(image, i), off, &at, &fileOff, &len) &&
+        len)
+      elfImageCopy(image, out + at, fileOff, len);
+  }
+
+  *phys = frame;
+  *shared = false;
+  return FAULT_RESOLVED;
+}
+
+// Has the pager read in what the faulting page needs. Called from the isr,
+// with the task put to sleep right after if it returns true
+bool elfPagerRequest(void *taskPtr, size_t virt) {
+  Task            *task = (Task *)taskPtr;
+  TaskInfoPagedir *info = task->infoPd;
+  virt &= ~0xFFF;
+
+  if (!spinlockTryAcquire(&info->LOCK_PD))
+    return false;
+  UserspaceMapping *mapping = taskInfoPdMappingFind(info, virt);
+  ElfImage         *image = mapping ? mapping->image : 0;
+  size_t            off = mapping ? virt - mapping->imageBase : 0;
+  spinlockRelease(&info->LOCK_PD);
+  if (!image)
+    return false;
+
+  // the pager can't get to the queue before we let go of LOCK_ELF_PAGER, so
+  // waking it up first is fine. if that can't be done, try again later
+  if (!spinlockTryAcquire(&LOCK_ELF_PAGER))
+    return false;
+  size_t next = (elfPagerWrite + 1) % ELF_PAGER_QUEUE;
+  bool   queued = next != elfPagerRead &&
+                waitQueueWakeOneNoWait(&elfPagerWait) &&
+                spinlockTryAcquire(&LOCK_ELF_IMAGES);
+  if (queued) {
+    image->refs++; // dropped by the pager
+    spinlockRelease(&LOCK_ELF_IMAGES);
+    elfPagerQueue[elfPagerWrite].taskId = task->id;
+    elfPagerQueue[elfPagerWrite].image = image;
+    elfPagerQueue[elfPagerWrite].off = off;
+    elfPagerWrite = next;
+  }
+  spinlockRelease(&LOCK_ELF_PAGER);
+
+  return queued;
+}
+
+// pager thread, reads in pages for tasks that faulted on them
+void elfPager() {
+  WaitQueueEntry wait;
+  while (true) {
+    spinlockAcquire(&LOCK_ELF_PAGER);
+    bool        empty = elfPagerRead == elfPagerWrite;
+    ElfPagerReq req = elfPagerQueue[elfPagerRead];
+    if (!empty)
+      elfPagerRead = (elfPagerRead + 1) % ELF_PAGER_QUEUE;
+    spinlockRelease(&LOCK_ELF_PAGER);
+
+    if (!empty) {
+      elfImageReady(req.image, req.off, true);
+      elfImageRelease(req.image);
+
+      // it'll fault again & get the page mapped in this time
+      Task *task = taskGet(req.taskId);
+      asm volatile("cli");
+      if (task && task->state == TASK_STATE_PAGING)
+        schedWake(task);
+      asm volatile("sti");
+      continue;
+    }
+
+    // sleep till the next one
+    waitQueuePrepare(&elfPagerWait, &wait);
+    if (elfPagerRead == elfPagerWrite)
+      waitQueueSleep(&elfPagerWait, &wait, 0);
+    else
+      waitQueueFinish(&elfPagerWait, &wait);
+  }
+}
+
+// Span of an object's PT_LOAD segments, in whole pages
+static void elfImageSpan(ElfImage *image, size_t *start, size_t *end) {
+  *start = (size_t)-1;
+  *end = 0;
+  for (int i = 0; i < image->ehdr->e_phnum; i++) {
+    Elf64_Phdr *phdr = ELF_PHDR(image, i);
+    if (phdr->p_type != PT_LOAD || !phdr->p_memsz)
       continue;
-    size_t paddr = PhysicalAllocate(1);
-    VirtualMap(base + vaddr, paddr, PF_USER | PF_RW);
+    *start = MIN(*start, phdr->p_vaddr & ~0xFFF);
+    *end = MAX(*end, DivRoundUp(phdr->p_vaddr + phdr->p_memsz, PAGE_SIZE) *
+                         PAGE_SIZE);
   }
+  if (*start > *end)
+    *start = *end;
+}
 
-  // Copy the required info
-  memcpy((void *)(base + elf_phdr->p_vaddr), out + elf_phdr->p_offset,
-         elf_phdr->p_filesz);
+static void elfImageMap(Task *target, ElfImage *image, size_t base) {
+  size_t start = 0, end = 0;
+  elfImageSpan(image, &start, &end);
+  if (start == end)
+    return;
 
-  // wtf is this? (needed)
-  if (elf_phdr->p_memsz > elf_phdr->p_filesz)
-    memset((void *)(base + elf_phdr->p_vaddr + elf_phdr->p_filesz), 0,
-           elf_phdr->p_memsz - elf_phdr->p_filesz);
+  spinlockAcquire(&target->infoPd->LOCK_PD);
+  taskInfoPdMappingAddImage(target->infoPd, base + start,
+                            (end - start) / PAGE_SIZE, image, base);
+  spinlockRelease(&target->infoPd->LOCK_PD);
 }
 
 Task *elfExecute(char *filepath, uint32_t argc, char **argv, uint32_t envc,
                  char **envv, bool startup) {
-  // Open & read executable file
-  OpenFile *dir = fsKernelOpen(filepath, O_RDONLY, 0);
-  if (!dir) {
+  // Nothing is read in besides the headers, pages come in as they're faulted
+  ElfImage *image = elfImageGet(filepath);
+  if (!image) {
     debugf("[elf] Could not open %s\n", filepath);
     return 0;
   }
-  size_t filesize = fsGetFilesize(dir);
 #if ELF_DEBUG
-  debugf("[elf] Executing %s: filesize{%d}\n", filepath, filesize);
+  debugf("[elf] Executing %s: filesize{%d}\n", filepath, image->size);
 #endif
-  size_t   outSize = DivRoundUp(filesize, BLOCK_SIZE);
-  uint8_t *out = (uint8_t *)VirtualAllocate(outSize);
-  fsRead(dir, out, filesize);
-  fsKernelClose(dir);
 
-  // Cast ELF32 header
-  Elf64_Ehdr *elf_ehdr = (Elf64_Ehdr *)(out);
-
-  if (!elf_check_file(elf_ehdr)) {
-    debugf("[elf] File %s is not a valid tivOS ELF32 executable!\n", filepath);
-    return 0;
-  }
+  Elf64_Ehdr *elf_ehdr = image->ehdr;
 
   // Create a new page directory which is later used by the process
-  uint64_t *oldpagedir = GetPageDirectory();
   uint64_t *pagedir = PageDirectoryAllocate();
-  ChangePageDirectory(pagedir);
 
 #if ELF_DEBUG
   debugf("\n[elf_ehdr] entry=%x type=%d arch=%d\n", elf_ehdr->e_entry,
@@ -116,89 +524,63 @@ Task *elfExecute(char *filepath, uint32_t argc, char **argv, uint32_t envc,
     panic();
   }
 
-  size_t interpreterEntry = 0;
-  size_t interpreterBase = 0x100000000000; // todo: not hardcode
-  size_t executableBase = 0;               // modified later if needed
-  // Loop through the multiple ELF32 program header tables
-  for (int i = 0; i < elf_ehdr->e_phnum; i++) {
-    Elf64_Phdr *elf_phdr = (Elf64_Phdr *)((size_t)out + elf_ehdr->e_phoff +
-                                          i * elf_ehdr->e_phentsize);
-    if (elf_phdr->p_type == 3) {
-      char     *interpreterFilename = (char *)(out + elf_phdr->p_offset);
-      OpenFile *interpreter = fsKernelOpen(interpreterFilename, O_RDONLY, 0);
-      if (!interpreter) {
-        debugf("[elf] Interpreter path{%s} could not be found!\n",
-               interpreterFilename);
-        panic();
-      }
-      size_t size = fsGetFilesize(interpreter);
-
-      size_t   intContentsSize = DivRoundUp(size, BLOCK_SIZE);
-      uint8_t *interpreterContents =
-          (uint8_t *)VirtualAllocate(intContentsSize);
-      fsRead(interpreter, interpreterContents, size);
-      fsKernelClose(interpreter);
-
-      Elf64_Ehdr *interpreterEhdr = (Elf64_Ehdr *)(interpreterContents);
-      if (interpreterEhdr->e_type != 3) { // ET_DYN
-        debugf("[elf::dyn] Interpreter{%s} isn't really of type ET_DYN!\n",
-               interpreterFilename);
-        panic();
-      }
-      interpreterEntry = interpreterEhdr->e_entry;
-      for (int i = 0; i < interpreterEhdr->e_phnum; i++) {
-        Elf64_Phdr *interpreterPhdr =
-            (Elf64_Phdr *)((size_t)interpreterContents +
-                           interpreterEhdr->e_phoff +
-                           i * interpreterEhdr->e_phentsize);
-        if (interpreterPhdr->p_type != PT_LOAD)
-          continue;
-        elfProcessLoad(interpreterPhdr, interpreterContents, interpreterBase);
-      }
-      VirtualFree(interpreterContents, intContentsSize);
-
-      continue;
-    }
-    if (elf_phdr->p_type != PT_LOAD)
-      continue;
-
-    if (elf_ehdr->e_type == 3) {
-      // ET_DYN
-      executableBase = 0x50000000000; // todo: not hardcode
-    }
-    elfProcessLoad(elf_phdr, out, executableBase);
+  ElfImage *interpreter = 0;
+  size_t    interpreterEntry = 0;
+  size_t    interpreterBase = 0x100000000000; // todo: not hardcode
+  size_t    executableBase = 0;               // modified later if needed
+  if (elf_ehdr->e_type == 3) {
+    // ET_DYN
+    executableBase = 0x50000000000; // todo: not hardcode
+  }
 
+  // Loop through the multiple ELF64 program header tables
+  for (int i = 0; i < elf_ehdr->e_phnum; i++) {
+    Elf64_Phdr *elf_phdr = ELF_PHDR(image, i);
 #if ELF_DEBUG
     debugf("[elf] Program header: type{%d} offset{%x} vaddr{%x} size{%x} "
            "alignment{%x}\n",
            elf_phdr->p_type, elf_phdr->p_offset, elf_phdr->p_vaddr,
            elf_phdr->p_memsz, elf_phdr->p_align);
 #endif
-  }
+    if (elf_phdr->p_type != PT_INTERP || interpreter)
+      continue;
 
-  // For the foreseeable future ;)
-#if ELF_DEBUG
-  // for (int i = 0; i < elf_ehdr->e_shnum; i++) {
-  //   Elf64_Shdr *elf_shdr = (Elf64_Shdr *)((uint32_t)out + elf_ehdr->e_shoff +
-  //                                         i * elf_ehdr->e_shentsize);
-  //   debugf("[elf] Section header: type{%d} offset{%lx}\n", elf_shdr->sh_type,
-  //          elf_shdr->sh_offset);
-  // }
-#endif
+    char *interpreterFilename = calloc(elf_phdr->p_filesz + 1, 1);
+    elfImageRead(image, interpreterFilename, elf_phdr->p_offset,
+                 elf_phdr->p_filesz);
+    interpreter = elfImageGet(interpreterFilename);
+    if (!interpreter) {
+      debugf("[elf] Interpreter path{%s} could not be found!\n",
+             interpreterFilename);
+      panic();
+    }
+
+    if (interpreter->ehdr->e_type != 3) { // ET_DYN
+      debugf("[elf::dyn] Interpreter{%s} isn't really of type ET_DYN!\n",
+             interpreterFilename);
+      panic();
+    }
+    interpreterEntry = interpreter->ehdr->e_entry;
+    free(interpreterFilename);
+  }
 
 #if ELF_DEBUG
   debugf("[elf] New pagedir: offset{%x}\n", pagedir);
 #endif
 
-  // Done loading into the pagedir
-  ChangePageDirectory(oldpagedir);
-
   Task *target =
       taskCreate(id,
                  interpreterEntry ? (interpreterBase + interpreterEntry)
                                   : (executableBase + elf_ehdr->e_entry),
                  false, pagedir, argc, argv);
 
+  vdsoMap(pagedir);
+
+  // Segments get faulted in from the images (which the mappings hold onto)
+  elfImageMap(target, image, executableBase);
+  if (interpreter)
+    elfImageMap(target, interpreter, interpreterBase);
+
   size_t totalLen = 0;
   for (int curr = 0; curr < argc; curr++)
     totalLen += strlength(argv[curr]) + 1;
@@ -243,9 +625,12 @@ Task *elfExecute(char *filepath, uint32_t argc, char **argv, uint32_t envc,
   // target->cwd[1] = '\0';
 
   // User stack generation: the stack itself, AUXs, etc...
-  stackGenerateUser(target, argc, argv, envc, envv, out, filesize, elf_ehdr,
-                    interpreterEntry ? 0x100000000000 : 0, executableBase);
-  VirtualFree(out, outSize);
+  stackGenerateUser(target, argc, argv, envc, envv, image->head, image->size,
+                    elf_ehdr, interpreterEntry ? 0x100000000000 : 0,
+                    executableBase);
+  if (interpreter)
+    elfImageRelease(interpreter);
+  elfImageRelease(image);
 
   // Align it, just in case...
   spinlockAcquire(&target->infoPd->LOCK_PD);
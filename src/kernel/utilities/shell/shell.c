@@ -107,7 +107,7 @@ void readDisk() {
   snprintf(choice, 200, "reading disk{0} LBA{%d}:", lba);
 
   uint8_t *rawArr = (uint8_t *)malloc(SECTOR_SIZE);
-  getDiskBytes(rawArr, lba, 1);
+  getDiskBytes(0, rawArr, lba, 1);
 
   hexDump(choice, rawArr, SECTOR_SIZE, 16, printf);
 
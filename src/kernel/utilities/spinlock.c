@@ -1,5 +1,8 @@
+#include <schedule.h>
 #include <spinlock.h>
+#include <syscalls.h>
 #include <system.h>
+#include <task.h>
 #include <timer.h>
 
 // Various thread-safe locking mechanisms
@@ -13,6 +16,12 @@ void spinlockRelease(Spinlock *lock) {
   atomic_flag_clear_explicit(lock, memory_order_release);
 }
 
+// Never hands control over, meant for interrupt contexts where waiting for the
+// holder is impossible. Returns whether the lock was actually acquired
+bool spinlockTryAcquire(Spinlock *lock) {
+  return !atomic_flag_test_and_set_explicit(lock, memory_order_acquire);
+}
+
 // Cnt spinlock is basically just a counter that increases for every read
 // operation. When something has to modify, it waits for it to become 0 and
 // makes it -1, not permitting any reads. Useful for linked lists..
@@ -58,6 +67,17 @@ cleanup:
   spinlockRelease(&lock->LOCK);
 }
 
+bool spinlockCntWriteTryAcquire(SpinlockCnt *lock) {
+  if (!spinlockTryAcquire(&lock->LOCK))
+    return false;
+
+  bool ret = lock->cnt == 0;
+  if (ret)
+    lock->cnt = -1;
+  spinlockRelease(&lock->LOCK);
+  return ret;
+}
+
 void spinlockCntWriteRelease(SpinlockCnt *lock) {
   spinlockAcquire(&lock->LOCK);
   if (lock->cnt != -1) {
@@ -68,31 +88,139 @@ void spinlockCntWriteRelease(SpinlockCnt *lock) {
   spinlockRelease(&lock->LOCK);
 }
 
+// Wait queues, see spinlock.h. Everything below assumes wq->LOCK_WAIT is held
+static void waitQueueRemove(WaitQueue *wq, WaitQueueEntry *entry) {
+  WaitQueueEntry **browse = &wq->first;
+  WaitQueueEntry  *prev = 0;
+  while (*browse != entry) {
+    prev = *browse;
+    browse = &prev->next;
+  }
+  *browse = entry->next;
+  if (wq->last == entry)
+    wq->last = prev;
+  entry->queued = false;
+}
+
+static void waitQueueWakeFirst(WaitQueue *wq) {
+  WaitQueueEntry *entry = wq->first;
+  Task           *task = entry->task;
+  waitQueueRemove(wq, entry);
+  // the entry is gone the moment we let go of the lock, task isn't
+  task->forcefulWakeupTimeUnsafe = 0;
+  schedWake(task);
+}
+
+void waitQueuePrepare(WaitQueue *wq, WaitQueueEntry *entry) {
+  entry->next = 0;
+  entry->task = currentTask;
+  entry->queued = true;
+
+  spinlockAcquire(&wq->LOCK_WAIT);
+  if (wq->last)
+    wq->last->next = entry;
+  else
+    wq->first = entry;
+  wq->last = entry;
+  spinlockRelease(&wq->LOCK_WAIT);
+}
+
+// expiry is in timerNanos() (0 for none). The entry is off the queue afterwards
+static int waitQueueSleepAs(WaitQueue *wq, WaitQueueEntry *entry,
+                            uint64_t expiry, int state) {
+  spinlockAcquire(&wq->LOCK_WAIT);
+  if (entry->queued) { // not woken up in the meantime
+    currentTask->forcefulWakeupTimeUnsafe = expiry;
+    taskSpinlockExit(currentTask, &wq->LOCK_WAIT);
+    currentTask->state = state;
+    while (currentTask->state != TASK_STATE_READY)
+      handControl();
+    spinlockAcquire(&wq->LOCK_WAIT);
+  }
+
+  int ret = WAIT_WOKEN;
+  if (entry->queued) { // timer or signal, we have to get off ourselves
+    waitQueueRemove(wq, entry);
+    ret = signalsPendingQuick(currentTask) ? WAIT_SIGNAL : WAIT_TIMEOUT;
+  }
+  spinlockRelease(&wq->LOCK_WAIT);
+  return ret;
+}
+
+int waitQueueSleep(WaitQueue *wq, WaitQueueEntry *entry, uint64_t expiry) {
+  return waitQueueSleepAs(wq, entry, expiry, TASK_STATE_BLOCKED);
+}
+
+// for whoever can't back out halfway through, pending signals wait for us
+int waitQueueSleepUninterruptible(WaitQueue *wq, WaitQueueEntry *entry,
+                                  uint64_t expiry) {
+  return waitQueueSleepAs(wq, entry, expiry, TASK_STATE_UNINTERRUPTIBLE);
+}
+
+// the condition was met without ever going to sleep
+void waitQueueFinish(WaitQueue *wq, WaitQueueEntry *entry) {
+  spinlockAcquire(&wq->LOCK_WAIT);
+  if (entry->queued)
+    waitQueueRemove(wq, entry);
+  spinlockRelease(&wq->LOCK_WAIT);
+}
+
+bool waitQueueWakeOne(WaitQueue *wq) {
+  spinlockAcquire(&wq->LOCK_WAIT);
+  bool ret = wq->first != 0;
+  if (ret)
+    waitQueueWakeFirst(wq);
+  spinlockRelease(&wq->LOCK_WAIT);
+  return ret;
+}
+
+// for interrupt contexts, returns false if the queue's lock is held (so nobody
+// could be woken up) & true otherwise, even if nobody was sleeping
+bool waitQueueWakeOneNoWait(WaitQueue *wq) {
+  if (!spinlockTryAcquire(&wq->LOCK_WAIT))
+    return false;
+  if (wq->first)
+    waitQueueWakeFirst(wq);
+  spinlockRelease(&wq->LOCK_WAIT);
+  return true;
+}
+
+int waitQueueWakeAll(WaitQueue *wq) {
+  int ret = 0;
+  spinlockAcquire(&wq->LOCK_WAIT);
+  while (wq->first) {
+    waitQueueWakeFirst(wq);
+    ret++;
+  }
+  spinlockRelease(&wq->LOCK_WAIT);
+  return ret;
+}
+
 bool semaphoreWait(Semaphore *sem, uint32_t timeout) {
-  uint64_t timerStart = timerTicks;
-  bool     ret = false;
+  uint64_t       expiry = timeout > 0 ? timerNanos() + timeout * 1000000ULL : 0;
+  WaitQueueEntry wait;
 
   while (true) {
-    if (timeout > 0 && timerTicks > (timerStart + timeout))
-      goto just_return; // not under any lock atm
     spinlockAcquire(&sem->LOCK);
     if (sem->cnt > 0) {
       sem->cnt--;
-      ret = true;
-      goto cleanup;
+      spinlockRelease(&sem->LOCK);
+      return true;
     }
+    waitQueuePrepare(&sem->waiters, &wait);
     spinlockRelease(&sem->LOCK);
-    handControl();
-  }
 
-cleanup:
-  spinlockRelease(&sem->LOCK);
-just_return:
-  return ret;
+    // callers (lwip, uacpi) can't be interrupted, so signals don't wake us
+    if (waitQueueSleepUninterruptible(&sem->waiters, &wait, expiry) ==
+            WAIT_TIMEOUT &&
+        expiry)
+      return false;
+  }
 }
 
 void semaphorePost(Semaphore *sem) {
   spinlockAcquire(&sem->LOCK);
   sem->cnt++;
   spinlockRelease(&sem->LOCK);
+  waitQueueWakeOne(&sem->waiters);
 }
@@ -0,0 +1,70 @@
+#include <bootloader.h>
+#include <elf.h>
+#include <paging.h>
+#include <pmm.h>
+#include <system.h>
+#include <timer.h>
+#include <util.h>
+#include <vdso.h>
+
+// Kernel side of the vDSO: a copy of the image (linked into the kernel, see
+// vdso/image.asm) & its data page, shared read-only by every address space
+
+extern uint8_t vdsoImage[];
+extern uint8_t vdsoImageEnd[];
+
+size_t    vdsoPhys = 0; // image frames, contiguous
+size_t    vdsoPages = 0;
+size_t    vdsoDataPhys = 0;
+VdsoData *vdsoData = 0;
+
+void initiateVdso() {
+  size_t      size = vdsoImageEnd - vdsoImage;
+  Elf64_Ehdr *ehdr = (Elf64_Ehdr *)vdsoImage;
+  if (size < sizeof(Elf64_Ehdr) || !elf_check_file(ehdr) ||
+      ehdr->e_type != 3) { // ET_DYN
+    debugf("[vdso] Embedded image is broken!\n");
+    panic();
+  }
+
+  vdsoPages = DivRoundUp(size, PAGE_SIZE);
+  vdsoPhys = PhysicalAllocate(vdsoPages);
+  uint8_t *image = (uint8_t *)(vdsoPhys + bootloader.hhdmOffset);
+  memset(image, 0, vdsoPages * PAGE_SIZE);
+  memcpy(image, vdsoImage, size);
+
+  vdsoDataPhys = PhysicalAllocate(1);
+  vdsoData = (VdsoData *)(vdsoDataPhys + bootloader.hhdmOffset);
+  memset(vdsoData, 0, PAGE_SIZE);
+  vdsoUpdate();
+
+  debugf("[vdso] Ready: pages{%ld}\n", vdsoPages);
+}
+
+// ints have to be off (it's mostly called from the timer interrupt)
+void vdsoUpdate() {
+  if (!vdsoData)
+    return;
+
+  vdsoData->seq++;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  vdsoData->tsc = !!timerTscFreq;
+  vdsoData->tscBoot = timerTscBoot;
+  vdsoData->tscMult = timerTscMult;
+  vdsoData->tscShift = TIMER_TSC_SHIFT;
+  vdsoData->bootUnix = timerBootUnix;
+  vdsoData->ticks = timerTicks;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  vdsoData->seq++;
+}
+
+// the frames are never freed, we hold onto a reference of our own
+void vdsoMap(uint64_t *pagedir) {
+  PhysicalShare(vdsoDataPhys);
+  VirtualMapL(pagedir, VDSO_DATA, vdsoDataPhys, PF_USER);
+  for (size_t i = 0; i < vdsoPages; i++) {
+    PhysicalShare(vdsoPhys + i * PAGE_SIZE);
+    VirtualMapL(pagedir, VDSO_BASE + i * PAGE_SIZE, vdsoPhys + i * PAGE_SIZE,
+                PF_USER);
+  }
+}
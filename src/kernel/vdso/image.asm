@@ -0,0 +1,14 @@
+bits 64
+
+; The vDSO, linked on its own first (see the Makefile) & carried around by the
+; kernel, which copies it into pages of its own on boot (see utilities/vdso.c)
+
+section .rodata
+
+global vdsoImage
+global vdsoImageEnd
+
+align 4096
+vdsoImage:
+	incbin "vdso/vdso.so"
+vdsoImageEnd:
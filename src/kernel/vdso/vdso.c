@@ -0,0 +1,112 @@
+#include <linux.h>
+#include <vdso.h>
+
+// The vDSO itself. Runs in userspace (built as a standalone shared object,
+// see vdso.ld), so nothing from the kernel is reachable besides the data page
+// which the linker script places right below us
+
+#define VDSO_EXPORT __attribute__((visibility("default")))
+
+#define SYSCALL_CLOCK_GETTIME 228
+
+// hidden, so it's reached rip-relative instead of through a GOT nobody fills
+extern const volatile VdsoData vdsoData __attribute__((visibility("hidden")));
+
+static long vdsoSyscall2(long id, long arg1, long arg2) {
+  long ret;
+  asm volatile("syscall"
+               : "=a"(ret)
+               : "a"(id), "D"(arg1), "S"(arg2)
+               : "rcx", "r11", "memory");
+  return ret;
+}
+
+static uint64_t vdsoRdtsc() {
+  uint32_t low;
+  uint32_t high;
+  asm volatile("rdtsc" : "=a"(low), "=d"(high));
+  return (uint64_t)low << 0 | (uint64_t)high << 32;
+}
+
+// same math as timerNanos(), so both agree with each other. the kernel might
+// update the page at any point (the timer interrupt), so retry until we've
+// read it all without it changing under us
+static uint64_t vdsoNanos(uint64_t *bootUnix) {
+  uint32_t seq;
+  uint64_t nanos;
+  do {
+    while ((seq = __atomic_load_n(&vdsoData.seq, __ATOMIC_ACQUIRE)) & 1)
+      asm volatile("pause");
+
+    if (vdsoData.tsc) {
+      uint64_t delta = vdsoRdtsc() - vdsoData.tscBoot;
+      nanos = ((unsigned __int128)delta * vdsoData.tscMult) >>
+              vdsoData.tscShift;
+    } else
+      nanos = vdsoData.ticks * 1000000;
+    *bootUnix = vdsoData.bootUnix;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (seq != vdsoData.seq);
+  return nanos;
+}
+
+VDSO_EXPORT int __vdso_clock_gettime(int which, timespec *spec) {
+  uint64_t bootUnix = 0;
+  uint64_t nanos = 0;
+  switch (which) {
+  case CLOCK_REALTIME:
+  case CLOCK_REALTIME_COARSE:
+    nanos = vdsoNanos(&bootUnix) + bootUnix * 1000000000ULL;
+    break;
+  case CLOCK_MONOTONIC:
+  case CLOCK_MONOTONIC_RAW:
+  case CLOCK_MONOTONIC_COARSE:
+  case CLOCK_BOOTTIME:
+    nanos = vdsoNanos(&bootUnix);
+    break;
+  default: // cpu time & such, only the kernel knows
+    return vdsoSyscall2(SYSCALL_CLOCK_GETTIME, which, (long)spec);
+  }
+
+  spec->tv_sec = nanos / 1000000000;
+  spec->tv_nsec = nanos % 1000000000;
+  return 0;
+}
+
+typedef struct VdsoTimezone {
+  int tz_minuteswest;
+  int tz_dsttime;
+} VdsoTimezone;
+
+VDSO_EXPORT int __vdso_gettimeofday(timeval *tv, VdsoTimezone *tz) {
+  if (tv) {
+    uint64_t bootUnix = 0;
+    uint64_t nanos = vdsoNanos(&bootUnix) + bootUnix * 1000000000ULL;
+    tv->tv_sec = nanos / 1000000000;
+    tv->tv_usec = (nanos % 1000000000) / 1000;
+  }
+  if (tz) { // always UTC
+    tz->tz_minuteswest = 0;
+    tz->tz_dsttime = 0;
+  }
+  return 0;
+}
+
+VDSO_EXPORT int64_t __vdso_time(int64_t *out) {
+  uint64_t bootUnix = 0;
+  uint64_t nanos = vdsoNanos(&bootUnix);
+  int64_t  time = bootUnix + nanos / 1000000000;
+  if (out)
+    *out = time;
+  return time;
+}
+
+// uniprocessor, the answer never changes
+VDSO_EXPORT long __vdso_getcpu(uint32_t *cpu, uint32_t *node, void *cache) {
+  if (cpu)
+    *cpu = 0;
+  if (node)
+    *node = 0;
+  return 0;
+}